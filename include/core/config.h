@@ -24,6 +24,8 @@ struct ModelConfig {
   int32_t moe_intermediate_size = 0;
   float rms_norm_eps = 1e-6f;
   bool use_qk_norm = false;
+  // lm_head shares embed_tokens; such checkpoints carry no lm_head tensor.
+  bool tie_word_embeddings = false;
 
   // MoE
   bool use_moe = false;
@@ -31,6 +33,19 @@ struct ModelConfig {
   int32_t top_k = 0;
   int32_t moe_layer_freq = 0;
   std::vector<int32_t> mlp_only_layers;
+  // Keep expert weights stacked as gate_up_proj [E, 2I, D] / down_proj [E, D, I]
+  // (HF-style) instead of one ExpertMLP module per expert.
+  bool moe_stacked_experts = false;
+
+  // Attention: "gqa" (grouped query heads, default), "tiled" (online softmax
+  // over K/V blocks, never materializes [T, S]) or "reference" (repeat K/V).
+  std::string attention_impl = "gqa";
+  // Tile sizes for "tiled": query positions and key positions per block.
+  int32_t attention_block_q = 128;
+  int32_t attention_block_kv = 512;
+  // Single-token steps (T == 1) skip masking and read the cache in place.
+  // Applies to "gqa" and "tiled"; "reference" always takes the generic path.
+  bool attention_decode_fast_path = true;
 
   // RoPE
   float rope_theta = 10000.0f;
@@ -39,6 +54,15 @@ struct ModelConfig {
   // KV cache
   int32_t max_batch = 1;
   int32_t max_seq_len = 4096;
+  // Tokens per paged KV block; 0 keeps dense [B, kv_heads, max_seq, head_dim] buffers.
+  // Paged is opt-in: attention reads it in gathered tiles of whole blocks
+  // ("reference" prefill and continuous batching gather the full history).
+  int32_t kv_block_size = 0;
+  // Upper bound on KV blocks per stage pool, allocated on first use; 0 grows
+  // on demand (doubling, which copies every layer's pool).
+  int32_t kv_max_blocks = 0;
+  // Prefill chunk length in tokens; 0 runs the whole prompt in one pass.
+  int32_t prefill_chunk_size = 0;
 
   // Vision (placeholder fields; actual values come from spec lock)
   int32_t vision_hidden_size = 0;
@@ -54,7 +78,7 @@ struct ModelConfig {
   int32_t layer_end = 0;   // exclusive
 
   // Runtime
-  int32_t device_index = 0; // CUDA device index
+  int32_t device_index = 0; // CUDA device index; < 0 runs on CPU
 };
 
 inline bool is_valid_stage_range(const ModelConfig& c) {
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace qwen {
+
+// Minimal JSON DOM used for HF config exports and checkpoint headers
+// (safetensors, model.safetensors.index.json). Numbers are doubles, which is
+// exact for every integer below 2^53 (byte offsets included).
+
+struct JsonValue;
+
+using JsonObject = std::unordered_map<std::string, JsonValue>;
+using JsonArray  = std::vector<JsonValue>;
+
+struct JsonValue {
+  enum class Type {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object
+  };
+
+  Type type = Type::Null;
+
+  bool b = false;
+  double n = 0.0;
+  std::string s;
+  JsonArray a;
+  JsonObject o;
+
+  JsonValue() = default;
+
+  static JsonValue make_null() {
+    JsonValue v;
+    v.type = Type::Null;
+    return v;
+  }
+  static JsonValue make_bool(bool x) {
+    JsonValue v;
+    v.type = Type::Bool;
+    v.b = x;
+    return v;
+  }
+  static JsonValue make_number(double x) {
+    JsonValue v;
+    v.type = Type::Number;
+    v.n = x;
+    return v;
+  }
+  static JsonValue make_string(std::string x) {
+    JsonValue v;
+    v.type = Type::String;
+    v.s = std::move(x);
+    return v;
+  }
+  static JsonValue make_array(JsonArray x) {
+    JsonValue v;
+    v.type = Type::Array;
+    v.a = std::move(x);
+    return v;
+  }
+  static JsonValue make_object(JsonObject x) {
+    JsonValue v;
+    v.type = Type::Object;
+    v.o = std::move(x);
+    return v;
+  }
+};
+
+// Parses a complete JSON document; throws std::runtime_error on malformed
+// input or trailing characters.
+JsonValue parse_json(std::string text);
+
+// Reads a whole file; throws std::runtime_error if it cannot be opened.
+std::string read_text_file(const std::string& path);
+
+// Member lookup; nullptr if absent.
+inline const JsonValue* json_get(const JsonObject& o, const std::string& k) {
+  auto it = o.find(k);
+  if (it == o.end()) return nullptr;
+  return &it->second;
+}
+
+} // namespace qwen
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <torch/torch.h>
+#include <cstdint>
+#include <vector>
+
+namespace qwen {
+
+// Fixed-size block allocator backing the paged KVCache.
+//
+// One pool serves every layer of a stage and every sequence that attaches to
+// it: a block id addresses the same slot range in each layer's K and V pool.
+//
+// Layout (per layer):
+//  k: [capacity, block_size, kv_heads, head_dim]
+//  v: [capacity, block_size, kv_heads, head_dim]
+//
+// Blocks are refcounted so sequences can share a prefix (KVCache::fork) and
+// copy a block only when they write into it. An unbounded pool grows on
+// demand by doubling, copying every layer each time, so memory tracks live
+// tokens rather than max_seq_len. A pool with max_blocks is allocated at that
+// size on first use and never copies. Not thread-safe.
+class KVBlockPool {
+public:
+  KVBlockPool(int32_t num_layers,
+              int32_t block_size,
+              int32_t kv_heads,
+              int32_t head_dim,
+              c10::ScalarType dtype,
+              int device_index,          // < 0 allocates on CPU
+              int32_t max_blocks = 0);   // 0 = unbounded
+
+  int32_t allocate();                    // new block with refcount 1
+  void retain(int32_t block);
+  void release(int32_t block);           // returns the block to the free list at refcount 0
+  int32_t refcount(int32_t block) const;
+
+  // Copy one block's contents in every layer (copy-on-write helper).
+  void copy_block(int32_t dst, int32_t src);
+
+  torch::Tensor& k(int32_t layer);
+  torch::Tensor& v(int32_t layer);
+
+  int32_t num_layers() const { return num_layers_; }
+  int32_t block_size() const { return block_size_; }
+  int32_t kv_heads() const { return kv_heads_; }
+  int32_t head_dim() const { return head_dim_; }
+  c10::ScalarType dtype() const { return dtype_; }
+  int device_index() const { return device_index_; }
+
+  int32_t capacity() const { return (int32_t)refcount_.size(); }
+  int32_t num_free() const { return (int32_t)free_.size(); }
+  int32_t num_used() const { return capacity() - num_free(); }
+  int64_t bytes_reserved() const;
+
+private:
+  void grow(int32_t min_capacity);
+
+  int32_t num_layers_ = 0;
+  int32_t block_size_ = 0;
+  int32_t kv_heads_ = 0;
+  int32_t head_dim_ = 0;
+  c10::ScalarType dtype_ = c10::ScalarType::Half;
+  int device_index_ = 0;
+  int32_t max_blocks_ = 0;
+
+  std::vector<torch::Tensor> k_;
+  std::vector<torch::Tensor> v_;
+  std::vector<int32_t> refcount_;
+  std::vector<int32_t> free_;
+};
+
+} // namespace qwen
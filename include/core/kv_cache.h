@@ -3,20 +3,52 @@
 #include <torch/torch.h>
 #include <c10/util/Optional.h>
 #include <cstdint>
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "core/kv_block_pool.h"
 
 namespace qwen {
 
-// KV cache owner for one pipeline stage.
+// KV cache owner for one pipeline stage (or one request on a serving stage).
 // Stores per-layer key/value for self-attention.
 //
-// Layout (common):
-//  k: [B, kv_heads, max_seq, head_dim]
-//  v: [B, kv_heads, max_seq, head_dim]
+// Two storage modes:
+//  - dense (init):  k/v: [B, kv_heads, max_seq, head_dim] per layer, allocated up front.
+//  - paged (init_paged): each batch row owns a block table into a shared
+//    KVBlockPool; blocks are allocated as positions are written, so memory
+//    scales with live tokens instead of max_seq_len.
+//
+// Readers should go through keys()/values(), which return the contiguous
+// [B, kv_heads, S, head_dim] view in either mode, or walk the history in
+// chunks with keys_range()/values_range(). layer() is dense-only.
+
+// Continuous batching: batch row i is cache row rows[i] and its first new
+// token sits at positions[i]. Rows of one batch may be at different lengths
+// and need not be contiguous in the cache.
 //
-// Notes:
-// - This is a minimal cache container for Milestone 1 scaffolding.
-// - Attention implementation will decide exact layout; keep this stable and explicit.
+// Packed varlen: with cu_seqlens ([N+1], cu_seqlens[0] == 0) the batch is a
+// single row of N concatenated sequences; segment i is tokens
+// [cu_seqlens[i], cu_seqlens[i+1]) and uses rows[i]/positions[i].
+struct RowPlacement {
+  std::vector<int64_t> rows;
+  std::vector<int64_t> positions;
+  std::vector<int64_t> cu_seqlens;
+
+  bool packed() const { return !cu_seqlens.empty(); }
+  int64_t num_segments() const { return (int64_t)rows.size(); }
+
+  // Segment i of a batch with T tokens per row: offset into the flattened
+  // b-major token order, and length.
+  int64_t offset(int64_t i, int64_t T) const { return packed() ? cu_seqlens[(size_t)i] : i * T; }
+  int64_t length(int64_t i, int64_t T) const {
+    return packed() ? cu_seqlens[(size_t)i + 1] - cu_seqlens[(size_t)i] : T;
+  }
+
+  // Key length needed to cover every segment after appending.
+  int64_t max_end(int64_t T) const;
+};
 
 struct LayerKV {
   torch::Tensor k;
@@ -26,6 +58,14 @@ struct LayerKV {
 class KVCache {
 public:
   KVCache() = default;
+  ~KVCache();
+
+  // Copies share storage: dense copies alias the same tensors, paged copies
+  // are forks (see fork()).
+  KVCache(const KVCache& other);
+  KVCache& operator=(const KVCache& other);
+  KVCache(KVCache&& other) noexcept;
+  KVCache& operator=(KVCache&& other) noexcept;
 
   void init(int32_t num_layers_in_stage,
             int32_t max_batch,
@@ -33,21 +73,50 @@ public:
             int32_t kv_heads,
             int32_t head_dim,
             c10::ScalarType dtype,
-            int device_index);
+            int device_index); // < 0 allocates on CPU
+
+  // Attach to a block pool; no K/V memory is reserved until append().
+  void init_paged(std::shared_ptr<KVBlockPool> pool, int32_t max_batch, int32_t max_seq_len);
 
   bool is_initialized() const { return initialized_; }
+  bool is_paged() const { return (bool)pool_; }
 
   int32_t num_layers() const { return num_layers_in_stage_; }
   int32_t max_batch() const { return max_batch_; }
   int32_t max_seq_len() const { return max_seq_len_; }
   int32_t kv_heads() const { return kv_heads_; }
   int32_t head_dim() const { return head_dim_; }
+  c10::ScalarType dtype() const { return dtype_; }
+  int device_index() const { return device_index_; }
+
+  // Number of positions written so far (max pos + T over all appends).
+  int64_t length() const { return length_; }
 
   LayerKV& layer(int32_t layer_idx);
   const LayerKV& layer(int32_t layer_idx) const;
 
+  // K/V for rows [0, B) and positions [0, S): [B, kv_heads, S, head_dim].
+  torch::Tensor keys(int32_t layer_idx, int64_t B, int64_t S) const;
+  torch::Tensor values(int32_t layer_idx, int64_t B, int64_t S) const;
+
+  // Same shape, but dense caches return a strided view into the buffer
+  // instead of a contiguous copy. Paged caches still gather all of [0, S).
+  torch::Tensor keys_view(int32_t layer_idx, int64_t B, int64_t S) const;
+  torch::Tensor values_view(int32_t layer_idx, int64_t B, int64_t S) const;
+
+  // Rows [0, B), positions [s0, s0 + n): [B, kv_heads, n, head_dim], strided.
+  // Dense caches return a view; paged caches gather only the blocks covering
+  // the range, so a long history can be read one chunk at a time.
+  torch::Tensor keys_range(int32_t layer_idx, int64_t B, int64_t s0, int64_t n) const;
+  torch::Tensor values_range(int32_t layer_idx, int64_t B, int64_t s0, int64_t n) const;
+
+  // Dense: zero the buffers. Paged: return every block to the pool.
   void clear_all();
 
+  // Free one cache row for a new sequence. Paged rows return their blocks;
+  // dense rows are left as is (stale positions are masked by position).
+  void clear_row(int32_t row);
+
   // Append K/V at positions [pos, pos+T)
   // new_k/new_v expected: [B, kv_heads, T, head_dim]
   void append(int32_t layer_idx,
@@ -55,7 +124,41 @@ public:
               const torch::Tensor& new_v,
               int64_t pos);
 
+  // Per-row variant: batch row i (or packed segment i) is written to cache
+  // row place.rows[i] from position place.positions[i] on.
+  void append_rows(int32_t layer_idx,
+                   const torch::Tensor& new_k,
+                   const torch::Tensor& new_v,
+                   const RowPlacement& place);
+
+  // K/V for the given cache rows and positions [0, S): [rows, kv_heads, S, head_dim].
+  torch::Tensor keys_rows(int32_t layer_idx, const std::vector<int64_t>& rows, int64_t S) const;
+  torch::Tensor values_rows(int32_t layer_idx, const std::vector<int64_t>& rows, int64_t S) const;
+
+  // Paged only: a new cache sharing this one's blocks. Blocks are copied
+  // lazily when either side writes into a shared block.
+  KVCache fork() const;
+
+  // Paged introspection.
+  const std::shared_ptr<KVBlockPool>& pool() const { return pool_; }
+  const std::vector<int32_t>& block_table(int32_t row) const;
+  int64_t num_blocks() const;
+
 private:
+  void release_blocks();
+  void retain_blocks();
+  bool ensure_row_blocks(int64_t row, int64_t pos, int64_t T);
+  void ensure_blocks(int64_t B, int64_t pos, int64_t T);
+  torch::Tensor slots_for(int64_t B, int64_t pos, int64_t T);
+  void refresh_table(int64_t nblk) const;
+  torch::Tensor gather_blocks(const torch::Tensor& pool, const torch::Tensor& table, int64_t S) const;
+  torch::Tensor gather(const torch::Tensor& pool, int64_t B, int64_t S) const;
+  torch::Tensor gather_range(const torch::Tensor& pool, int64_t B, int64_t s0, int64_t n) const;
+  void check_range(int32_t layer_idx, int64_t B, int64_t s0, int64_t n) const;
+  torch::Tensor gather_rows(const torch::Tensor& pool, const torch::Tensor& rows, int64_t S) const;
+  torch::Tensor rows_tensor(const std::vector<int64_t>& rows) const;
+  void check_rows(const std::vector<int64_t>& rows, int64_t S) const;
+
   bool initialized_ = false;
   int32_t num_layers_in_stage_ = 0;
   int32_t max_batch_ = 0;
@@ -64,8 +167,18 @@ private:
   int32_t head_dim_ = 0;
   c10::ScalarType dtype_ = c10::ScalarType::Half;
   int device_index_ = 0;
+  int64_t length_ = 0;
 
   std::vector<LayerKV> layers_;
+
+  // Paged mode.
+  std::shared_ptr<KVBlockPool> pool_;
+  std::vector<std::vector<int32_t>> block_tables_; // [max_batch][num_blocks]
+  // Device copies of the block table / write slots, rebuilt only when stale.
+  mutable torch::Tensor table_dev_;
+  mutable bool table_dirty_ = true;
+  torch::Tensor slots_dev_;
+  int64_t slots_key_[3] = {-1, -1, -1};
 };
 
 } // namespace qwen
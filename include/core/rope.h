@@ -8,7 +8,7 @@ namespace qwen {
 
 // Minimal RoPE helper for later integration.
 // This header provides:
-//  - precompute_cos_sin: builds cos/sin tables on CUDA
+//  - precompute_cos_sin: builds cos/sin tables on device_index (CPU when < 0)
 //  - apply_rope: applies RoPE to q/k using cos/sin
 //
 // Assumptions for apply_rope (common layout):
@@ -34,4 +34,11 @@ void apply_rope_inplace(torch::Tensor q,
                         const RopeTables& tables,
                         int64_t start_pos = 0);
 
+// Per-token positions: position_ids [B, T] int64 on the tables device, so
+// rows of one batch can sit at different offsets.
+void apply_rope_inplace(torch::Tensor q,
+                        torch::Tensor k,
+                        const RopeTables& tables,
+                        const torch::Tensor& position_ids);
+
 } // namespace qwen
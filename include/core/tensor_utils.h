@@ -17,6 +17,19 @@ inline void require_cuda(const torch::Tensor& t, const std::string& name) {
   require(t.is_cuda(), name + " must be CUDA tensor");
 }
 
+// Device convention shared by ModelConfig::device_index, KVCache and the RoPE
+// tables: a negative index means CPU, otherwise the CUDA ordinal. Matches
+// Tensor::get_device(), which returns -1 for CPU tensors.
+inline torch::Device device_for_index(int device_index) {
+  if (device_index < 0) return torch::Device(torch::kCPU);
+  return torch::Device(torch::kCUDA, (c10::DeviceIndex)device_index);
+}
+
+inline void require_same_device(const torch::Tensor& t, const torch::Tensor& ref, const std::string& name) {
+  require(t.defined(), name + " is undefined");
+  require(t.device() == ref.device(), name + " is on " + t.device().str() + ", expected " + ref.device().str());
+}
+
 inline void require_contiguous(const torch::Tensor& t, const std::string& name) {
   require(t.is_contiguous(), name + " must be contiguous");
 }
@@ -31,14 +44,19 @@ inline torch::Tensor to_cuda(const torch::Tensor& t, int device_index) {
   return t.to(torch::Device(torch::kCUDA, device_index), /*non_blocking=*/false);
 }
 
+inline torch::Tensor to_device_index(const torch::Tensor& t, int device_index) {
+  if (!t.defined()) return t;
+  const torch::Device device = device_for_index(device_index);
+  if (t.device() == device) return t;
+  return t.to(device, /*non_blocking=*/false);
+}
+
 inline torch::Tensor empty_like_on(const torch::Tensor& ref,
                                    const std::vector<int64_t>& sizes,
                                    c10::ScalarType dtype,
                                    int device_index) {
-  auto opts = torch::TensorOptions().dtype(dtype).device(torch::kCUDA, device_index);
-  if (ref.defined()) {
-    opts = opts.dtype(dtype).device(torch::kCUDA, device_index);
-  }
+  (void)ref;
+  auto opts = torch::TensorOptions().dtype(dtype).device(device_for_index(device_index));
   return torch::empty(sizes, opts);
 }
 
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "loader/weight_loader.h"
+
+namespace caffe2 {
+namespace serialize {
+class PyTorchStreamReader;
+} // namespace serialize
+} // namespace caffe2
+
+namespace qwen {
+
+// WeightLoader over a packed state_dict archive (torch.save of a dict) that
+// never materializes the whole checkpoint.
+//
+// The constructor unpickles data.pkl with placeholder storages, which yields
+// each tensor's dtype/shape/strides/offset and the storage record it lives in
+// without reading any tensor bytes. get() then reads only that record from the
+// zip, so a stage loading [layer_start, layer_end) touches only its own
+// bytes. Tensors that share a storage (tied weights, views) read the record
+// once per get(); nothing is cached.
+//
+// TorchScript archives are not supported here; open_weight_loader() falls
+// back to the eager PtWeightLoader for those.
+class LazyPtWeightLoader final : public WeightLoader {
+ public:
+  // Throws std::runtime_error if the file is not a packed state_dict.
+  explicit LazyPtWeightLoader(std::string weights_path);
+  ~LazyPtWeightLoader() override;
+
+  bool exists(const std::string& key) const override;
+  torch::Tensor get(const std::string& key) const override;
+  std::vector<std::string> list_keys() const override;
+
+  // Storage bytes read by get() so far.
+  int64_t bytes_read() const { return bytes_read_.load(); }
+
+ private:
+  struct Entry {
+    std::string record;          // storage record name under data/
+    torch::Dtype dtype = torch::kFloat32;
+    std::vector<int64_t> sizes;
+    std::vector<int64_t> strides;
+    int64_t storage_offset = 0;
+  };
+
+  std::string weights_path_;
+  std::unique_ptr<caffe2::serialize::PyTorchStreamReader> reader_;
+  std::unordered_map<std::string, Entry> entries_;
+  mutable std::mutex reader_mu_;
+  mutable std::atomic<int64_t> bytes_read_{0};
+};
+
+} // namespace qwen
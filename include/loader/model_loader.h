@@ -19,15 +19,30 @@ struct LoadReport {
   std::vector<std::string> mismatch_keys;
   std::vector<std::string> skipped_keys;
   std::vector<std::string> used_keys;
+
+  // Checkpoint bytes fetched from the WeightLoader and wall time of the load.
+  int64_t bytes = 0;
+  double seconds = 0.0;
+
+  double gb_per_s() const { return seconds > 0.0 ? (double)bytes / seconds / 1e9 : 0.0; }
 };
 
 struct LoadOptions {
   bool strict = true;
   bool load_vision = false;
+
+  // Worker threads. Each layer (plus embedding and head) is fetched,
+  // converted and copied into place by one worker, so reads of one layer
+  // overlap conversion and placement of others. WeightLoader::get() must be
+  // thread-safe when > 1. Report contents do not depend on the thread count.
+  int32_t num_threads = 1;
 };
 
 // Load weights for a single stage using HF-style keys.
-// Returns true on success (or throws if options.strict is true).
+// Returns true on success. With options.strict it throws on a mismatched
+// tensor (with several threads the error of the earliest failing layer is
+// rethrown) and, after the report is filled in, on any missing required
+// tensor. With cfg.tie_word_embeddings, lm_head is loaded from embed_tokens.
 bool load_stage_weights(ModelStage& stage,
                         const WeightLoader& wl,
                         const ModelConfig& cfg,
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "loader/weight_loader.h"
+
+namespace qwen {
+
+// WeightLoader reading Hugging Face .safetensors checkpoints in place.
+//
+// `path` may be a single .safetensors file, a model.safetensors.index.json
+// (multi-shard), or a directory holding either. Every shard is mmapped
+// read-only and only its JSON header is parsed up front; get() returns a
+// torch::from_blob view into the mapping (zero copy), so pages are faulted in
+// only for the keys a stage actually requests. Returned tensors keep their
+// shard mapped and must be treated as read-only.
+class SafetensorsWeightLoader final : public WeightLoader {
+ public:
+  // Throws std::runtime_error on unreadable files or malformed headers.
+  explicit SafetensorsWeightLoader(const std::string& path);
+  ~SafetensorsWeightLoader() override;
+
+  bool exists(const std::string& key) const override;
+  torch::Tensor get(const std::string& key) const override;
+  std::vector<std::string> list_keys() const override;
+  std::string metadata(const std::string& key) const override;
+
+  int64_t num_shards() const { return (int64_t)shards_.size(); }
+
+  // Tensor bytes handed out by get() so far.
+  int64_t bytes_read() const { return bytes_read_.load(); }
+
+  // True if `path` looks like something this loader opens.
+  static bool accepts(const std::string& path);
+
+ private:
+  struct Shard;
+
+  struct Entry {
+    size_t shard = 0;
+    torch::Dtype dtype = torch::kFloat32;
+    std::vector<int64_t> sizes;
+    int64_t begin = 0;            // absolute file offsets
+    int64_t end = 0;
+  };
+
+  void add_shard(const std::string& file);
+
+  std::vector<std::shared_ptr<Shard>> shards_;
+  std::unordered_map<std::string, Entry> entries_;
+  std::unordered_map<std::string, std::string> metadata_;   // merged over shards
+  mutable std::atomic<int64_t> bytes_read_{0};
+};
+
+} // namespace qwen
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "core/config.h"
+#include "loader/weight_loader.h"
+#include "model/model_stage.h"
+
+namespace qwen {
+
+// Pre-sharded per-stage checkpoints.
+//
+// A stage shard holds exactly the parameters of one ModelStage, keyed by
+// their module path (ModelStage::named_parameters(), e.g.
+// "block_0.attn.wq.weight") and stored in the runtime dtype and layout:
+// expert weights are stacked or per expert as the stage was built. The file
+// is a regular .safetensors file whose data section and every tensor start
+// on a 64-byte boundary, so SafetensorsWeightLoader mmaps it and
+// load_stage_weights() copies each tensor into place without conversion.
+// The stage it was cut for is recorded in the "__metadata__" header.
+
+constexpr const char* kStageShardFormat = "qwen-stage-shard";
+constexpr int64_t kStageShardAlign = 64;
+
+struct StageShardInfo {
+  int32_t stage_id = 0;
+  int32_t stage_count = 1;
+  int32_t layer_start = 0;
+  int32_t layer_end = 0;
+  bool moe_stacked = false;
+  bool qk_norm = false;
+};
+
+// "stage-<i>-of-<N>.safetensors"
+std::string stage_shard_file_name(int32_t stage_id, int32_t stage_count);
+
+// Reads the stage header of `wl`. Returns false if `wl` is not a stage shard.
+bool read_stage_shard_info(const WeightLoader& wl, StageShardInfo* info);
+
+// Writes the language-model parameters of `stage` (built from `cfg`) to
+// `path`. Vision and projector modules are not part of the checkpoint
+// mapping and are not written. Returns the file size in bytes; throws
+// std::runtime_error on I/O failure.
+int64_t write_stage_shard(const std::string& path, ModelStage& stage, const ModelConfig& cfg);
+
+// True for parameters that belong in a stage shard.
+bool is_stage_shard_param(const std::string& name);
+
+} // namespace qwen
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <torch/torch.h>
+#include <memory>
 #include <unordered_map>
 #include <string>
 #include <vector>
@@ -28,6 +29,13 @@ public:
   virtual bool exists(const std::string& key) const = 0;
   virtual torch::Tensor get(const std::string& key) const = 0;
   virtual std::vector<std::string> list_keys() const = 0;
+
+  // String metadata stored alongside the tensors (e.g. the safetensors
+  // "__metadata__" object); empty if the format has none or `key` is absent.
+  virtual std::string metadata(const std::string& key) const {
+    (void)key;
+    return {};
+  }
 };
 
 // Simple in-memory loader used for tests or for adapters that pre-load tensors.
@@ -62,6 +70,14 @@ private:
   std::unordered_map<std::string, torch::Tensor> tensors_;
 };
 
+// Opens a checkpoint for stage loading. .safetensors files, a
+// model.safetensors.index.json, or a directory of shards are mmapped
+// (SafetensorsWeightLoader). Packed state_dict archives are indexed and read
+// tensor by tensor on get() (LazyPtWeightLoader); anything else
+// PtWeightLoader understands (TorchScript archives) is loaded eagerly into a
+// MapWeightLoader. Throws if no reader accepts the path.
+std::unique_ptr<WeightLoader> open_weight_loader(const std::string& weights_path);
+
 // Utility to assign tensor into a parameter safely.
 inline void assign_param(torch::Tensor& param, const torch::Tensor& value) {
   if (!param.defined()) {
@@ -3,16 +3,39 @@
 
 #include <torch/torch.h>
 #include <c10/util/Optional.h>
+#include <functional>
+#include <string>
+#include <utility>
 
 #include "core/config.h"
 #include "core/kv_cache.h"
 #include "core/rope.h"
+#include "model/linear.h"
 #include "model/rms_norm.h"
 
 namespace qwen {
 
 // Self-attention with optional KV caching and optional RoPE.
-// This implementation is correctness-first (no fused kernels) and runs on CUDA.
+// This implementation is correctness-first (no fused kernels) and runs on CPU or CUDA.
+//
+// cfg.attention_impl selects how scores are computed:
+//  - "gqa" (default): query heads are grouped per KV head; K/V are never
+//    repeated to q_heads.
+//  - "tiled": grouped heads plus online softmax over K/V blocks of
+//    cfg.attention_block_kv keys for cfg.attention_block_q queries at a time;
+//    causal masking is applied per tile and [T, S] is never allocated.
+//  - "reference": K/V repeated to q_heads, one [B,H,T,S] matmul.
+//
+// With cfg.attention_decode_fast_path, T == 1 steps of "gqa"/"tiled" use a
+// dedicated decode path: no causal mask (every cached key is visible), K/V
+// read as strided views of a dense cache, and one [rep, Hd] x [Hd, S] product
+// per KV head. A paged cache is read through its block table in chunks of
+// about cfg.attention_block_kv keys with an online softmax, so the history is
+// never gathered into one contiguous copy; multi-token steps on a paged cache
+// do the same through the "tiled" loop unless the impl is "reference".
+// Sequences of different lengths in
+// one batch are expressed with a padding attn_mask ([B, 1, 1, S]), which the
+// decode path applies.
 
 class AttentionImpl : public torch::nn::Module {
 public:
@@ -25,14 +48,24 @@ public:
   // cache: optional KV cache owner for this stage
   // pos: current position in sequence for KV append
   // rope: optional precomputed RoPE tables
+  // place: optional per-row cache rows/positions (continuous batching); pos
+  //   is then ignored, a cache is required, and attn_mask must be absent:
+  //   row i sees keys [0, place->positions[i] + t] of its own cache row.
+  //   With place->cu_seqlens, x is [1, total, D] packed sequences and
+  //   attention runs per segment (a cache is optional if all start at 0).
   torch::Tensor forward(const torch::Tensor& x,
                         const c10::optional<torch::Tensor>& attn_mask,
                         KVCache* cache,
                         int64_t pos,
-                        const c10::optional<RopeTables>& rope);
+                        const c10::optional<RopeTables>& rope,
+                        const RowPlacement* place = nullptr);
 
   const ModelConfig& cfg() const { return cfg_; }
 
+  // Override cfg.attention_impl after construction (benchmarks, tests).
+  void set_impl(const std::string& name);
+  void set_decode_fast_path(bool enabled) { decode_fast_path_ = enabled; }
+
   // Expose weights for loader mapping
   torch::Tensor& wq() { return wq_->weight; }
   torch::Tensor& wk() { return wk_->weight; }
@@ -50,13 +83,68 @@ public:
   RmsNorm& k_norm() { return k_norm_; }
 
 private:
+  enum class Impl { kReference, kGrouped, kTiled };
+
+  // q: [B, H, T, Hd], k_all/v_all: [B, kv_heads, S, Hd] -> [B, H, T, Hd]
+  torch::Tensor attend_reference(const torch::Tensor& q,
+                                 const torch::Tensor& k_all,
+                                 const torch::Tensor& v_all,
+                                 const c10::optional<torch::Tensor>& attn_mask,
+                                 int64_t pos) const;
+  torch::Tensor attend_grouped(const torch::Tensor& q,
+                               const torch::Tensor& k_all,
+                               const torch::Tensor& v_all,
+                               const c10::optional<torch::Tensor>& attn_mask,
+                               int64_t pos) const;
+  torch::Tensor attend_tiled(const torch::Tensor& q,
+                             const torch::Tensor& k_all,
+                             const torch::Tensor& v_all,
+                             const c10::optional<torch::Tensor>& attn_mask,
+                             int64_t pos) const;
+  // q: [B, H, T, Hd] against keys [0, S) of a paged cache, tile by tile.
+  torch::Tensor attend_tiled_paged(const torch::Tensor& q,
+                                   const KVCache& cache,
+                                   int64_t S,
+                                   const c10::optional<torch::Tensor>& attn_mask,
+                                   int64_t pos) const;
+  // Returns keys/values [B, kv_heads, tk, Hd] for positions [s0, s0 + tk).
+  using KVTileFn = std::function<std::pair<torch::Tensor, torch::Tensor>(int64_t s0, int64_t tk)>;
+  // Online-softmax core shared by attend_tiled and attend_tiled_paged.
+  torch::Tensor attend_tiles(const torch::Tensor& q,
+                             int64_t kv_heads,
+                             int64_t S,
+                             int64_t block_kv,
+                             const KVTileFn& tile,
+                             const c10::optional<torch::Tensor>& attn_mask,
+                             int64_t pos) const;
+  // Dispatch to the configured implementation; decode (T == 1) takes the
+  // fast path when enabled.
+  torch::Tensor attend(const torch::Tensor& q,
+                       const torch::Tensor& k_all,
+                       const torch::Tensor& v_all,
+                       const c10::optional<torch::Tensor>& attn_mask,
+                       int64_t pos,
+                       bool decode) const;
+  // q: [B, H, 1, Hd]; k_all/v_all may be strided views.
+  torch::Tensor attend_decode(const torch::Tensor& q,
+                              const torch::Tensor& k_all,
+                              const torch::Tensor& v_all,
+                              const c10::optional<torch::Tensor>& attn_mask) const;
+  // q: [B, H, 1, Hd] against keys [0, S) of a paged cache.
+  torch::Tensor attend_decode_paged(const torch::Tensor& q,
+                                    const KVCache& cache,
+                                    int64_t S,
+                                    const c10::optional<torch::Tensor>& attn_mask) const;
+
   ModelConfig cfg_;
+  Impl impl_ = Impl::kGrouped;
+  bool decode_fast_path_ = true;
   int32_t layer_index_in_stage_ = 0;
 
-  torch::nn::Linear wq_{nullptr};
-  torch::nn::Linear wk_{nullptr};
-  torch::nn::Linear wv_{nullptr};
-  torch::nn::Linear wo_{nullptr};
+  Linear wq_{nullptr};
+  Linear wk_{nullptr};
+  Linear wv_{nullptr};
+  Linear wo_{nullptr};
 
   RmsNorm q_norm_{nullptr};
   RmsNorm k_norm_{nullptr};
@@ -15,12 +15,12 @@ class EmbeddingImpl : public torch::nn::Module {
   const qwen::ModelConfig& cfg() const { return cfg_; }
 
   // Expose the underlying weight tensor for mapping/debugging.
-  torch::Tensor& weight() { return embedding_->weight; }
-  const torch::Tensor& weight() const { return embedding_->weight; }
+  torch::Tensor& weight() { return weight_; }
+  const torch::Tensor& weight() const { return weight_; }
 
  private:
   qwen::ModelConfig cfg_;
-  torch::nn::Embedding embedding_{nullptr};
+  torch::Tensor weight_;  // [vocab, hidden] at "embedding.weight", allocated through param_init()
 };
 
 TORCH_MODULE(Embedding);
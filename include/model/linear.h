@@ -0,0 +1,25 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <cstdint>
+
+namespace qwen {
+
+// torch::nn::Linear replacement with the same parameter names and layout
+// ("weight" [out, in], optional "bias" [out]). Parameters are allocated
+// through param_init(), so construction can skip random init and place them
+// straight on the target device.
+class LinearImpl : public torch::nn::Module {
+public:
+  LinearImpl(int64_t in_features, int64_t out_features, bool bias = false);
+
+  torch::Tensor forward(const torch::Tensor& x) { return torch::linear(x, weight, bias); }
+
+  torch::Tensor weight;
+  torch::Tensor bias;
+};
+
+TORCH_MODULE(Linear);
+
+} // namespace qwen
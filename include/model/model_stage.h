@@ -3,6 +3,8 @@
 
 #include <torch/torch.h>
 #include <c10/util/Optional.h>
+#include <functional>
+#include <memory>
 #include <vector>
 #include <string>
 
@@ -10,6 +12,7 @@
 #include "core/kv_cache.h"
 #include "core/rope.h"
 #include "model/embedding.h"
+#include "model/linear.h"
 #include "model/transformer_block.h"
 #include "model/rms_norm.h"
 #include "vision/vision_encoder.h"
@@ -27,12 +30,35 @@ namespace qwen {
 // Milestone 2 focuses on a correct CUDA execution path with a real module graph
 // (even if weights are not yet mapped).
 
+// Called after stage block `block` has appended its K/V for positions
+// [pos, pos + T) and before the next block runs.
+using BlockKVCallback = std::function<void(int32_t block, const KVCache& cache, int64_t pos, int64_t T)>;
+
 struct StageInput {
   torch::Tensor input_ids;     // [B, T] int64 (optional)
   torch::Tensor images;        // [B, C, H, W] CUDA (optional)
   torch::Tensor hidden_in;     // [B, T, D] CUDA (optional)
   int64_t pos = 0;             // starting position for KV cache
   c10::optional<torch::Tensor> attn_mask; // optional attention mask
+  KVCache* cache = nullptr;    // per-request cache; nullptr uses the stage-owned cache
+
+  // Continuous batching (optional, CPU int64 [B]): row b starts at positions[b]
+  // and lives in cache row slots[b] (default b). Overrides pos; rows may be at
+  // different lengths. Incompatible with attn_mask. The cache must be sized
+  // for every slot (cfg.max_batch).
+  torch::Tensor positions;
+  torch::Tensor slots;
+
+  // Packed varlen (optional, CPU int64 [N+1]): input_ids [1, total] / hidden_in
+  // [1, total, D] hold N sequences back to back, sequence i being tokens
+  // [cu_seqlens[i], cu_seqlens[i+1]). positions/slots are then per sequence
+  // (default 0 and i). Outputs stay packed.
+  torch::Tensor cu_seqlens;
+
+  // Optional per-block hook (e.g. to stream each layer's K/V downstream
+  // while the remaining blocks compute). Called once per block per chunk;
+  // not called for positions/cu_seqlens batches.
+  BlockKVCallback on_block_kv;
 };
 
 struct StageOutput {
@@ -46,14 +72,29 @@ public:
 
   StageOutput forward(const StageInput& in);
 
+  // With cfg.prefill_chunk_size > 0, prompts longer than one chunk run through
+  // the blocks chunk by chunk at increasing pos, appending to the KV cache as
+  // they go; on_chunk sees each chunk's output as soon as it is computed (so a
+  // caller can ship it downstream) along with its starting pos. Otherwise, or
+  // with an explicit attn_mask, on_chunk is called once with the whole
+  // output. forward() is forward_chunks() with the chunks concatenated.
+  using ChunkCallback = std::function<void(const StageOutput& out, int64_t pos, bool last_chunk)>;
+  void forward_chunks(const StageInput& in, const ChunkCallback& on_chunk);
+
   KVCache& cache() { return cache_; }
+
+  // Size `cache` for this stage if it is not initialized yet. Dense by
+  // default; with cfg.kv_block_size > 0 the cache is paged and attached to
+  // the stage's shared block pool. `like` supplies dtype and device.
+  void init_cache(KVCache& cache, const torch::Tensor& like);
+  const std::shared_ptr<KVBlockPool>& kv_pool() const { return kv_pool_; }
   const ModelConfig& cfg() const { return cfg_; }
 
   VisionEncoder& vision() { return vision_; }
   Projector& projector() { return projector_; }
   Embedding& embedding() { return embedding_; }
   RmsNorm& final_norm() { return final_norm_; }
-  torch::nn::Linear& lm_head() { return lm_head_; }
+  Linear& lm_head() { return lm_head_; }
   std::vector<TransformerBlock>& blocks() { return blocks_; }
 
 private:
@@ -66,12 +107,21 @@ private:
 
   std::vector<TransformerBlock> blocks_;
 
-  torch::nn::Linear lm_head_{nullptr}; // only used on last stage
+  Linear lm_head_{nullptr}; // only used on last stage
 
   KVCache cache_;
+  std::shared_ptr<KVBlockPool> kv_pool_;
   c10::optional<RopeTables> rope_;
 
 private:
+  torch::Tensor embed_inputs(const StageInput& in);
+  StageOutput run_blocks(torch::Tensor h,
+                         const c10::optional<torch::Tensor>& attn_mask,
+                         KVCache* cache,
+                         int64_t pos,
+                         const RowPlacement* place = nullptr,
+                         const BlockKVCallback* on_block_kv = nullptr);
+
   int32_t block_count() const { return cfg_.layer_end - cfg_.layer_start; }
   bool is_first_stage() const { return (cfg_.stage_id == 0); }
   bool is_last_stage() const { return (cfg_.stage_id >= 0) && (cfg_.stage_count > 0) && (cfg_.stage_id == cfg_.stage_count - 1); }
@@ -79,4 +129,12 @@ private:
 
 TORCH_MODULE(ModelStage);
 
+// Builds a stage whose weights are about to be loaded: parameters are
+// allocated uninitialized directly on `device` (see ParamInit) instead of
+// being randomly initialized on the CPU and moved. The loader has no vision
+// weights, so the vision encoder and projector are left out unless
+// `with_vision`; they are then the randomly initialized placeholders, built on
+// the CPU and moved.
+ModelStage make_stage_for_load(const ModelConfig& cfg, const torch::Device& device, bool with_vision = false);
+
 } // namespace qwen
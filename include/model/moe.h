@@ -7,13 +7,21 @@
 #include <string>
 
 #include "core/config.h"
+#include "model/linear.h"
 
 namespace qwen {
 
 // MoE / MLP block interface.
-// For Qwen3-VL-235B-A22B this is MoE-enabled; we define a correctness-first
-// implementation that exercises routing + expert execution on CUDA.
-// Weight mapping is handled in Milestone 3.
+// For Qwen3-VL-235B-A22B this is MoE-enabled. forward() uses grouped dispatch:
+// tokens are bucketed by selected expert and each active expert runs once on
+// its own rows. forward_reference() keeps the dense run-every-expert path for
+// parity checks. Both work on CPU and CUDA.
+//
+// With cfg.moe_stacked_experts the experts are stored as two stacked
+// parameters (gate_up_proj [E, 2I, D], down_proj [E, D, I]) instead of
+// per-expert modules. Prefill (T > 1) pads each expert's rows into
+// [E, max_n, D] and runs one bmm against each whole stack; decode runs each
+// active expert on select(0, e) views. Neither path copies weights.
 
 struct MoeOutput {
   torch::Tensor y;               // [B, T, D]
@@ -21,20 +29,14 @@ struct MoeOutput {
 };
 
 struct ExpertMLPImpl : public torch::nn::Module {
-  torch::nn::Linear gate_proj{nullptr};
-  torch::nn::Linear up_proj{nullptr};
-  torch::nn::Linear down_proj{nullptr};
+  Linear gate_proj{nullptr};
+  Linear up_proj{nullptr};
+  Linear down_proj{nullptr};
 
   ExpertMLPImpl(int64_t model_dim, int64_t hidden_dim) {
-    gate_proj = register_module(
-        "gate_proj",
-        torch::nn::Linear(torch::nn::LinearOptions(model_dim, hidden_dim).bias(false)));
-    up_proj = register_module(
-        "up_proj",
-        torch::nn::Linear(torch::nn::LinearOptions(model_dim, hidden_dim).bias(false)));
-    down_proj = register_module(
-        "down_proj",
-        torch::nn::Linear(torch::nn::LinearOptions(hidden_dim, model_dim).bias(false)));
+    gate_proj = register_module("gate_proj", Linear(model_dim, hidden_dim));
+    up_proj = register_module("up_proj", Linear(model_dim, hidden_dim));
+    down_proj = register_module("down_proj", Linear(hidden_dim, model_dim));
   }
 
   torch::Tensor forward(const torch::Tensor& x) {
@@ -54,6 +56,10 @@ public:
   // x: [B, T, D]
   MoeOutput forward(const torch::Tensor& x);
 
+  // Dense reference: every expert runs on every token, outputs are masked and
+  // accumulated. Slow; kept only for parity tests against forward().
+  MoeOutput forward_reference(const torch::Tensor& x);
+
   const ModelConfig& cfg() const { return cfg_; }
   bool is_moe_layer() const { return use_moe_; }
 
@@ -67,19 +73,46 @@ public:
   ExpertMLP& expert(int32_t idx) { return experts_mods_.at((size_t)idx); }
   int32_t expert_count() const { return static_cast<int32_t>(experts_mods_.size()); }
 
+  // Stacked storage (cfg.moe_stacked_experts on a MoE layer). When set there are
+  // no per-expert modules and expert_count() is 0.
+  bool stacked_experts() const { return gate_up_proj_.defined(); }
+  torch::Tensor& gate_up_proj() { return gate_up_proj_; } // [E, 2I, D]
+  torch::Tensor& down_proj() { return down_proj_; }       // [E, D, I]
+
 private:
   ModelConfig cfg_;
   int32_t layer_index_in_stage_ = 0;
   bool use_moe_ = false;
 
   // Router: D -> num_experts (only when use_moe=true)
-  torch::nn::Linear router_{nullptr};
+  Linear router_{nullptr};
 
   // Owning expert modules (stable registration names)
   std::vector<ExpertMLP> experts_mods_;
   std::vector<torch::nn::Module*> experts_raw_;
 
+  // Stacked expert weights (undefined unless stacked_experts()).
+  torch::Tensor gate_up_proj_;
+  torch::Tensor down_proj_;
+
 private:
+  void check_input(const torch::Tensor& x) const;
+
+  // Expert e applied to rows x: [..., D] -> [..., D], for either storage mode.
+  torch::Tensor run_expert(int32_t e, const torch::Tensor& x);
+
+  // Runs each active expert once on the rows routed to it and accumulates the
+  // gated outputs. x_flat: [N,D], expert_ids/gates: [N,K]. Returns [N,D].
+  torch::Tensor dispatch_grouped(const torch::Tensor& x_flat,
+                                 const torch::Tensor& expert_ids,
+                                 const torch::Tensor& gates);
+
+  // Stacked experts only: same contract as dispatch_grouped, but all experts
+  // run in one bmm per projection over a zero-padded [E, max_n, D] batch.
+  torch::Tensor dispatch_batched(const torch::Tensor& x_flat,
+                                 const torch::Tensor& expert_ids,
+                                 const torch::Tensor& gates);
+
   int64_t model_dim() const { return cfg_.hidden_size; }
   int64_t expert_hidden_dim() const {
     if (cfg_.moe_intermediate_size > 0) return cfg_.moe_intermediate_size;
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <torch/torch.h>
+
+namespace qwen {
+
+// How model modules allocate their parameters at construction.
+//
+// The default (CPU, random) draws the same values as torch::nn's initializers,
+// which tests and random-weight runs rely on. A stage that overwrites every
+// weight right after construction installs a ParamInitGuard with its target
+// device and random = false: parameters are then allocated uninitialized,
+// directly on that device, so nothing is allocated twice and no random numbers
+// are generated. Norm weights are still set to one (cheap and harmless).
+struct ParamInit {
+  torch::Device device = torch::kCPU;
+  bool random = true;
+};
+
+// Construction settings of the calling thread.
+const ParamInit& param_init();
+
+// Installs `init` for the current thread until destroyed.
+class ParamInitGuard {
+public:
+  explicit ParamInitGuard(ParamInit init);
+  ~ParamInitGuard();
+
+  ParamInitGuard(const ParamInitGuard&) = delete;
+  ParamInitGuard& operator=(const ParamInitGuard&) = delete;
+
+private:
+  ParamInit prev_;
+};
+
+// Uninitialized float32 tensor on param_init().device.
+torch::Tensor empty_param(at::IntArrayRef sizes);
+
+} // namespace qwen
@@ -3,6 +3,7 @@
 #include <torch/torch.h>
 
 #include "core/tensor_utils.h"
+#include "model/param_init.h"
 
 namespace qwen {
 
@@ -10,7 +11,7 @@ class RmsNormImpl : public torch::nn::Module {
 public:
   explicit RmsNormImpl(int64_t dim, double eps = 1e-6) : eps_(eps) {
     require(dim > 0, "RmsNorm: dim must be > 0");
-    weight_ = register_parameter("weight", torch::ones({dim}));
+    weight_ = register_parameter("weight", empty_param({dim}).fill_(1.0));
   }
 
   torch::Tensor forward(const torch::Tensor& x) {
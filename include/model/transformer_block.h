@@ -23,7 +23,8 @@ public:
                         const c10::optional<torch::Tensor>& attn_mask,
                         KVCache* cache,
                         int64_t pos,
-                        const c10::optional<RopeTables>& rope);
+                        const c10::optional<RopeTables>& rope,
+                        const RowPlacement* place = nullptr);
 
   const ModelConfig& cfg() const { return cfg_; }
   RmsNorm& ln1() { return ln1_; }
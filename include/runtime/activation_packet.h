@@ -6,17 +6,59 @@
 
 namespace qwen {
 
+// Wire format version shared by activation and KV packets.
+constexpr int32_t kWireVersion = 9;
+
+// Activation packets carry hidden states (or int64 token ids for a stage that
+// owns the embedding). Control packets carry no tensors and act on the
+// per-request state identified by request_id.
+enum class PacketKind : int32_t {
+  kActivation = 0,
+  kReset = 1,    // clear request_id's KV state, keep the allocation
+  kRelease = 2,  // drop request_id's KV state
+  kShutdown = 3, // stop the serving loop
+};
+
+// Wire encoding of a floating-point `hidden` (runtime/hidden_codec.h). The
+// receiver dequantizes according to the packet, so only senders choose.
+enum class HiddenCodec : int32_t {
+  kNone = 0,  // hidden as is
+  kInt8 = 1,  // int8 codes, one float32 scale per token
+  kFp8 = 2,   // float8 e4m3 codes, one float32 scale per token
+};
+
+// Activation flag bits.
+constexpr int32_t kFlagMoreChunks = 1; // more prefill chunks of this step follow
+
 struct ActivationPacket {
-  int32_t version = 1;
+  int32_t version = kWireVersion;
 
   int32_t stage_from = 0;
   int32_t stage_to = 0;
+  PacketKind kind = PacketKind::kActivation;
+  int32_t flags = 0;
 
   int64_t step = 0;
   int64_t pos = 0;
+  int64_t request_id = 0;
 
   torch::Tensor hidden;
   c10::optional<torch::Tensor> attn_mask;
+
+  // Continuous batching: per-row start position and KV slot, int64 [B].
+  c10::optional<torch::Tensor> positions;
+  c10::optional<torch::Tensor> slots;
+
+  // Packed varlen: hidden is [1, total, D] holding N sequences; int64 [N+1]
+  // offsets replace a padded [B, T_max] layout and its attn_mask.
+  c10::optional<torch::Tensor> cu_seqlens;
+
+  // Quantized hidden states: `hidden` holds the codes, `hidden_scale` the
+  // float32 per-token scales ([B, T] for a [B, T, D] hidden) and
+  // `hidden_dtype` the dtype the receiver restores.
+  HiddenCodec codec = HiddenCodec::kNone;
+  c10::ScalarType hidden_dtype = c10::ScalarType::Undefined;
+  c10::optional<torch::Tensor> hidden_scale;
 };
 
 } // namespace qwen
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "runtime/activation_packet.h"
+#include "runtime/kv_packet.h"
+#include "runtime/transport.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace qwen {
+
+// Reusable host staging buffers. empty() hands out a CPU tensor backed by a
+// pooled block (page-locked when `pinned`); the block returns to the pool
+// when the last reference to the tensor goes away, so a steady stream of
+// same-sized packets allocates only as many blocks as are in flight.
+class StagingPool {
+public:
+  // `pinned` is ignored without CUDA. At most `max_free` idle blocks are kept.
+  explicit StagingPool(bool pinned, int64_t max_free = 8);
+
+  torch::Tensor empty(at::IntArrayRef sizes, c10::ScalarType dtype);
+
+  bool pinned() const;
+  // Blocks allocated so far (reuse keeps this flat).
+  int64_t allocations() const;
+
+private:
+  struct State;
+  std::shared_ptr<State> state_;
+};
+
+// Sends packets from a dedicated I/O thread so the caller can start its next
+// forward while the previous activation is still on the wire.
+//
+// send() stages every CUDA tensor of the packet into a pooled pinned buffer
+// with an asynchronous device-to-host copy on the current stream, queues the
+// packet and returns; the I/O thread waits for the copy and writes it with
+// `send_fn`. CPU tensors are queued as they are and must not be modified
+// after send(). At most `depth` packets are queued (2 = double buffering);
+// send() blocks beyond that. An I/O error stops the thread and is rethrown
+// by the next send() or flush().
+//
+// With `send_kv_fn`, send_kv() queues KV packets the same way; activation
+// and KV packets go out in the order they were queued.
+class AsyncSender {
+public:
+  using SendFn = std::function<void(const ActivationPacket&)>;
+  using KVSendFn = std::function<void(const KVPacket&)>;
+
+  AsyncSender(SendFn send_fn,
+              int64_t depth = 2,
+              std::shared_ptr<StagingPool> pool = nullptr,
+              KVSendFn send_kv_fn = nullptr);
+  ~AsyncSender();   // writes out what is queued; errors are dropped
+
+  AsyncSender(const AsyncSender&) = delete;
+  AsyncSender& operator=(const AsyncSender&) = delete;
+
+  void send(const ActivationPacket& p);
+  void send_kv(const KVPacket& p);
+
+  // Blocks until every queued packet has been written.
+  void flush();
+
+  int64_t sent() const;
+
+private:
+  struct Item;
+  torch::Tensor stage(const torch::Tensor& t, Item* item);
+  void enqueue(std::unique_ptr<Item> item);
+  void loop();
+
+  SendFn send_fn_;
+  KVSendFn send_kv_fn_;
+  int64_t depth_;
+  std::shared_ptr<StagingPool> pool_;
+
+  mutable std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<std::unique_ptr<Item>> queue_;   // front is being written
+  bool stop_ = false;
+  int64_t sent_ = 0;
+  std::exception_ptr error_;
+  std::thread thread_;
+};
+
+// Receives packets on a dedicated I/O thread into pooled pinned buffers, up
+// to `depth` ahead of the consumer. The thread stops after a packet for which
+// `is_last` returns true (or a kShutdown packet) and on I/O errors, which
+// pop() rethrows once the queue is drained. `cancel` must unblock a pending
+// receive (e.g. TcpConn::shutdown); the destructor calls it if the thread is
+// still running.
+//
+// Payloads live in pooled buffers: copy what must outlive the packet (a
+// blocking .to(device) does) before dropping it.
+class AsyncReceiver {
+public:
+  using RecvFn = std::function<ActivationPacket(const TensorAllocator&)>;
+  using LastFn = std::function<bool(const ActivationPacket&)>;
+
+  AsyncReceiver(RecvFn recv_fn,
+                std::function<void()> cancel,
+                LastFn is_last = nullptr,
+                int64_t depth = 2,
+                std::shared_ptr<StagingPool> pool = nullptr);
+  ~AsyncReceiver();
+
+  AsyncReceiver(const AsyncReceiver&) = delete;
+  AsyncReceiver& operator=(const AsyncReceiver&) = delete;
+
+  // Next packet in arrival order.
+  ActivationPacket pop();
+
+private:
+  void loop();
+
+  RecvFn recv_fn_;
+  std::function<void()> cancel_;
+  LastFn is_last_;
+  int64_t depth_;
+  std::shared_ptr<StagingPool> pool_;
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::deque<ActivationPacket> queue_;
+  bool done_ = false;
+  bool stop_ = false;
+  std::exception_ptr error_;
+  std::thread thread_;
+};
+
+} // namespace qwen
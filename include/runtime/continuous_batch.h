@@ -0,0 +1,102 @@
+#pragma once
+
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace qwen {
+
+// Iteration-level (continuous) batching for greedy generation on stage 0.
+//
+// Every sequence owns one KV cache row ("slot") for its lifetime. Each call to
+// next() yields one forward: either a packed prefill of every queued request
+// that fits a free slot, or one decode step over every running sequence, each
+// at its own position. A sequence that reaches max_new_tokens frees its slot
+// immediately, and the next queued request is admitted on the following
+// iteration instead of waiting for the whole batch to drain.
+//
+// With static_batching the scheduler only admits when no sequence is
+// running, which reproduces classic fixed batches for comparison.
+
+struct SequenceRequest {
+  int64_t id = 0;
+  torch::Tensor prompt;        // [1, T] int64
+  int64_t max_new_tokens = 1;
+};
+
+struct FinishedSequence {
+  int64_t id = 0;
+  torch::Tensor tokens;        // [1, max_new_tokens] int64
+  int64_t slot = -1;
+  int64_t admitted_iteration = 0;
+  int64_t finished_iteration = 0;
+};
+
+// One forward to run over B sequences. positions/slots are CPU int64 [B],
+// ready for StageInput::positions/slots. A prefill packs its prompts back to
+// back without padding: input_ids is [1, total] and cu_seqlens [B+1].
+struct ScheduledBatch {
+  bool prefill = false;
+  torch::Tensor input_ids;     // decode: [B, 1]; prefill: [1, total] (CPU int64)
+  torch::Tensor positions;     // [B]
+  torch::Tensor slots;         // [B]
+  torch::Tensor cu_seqlens;    // prefill only: [B+1]
+};
+
+// Concatenate [1, T_i] sequences into [1, sum T_i]; *cu_seqlens receives the
+// int64 offsets [N+1].
+torch::Tensor pack_sequences(const std::vector<torch::Tensor>& seqs, torch::Tensor* cu_seqlens);
+
+// Index of each sequence's last token in a packed row (cu_seqlens[1:] - 1).
+torch::Tensor packed_last_indices(const torch::Tensor& cu_seqlens);
+
+class ContinuousBatchScheduler {
+public:
+  explicit ContinuousBatchScheduler(int64_t num_slots, bool static_batching = false);
+
+  void submit(SequenceRequest r);
+
+  // Next forward to run; false once every request has finished.
+  bool next(ScheduledBatch* out);
+
+  // Greedy tokens [B, 1] for the batch last returned by next(), one per
+  // sequence (for a packed prefill: from each sequence's last token).
+  void complete(const ScheduledBatch& batch, const torch::Tensor& tokens);
+
+  std::vector<FinishedSequence> take_finished();
+
+  int64_t num_slots() const { return (int64_t)slots_.size(); }
+  int64_t running() const;
+  int64_t queued() const { return (int64_t)queue_.size(); }
+
+  // Iterations run so far, decode iterations among them, and the rows those
+  // decode iterations carried (rows / decode_iterations = mean batch size).
+  int64_t iterations() const { return iterations_; }
+  int64_t decode_iterations() const { return decode_iterations_; }
+  int64_t decode_rows() const { return decode_rows_; }
+
+private:
+  struct Slot {
+    bool active = false;
+    int64_t id = 0;
+    int64_t length = 0;        // positions written to the cache
+    int64_t max_new_tokens = 0;
+    int64_t admitted_iteration = 0;
+    std::vector<int64_t> tokens;
+  };
+
+  void finish(int64_t slot);
+
+  std::vector<Slot> slots_;
+  std::deque<SequenceRequest> queue_;
+  std::vector<FinishedSequence> finished_;
+  bool static_batching_ = false;
+  bool admitting_ = true;
+  int64_t iterations_ = 0;
+  int64_t decode_iterations_ = 0;
+  int64_t decode_rows_ = 0;
+};
+
+} // namespace qwen
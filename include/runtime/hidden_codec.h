@@ -0,0 +1,45 @@
+#pragma once
+
+#include "runtime/activation_packet.h"
+
+#include <torch/torch.h>
+
+#include <string>
+#include <utility>
+
+namespace qwen {
+
+// "none" | "int8" | "fp8"
+bool parse_hidden_codec(const std::string& s, HiddenCodec* codec);
+const char* hidden_codec_name(HiddenCodec codec);
+
+// Symmetric per-token quantization of x ([..., D]): one float32 scale per
+// row of the last dimension (amax / qmax), codes int8 or float8 e4m3 on x's
+// device. A [B, T, D] hidden shrinks to D + 4 bytes per token (from 2D for
+// bf16, 4D for fp32). kNone is not a quantizing codec.
+std::pair<torch::Tensor, torch::Tensor> quantize_rows(const torch::Tensor& x, HiddenCodec codec);
+
+// codes * scale, as `dtype`.
+torch::Tensor dequantize_rows(const torch::Tensor& codes, const torch::Tensor& scale, c10::ScalarType dtype);
+
+// Sender side: replaces a floating-point p->hidden with its codes and sets
+// codec, hidden_scale and hidden_dtype. Token ids, empty packets and kNone
+// leave the packet as it is. Run it before the packet is staged so the
+// device-to-host copy moves the smaller codes.
+void quantize_hidden(ActivationPacket* p, HiddenCodec codec);
+
+// Receiver side: p.hidden on `device` in its original dtype, dequantized
+// there if the packet carries a codec.
+torch::Tensor hidden_on(const ActivationPacket& p, const torch::Device& device);
+
+struct CodecError {
+  double max_abs = 0.0;
+  double mean_abs = 0.0;
+};
+
+// |dequantize(quantize(x)) - x|, or |a - b| for error_between; computed in
+// float32.
+CodecError codec_error(const torch::Tensor& x, HiddenCodec codec);
+CodecError error_between(const torch::Tensor& a, const torch::Tensor& b);
+
+} // namespace qwen
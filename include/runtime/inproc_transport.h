@@ -0,0 +1,78 @@
+#pragma once
+
+#include "runtime/transport.h"
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+namespace qwen {
+
+struct InProcOptions {
+  // Packets queued per direction before send blocks, like a full socket
+  // buffer. 0 means unbounded.
+  int64_t capacity = 16;
+  // How long a connect waits for the listener to be created.
+  int64_t connect_timeout_ms = 60000;
+};
+
+struct InProcChannel;
+struct InProcAcceptQueue;
+
+// Packet connection between two threads of one process. Packets are handed
+// over through a queue per direction with no encoding and no syscalls. send()
+// clones every tensor on its own device (a sender may reuse its buffers once
+// send returns, as with the socket transports), so payloads arrive where they
+// were sent from; CUDA tensors stay on the GPU.
+//
+// Activation and KV packets share one ordered stream per direction; a recv of
+// the wrong kind throws. Destroying or shutting down either end fails the
+// peer's calls once its queue is drained.
+class InProcTransport : public Transport {
+public:
+  InProcTransport(std::shared_ptr<InProcChannel> ch, int side);
+  ~InProcTransport() override;
+
+  InProcTransport(const InProcTransport&) = delete;
+  InProcTransport& operator=(const InProcTransport&) = delete;
+
+  void send_activation(const ActivationPacket& p) override;
+  ActivationPacket recv_activation(const TensorAllocator& alloc = nullptr) override;
+  void send_kv(const KVPacket& p) override;
+  KVPacket recv_kv() override;
+
+  void shutdown() override;
+
+private:
+  std::shared_ptr<InProcChannel> ch_;
+  int side_ = 0;
+};
+
+// Two connected ends.
+std::pair<std::unique_ptr<InProcTransport>, std::unique_ptr<InProcTransport>> make_inproc_pair(
+    const InProcOptions& opts = {});
+
+// Accepts in-process connections addressed by `port` in a process-wide
+// table, so stage code written against TransportListener/make_connection runs
+// unchanged with every stage on a thread. Port 0 picks an unused one.
+class InProcListener {
+public:
+  explicit InProcListener(int port);
+  ~InProcListener();  // unregisters the port
+
+  InProcListener(const InProcListener&) = delete;
+  InProcListener& operator=(const InProcListener&) = delete;
+
+  std::unique_ptr<InProcTransport> accept_one();
+  int port() const { return port_; }
+
+private:
+  int port_ = 0;
+  std::shared_ptr<InProcAcceptQueue> q_;
+};
+
+// Connects to the InProcListener on `port`, waiting up to
+// opts.connect_timeout_ms for it to be created.
+std::unique_ptr<InProcTransport> inproc_connect(int port, const InProcOptions& opts = {});
+
+} // namespace qwen
@@ -5,16 +5,27 @@
 
 #include <cstdint>
 
+#include "runtime/activation_packet.h"
+
 namespace qwen {
 
 struct KVPacket {
-  int32_t version = 1;
+  int32_t version = kWireVersion;
 
   int32_t stage_from = 0;
   int32_t stage_to = 0;
 
   int64_t step = 0;
   int64_t pos = 0;
+  int64_t request_id = 0;
+  // Cache position of k/v[..., 0, :]. 0 for a full sync; a delta carries
+  // only the positions appended since the previous one.
+  int64_t kv_start = 0;
+  // Layer-wise streams send one packet per layer: k/v hold stage layer
+  // `layer` only ([1, B, H, S, D]) and `layer_count` packets make up the
+  // stream. layer < 0: k/v hold every layer.
+  int32_t layer = -1;
+  int32_t layer_count = 0;
 
   // Minimal representation: cache tensors can be packed however your runtime chooses.
   // Keeping them optional allows "no-kv" paths to work.
@@ -2,6 +2,8 @@
 
 #include <torch/torch.h>
 
+#include <cstdint>
+
 #include "core/kv_cache.h"
 
 namespace qwen {
@@ -9,9 +11,34 @@ namespace qwen {
 struct PackedKV {
   torch::Tensor k; // [L, B, H, S, D] on CPU
   torch::Tensor v; // [L, B, H, S, D] on CPU
+  int64_t start = 0; // cache position of k/v[..., 0, :]
 };
 
+// Whole cache: dense caches ship the full max_seq_len buffer, paged caches
+// the positions written so far.
 PackedKV pack_kv_cache(const KVCache& cache);
-void restore_kv_cache(KVCache* cache, const torch::Tensor& k, const torch::Tensor& v);
+
+// Positions [start, start + len) of every layer, copied straight into one
+// preallocated CPU buffer (k and v are views of it); paged caches read only
+// the blocks covering the range. A first sync packs [0, cache.length()); a
+// later delta can pack only what was appended since (e.g. [pos, pos + T)
+// after a decode step), so its bytes scale with the new tokens instead of
+// max_seq_len. The runtime binaries only use the first kind (--kv-delta);
+// per-step deltas are an API for callers that sync caches themselves.
+// `pinned` allocates the buffer page-locked (CUDA builds only).
+PackedKV pack_kv_range(const KVCache& cache, int64_t start, int64_t len, bool pinned = false);
+
+// Writes k/v ([L, B, H, S, D]) into positions [start, start + S) of rows
+// [0, B) in place; positions outside the range are left as they are, so a
+// full pack restores with start 0 and deltas apply on top of it.
+void restore_kv_cache(KVCache* cache, const torch::Tensor& k, const torch::Tensor& v, int64_t start = 0);
+
+// One layer of a layer-wise stream: positions [start, start + len) of
+// `layer` as contiguous [1, B, H, len, D] tensors, left on the cache device
+// so the device-to-host copy can be issued by the sender (see AsyncSender).
+PackedKV pack_kv_layer(const KVCache& cache, int32_t layer, int64_t start, int64_t len);
+
+// Writes one layer ([1, B, H, S, D]) at positions [start, start + S).
+void restore_kv_layer(KVCache* cache, int32_t layer, const torch::Tensor& k, const torch::Tensor& v, int64_t start = 0);
 
 } // namespace qwen
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "model/model_stage.h"
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace qwen {
+
+// Split a first-stage input into `m` micro-batches along the batch dim (rows
+// are divided as evenly as possible; requires batch >= m). Every defined
+// tensor is split; pos is copied and cache is left unset so the caller can
+// give each micro-batch its own KV cache slot.
+std::vector<StageInput> split_micro_batches(const StageInput& in, int64_t m);
+
+// Busy/idle accounting for one pipeline stage. Wall time runs from the first
+// begin_wall() to the last add_busy(); busy time is the sum of the work
+// intervals (forward plus send). With micro-batches in flight the ratio shows
+// how much of the run this stage spent computing instead of waiting upstream.
+class StageUtilization {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  void begin_wall();
+  void add_busy(const Clock::time_point& t0);
+
+  int64_t items() const { return items_; }
+  double busy_ms() const { return busy_ms_; }
+  double wall_ms() const;
+  double utilization() const;
+
+  // "busy_ms=.. wall_ms=.. utilization=..% items=.."
+  std::string summary() const;
+
+private:
+  bool started_ = false;
+  Clock::time_point wall_begin_;
+  Clock::time_point wall_end_;
+  double busy_ms_ = 0.0;
+  int64_t items_ = 0;
+};
+
+} // namespace qwen
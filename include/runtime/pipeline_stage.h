@@ -1,34 +1,88 @@
 #pragma once
 
+#include "core/kv_cache.h"
 #include "model/model_stage.h"
 #include "runtime/activation_packet.h"
+#include "runtime/transport.h"
 
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 
 namespace qwen {
 
+// Where a serving stage's packets come from and go to.
+struct ServeLinks {
+  // Accepts the upstream peer (stage 0: the client).
+  TransportListener* upstream = nullptr;
+  // Opens the downstream connection (last stage: the client's reply port);
+  // called when the first packet is forwarded.
+  std::function<std::unique_ptr<Transport>()> connect_downstream;
+  // Optional: upstream connects/disconnects, for logging.
+  std::function<void(const std::string&)> on_event;
+  // Wire encoding of forwarded hidden states; the reply token is never
+  // quantized.
+  HiddenCodec codec = HiddenCodec::kNone;
+};
+
+// Serving wrapper around one ModelStage. Keeps one KVCache per request id so
+// interleaved requests never see each other's history; caches are created on
+// first use and live until reset/released.
 class PipelineStage {
 public:
   explicit PipelineStage(const ModelConfig& cfg);
 
+  // Wrap an already constructed (and typically already loaded) stage.
+  explicit PipelineStage(ModelStage stage);
+
   // Local execution (no transport): takes StageInput, returns StageOutput.
   StageOutput run_local(const StageInput& in);
 
-  // Deserialize an ActivationPacket into StageInput, run_local(), return StageOutput.
+  // Deserialize an ActivationPacket into StageInput, run_local(), return
+  // StageOutput. Integral `hidden` tensors are treated as token ids for a
+  // stage with an embedding; quantized hidden states are dequantized on the
+  // stage device. Tensors are moved to the stage's parameter device;
+  // device_index is unused. The request's own KV cache is used.
   StageOutput run_from_activation(const ActivationPacket& p, int device_index);
 
+  // Same as run_from_activation, but hands each prefill chunk to on_chunk as
+  // soon as it is computed (see ModelStageImpl::forward_chunks).
+  void run_chunks_from_activation(const ActivationPacket& p, const ModelStageImpl::ChunkCallback& on_chunk);
+
   // Serialize StageOutput into ActivationPacket to send to next stage.
   ActivationPacket to_activation(const StageOutput& out,
                                  int32_t stage_from,
                                  int32_t stage_to,
                                  int64_t step,
-                                 int64_t pos);
+                                 int64_t pos,
+                                 int64_t request_id = 0);
+
+  // Serving loop over any transport: runs each activation packet against its
+  // request's cache and forwards the result downstream as soon as every
+  // prefill chunk finishes; the last stage instead replies with the greedy
+  // next token of the step's final chunk. Control packets are applied and
+  // forwarded. When the upstream peer disconnects the next one is accepted;
+  // returns the number of activations run once a shutdown packet arrives.
+  int64_t serve(const ServeLinks& links, int32_t stage_idx, int32_t num_stages);
+
+  // Per-request KV state.
+  KVCache& request_cache(int64_t request_id);
+  void reset_request(int64_t request_id);   // clear the cache (paged: blocks return to the pool)
+  void release_request(int64_t request_id); // free the cache
+  size_t active_requests() const { return caches_.size(); }
+
+  ModelStage& stage() { return stage_; }
 
 private:
+  torch::Device stage_device();
+  StageInput input_from_activation(const ActivationPacket& p);
+
   ModelConfig cfg_;
   ModelStage stage_;
+  std::unordered_map<int64_t, KVCache> caches_;
 };
 
 } // namespace qwen
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "runtime/transport.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace qwen {
+
+struct ShmOptions {
+  // Ring size per direction, rounded up to 64 bytes. One packet (header plus
+  // payloads) must fit.
+  int64_t ring_bytes = 64ll << 20;
+  // How long a client waits for the server's segment to appear.
+  int64_t connect_timeout_ms = 60000;
+};
+
+// POSIX shared-memory segment name for the pipeline hop addressed by `port`.
+std::string shm_segment_name(int port);
+
+struct ShmSegment;
+struct ShmReleaseQueue;
+
+// Packet connection between two processes on one host through a POSIX
+// shared-memory segment holding one single-producer/single-consumer ring per
+// direction. A sender encodes the frame header and copies each payload
+// straight into the ring (CUDA tensors with one device-to-host copy); the
+// receiver decodes the header in place and returns payloads as from_blob
+// views of the ring, with no copy. Waits spin briefly, then sleep on a futex
+// in the segment.
+//
+// A packet's ring space is released when the last view into it goes away
+// and the sender blocks while the ring is full, so copy (or .to(device))
+// what must outlive the next few packets.
+class ShmConn : public Transport {
+public:
+  ShmConn(std::shared_ptr<ShmSegment> seg, bool server_side);
+  ~ShmConn() override;
+
+  ShmConn(const ShmConn&) = delete;
+  ShmConn& operator=(const ShmConn&) = delete;
+
+  void send_activation(const ActivationPacket& p) override;
+  ActivationPacket recv_activation(const TensorAllocator& alloc = nullptr) override;
+  void send_kv(const KVPacket& p) override;
+  KVPacket recv_kv() override;
+
+  void shutdown() override;
+
+private:
+  void send_frame(const EncodedFrame& f);
+  // Waits for the next record and returns its offset in the receive ring.
+  uint64_t next_record(const char* what);
+
+  template <class Packet, class Decode>
+  Packet recv_frame(const char* what, Decode decode);
+
+  // Index of the peer's pid in the segment (0 server, 1 client); the server
+  // writes ring 1.
+  int peer() const { return tx_; }
+
+  std::shared_ptr<ShmSegment> seg_;
+  int tx_ = 0;  // ring written by this side
+  int rx_ = 1;  // ring read by this side
+  uint64_t rd_ = 0;
+  std::shared_ptr<ShmReleaseQueue> releases_;
+};
+
+// Creates the segment and accepts one client at a time.
+class ShmServer {
+public:
+  explicit ShmServer(const std::string& name, const ShmOptions& opts = {});
+  ~ShmServer();  // unlinks the segment
+
+  ShmServer(const ShmServer&) = delete;
+  ShmServer& operator=(const ShmServer&) = delete;
+
+  // Resets the rings and waits for a client. Views from a previous
+  // connection must be gone by then.
+  std::unique_ptr<ShmConn> accept_one();
+  const std::string& name() const { return name_; }
+
+private:
+  std::string name_;
+  std::shared_ptr<ShmSegment> seg_;
+};
+
+// Attaches to a ShmServer's segment, waiting up to opts.connect_timeout_ms
+// for it to be created and listening.
+class ShmClient : public ShmConn {
+public:
+  explicit ShmClient(const std::string& name, const ShmOptions& opts = {});
+};
+
+} // namespace qwen
@@ -2,54 +2,126 @@
 
 #include "runtime/activation_packet.h"
 #include "runtime/kv_packet.h"
+#include "runtime/wire_frame.h"
 
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 
 namespace qwen {
 
-class TcpClient {
+// A packet connection to a neighbouring stage. Socket and shared-memory
+// implementations carry the frames of runtime/wire_frame.h; the in-process one
+// hands packets over directly. Stage code holds a Transport and does not care
+// which one it got.
+class Transport {
 public:
-  TcpClient(const std::string& host, int port);
-  ~TcpClient();
+  virtual ~Transport() = default;
 
-  void send_activation(const ActivationPacket& p);
-  ActivationPacket recv_activation();
-  void send_kv(const KVPacket& p);
-  KVPacket recv_kv();
+  virtual void send_activation(const ActivationPacket& p) = 0;
+  // `alloc` supplies the tensors payloads are read into; transports that do
+  // not copy into fresh host memory (shared memory, in-process) ignore it.
+  virtual ActivationPacket recv_activation(const TensorAllocator& alloc = nullptr) = 0;
+  virtual void send_kv(const KVPacket& p) = 0;
+  virtual KVPacket recv_kv() = 0;
 
-private:
+  // Unblocks a send/recv in progress on another thread (it throws).
+  virtual void shutdown() = 0;
+};
+
+// Server side of a hop: accepts one peer at a time.
+class TransportListener {
+public:
+  virtual ~TransportListener() = default;
+  virtual std::unique_ptr<Transport> accept() = 0;
+  virtual int port() const = 0;
+};
+
+// Per-connection socket behaviour.
+struct TcpOptions {
+  // TCP_NODELAY: small decode packets go out at once instead of waiting on
+  // Nagle for the ACK of the previous segment. Ignored on Unix sockets.
+  bool nodelay = true;
+  // Send each packet as one frame (header + payloads) with a single
+  // sendmsg(). false issues one send() per field, the pre-framing syscall
+  // pattern; the bytes on the wire are identical. For benchmarking.
+  bool vectored = true;
+};
+
+// Packet connection over a connected stream socket (TCP or Unix domain).
+// Owns the descriptor.
+class SocketTransport : public Transport {
+public:
+  explicit SocketTransport(int fd, const TcpOptions& opts = {});
+  ~SocketTransport() override;
+
+  SocketTransport(const SocketTransport&) = delete;
+  SocketTransport& operator=(const SocketTransport&) = delete;
+
+  void send_activation(const ActivationPacket& p) override;
+  ActivationPacket recv_activation(const TensorAllocator& alloc = nullptr) override;
+  void send_kv(const KVPacket& p) override;
+  KVPacket recv_kv() override;
+
+  void shutdown() override;
+
+protected:
   int fd_ = -1;
+  TcpOptions opts_;
+};
+
+class TcpClient : public SocketTransport {
+public:
+  TcpClient(const std::string& host, int port, const TcpOptions& opts = {});
 };
 
 class TcpServer {
 public:
-  explicit TcpServer(int port);
+  explicit TcpServer(int port, const TcpOptions& opts = {});
   ~TcpServer();
 
+  // Accepted sockets get this server's TcpOptions::nodelay.
   int accept_one();
   int port() const { return port_; }
 
 private:
   int fd_ = -1;
   int port_ = -1;
+  TcpOptions opts_;
 };
 
-class TcpConn {
+class TcpConn : public SocketTransport {
 public:
-  explicit TcpConn(int fd);
-  ~TcpConn();
-
-  void send_activation(const ActivationPacket& p);
-  ActivationPacket recv_activation();
+  explicit TcpConn(int fd, const TcpOptions& opts = {});
 
   void send_activation_raw(const ActivationPacket& p);
+};
+
+// Unix-domain socket path for the pipeline hop addressed by `port`.
+std::string unix_socket_path(int port);
 
-  void send_kv(const KVPacket& p);
-  KVPacket recv_kv();
+// Stream socket bound to a filesystem path; same framing as TCP without the
+// TCP/IP stack. The path is replaced on bind and removed on destruction.
+class UnixServer {
+public:
+  explicit UnixServer(const std::string& path);
+  ~UnixServer();
+
+  UnixServer(const UnixServer&) = delete;
+  UnixServer& operator=(const UnixServer&) = delete;
+
+  int accept_one();
+  const std::string& path() const { return path_; }
 
 private:
   int fd_ = -1;
+  std::string path_;
+};
+
+class UnixClient : public SocketTransport {
+public:
+  explicit UnixClient(const std::string& path, const TcpOptions& opts = {});
 };
 
 } // namespace qwen
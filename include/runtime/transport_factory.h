@@ -0,0 +1,39 @@
+#pragma once
+
+#include "runtime/inproc_transport.h"
+#include "runtime/shm_transport.h"
+#include "runtime/transport.h"
+
+#include <memory>
+#include <string>
+
+namespace qwen {
+
+// Every kind addresses a hop by port, so stage wiring is the same for all.
+enum class TransportKind {
+  kTcp = 0,
+  kShm = 1,     // stages on the same host; the segment is named after the port
+  kUnix = 2,    // stages on the same host; socket at unix_socket_path(port)
+  kInProc = 3,  // stages on threads of one process
+};
+
+// "tcp" | "shm" | "unix" | "inproc"
+bool parse_transport_kind(const std::string& s, TransportKind* kind);
+const char* transport_kind_name(TransportKind kind);
+
+struct TransportOptions {
+  TransportKind kind = TransportKind::kTcp;
+  TcpOptions tcp;  // also used by kUnix (nodelay does not apply)
+  ShmOptions shm;
+  InProcOptions inproc;
+};
+
+// Listens on `port` (0 picks a free TCP or in-process port). Shared memory
+// and Unix sockets create the segment/socket named after the port instead.
+std::unique_ptr<TransportListener> make_listener(const TransportOptions& opts, int port);
+
+// Connects to a listener. Only TCP uses `host`; the other kinds must be on
+// this machine (in-process: in this process).
+std::unique_ptr<Transport> make_connection(const TransportOptions& opts, const std::string& host, int port);
+
+} // namespace qwen
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "runtime/activation_packet.h"
+#include "runtime/kv_packet.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace qwen {
+
+// Packet <-> frame encoding shared by every transport. One packet is one
+// frame (all integers in network byte order):
+//
+//   int32 version, uint32 header_len        fixed 8-byte prefix
+//   header_len bytes                        packet fields, then metadata of
+//                                           every tensor slot
+//   tensor payloads                         raw bytes, in slot order
+//
+// Header fields after the prefix:
+//   activation: int32 stage_from, int32 stage_to, int32 kind, int32 flags,
+//               int32 codec, int32 hidden_dtype,
+//               uint64 step, uint64 pos, uint64 request_id,
+//               tensors hidden, attn_mask, positions, slots, cu_seqlens,
+//               hidden_scale
+//   kv:         int32 stage_from, int32 stage_to,
+//               uint64 step, uint64 pos, uint64 request_id, uint64 kv_start,
+//               int32 layer, int32 layer_count, tensors k, v
+// Tensor metadata: uint8 defined; if defined: int32 dtype, int32 ndim,
+// uint64 sizes[ndim], uint64 nbytes.
+
+constexpr size_t kFramePrefixBytes = 8;
+
+// Largest header a receiver accepts; tensor metadata is a few dozen bytes.
+constexpr uint32_t kMaxHeaderBytes = 1u << 20;
+
+// Allocates the CPU tensor a received payload is read into (default:
+// torch::empty). Lets a caller receive into reusable staging buffers.
+using TensorAllocator = std::function<torch::Tensor(at::IntArrayRef sizes, c10::ScalarType dtype)>;
+
+struct EncodedFrame {
+  std::vector<uint8_t> head;           // prefix + header
+  std::vector<size_t> fields;          // offset of every field in `head`
+  std::vector<torch::Tensor> payloads; // defined slots, contiguous, in slot order (may be CUDA)
+
+  size_t payload_bytes() const;
+};
+
+EncodedFrame encode_activation(const ActivationPacket& p);
+EncodedFrame encode_kv(const KVPacket& p);
+
+// Checks the version in an 8-byte prefix and returns header_len.
+uint32_t parse_frame_prefix(const uint8_t* prefix, const char* what);
+
+// Decode a header (the header_len bytes after the prefix). Every defined
+// tensor slot is allocated with `alloc` and appended to `payloads` unfilled;
+// the caller copies the payload bytes into them, in order.
+ActivationPacket decode_activation(const uint8_t* header,
+                                   size_t len,
+                                   const TensorAllocator& alloc,
+                                   std::vector<torch::Tensor>* payloads);
+KVPacket decode_kv(const uint8_t* header,
+                   size_t len,
+                   const TensorAllocator& alloc,
+                   std::vector<torch::Tensor>* payloads);
+
+} // namespace qwen
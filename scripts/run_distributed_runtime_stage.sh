@@ -23,8 +23,14 @@ LAYER_BEGIN="${LAYER_BEGIN:-}"
 LAYER_END="${LAYER_END:-}"
 
 SEND_KV="${SEND_KV:-0}"
+KV_DELTA="${KV_DELTA:-0}"
+KV_STREAM="${KV_STREAM:-0}"
 RECV_KV="${RECV_KV:-0}"
 KV_RESTORE="${KV_RESTORE:-0}"
+GENERATE="${GENERATE:-}"
+SERVE="${SERVE:-0}"
+TRANSPORT="${TRANSPORT:-}"
+WIRE_CODEC="${WIRE_CODEC:-}"
 
 if [[ ! -x "$BIN" ]]; then
   echo "[stage] missing binary: $BIN"
@@ -57,11 +63,29 @@ fi
 if [[ "$SEND_KV" == "1" ]]; then
   args+=(--send-kv)
 fi
+if [[ "$KV_DELTA" == "1" ]]; then
+  args+=(--kv-delta)
+fi
+if [[ "$KV_STREAM" == "1" ]]; then
+  args+=(--kv-stream)
+fi
 if [[ "$RECV_KV" == "1" ]]; then
   args+=(--recv-kv)
 fi
 if [[ "$KV_RESTORE" == "1" ]]; then
   args+=(--kv-restore)
 fi
+if [[ -n "$GENERATE" ]]; then
+  args+=(--generate "$GENERATE")
+fi
+if [[ "$SERVE" == "1" ]]; then
+  args+=(--serve)
+fi
+if [[ -n "$TRANSPORT" ]]; then
+  args+=(--transport "$TRANSPORT")
+fi
+if [[ -n "$WIRE_CODEC" ]]; then
+  args+=(--wire-codec "$WIRE_CODEC")
+fi
 
 exec "$BIN" "${args[@]}"
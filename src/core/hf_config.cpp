@@ -1,326 +1,18 @@
 #include "core/hf_config.h"
 
-#include <cctype>
+#include "core/json.h"
+
 #include <cstdint>
-#include <fstream>
 #include <limits>
-#include <sstream>
 #include <stdexcept>
 #include <string>
-#include <unordered_map>
-#include <utility>
 #include <vector>
 
 namespace qwen {
 namespace {
 
-struct JsonValue;
-
-using JsonObject = std::unordered_map<std::string, JsonValue>;
-using JsonArray  = std::vector<JsonValue>;
-
-struct JsonValue {
-  enum class Type {
-    Null,
-    Bool,
-    Number,
-    String,
-    Array,
-    Object
-  };
-
-  Type type = Type::Null;
-
-  bool b = false;
-  double n = 0.0;
-  std::string s;
-  JsonArray a;
-  JsonObject o;
-
-  JsonValue() = default;
-
-  static JsonValue make_null() {
-    JsonValue v;
-    v.type = Type::Null;
-    return v;
-  }
-  static JsonValue make_bool(bool x) {
-    JsonValue v;
-    v.type = Type::Bool;
-    v.b = x;
-    return v;
-  }
-  static JsonValue make_number(double x) {
-    JsonValue v;
-    v.type = Type::Number;
-    v.n = x;
-    return v;
-  }
-  static JsonValue make_string(std::string x) {
-    JsonValue v;
-    v.type = Type::String;
-    v.s = std::move(x);
-    return v;
-  }
-  static JsonValue make_array(JsonArray x) {
-    JsonValue v;
-    v.type = Type::Array;
-    v.a = std::move(x);
-    return v;
-  }
-  static JsonValue make_object(JsonObject x) {
-    JsonValue v;
-    v.type = Type::Object;
-    v.o = std::move(x);
-    return v;
-  }
-};
-
-class JsonParser {
-public:
-  explicit JsonParser(std::string src) : src_(std::move(src)) {}
-
-  JsonValue parse_root() {
-    idx_ = 0;
-    skip_ws();
-    JsonValue v = parse_value();
-    skip_ws();
-    if (idx_ != src_.size()) {
-      throw std::runtime_error("hf_config: trailing characters after JSON root");
-    }
-    return v;
-  }
-
-private:
-  void skip_ws() {
-    while (idx_ < src_.size()) {
-      const unsigned char c = static_cast<unsigned char>(src_[idx_]);
-      if (!std::isspace(c)) break;
-      ++idx_;
-    }
-  }
-
-  char peek() const {
-    if (idx_ >= src_.size()) return '\0';
-    return src_[idx_];
-  }
-
-  char get() {
-    if (idx_ >= src_.size()) {
-      throw std::runtime_error("hf_config: unexpected end of input");
-    }
-    return src_[idx_++];
-  }
-
-  void expect(char c) {
-    const char got = get();
-    if (got != c) {
-      std::ostringstream oss;
-      oss << "hf_config: expected '" << c << "' but got '" << got << "'";
-      throw std::runtime_error(oss.str());
-    }
-  }
-
-  JsonValue parse_value() {
-    skip_ws();
-    const char c = peek();
-    if (c == '{') return parse_object();
-    if (c == '[') return parse_array();
-    if (c == '"') return JsonValue::make_string(parse_string());
-    if (c == '-' || (c >= '0' && c <= '9')) return JsonValue::make_number(parse_number());
-    if (starts_with("true"))  { idx_ += 4; return JsonValue::make_bool(true); }
-    if (starts_with("false")) { idx_ += 5; return JsonValue::make_bool(false); }
-    if (starts_with("null"))  { idx_ += 4; return JsonValue::make_null(); }
-
-    std::ostringstream oss;
-    oss << "hf_config: invalid JSON value at offset " << idx_;
-    throw std::runtime_error(oss.str());
-  }
-
-  bool starts_with(const char* lit) const {
-    size_t i = 0;
-    while (lit[i] != '\0') {
-      if (idx_ + i >= src_.size()) return false;
-      if (src_[idx_ + i] != lit[i]) return false;
-      ++i;
-    }
-    return true;
-  }
-
-  std::string parse_string() {
-    expect('"');
-    std::string out;
-    out.reserve(32);
-
-    while (true) {
-      if (idx_ >= src_.size()) {
-        throw std::runtime_error("hf_config: unterminated string");
-      }
-      char c = get();
-      if (c == '"') break;
-
-      if (c == '\\') {
-        if (idx_ >= src_.size()) throw std::runtime_error("hf_config: bad escape");
-        char e = get();
-        switch (e) {
-          case '"': out.push_back('"'); break;
-          case '\\': out.push_back('\\'); break;
-          case '/': out.push_back('/'); break;
-          case 'b': out.push_back('\b'); break;
-          case 'f': out.push_back('\f'); break;
-          case 'n': out.push_back('\n'); break;
-          case 'r': out.push_back('\r'); break;
-          case 't': out.push_back('\t'); break;
-          case 'u': {
-            // Minimal \uXXXX support: we parse the code unit and emit UTF-8 for BMP.
-            // For config files this is typically not needed, but we keep it correct enough.
-            uint32_t code = 0;
-            for (int i = 0; i < 4; ++i) {
-              if (idx_ >= src_.size()) throw std::runtime_error("hf_config: bad unicode escape");
-              const char h = get();
-              code <<= 4;
-              if (h >= '0' && h <= '9') code |= static_cast<uint32_t>(h - '0');
-              else if (h >= 'a' && h <= 'f') code |= static_cast<uint32_t>(h - 'a' + 10);
-              else if (h >= 'A' && h <= 'F') code |= static_cast<uint32_t>(h - 'A' + 10);
-              else throw std::runtime_error("hf_config: bad unicode escape");
-            }
-            append_utf8(out, code);
-            break;
-          }
-          default:
-            throw std::runtime_error("hf_config: unsupported escape sequence");
-        }
-      } else {
-        out.push_back(c);
-      }
-    }
-    return out;
-  }
-
-  static void append_utf8(std::string& out, uint32_t code) {
-    if (code <= 0x7F) {
-      out.push_back(static_cast<char>(code));
-    } else if (code <= 0x7FF) {
-      out.push_back(static_cast<char>(0xC0 | ((code >> 6) & 0x1F)));
-      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
-    } else if (code <= 0xFFFF) {
-      out.push_back(static_cast<char>(0xE0 | ((code >> 12) & 0x0F)));
-      out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
-      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
-    } else {
-      out.push_back(static_cast<char>(0xF0 | ((code >> 18) & 0x07)));
-      out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
-      out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
-      out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
-    }
-  }
-
-  double parse_number() {
-    // JSON number: -?(0|[1-9]\d*)(\.\d+)?([eE][+-]?\d+)?
-    const size_t start = idx_;
-    if (peek() == '-') ++idx_;
-
-    if (idx_ >= src_.size()) throw std::runtime_error("hf_config: bad number");
-    if (src_[idx_] == '0') {
-      ++idx_;
-    } else if (src_[idx_] >= '1' && src_[idx_] <= '9') {
-      while (idx_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[idx_]))) ++idx_;
-    } else {
-      throw std::runtime_error("hf_config: bad number");
-    }
-
-    if (idx_ < src_.size() && src_[idx_] == '.') {
-      ++idx_;
-      if (idx_ >= src_.size() || !std::isdigit(static_cast<unsigned char>(src_[idx_]))) {
-        throw std::runtime_error("hf_config: bad number fraction");
-      }
-      while (idx_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[idx_]))) ++idx_;
-    }
-
-    if (idx_ < src_.size() && (src_[idx_] == 'e' || src_[idx_] == 'E')) {
-      ++idx_;
-      if (idx_ < src_.size() && (src_[idx_] == '+' || src_[idx_] == '-')) ++idx_;
-      if (idx_ >= src_.size() || !std::isdigit(static_cast<unsigned char>(src_[idx_]))) {
-        throw std::runtime_error("hf_config: bad number exponent");
-      }
-      while (idx_ < src_.size() && std::isdigit(static_cast<unsigned char>(src_[idx_]))) ++idx_;
-    }
-
-    const std::string num_str = src_.substr(start, idx_ - start);
-    char* endp = nullptr;
-    const double v = std::strtod(num_str.c_str(), &endp);
-    if (!endp || *endp != '\0') {
-      throw std::runtime_error("hf_config: failed to parse number");
-    }
-    return v;
-  }
-
-  JsonValue parse_array() {
-    expect('[');
-    skip_ws();
-    JsonArray arr;
-    if (peek() == ']') {
-      get();
-      return JsonValue::make_array(std::move(arr));
-    }
-
-    while (true) {
-      skip_ws();
-      arr.push_back(parse_value());
-      skip_ws();
-      const char c = get();
-      if (c == ']') break;
-      if (c != ',') throw std::runtime_error("hf_config: expected ',' or ']' in array");
-    }
-
-    return JsonValue::make_array(std::move(arr));
-  }
-
-  JsonValue parse_object() {
-    expect('{');
-    skip_ws();
-    JsonObject obj;
-    if (peek() == '}') {
-      get();
-      return JsonValue::make_object(std::move(obj));
-    }
-
-    while (true) {
-      skip_ws();
-      if (peek() != '"') throw std::runtime_error("hf_config: expected string key in object");
-      std::string key = parse_string();
-      skip_ws();
-      expect(':');
-      skip_ws();
-      JsonValue val = parse_value();
-      obj.emplace(std::move(key), std::move(val));
-      skip_ws();
-      const char c = get();
-      if (c == '}') break;
-      if (c != ',') throw std::runtime_error("hf_config: expected ',' or '}' in object");
-    }
-
-    return JsonValue::make_object(std::move(obj));
-  }
-
-  std::string src_;
-  size_t idx_ = 0;
-};
-
-static std::string read_text_file(const std::string& path) {
-  std::ifstream in(path, std::ios::in | std::ios::binary);
-  if (!in) {
-    throw std::runtime_error("hf_config: failed to open file: " + path);
-  }
-  std::ostringstream ss;
-  ss << in.rdbuf();
-  return ss.str();
-}
-
 static const JsonValue* obj_get(const JsonObject& o, const std::string& k) {
-  auto it = o.find(k);
-  if (it == o.end()) return nullptr;
-  return &it->second;
+  return json_get(o, k);
 }
 
 static const JsonObject* as_object_ptr(const JsonValue& v) {
@@ -537,6 +229,13 @@ static void apply_text_fields(const JsonObject& root, ModelConfig* cfg) {
       if (as_bool(*v, &b)) cfg->use_qk_norm = b;
     }
   }
+  {
+    const JsonValue* v = obj_get(root, "tie_word_embeddings");
+    if (v) {
+      bool b = false;
+      if (as_bool(*v, &b)) cfg->tie_word_embeddings = b;
+    }
+  }
 
   // Sequence length
   {
@@ -637,8 +336,7 @@ static void apply_root_fields(const JsonObject& root, ModelConfig* cfg) {
 }
 
 static ModelConfig parse_model_config_from_json_text(const std::string& text) {
-  JsonParser p(text);
-  JsonValue root_val = p.parse_root();
+  JsonValue root_val = parse_json(text);
   if (root_val.type != JsonValue::Type::Object) {
     throw std::runtime_error("hf_config: JSON root must be an object");
   }
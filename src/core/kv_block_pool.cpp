@@ -0,0 +1,107 @@
+#include "core/kv_block_pool.h"
+#include "core/tensor_utils.h"
+
+#include <algorithm>
+
+namespace qwen {
+
+KVBlockPool::KVBlockPool(int32_t num_layers,
+                         int32_t block_size,
+                         int32_t kv_heads,
+                         int32_t head_dim,
+                         c10::ScalarType dtype,
+                         int device_index,
+                         int32_t max_blocks)
+    : num_layers_(num_layers),
+      block_size_(block_size),
+      kv_heads_(kv_heads),
+      head_dim_(head_dim),
+      dtype_(dtype),
+      device_index_(device_index),
+      max_blocks_(max_blocks) {
+  require(num_layers_ > 0, "KVBlockPool: num_layers must be > 0");
+  require(block_size_ > 0, "KVBlockPool: block_size must be > 0");
+  require(kv_heads_ > 0, "KVBlockPool: kv_heads must be > 0");
+  require(head_dim_ > 0, "KVBlockPool: head_dim must be > 0");
+  require(max_blocks_ >= 0, "KVBlockPool: max_blocks must be >= 0");
+  k_.resize(num_layers_);
+  v_.resize(num_layers_);
+}
+
+void KVBlockPool::grow(int32_t min_capacity) {
+  const int32_t old_cap = capacity();
+  // A bounded pool is allocated once at its limit so it never copies.
+  int32_t new_cap = max_blocks_ > 0 ? max_blocks_ : std::max(min_capacity, std::max<int32_t>(8, old_cap * 2));
+  require(new_cap >= min_capacity,
+          "KVBlockPool: out of blocks (max_blocks=" + std::to_string(max_blocks_) + ")");
+
+  auto opts = torch::TensorOptions().dtype(dtype_).device(device_for_index(device_index_));
+  for (int32_t l = 0; l < num_layers_; ++l) {
+    auto k = torch::zeros({new_cap, block_size_, kv_heads_, head_dim_}, opts);
+    auto v = torch::zeros({new_cap, block_size_, kv_heads_, head_dim_}, opts);
+    if (old_cap > 0) {
+      k.narrow(0, 0, old_cap).copy_(k_[l]);
+      v.narrow(0, 0, old_cap).copy_(v_[l]);
+    }
+    k_[l] = k;
+    v_[l] = v;
+  }
+
+  refcount_.resize((size_t)new_cap, 0);
+  // Hand out low ids first.
+  for (int32_t b = new_cap - 1; b >= old_cap; --b) free_.push_back(b);
+}
+
+int32_t KVBlockPool::allocate() {
+  if (free_.empty()) grow(capacity() + 1);
+  const int32_t b = free_.back();
+  free_.pop_back();
+  refcount_[b] = 1;
+  return b;
+}
+
+void KVBlockPool::retain(int32_t block) {
+  require(block >= 0 && block < capacity(), "KVBlockPool: block id out of range");
+  require(refcount_[block] > 0, "KVBlockPool: retain of a free block");
+  refcount_[block]++;
+}
+
+void KVBlockPool::release(int32_t block) {
+  require(block >= 0 && block < capacity(), "KVBlockPool: block id out of range");
+  require(refcount_[block] > 0, "KVBlockPool: double free");
+  if (--refcount_[block] == 0) free_.push_back(block);
+}
+
+int32_t KVBlockPool::refcount(int32_t block) const {
+  require(block >= 0 && block < capacity(), "KVBlockPool: block id out of range");
+  return refcount_[block];
+}
+
+void KVBlockPool::copy_block(int32_t dst, int32_t src) {
+  require(dst >= 0 && dst < capacity() && src >= 0 && src < capacity(), "KVBlockPool: block id out of range");
+  for (int32_t l = 0; l < num_layers_; ++l) {
+    k_[l][dst].copy_(k_[l][src]);
+    v_[l][dst].copy_(v_[l][src]);
+  }
+}
+
+torch::Tensor& KVBlockPool::k(int32_t layer) {
+  require(layer >= 0 && layer < num_layers_, "KVBlockPool: layer out of range");
+  return k_[layer];
+}
+
+torch::Tensor& KVBlockPool::v(int32_t layer) {
+  require(layer >= 0 && layer < num_layers_, "KVBlockPool: layer out of range");
+  return v_[layer];
+}
+
+int64_t KVBlockPool::bytes_reserved() const {
+  int64_t total = 0;
+  for (int32_t l = 0; l < num_layers_; ++l) {
+    if (k_[l].defined()) total += (int64_t)k_[l].nbytes();
+    if (v_[l].defined()) total += (int64_t)v_[l].nbytes();
+  }
+  return total;
+}
+
+} // namespace qwen
@@ -1,8 +1,86 @@
 #include "core/kv_cache.h"
 #include "core/tensor_utils.h"
 
+#include <algorithm>
+
 namespace qwen {
 
+int64_t RowPlacement::max_end(int64_t T) const {
+  int64_t end = 0;
+  for (int64_t i = 0; i < (int64_t)positions.size(); ++i) end = std::max(end, positions[(size_t)i] + length(i, T));
+  return end;
+}
+
+KVCache::~KVCache() {
+  release_blocks();
+}
+
+KVCache::KVCache(const KVCache& other)
+    : initialized_(other.initialized_),
+      num_layers_in_stage_(other.num_layers_in_stage_),
+      max_batch_(other.max_batch_),
+      max_seq_len_(other.max_seq_len_),
+      kv_heads_(other.kv_heads_),
+      head_dim_(other.head_dim_),
+      dtype_(other.dtype_),
+      device_index_(other.device_index_),
+      length_(other.length_),
+      layers_(other.layers_),
+      pool_(other.pool_),
+      block_tables_(other.block_tables_) {
+  retain_blocks();
+}
+
+KVCache& KVCache::operator=(const KVCache& other) {
+  if (this == &other) return *this;
+  KVCache tmp(other);
+  *this = std::move(tmp);
+  return *this;
+}
+
+KVCache::KVCache(KVCache&& other) noexcept
+    : initialized_(other.initialized_),
+      num_layers_in_stage_(other.num_layers_in_stage_),
+      max_batch_(other.max_batch_),
+      max_seq_len_(other.max_seq_len_),
+      kv_heads_(other.kv_heads_),
+      head_dim_(other.head_dim_),
+      dtype_(other.dtype_),
+      device_index_(other.device_index_),
+      length_(other.length_),
+      layers_(std::move(other.layers_)),
+      pool_(std::move(other.pool_)),
+      block_tables_(std::move(other.block_tables_)) {
+  other.pool_.reset();
+  other.block_tables_.clear();
+  other.initialized_ = false;
+}
+
+KVCache& KVCache::operator=(KVCache&& other) noexcept {
+  if (this == &other) return *this;
+  release_blocks();
+  initialized_ = other.initialized_;
+  num_layers_in_stage_ = other.num_layers_in_stage_;
+  max_batch_ = other.max_batch_;
+  max_seq_len_ = other.max_seq_len_;
+  kv_heads_ = other.kv_heads_;
+  head_dim_ = other.head_dim_;
+  dtype_ = other.dtype_;
+  device_index_ = other.device_index_;
+  length_ = other.length_;
+  layers_ = std::move(other.layers_);
+  pool_ = std::move(other.pool_);
+  block_tables_ = std::move(other.block_tables_);
+  table_dev_ = torch::Tensor();
+  table_dirty_ = true;
+  slots_dev_ = torch::Tensor();
+  slots_key_[0] = slots_key_[1] = slots_key_[2] = -1;
+  other.pool_.reset();
+  other.block_tables_.clear();
+  other.initialized_ = false;
+  return *this;
+}
+
 void KVCache::init(int32_t num_layers_in_stage,
                    int32_t max_batch,
                    int32_t max_seq_len,
@@ -16,6 +94,10 @@ void KVCache::init(int32_t num_layers_in_stage,
   require(kv_heads > 0, "KVCache: kv_heads must be > 0");
   require(head_dim > 0, "KVCache: head_dim must be > 0");
 
+  release_blocks();
+  pool_.reset();
+  block_tables_.clear();
+
   num_layers_in_stage_ = num_layers_in_stage;
   max_batch_ = max_batch;
   max_seq_len_ = max_seq_len;
@@ -23,11 +105,12 @@ void KVCache::init(int32_t num_layers_in_stage,
   head_dim_ = head_dim;
   dtype_ = dtype;
   device_index_ = device_index;
+  length_ = 0;
 
   layers_.clear();
   layers_.resize(num_layers_in_stage_);
 
-  auto opts = torch::TensorOptions().dtype(dtype_).device(torch::kCUDA, device_index_);
+  auto opts = torch::TensorOptions().dtype(dtype_).device(device_for_index(device_index_));
 
   for (int32_t i = 0; i < num_layers_in_stage_; ++i) {
     layers_[i].k = torch::zeros({max_batch_, kv_heads_, max_seq_len_, head_dim_}, opts);
@@ -37,26 +120,305 @@ void KVCache::init(int32_t num_layers_in_stage,
   initialized_ = true;
 }
 
+void KVCache::init_paged(std::shared_ptr<KVBlockPool> pool, int32_t max_batch, int32_t max_seq_len) {
+  require((bool)pool, "KVCache: pool is null");
+  require(max_batch > 0, "KVCache: max_batch must be > 0");
+  require(max_seq_len > 0, "KVCache: max_seq_len must be > 0");
+
+  release_blocks();
+  layers_.clear();
+
+  pool_ = std::move(pool);
+  num_layers_in_stage_ = pool_->num_layers();
+  max_batch_ = max_batch;
+  max_seq_len_ = max_seq_len;
+  kv_heads_ = pool_->kv_heads();
+  head_dim_ = pool_->head_dim();
+  dtype_ = pool_->dtype();
+  device_index_ = pool_->device_index();
+  length_ = 0;
+
+  block_tables_.assign((size_t)max_batch_, std::vector<int32_t>());
+  table_dirty_ = true;
+  slots_key_[0] = slots_key_[1] = slots_key_[2] = -1;
+
+  initialized_ = true;
+}
+
+void KVCache::release_blocks() {
+  if (!pool_) return;
+  for (auto& table : block_tables_) {
+    for (int32_t b : table) pool_->release(b);
+    table.clear();
+  }
+  table_dirty_ = true;
+  slots_key_[0] = slots_key_[1] = slots_key_[2] = -1;
+}
+
+void KVCache::retain_blocks() {
+  if (!pool_) return;
+  for (const auto& table : block_tables_) {
+    for (int32_t b : table) pool_->retain(b);
+  }
+}
+
 LayerKV& KVCache::layer(int32_t layer_idx) {
   require(initialized_, "KVCache: not initialized");
+  require(!is_paged(), "KVCache: layer() requires dense mode; use keys()/values()");
   require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
   return layers_[layer_idx];
 }
 
 const LayerKV& KVCache::layer(int32_t layer_idx) const {
   require(initialized_, "KVCache: not initialized");
+  require(!is_paged(), "KVCache: layer() requires dense mode; use keys()/values()");
   require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
   return layers_[layer_idx];
 }
 
+const std::vector<int32_t>& KVCache::block_table(int32_t row) const {
+  require(is_paged(), "KVCache: block_table() requires paged mode");
+  require(row >= 0 && row < max_batch_, "KVCache: row out of range");
+  return block_tables_[row];
+}
+
+int64_t KVCache::num_blocks() const {
+  int64_t n = 0;
+  for (const auto& table : block_tables_) n += (int64_t)table.size();
+  return n;
+}
+
 void KVCache::clear_all() {
   if (!initialized_) return;
+  length_ = 0;
+  if (is_paged()) {
+    release_blocks();
+    return;
+  }
   for (auto& l : layers_) {
     if (l.k.defined()) l.k.zero_();
     if (l.v.defined()) l.v.zero_();
   }
 }
 
+void KVCache::clear_row(int32_t row) {
+  require(initialized_, "KVCache: not initialized");
+  require(row >= 0 && row < max_batch_, "KVCache: row out of range");
+  if (!is_paged()) return;
+  auto& table = block_tables_[(size_t)row];
+  if (table.empty()) return;
+  for (int32_t b : table) pool_->release(b);
+  table.clear();
+  table_dirty_ = true;
+  slots_key_[0] = slots_key_[1] = slots_key_[2] = -1;
+}
+
+// Make `row` own writable blocks covering [pos, pos+T): allocate missing
+// blocks and copy any shared block the write range touches. Returns whether
+// the block table changed.
+bool KVCache::ensure_row_blocks(int64_t row, int64_t pos, int64_t T) {
+  const int64_t bs = pool_->block_size();
+  const int64_t first = pos / bs;
+  const int64_t last = (pos + T - 1) / bs;
+  bool changed = false;
+  auto& table = block_tables_[(size_t)row];
+  require((int64_t)table.size() >= first, "KVCache: paged append would leave a gap in the block table");
+  for (int64_t i = first; i <= last; ++i) {
+    if (i == (int64_t)table.size()) {
+      table.push_back(pool_->allocate());
+      changed = true;
+      continue;
+    }
+    const int32_t blk = table[(size_t)i];
+    if (pool_->refcount(blk) > 1) {
+      const int32_t fresh = pool_->allocate();
+      pool_->copy_block(fresh, blk);
+      pool_->release(blk);
+      table[(size_t)i] = fresh;
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+void KVCache::ensure_blocks(int64_t B, int64_t pos, int64_t T) {
+  bool changed = false;
+  for (int64_t b = 0; b < B; ++b) {
+    if (ensure_row_blocks(b, pos, T)) changed = true;
+  }
+  if (changed) {
+    table_dirty_ = true;
+    slots_key_[0] = slots_key_[1] = slots_key_[2] = -1;
+  }
+}
+
+// Flat pool row (block * block_size + offset) for each (b, t), b-major.
+torch::Tensor KVCache::slots_for(int64_t B, int64_t pos, int64_t T) {
+  if (slots_key_[0] == B && slots_key_[1] == pos && slots_key_[2] == T && slots_dev_.defined()) {
+    return slots_dev_;
+  }
+  const int64_t bs = pool_->block_size();
+  auto host = torch::empty({B * T}, torch::TensorOptions().dtype(torch::kInt64));
+  auto* p = host.data_ptr<int64_t>();
+  for (int64_t b = 0; b < B; ++b) {
+    const auto& table = block_tables_[(size_t)b];
+    for (int64_t t = 0; t < T; ++t) {
+      const int64_t q = pos + t;
+      p[b * T + t] = (int64_t)table[(size_t)(q / bs)] * bs + (q % bs);
+    }
+  }
+  slots_dev_ = host.to(device_for_index(device_index_));
+  slots_key_[0] = B;
+  slots_key_[1] = pos;
+  slots_key_[2] = T;
+  return slots_dev_;
+}
+
+// Device copy of the block tables, [max_batch, width >= nblk]; rows shorter
+// than width are padded with block 0.
+void KVCache::refresh_table(int64_t nblk) const {
+  if (!table_dirty_ && table_dev_.defined() && table_dev_.size(1) >= nblk) return;
+  int64_t width = nblk;
+  for (const auto& table : block_tables_) width = std::max(width, (int64_t)table.size());
+  auto host = torch::zeros({(int64_t)max_batch_, width}, torch::TensorOptions().dtype(torch::kInt64));
+  auto acc = host.accessor<int64_t, 2>();
+  for (int64_t b = 0; b < (int64_t)max_batch_; ++b) {
+    const auto& table = block_tables_[(size_t)b];
+    for (int64_t i = 0; i < (int64_t)table.size(); ++i) acc[b][i] = table[(size_t)i];
+  }
+  table_dev_ = host.to(device_for_index(device_index_));
+  table_dirty_ = false;
+}
+
+// table: [B, nblk] block ids -> [B, kv_heads, S, hd].
+torch::Tensor KVCache::gather_blocks(const torch::Tensor& pool, const torch::Tensor& table, int64_t S) const {
+  const int64_t bs = pool_->block_size();
+  const int64_t B = table.size(0);
+  const int64_t nblk = table.size(1);
+  auto blocks = pool.index_select(0, table.reshape({-1}));    // [B*nblk, bs, kv_heads, hd]
+  return blocks.view({B, nblk * bs, kv_heads_, head_dim_})
+      .narrow(1, 0, S)
+      .permute({0, 2, 1, 3})
+      .contiguous();                                          // [B, kv_heads, S, hd]
+}
+
+torch::Tensor KVCache::gather(const torch::Tensor& pool, int64_t B, int64_t S) const {
+  const int64_t nblk = (S + pool_->block_size() - 1) / pool_->block_size();
+  refresh_table(nblk);
+  return gather_blocks(pool, table_dev_.narrow(0, 0, B).narrow(1, 0, nblk), S);
+}
+
+// Only the blocks covering [s0, s0 + n); the result is a strided view of
+// that scratch, [B, kv_heads, n, hd].
+torch::Tensor KVCache::gather_range(const torch::Tensor& pool, int64_t B, int64_t s0, int64_t n) const {
+  const int64_t bs = pool_->block_size();
+  const int64_t first = s0 / bs;
+  const int64_t nblk = (s0 + n - 1) / bs - first + 1;
+  refresh_table(first + nblk);
+  auto ids = table_dev_.narrow(0, 0, B).narrow(1, first, nblk).reshape({-1});
+  return pool.index_select(0, ids)                             // [B*nblk, bs, kv_heads, hd]
+      .view({B, nblk * bs, kv_heads_, head_dim_})
+      .narrow(1, s0 - first * bs, n)
+      .permute({0, 2, 1, 3});
+}
+
+// Rows of a continuous batch may be shorter than S; the padding blocks they
+// read are masked by position in attention.
+torch::Tensor KVCache::gather_rows(const torch::Tensor& pool, const torch::Tensor& rows, int64_t S) const {
+  const int64_t nblk = (S + pool_->block_size() - 1) / pool_->block_size();
+  refresh_table(nblk);
+  return gather_blocks(pool, table_dev_.index_select(0, rows).narrow(1, 0, nblk), S);
+}
+
+torch::Tensor KVCache::rows_tensor(const std::vector<int64_t>& rows) const {
+  auto host = torch::tensor(rows, torch::TensorOptions().dtype(torch::kInt64));
+  return host.to(device_for_index(device_index_));
+}
+
+void KVCache::check_rows(const std::vector<int64_t>& rows, int64_t S) const {
+  require(initialized_, "KVCache: not initialized");
+  require(!rows.empty() && (int64_t)rows.size() <= max_batch_, "KVCache: batch out of range");
+  for (int64_t r : rows) require(r >= 0 && r < max_batch_, "KVCache: row out of range");
+  require(S > 0 && S <= max_seq_len_, "KVCache: length out of range");
+}
+
+torch::Tensor KVCache::keys_rows(int32_t layer_idx, const std::vector<int64_t>& rows, int64_t S) const {
+  require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
+  check_rows(rows, S);
+  auto idx = rows_tensor(rows);
+  if (is_paged()) return gather_rows(pool_->k(layer_idx), idx, S);
+  return layers_[layer_idx].k.narrow(2, 0, S).index_select(0, idx);
+}
+
+torch::Tensor KVCache::values_rows(int32_t layer_idx, const std::vector<int64_t>& rows, int64_t S) const {
+  require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
+  check_rows(rows, S);
+  auto idx = rows_tensor(rows);
+  if (is_paged()) return gather_rows(pool_->v(layer_idx), idx, S);
+  return layers_[layer_idx].v.narrow(2, 0, S).index_select(0, idx);
+}
+
+torch::Tensor KVCache::keys(int32_t layer_idx, int64_t B, int64_t S) const {
+  require(initialized_, "KVCache: not initialized");
+  require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
+  require(B > 0 && B <= max_batch_, "KVCache: batch out of range");
+  require(S > 0 && S <= max_seq_len_, "KVCache: length out of range");
+  if (is_paged()) return gather(pool_->k(layer_idx), B, S);
+  return layers_[layer_idx].k.index({torch::indexing::Slice(0, B),
+                                     torch::indexing::Slice(),
+                                     torch::indexing::Slice(0, S),
+                                     torch::indexing::Slice()}).contiguous();
+}
+
+torch::Tensor KVCache::values(int32_t layer_idx, int64_t B, int64_t S) const {
+  require(initialized_, "KVCache: not initialized");
+  require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
+  require(B > 0 && B <= max_batch_, "KVCache: batch out of range");
+  require(S > 0 && S <= max_seq_len_, "KVCache: length out of range");
+  if (is_paged()) return gather(pool_->v(layer_idx), B, S);
+  return layers_[layer_idx].v.index({torch::indexing::Slice(0, B),
+                                     torch::indexing::Slice(),
+                                     torch::indexing::Slice(0, S),
+                                     torch::indexing::Slice()}).contiguous();
+}
+
+torch::Tensor KVCache::keys_view(int32_t layer_idx, int64_t B, int64_t S) const {
+  if (is_paged()) return keys(layer_idx, B, S);
+  require(initialized_, "KVCache: not initialized");
+  require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
+  require(B > 0 && B <= max_batch_, "KVCache: batch out of range");
+  require(S > 0 && S <= max_seq_len_, "KVCache: length out of range");
+  return layers_[layer_idx].k.narrow(0, 0, B).narrow(2, 0, S);
+}
+
+torch::Tensor KVCache::values_view(int32_t layer_idx, int64_t B, int64_t S) const {
+  if (is_paged()) return values(layer_idx, B, S);
+  require(initialized_, "KVCache: not initialized");
+  require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
+  require(B > 0 && B <= max_batch_, "KVCache: batch out of range");
+  require(S > 0 && S <= max_seq_len_, "KVCache: length out of range");
+  return layers_[layer_idx].v.narrow(0, 0, B).narrow(2, 0, S);
+}
+
+void KVCache::check_range(int32_t layer_idx, int64_t B, int64_t s0, int64_t n) const {
+  require(initialized_, "KVCache: not initialized");
+  require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
+  require(B > 0 && B <= max_batch_, "KVCache: batch out of range");
+  require(s0 >= 0 && n > 0 && s0 + n <= max_seq_len_, "KVCache: range out of bounds");
+}
+
+torch::Tensor KVCache::keys_range(int32_t layer_idx, int64_t B, int64_t s0, int64_t n) const {
+  check_range(layer_idx, B, s0, n);
+  if (is_paged()) return gather_range(pool_->k(layer_idx), B, s0, n);
+  return layers_[layer_idx].k.narrow(0, 0, B).narrow(2, s0, n);
+}
+
+torch::Tensor KVCache::values_range(int32_t layer_idx, int64_t B, int64_t s0, int64_t n) const {
+  check_range(layer_idx, B, s0, n);
+  if (is_paged()) return gather_range(pool_->v(layer_idx), B, s0, n);
+  return layers_[layer_idx].v.narrow(0, 0, B).narrow(2, s0, n);
+}
+
 void KVCache::append(int32_t layer_idx,
                      const torch::Tensor& new_k,
                      const torch::Tensor& new_v,
@@ -66,7 +428,8 @@ void KVCache::append(int32_t layer_idx,
   require(pos >= 0, "KVCache: pos must be >= 0");
 
   require(new_k.defined() && new_v.defined(), "KVCache: new_k/new_v must be defined");
-  require(new_k.is_cuda() && new_v.is_cuda(), "KVCache: new_k/new_v must be CUDA");
+  require(new_k.device() == device_for_index(device_index_) && new_v.device() == new_k.device(),
+          "KVCache: new_k/new_v must be on the cache device");
   require(new_k.scalar_type() == dtype_ && new_v.scalar_type() == dtype_, "KVCache: dtype mismatch");
 
   require(new_k.dim() == 4 && new_v.dim() == 4, "KVCache: new_k/new_v must be [B, kv_heads, T, head_dim]");
@@ -80,6 +443,18 @@ void KVCache::append(int32_t layer_idx,
   const int64_t T = new_k.size(2);
 
   require(pos + T <= max_seq_len_, "KVCache: append would exceed max_seq_len");
+  length_ = std::max(length_, pos + T);
+
+  if (is_paged()) {
+    ensure_blocks(B, pos, T);
+    auto slots = slots_for(B, pos, T);
+    const int64_t rows = (int64_t)pool_->capacity() * pool_->block_size();
+    auto k_flat = pool_->k(layer_idx).view({rows, kv_heads_, head_dim_});
+    auto v_flat = pool_->v(layer_idx).view({rows, kv_heads_, head_dim_});
+    k_flat.index_copy_(0, slots, new_k.permute({0, 2, 1, 3}).reshape({B * T, kv_heads_, head_dim_}));
+    v_flat.index_copy_(0, slots, new_v.permute({0, 2, 1, 3}).reshape({B * T, kv_heads_, head_dim_}));
+    return;
+  }
 
   auto& l = layers_[layer_idx];
 
@@ -97,4 +472,99 @@ void KVCache::append(int32_t layer_idx,
   dst_v.copy_(new_v);
 }
 
+void KVCache::append_rows(int32_t layer_idx,
+                          const torch::Tensor& new_k,
+                          const torch::Tensor& new_v,
+                          const RowPlacement& place) {
+  require(initialized_, "KVCache: not initialized");
+  require(layer_idx >= 0 && layer_idx < num_layers_in_stage_, "KVCache: layer_idx out of range");
+  require(new_k.defined() && new_v.defined(), "KVCache: new_k/new_v must be defined");
+  require(new_k.device() == device_for_index(device_index_) && new_v.device() == new_k.device(),
+          "KVCache: new_k/new_v must be on the cache device");
+  require(new_k.scalar_type() == dtype_ && new_v.scalar_type() == dtype_, "KVCache: dtype mismatch");
+  require(new_k.dim() == 4 && new_v.dim() == 4, "KVCache: new_k/new_v must be [B, kv_heads, T, head_dim]");
+  require(new_k.size(1) == kv_heads_, "KVCache: kv_heads mismatch");
+  require(new_k.size(3) == head_dim_, "KVCache: head_dim mismatch");
+  require(new_v.sizes() == new_k.sizes(), "KVCache: new_v shape mismatch vs new_k");
+
+  const int64_t B = new_k.size(0);
+  const int64_t T = new_k.size(2);
+  const int64_t N = place.num_segments();
+  require((int64_t)place.positions.size() == N, "KVCache: placement must have one position per row");
+  if (place.packed()) {
+    require(B == 1, "KVCache: packed placement expects a single batch row");
+    require((int64_t)place.cu_seqlens.size() == N + 1 && place.cu_seqlens.front() == 0 &&
+                place.cu_seqlens.back() == T,
+            "KVCache: cu_seqlens must be [N+1] from 0 to T");
+  } else {
+    require(N == B, "KVCache: placement must have one row per batch row");
+  }
+  for (int64_t i = 0; i < N; ++i) {
+    require(place.rows[(size_t)i] >= 0 && place.rows[(size_t)i] < max_batch_, "KVCache: row out of range");
+    require(place.positions[(size_t)i] >= 0, "KVCache: pos must be >= 0");
+    require(place.length(i, T) >= 0, "KVCache: cu_seqlens must be non-decreasing");
+    require(place.positions[(size_t)i] + place.length(i, T) <= max_seq_len_,
+            "KVCache: append would exceed max_seq_len");
+  }
+  length_ = std::max(length_, place.max_end(T));
+
+  // Destination of every new token in flattened b-major order: segment i's
+  // tokens go to row rows[i] at positions[i], positions[i] + 1, ...
+  const int64_t total = B * T;
+  auto host = torch::empty({total}, torch::TensorOptions().dtype(torch::kInt64));
+  auto* p = host.data_ptr<int64_t>();
+  const auto k_rows = new_k.permute({0, 2, 1, 3}).reshape({total, kv_heads_, head_dim_});
+  const auto v_rows = new_v.permute({0, 2, 1, 3}).reshape({total, kv_heads_, head_dim_});
+
+  if (is_paged()) {
+    bool changed = false;
+    for (int64_t i = 0; i < N; ++i) {
+      const int64_t len = place.length(i, T);
+      if (len > 0 && ensure_row_blocks(place.rows[(size_t)i], place.positions[(size_t)i], len)) changed = true;
+    }
+    if (changed) {
+      table_dirty_ = true;
+      slots_key_[0] = slots_key_[1] = slots_key_[2] = -1;
+    }
+    const int64_t bs = pool_->block_size();
+    for (int64_t i = 0; i < N; ++i) {
+      const auto& table = block_tables_[(size_t)place.rows[(size_t)i]];
+      const int64_t off = place.offset(i, T);
+      for (int64_t t = 0; t < place.length(i, T); ++t) {
+        const int64_t q = place.positions[(size_t)i] + t;
+        p[off + t] = (int64_t)table[(size_t)(q / bs)] * bs + (q % bs);
+      }
+    }
+    auto slots = host.to(device_for_index(device_index_));
+    const int64_t rows = (int64_t)pool_->capacity() * bs;
+    pool_->k(layer_idx).view({rows, kv_heads_, head_dim_}).index_copy_(0, slots, k_rows);
+    pool_->v(layer_idx).view({rows, kv_heads_, head_dim_}).index_copy_(0, slots, v_rows);
+    return;
+  }
+
+  // Dense: (row, position) pairs index the [max_batch, kv_heads, max_seq, hd]
+  // buffer directly; the indexed view is [total, kv_heads, hd].
+  auto row_host = torch::empty({total}, torch::TensorOptions().dtype(torch::kInt64));
+  auto* r = row_host.data_ptr<int64_t>();
+  for (int64_t i = 0; i < N; ++i) {
+    const int64_t off = place.offset(i, T);
+    for (int64_t t = 0; t < place.length(i, T); ++t) {
+      r[off + t] = place.rows[(size_t)i];
+      p[off + t] = place.positions[(size_t)i] + t;
+    }
+  }
+  const auto device = device_for_index(device_index_);
+  auto row_idx = row_host.to(device);
+  auto pos_idx = host.to(device);
+  auto& l = layers_[layer_idx];
+  l.k.index_put_({row_idx, torch::indexing::Slice(), pos_idx}, k_rows);
+  l.v.index_put_({row_idx, torch::indexing::Slice(), pos_idx}, v_rows);
+}
+
+KVCache KVCache::fork() const {
+  require(initialized_, "KVCache: not initialized");
+  require(is_paged(), "KVCache: fork() requires paged mode");
+  return KVCache(*this);
+}
+
 } // namespace qwen
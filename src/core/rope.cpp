@@ -11,7 +11,7 @@ static torch::Tensor build_inv_freq(int64_t rope_dim, double theta, int device_i
 
   auto opts = torch::TensorOptions()
                   .dtype(torch::kFloat32)
-                  .device(torch::kCUDA, device_index);
+                  .device(device_for_index(device_index));
 
   // inv_freq[i] = 1 / (theta^(2i/rope_dim))
   auto i = torch::arange(0, half, opts);
@@ -32,7 +32,7 @@ RopeTables precompute_cos_sin(int64_t seq_len,
   auto inv_freq = build_inv_freq(rope_dim, theta, device_index); // [half]
   auto t_opts = torch::TensorOptions()
                     .dtype(torch::kFloat32)
-                    .device(torch::kCUDA, device_index);
+                    .device(device_for_index(device_index));
 
   auto t = torch::arange(0, seq_len, t_opts);      // [T]
   auto freqs = torch::einsum("t,f->tf", {t, inv_freq}); // [T, half]
@@ -62,11 +62,13 @@ static void rope_rotate_inplace(torch::Tensor x,
                                 const torch::Tensor& sin_t,
                                 int64_t rope_dim) {
   // x: [B, H, T, D]
-  // cos_t/sin_t: [T, rope_dim]
+  // cos_t/sin_t: [T, rope_dim], or [B, T, rope_dim] for per-row positions
   require(x.dim() == 4, "apply_rope expects x dim == 4");
-  require(cos_t.dim() == 2 && sin_t.dim() == 2, "cos/sin must be [T, rope_dim]");
-  require(cos_t.size(1) == rope_dim && sin_t.size(1) == rope_dim, "rope_dim mismatch");
-  require(x.size(2) == cos_t.size(0), "T mismatch between x and cos/sin");
+  require((cos_t.dim() == 2 || cos_t.dim() == 3) && sin_t.dim() == cos_t.dim(),
+          "cos/sin must be [T, rope_dim] or [B, T, rope_dim]");
+  require(cos_t.size(-1) == rope_dim && sin_t.size(-1) == rope_dim, "rope_dim mismatch");
+  require(x.size(2) == cos_t.size(-2), "T mismatch between x and cos/sin");
+  require(cos_t.dim() == 2 || cos_t.size(0) == x.size(0), "B mismatch between x and cos/sin");
   require((rope_dim % 2) == 0, "rope_dim must be even");
   require(x.size(3) >= rope_dim, "head_dim must be >= rope_dim");
 
@@ -83,12 +85,16 @@ static void rope_rotate_inplace(torch::Tensor x,
   auto x2 = x_pair.select(-1, 1); // [B,H,T,half]
 
   // cos/sin half are the even positions
-  auto cos_half = cos_t.index({torch::indexing::Slice(), torch::indexing::Slice(0, rope_dim, 2)}); // [T,half]
-  auto sin_half = sin_t.index({torch::indexing::Slice(), torch::indexing::Slice(0, rope_dim, 2)}); // [T,half]
+  auto cos_half = cos_t.index({torch::indexing::Ellipsis, torch::indexing::Slice(0, rope_dim, 2)}); // [(B,)T,half]
+  auto sin_half = sin_t.index({torch::indexing::Ellipsis, torch::indexing::Slice(0, rope_dim, 2)}); // [(B,)T,half]
 
-  // Broadcast to [1,1,T,half]
-  cos_half = cos_half.unsqueeze(0).unsqueeze(0);
-  sin_half = sin_half.unsqueeze(0).unsqueeze(0);
+  // Broadcast to [1,1,T,half] or [B,1,T,half]
+  if (cos_half.dim() == 2) {
+    cos_half = cos_half.unsqueeze(0);
+    sin_half = sin_half.unsqueeze(0);
+  }
+  cos_half = cos_half.unsqueeze(1);
+  sin_half = sin_half.unsqueeze(1);
 
   // Rotate
   // y1 = x1*cos - x2*sin
@@ -106,7 +112,8 @@ void apply_rope_inplace(torch::Tensor q,
                         const RopeTables& tables,
                         int64_t start_pos) {
   require(q.defined() && k.defined(), "q/k must be defined");
-  require(q.is_cuda() && k.is_cuda(), "q/k must be CUDA tensors");
+  require(q.device() == k.device(), "q/k must be on the same device");
+  require(q.device() == tables.cos.device(), "q/k must be on the rope tables device");
   require(q.scalar_type() == tables.cos.scalar_type(), "q dtype must match rope tables dtype");
   require(k.scalar_type() == tables.cos.scalar_type(), "k dtype must match rope tables dtype");
   require(q.dim() == 4 && k.dim() == 4, "q/k must be [B,H,T,D]");
@@ -127,4 +134,31 @@ void apply_rope_inplace(torch::Tensor q,
   rope_rotate_inplace(k, cos_t, sin_t, rope_dim);
 }
 
+void apply_rope_inplace(torch::Tensor q,
+                        torch::Tensor k,
+                        const RopeTables& tables,
+                        const torch::Tensor& position_ids) {
+  require(q.defined() && k.defined(), "q/k must be defined");
+  require(q.device() == k.device(), "q/k must be on the same device");
+  require(q.device() == tables.cos.device(), "q/k must be on the rope tables device");
+  require(q.scalar_type() == tables.cos.scalar_type(), "q dtype must match rope tables dtype");
+  require(k.scalar_type() == tables.cos.scalar_type(), "k dtype must match rope tables dtype");
+  require(q.dim() == 4 && k.dim() == 4, "q/k must be [B,H,T,D]");
+  require(q.size(2) == k.size(2), "q/k must have same T");
+  require(q.size(3) == k.size(3), "q/k must have same D");
+  require(position_ids.defined() && position_ids.dim() == 2, "position_ids must be [B, T]");
+  require(position_ids.size(0) == q.size(0) && position_ids.size(1) == q.size(2),
+          "position_ids must match q [B, T]");
+
+  const int64_t B = position_ids.size(0);
+  const int64_t T = position_ids.size(1);
+  const int64_t rope_dim = tables.rope_dim;
+  auto ids = position_ids.to(tables.cos.device(), torch::kInt64).reshape({-1});
+  auto cos_t = tables.cos.index_select(0, ids).view({B, T, rope_dim});
+  auto sin_t = tables.sin.index_select(0, ids).view({B, T, rope_dim});
+
+  rope_rotate_inplace(q, cos_t, sin_t, rope_dim);
+  rope_rotate_inplace(k, cos_t, sin_t, rope_dim);
+}
+
 } // namespace qwen
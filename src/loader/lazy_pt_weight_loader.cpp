@@ -0,0 +1,123 @@
+#include <loader/lazy_pt_weight_loader.h>
+
+#include <torch/csrc/jit/serialization/import_read.h>
+#include <torch/csrc/jit/serialization/storage_context.h>
+#include <caffe2/serialize/inline_container.h>
+
+#include <c10/util/Exception.h>
+
+#include <sstream>
+#include <stdexcept>
+#include <tuple>
+
+namespace qwen {
+
+namespace {
+
+constexpr const char* kDataPrefix = "data/";
+
+} // namespace
+
+LazyPtWeightLoader::LazyPtWeightLoader(std::string weights_path)
+    : weights_path_(std::move(weights_path)) {
+  try {
+    reader_ = std::make_unique<caffe2::serialize::PyTorchStreamReader>(weights_path_);
+
+    // Pre-register an empty storage for every data/<id> record. The unpickler
+    // takes storages from the context instead of reading the record, so the
+    // tensors it returns carry metadata only; the storage identity maps each
+    // one back to its record.
+    auto context = std::make_shared<torch::jit::DeserializationStorageContext>();
+    std::unordered_map<const c10::StorageImpl*, std::string> record_of;
+    const std::string prefix = kDataPrefix;
+    for (const auto& r : reader_->getAllRecords()) {
+      if (r.size() <= prefix.size() || r.compare(0, prefix.size(), prefix) != 0) continue;
+      const std::string id = r.substr(prefix.size());
+      c10::Storage placeholder(c10::Storage::use_byte_size_t(),
+                               0,
+                               c10::DataPtr(nullptr, c10::Device(c10::kCPU)),
+                               /*allocator=*/nullptr,
+                               /*resizable=*/false);
+      record_of[placeholder.unsafeGetStorageImpl()] = id;
+      context->addStorage(id, std::move(placeholder));
+    }
+
+    auto iv = torch::jit::readArchiveAndTensors(
+        "",
+        "data",
+        kDataPrefix,
+        std::nullopt,
+        std::nullopt,
+        c10::Device(c10::kCPU),
+        *reader_,
+        torch::jit::Unpickler::defaultTypeParser,
+        context);
+
+    if (!iv.isGenericDict()) {
+      throw std::runtime_error("packed data is not a dict");
+    }
+    for (const auto& item : iv.toGenericDict()) {
+      if (!item.key().isString() || !item.value().isTensor()) continue;
+      const torch::Tensor t = item.value().toTensor();
+      auto it = record_of.find(t.storage().unsafeGetStorageImpl());
+      if (it == record_of.end()) continue;
+      Entry e;
+      e.record = it->second;
+      e.dtype = t.scalar_type();
+      e.sizes = t.sizes().vec();
+      e.strides = t.strides().vec();
+      e.storage_offset = t.storage_offset();
+      entries_[item.key().toStringRef()] = std::move(e);
+    }
+    if (entries_.empty()) {
+      throw std::runtime_error("packed dict contained no tensor entries");
+    }
+  } catch (const c10::Error& e) {
+    std::ostringstream oss;
+    oss << "LazyPtWeightLoader: failed to index '" << weights_path_ << "': " << e.what_without_backtrace();
+    throw std::runtime_error(oss.str());
+  } catch (const std::exception& e) {
+    std::ostringstream oss;
+    oss << "LazyPtWeightLoader: failed to index '" << weights_path_ << "': " << e.what();
+    throw std::runtime_error(oss.str());
+  }
+}
+
+LazyPtWeightLoader::~LazyPtWeightLoader() = default;
+
+bool LazyPtWeightLoader::exists(const std::string& key) const {
+  return entries_.find(key) != entries_.end();
+}
+
+torch::Tensor LazyPtWeightLoader::get(const std::string& key) const {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    throw std::runtime_error("WeightLoader: missing key: " + key);
+  }
+  const Entry& e = it->second;
+
+  at::DataPtr data;
+  size_t nbytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(reader_mu_);
+    std::tie(data, nbytes) = reader_->getRecord(std::string(kDataPrefix) + e.record);
+  }
+  bytes_read_ += (int64_t)nbytes;
+
+  c10::Storage storage(c10::Storage::use_byte_size_t(),
+                       nbytes,
+                       std::move(data),
+                       /*allocator=*/nullptr,
+                       /*resizable=*/false);
+  return torch::empty({0}, torch::TensorOptions().dtype(e.dtype))
+      .set_(storage, e.storage_offset, e.sizes, e.strides);
+}
+
+std::vector<std::string> LazyPtWeightLoader::list_keys() const {
+  std::vector<std::string> ks;
+  ks.reserve(entries_.size());
+  for (const auto& kv : entries_) ks.push_back(kv.first);
+  return ks;
+}
+
+} // namespace qwen
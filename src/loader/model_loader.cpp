@@ -1,9 +1,15 @@
 #include "loader/model_loader.h"
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <functional>
 #include <sstream>
+#include <thread>
 
 #include "core/tensor_utils.h"
+#include "loader/stage_shard.h"
 
 namespace qwen {
 namespace {
@@ -12,6 +18,23 @@ static void record_used(LoadReport* rep, const std::string& key) {
   if (rep) rep->used_keys.push_back(key);
 }
 
+// src in param's dtype and on its device. When the target is a GPU and the
+// checkpoint dtype is no wider, the raw tensor crosses the bus and the GPU
+// converts it.
+static torch::Tensor place_like(const torch::Tensor& src, const torch::Tensor& param) {
+  torch::Tensor t = src;
+  if (t.device() != param.device() && param.device().is_cuda() && t.element_size() <= param.element_size()) {
+    t = t.to(param.device());
+  }
+  if (t.scalar_type() != param.scalar_type()) {
+    t = t.to(param.scalar_type());
+  }
+  if (t.device() != param.device()) {
+    t = t.to(param.device());
+  }
+  return t;
+}
+
 static bool try_assign_param(const WeightLoader& wl,
                              const std::string& key,
                              torch::Tensor& param,
@@ -28,6 +51,7 @@ static bool try_assign_param(const WeightLoader& wl,
 
   torch::Tensor src = wl.get(key);
   record_used(rep, key);
+  if (rep) rep->bytes += (int64_t)src.nbytes();
 
   if (!param.defined()) {
     if (rep) {
@@ -38,12 +62,7 @@ static bool try_assign_param(const WeightLoader& wl,
     return false;
   }
 
-  if (src.scalar_type() != param.scalar_type()) {
-    src = src.to(param.scalar_type());
-  }
-  if (src.device() != param.device()) {
-    src = src.to(param.device());
-  }
+  src = place_like(src, param);
   if (!src.is_contiguous()) {
     src = src.contiguous();
   }
@@ -68,13 +87,7 @@ static bool try_assign_linear_transpose(const torch::Tensor& src,
                                         LoadReport* rep,
                                         const std::string& key,
                                         bool strict) {
-  torch::Tensor t = src;
-  if (t.scalar_type() != param.scalar_type()) {
-    t = t.to(param.scalar_type());
-  }
-  if (t.device() != param.device()) {
-    t = t.to(param.device());
-  }
+  torch::Tensor t = place_like(src, param);
   if (!t.is_contiguous()) {
     t = t.contiguous();
   }
@@ -126,69 +139,95 @@ static bool try_load_gate_up_combined(const torch::Tensor& gate_up,
   return false;
 }
 
-} // namespace
-
-bool load_stage_weights(ModelStage& stage,
-                        const WeightLoader& wl,
-                        const ModelConfig& cfg,
-                        LoadReport* rep,
-                        const LoadOptions& opts) {
-  const std::string lm_prefix = "model.language_model";
-  const bool strict = opts.strict;
+// Stacked expert tensors: accept the runtime layout as-is, or the HF layout
+// with the last two dims swapped ([E, D, 2I] / [E, I, D]).
+static bool try_assign_stacked(const torch::Tensor& src,
+                               torch::Tensor& param,
+                               LoadReport* rep,
+                               const std::string& key,
+                               bool strict) {
+  torch::Tensor t = place_like(src, param);
 
-  if ((bool)stage->embedding()) {
-    try_assign_param(wl, lm_prefix + ".embed_tokens.weight", stage->embedding()->weight(), rep, true, strict);
+  if (t.sizes() == param.sizes()) {
+    param.detach().copy_(t);
+    if (rep) rep->loaded++;
+    return true;
+  }
+  if (t.dim() == 3 && t.transpose(1, 2).sizes() == param.sizes()) {
+    param.detach().copy_(t.transpose(1, 2));
+    if (rep) rep->loaded++;
+    return true;
+  }
+  if (rep) {
+    rep->mismatched++;
+    std::ostringstream oss;
+    oss << key << ": expected " << qwen::shape_str(param) << " got " << qwen::shape_str(src);
+    rep->mismatch_keys.push_back(oss.str());
   }
+  if (strict) throw std::runtime_error("load: shape mismatch for " + key);
+  return false;
+}
 
-  for (size_t i = 0; i < stage->blocks().size(); ++i) {
-    const int32_t layer = cfg.layer_start + static_cast<int32_t>(i);
-    const std::string base = lm_prefix + ".layers." + std::to_string(layer);
-    auto& blk = stage->blocks()[i];
+// One transformer block: every tensor of `layer` into `blk`.
+static void load_block(const WeightLoader& wl,
+                       const ModelConfig& cfg,
+                       TransformerBlock& blk,
+                       int32_t layer,
+                       LoadReport* rep,
+                       bool strict) {
+  const std::string lm_prefix = "model.language_model";
+  const std::string base = lm_prefix + ".layers." + std::to_string(layer);
 
-    try_assign_param(wl, base + ".input_layernorm.weight", blk->ln1()->weight(), rep, true, strict);
-    try_assign_param(wl, base + ".post_attention_layernorm.weight", blk->ln2()->weight(), rep, true, strict);
+  try_assign_param(wl, base + ".input_layernorm.weight", blk->ln1()->weight(), rep, true, strict);
+  try_assign_param(wl, base + ".post_attention_layernorm.weight", blk->ln2()->weight(), rep, true, strict);
 
-    auto& attn = blk->attn();
-    try_assign_param(wl, base + ".self_attn.q_proj.weight", attn->wq(), rep, true, strict);
-    try_assign_param(wl, base + ".self_attn.k_proj.weight", attn->wk(), rep, true, strict);
-    try_assign_param(wl, base + ".self_attn.v_proj.weight", attn->wv(), rep, true, strict);
-    try_assign_param(wl, base + ".self_attn.o_proj.weight", attn->wo(), rep, true, strict);
+  auto& attn = blk->attn();
+  try_assign_param(wl, base + ".self_attn.q_proj.weight", attn->wq(), rep, true, strict);
+  try_assign_param(wl, base + ".self_attn.k_proj.weight", attn->wk(), rep, true, strict);
+  try_assign_param(wl, base + ".self_attn.v_proj.weight", attn->wv(), rep, true, strict);
+  try_assign_param(wl, base + ".self_attn.o_proj.weight", attn->wo(), rep, true, strict);
 
-    if (cfg.use_qk_norm) {
+  if (cfg.use_qk_norm) {
+    attn->enable_qk_norm(true);
+    try_assign_param(wl, base + ".self_attn.q_norm.weight", attn->q_norm()->weight(), rep, true, strict);
+    try_assign_param(wl, base + ".self_attn.k_norm.weight", attn->k_norm()->weight(), rep, true, strict);
+  } else {
+    if (wl.exists(base + ".self_attn.q_norm.weight")) {
       attn->enable_qk_norm(true);
       try_assign_param(wl, base + ".self_attn.q_norm.weight", attn->q_norm()->weight(), rep, true, strict);
+    }
+    if (wl.exists(base + ".self_attn.k_norm.weight")) {
+      attn->enable_qk_norm(true);
       try_assign_param(wl, base + ".self_attn.k_norm.weight", attn->k_norm()->weight(), rep, true, strict);
-    } else {
-      if (wl.exists(base + ".self_attn.q_norm.weight")) {
-        attn->enable_qk_norm(true);
-        try_assign_param(wl, base + ".self_attn.q_norm.weight", attn->q_norm()->weight(), rep, true, strict);
-      }
-      if (wl.exists(base + ".self_attn.k_norm.weight")) {
-        attn->enable_qk_norm(true);
-        try_assign_param(wl, base + ".self_attn.k_norm.weight", attn->k_norm()->weight(), rep, true, strict);
-      }
     }
+  }
 
-    auto& moe = blk->moe();
-    if (moe->is_moe_layer()) {
-      try_assign_param(wl, base + ".mlp.gate.weight", moe->router_w(), rep, true, strict);
+  auto& moe = blk->moe();
+  if (moe->is_moe_layer()) {
+    try_assign_param(wl, base + ".mlp.gate.weight", moe->router_w(), rep, true, strict);
 
-      const std::string gate_up_key = base + ".mlp.experts.gate_up_proj";
-      const std::string down_key = base + ".mlp.experts.down_proj";
+    const std::string gate_up_key = base + ".mlp.experts.gate_up_proj";
+    const std::string down_key = base + ".mlp.experts.down_proj";
 
-      if (!wl.exists(gate_up_key) || !wl.exists(down_key)) {
-        if (rep) {
-          if (!wl.exists(gate_up_key)) { rep->missing++; rep->missing_keys.push_back(gate_up_key); }
-          if (!wl.exists(down_key)) { rep->missing++; rep->missing_keys.push_back(down_key); }
-        }
-        if (strict) throw std::runtime_error("load: missing MoE expert tensors at " + base);
-      } else {
-        auto gate_up = wl.get(gate_up_key);
-        auto down = wl.get(down_key);
-        record_used(rep, gate_up_key);
-        record_used(rep, down_key);
+    if (!wl.exists(gate_up_key) || !wl.exists(down_key)) {
+      if (rep) {
+        if (!wl.exists(gate_up_key)) { rep->missing++; rep->missing_keys.push_back(gate_up_key); }
+        if (!wl.exists(down_key)) { rep->missing++; rep->missing_keys.push_back(down_key); }
+      }
+      if (strict) throw std::runtime_error("load: missing MoE expert tensors at " + base);
+    } else {
+      auto gate_up = wl.get(gate_up_key);
+      auto down = wl.get(down_key);
+      record_used(rep, gate_up_key);
+      record_used(rep, down_key);
+      if (rep) rep->bytes += (int64_t)(gate_up.nbytes() + down.nbytes());
 
-        const int32_t E = cfg.num_experts;
+      const int32_t E = cfg.num_experts;
+      if (moe->stacked_experts()) {
+        // Stacked storage keeps the 3D tensors whole: one copy per key.
+        try_assign_stacked(gate_up, moe->gate_up_proj(), rep, gate_up_key, strict);
+        try_assign_stacked(down, moe->down_proj(), rep, down_key, strict);
+      } else {
         if (gate_up.dim() == 3 && gate_up.size(0) == E) {
           for (int32_t e = 0; e < E; ++e) {
             auto& ex = moe->expert(e);
@@ -219,24 +258,166 @@ bool load_stage_weights(ModelStage& stage,
           }
         }
       }
-    } else {
-      auto& ex = moe->expert(0);
-      const std::string gate_key = base + ".mlp.gate_proj.weight";
-      const std::string up_key = base + ".mlp.up_proj.weight";
-      const std::string down_key = base + ".mlp.down_proj.weight";
-      try_assign_param(wl, gate_key, ex->gate_proj->weight, rep, true, strict);
-      try_assign_param(wl, up_key, ex->up_proj->weight, rep, true, strict);
-      try_assign_param(wl, down_key, ex->down_proj->weight, rep, true, strict);
     }
+  } else {
+    auto& ex = moe->expert(0);
+    const std::string gate_key = base + ".mlp.gate_proj.weight";
+    const std::string up_key = base + ".mlp.up_proj.weight";
+    const std::string down_key = base + ".mlp.down_proj.weight";
+    try_assign_param(wl, gate_key, ex->gate_proj->weight, rep, true, strict);
+    try_assign_param(wl, up_key, ex->up_proj->weight, rep, true, strict);
+    try_assign_param(wl, down_key, ex->down_proj->weight, rep, true, strict);
+  }
+}
+
+static void merge_report(LoadReport* dst, const LoadReport& src) {
+  dst->loaded += src.loaded;
+  dst->missing += src.missing;
+  dst->mismatched += src.mismatched;
+  dst->skipped += src.skipped;
+  dst->bytes += src.bytes;
+  auto append = [](std::vector<std::string>& d, const std::vector<std::string>& s) { d.insert(d.end(), s.begin(), s.end()); };
+  append(dst->missing_keys, src.missing_keys);
+  append(dst->mismatch_keys, src.mismatch_keys);
+  append(dst->skipped_keys, src.skipped_keys);
+  append(dst->used_keys, src.used_keys);
+}
+
+// Stage shards are already in the runtime layout: match parameters by module
+// path and copy, no key mapping or conversion.
+static void load_stage_shard(ModelStage& stage,
+                             const WeightLoader& wl,
+                             const ModelConfig& cfg,
+                             const StageShardInfo& info,
+                             LoadReport* rep,
+                             bool strict) {
+  if (info.layer_start != cfg.layer_start || info.layer_end != cfg.layer_end) {
+    std::ostringstream oss;
+    oss << "load: stage shard holds layers [" << info.layer_start << ", " << info.layer_end
+        << ") but this stage runs [" << cfg.layer_start << ", " << cfg.layer_end << ")";
+    throw std::runtime_error(oss.str());
+  }
+  if (info.moe_stacked != cfg.moe_stacked_experts) {
+    throw std::runtime_error(std::string("load: stage shard was written ") +
+                             (info.moe_stacked ? "with" : "without") + " stacked experts (--moe-stacked)");
+  }
+  if (info.qk_norm) {
+    for (auto& blk : stage->blocks()) blk->attn()->enable_qk_norm(true);
+  }
+
+  for (auto& kv : stage->named_parameters()) {
+    const std::string& key = kv.key();
+    if (!is_stage_shard_param(key)) continue;
+    torch::Tensor& param = kv.value();
+    if (!wl.exists(key)) {
+      if (rep) { rep->missing++; rep->missing_keys.push_back(key); }
+      if (strict) throw std::runtime_error("load: stage shard is missing " + key);
+      continue;
+    }
+    torch::Tensor src = wl.get(key);
+    record_used(rep, key);
+    if (rep) rep->bytes += (int64_t)src.nbytes();
+    if (src.scalar_type() != param.scalar_type() || src.sizes() != param.sizes()) {
+      if (rep) { rep->mismatched++; rep->mismatch_keys.push_back(key); }
+      if (strict) throw std::runtime_error("load: stage shard tensor does not match parameter: " + key);
+      continue;
+    }
+    param.detach().copy_(src);
+    if (rep) rep->loaded++;
+  }
+}
+
+} // namespace
+
+bool load_stage_weights(ModelStage& stage,
+                        const WeightLoader& wl,
+                        const ModelConfig& cfg,
+                        LoadReport* rep,
+                        const LoadOptions& opts) {
+  const std::string lm_prefix = "model.language_model";
+  const bool strict = opts.strict;
+  const auto t0 = std::chrono::steady_clock::now();
+
+  StageShardInfo shard;
+  if (read_stage_shard_info(wl, &shard)) {
+    load_stage_shard(stage, wl, cfg, shard, rep, strict);
+    if (rep) rep->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    return true;
   }
 
-  if ((bool)stage->final_norm()) {
-    try_assign_param(wl, lm_prefix + ".norm.weight", stage->final_norm()->weight(), rep, true, strict);
+  // Independent units of work in checkpoint order: embedding, each block,
+  // then the head. Each writes only its own parameters and its own report.
+  std::vector<std::function<void(LoadReport*)>> tasks;
+  if ((bool)stage->embedding()) {
+    tasks.push_back([&](LoadReport* r) {
+      try_assign_param(wl, lm_prefix + ".embed_tokens.weight", stage->embedding()->weight(), r, true, strict);
+    });
+  }
+  for (size_t i = 0; i < stage->blocks().size(); ++i) {
+    tasks.push_back([&, i](LoadReport* r) {
+      load_block(wl, cfg, stage->blocks()[i], cfg.layer_start + static_cast<int32_t>(i), r, strict);
+    });
   }
-  if ((bool)stage->lm_head()) {
-    if (!try_assign_param(wl, "lm_head.weight", stage->lm_head()->weight, rep, false, strict)) {
-      try_assign_param(wl, lm_prefix + ".lm_head.weight", stage->lm_head()->weight, rep, true, strict);
+  if ((bool)stage->final_norm() || (bool)stage->lm_head()) {
+    tasks.push_back([&](LoadReport* r) {
+      if ((bool)stage->final_norm()) {
+        try_assign_param(wl, lm_prefix + ".norm.weight", stage->final_norm()->weight(), r, true, strict);
+      }
+      if ((bool)stage->lm_head()) {
+        // Tied checkpoints have no head tensor; the head reads embed_tokens.
+        const std::string head_key =
+            cfg.tie_word_embeddings ? lm_prefix + ".embed_tokens.weight" : lm_prefix + ".lm_head.weight";
+        if (!try_assign_param(wl, "lm_head.weight", stage->lm_head()->weight, r, false, strict)) {
+          try_assign_param(wl, head_key, stage->lm_head()->weight, r, true, strict);
+        }
+      }
+    });
+  }
+
+  std::vector<LoadReport> reports(tasks.size());
+  std::vector<std::exception_ptr> errors(tasks.size());
+  auto run = [&](size_t t) {
+    try {
+      tasks[t](&reports[t]);
+    } catch (...) {
+      errors[t] = std::current_exception();
     }
+  };
+
+  const size_t workers = std::min(tasks.size(), (size_t)std::max<int32_t>(1, opts.num_threads));
+  if (workers <= 1) {
+    for (size_t t = 0; t < tasks.size(); ++t) {
+      run(t);
+      if (errors[t]) break;
+    }
+  } else {
+    std::atomic<size_t> next{0};
+    std::atomic<bool> failed{false};
+    std::vector<std::thread> pool;
+    pool.reserve(workers);
+    for (size_t w = 0; w < workers; ++w) {
+      pool.emplace_back([&]() {
+        torch::NoGradGuard ng;
+        for (size_t t = next++; t < tasks.size() && !failed.load(); t = next++) {
+          run(t);
+          if (errors[t]) failed = true;
+        }
+      });
+    }
+    for (auto& th : pool) th.join();
+  }
+
+  std::vector<std::string> missing;
+  for (size_t t = 0; t < tasks.size(); ++t) {
+    if (errors[t]) std::rethrow_exception(errors[t]);
+    missing.insert(missing.end(), reports[t].missing_keys.begin(), reports[t].missing_keys.end());
+    if (rep) merge_report(rep, reports[t]);
+  }
+  // Parameters are allocated uninitialized for loading (make_stage_for_load),
+  // so a required tensor that is absent would be served from garbage.
+  if (strict && !missing.empty()) {
+    throw std::runtime_error("load: " + std::to_string(missing.size()) + " required tensor(s) missing, first: " +
+                             missing.front());
   }
 
   if (opts.load_vision && (bool)stage->vision()) {
@@ -247,6 +428,7 @@ bool load_stage_weights(ModelStage& stage,
     }
   }
 
+  if (rep) rep->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
   return true;
 }
 
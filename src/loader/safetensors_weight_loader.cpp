@@ -0,0 +1,224 @@
+#include <loader/safetensors_weight_loader.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <stdexcept>
+
+#include "core/json.h"
+
+namespace qwen {
+
+namespace fs = std::filesystem;
+
+namespace {
+
+bool ends_with(const std::string& s, const std::string& suffix) {
+  return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+[[noreturn]] void fail(const std::string& file, const std::string& msg) {
+  throw std::runtime_error("SafetensorsWeightLoader: " + file + ": " + msg);
+}
+
+torch::Dtype parse_dtype(const std::string& file, const std::string& s) {
+  if (s == "F64") return torch::kFloat64;
+  if (s == "F32") return torch::kFloat32;
+  if (s == "F16") return torch::kFloat16;
+  if (s == "BF16") return torch::kBFloat16;
+  if (s == "I64") return torch::kInt64;
+  if (s == "I32") return torch::kInt32;
+  if (s == "I16") return torch::kInt16;
+  if (s == "I8") return torch::kInt8;
+  if (s == "U8") return torch::kUInt8;
+  if (s == "BOOL") return torch::kBool;
+  if (s == "F8_E4M3") return torch::kFloat8_e4m3fn;
+  if (s == "F8_E5M2") return torch::kFloat8_e5m2;
+  fail(file, "unsupported dtype " + s);
+}
+
+int64_t as_offset(const std::string& file, const JsonValue& v) {
+  if (v.type != JsonValue::Type::Number || v.n < 0 || v.n != (double)(int64_t)v.n) {
+    fail(file, "expected a non-negative integer in header");
+  }
+  return (int64_t)v.n;
+}
+
+} // namespace
+
+// One mmapped shard; shared with every tensor handed out from it.
+struct SafetensorsWeightLoader::Shard {
+  std::string path;
+  int fd = -1;
+  const uint8_t* base = nullptr;
+  size_t size = 0;
+
+  ~Shard() {
+    if (base != nullptr) ::munmap(const_cast<uint8_t*>(base), size);
+    if (fd >= 0) ::close(fd);
+  }
+};
+
+bool SafetensorsWeightLoader::accepts(const std::string& path) {
+  std::error_code ec;
+  if (fs::is_directory(path, ec)) {
+    for (const auto& de : fs::directory_iterator(path, ec)) {
+      if (ends_with(de.path().string(), ".safetensors")) return true;
+    }
+    return false;
+  }
+  return ends_with(path, ".safetensors") || ends_with(path, ".safetensors.index.json");
+}
+
+SafetensorsWeightLoader::SafetensorsWeightLoader(const std::string& path) {
+  std::string index;
+  std::vector<std::string> files;
+
+  std::error_code ec;
+  if (fs::is_directory(path, ec)) {
+    const fs::path dir(path);
+    if (fs::exists(dir / "model.safetensors.index.json")) {
+      index = (dir / "model.safetensors.index.json").string();
+    } else {
+      for (const auto& de : fs::directory_iterator(dir)) {
+        if (ends_with(de.path().string(), ".safetensors")) files.push_back(de.path().string());
+      }
+      std::sort(files.begin(), files.end());
+    }
+  } else if (ends_with(path, ".json")) {
+    index = path;
+  } else {
+    files.push_back(path);
+  }
+
+  if (!index.empty()) {
+    // model.safetensors.index.json: {"weight_map": {"<key>": "<shard file>"}}
+    const JsonValue root = parse_json(read_text_file(index));
+    const JsonValue* wm = root.type == JsonValue::Type::Object ? json_get(root.o, "weight_map") : nullptr;
+    if (!wm || wm->type != JsonValue::Type::Object) fail(index, "missing weight_map");
+    std::set<std::string> unique;
+    for (const auto& kv : wm->o) {
+      if (kv.second.type != JsonValue::Type::String) fail(index, "weight_map values must be file names");
+      unique.insert(kv.second.s);
+    }
+    const fs::path dir = fs::path(index).parent_path();
+    for (const auto& f : unique) files.push_back((dir / f).string());
+  }
+
+  if (files.empty()) fail(path, "no .safetensors files found");
+  for (const auto& f : files) add_shard(f);
+}
+
+SafetensorsWeightLoader::~SafetensorsWeightLoader() = default;
+
+void SafetensorsWeightLoader::add_shard(const std::string& file) {
+  auto shard = std::make_shared<Shard>();
+  shard->path = file;
+  shard->fd = ::open(file.c_str(), O_RDONLY);
+  if (shard->fd < 0) fail(file, std::string("open failed: ") + std::strerror(errno));
+
+  struct stat st;
+  if (::fstat(shard->fd, &st) != 0) fail(file, std::string("fstat failed: ") + std::strerror(errno));
+  shard->size = (size_t)st.st_size;
+  if (shard->size < 8) fail(file, "file too small");
+
+  void* p = ::mmap(nullptr, shard->size, PROT_READ, MAP_PRIVATE, shard->fd, 0);
+  if (p == MAP_FAILED) fail(file, std::string("mmap failed: ") + std::strerror(errno));
+  shard->base = static_cast<const uint8_t*>(p);
+  // Keys are read in stage order, not file order: don't let a fault on one
+  // tensor drag its neighbours in.
+  (void)::madvise(p, shard->size, MADV_RANDOM);
+
+  // Header: u64 little-endian length, then that many bytes of JSON.
+  uint64_t header_len = 0;
+  for (int i = 7; i >= 0; --i) header_len = (header_len << 8) | shard->base[i];
+  if (header_len > shard->size - 8) fail(file, "header length exceeds file size");
+  const int64_t data_start = 8 + (int64_t)header_len;
+
+  const JsonValue root = parse_json(std::string(reinterpret_cast<const char*>(shard->base) + 8, (size_t)header_len));
+  if (root.type != JsonValue::Type::Object) fail(file, "header is not a JSON object");
+
+  const size_t shard_idx = shards_.size();
+  for (const auto& kv : root.o) {
+    if (kv.first == "__metadata__") {
+      if (kv.second.type != JsonValue::Type::Object) fail(file, "__metadata__ is not an object");
+      for (const auto& m : kv.second.o) {
+        if (m.second.type == JsonValue::Type::String) metadata_[m.first] = m.second.s;
+      }
+      continue;
+    }
+    const JsonValue& info = kv.second;
+    const JsonValue* dtype = info.type == JsonValue::Type::Object ? json_get(info.o, "dtype") : nullptr;
+    const JsonValue* shape = info.type == JsonValue::Type::Object ? json_get(info.o, "shape") : nullptr;
+    const JsonValue* offs = info.type == JsonValue::Type::Object ? json_get(info.o, "data_offsets") : nullptr;
+    if (!dtype || dtype->type != JsonValue::Type::String || !shape || shape->type != JsonValue::Type::Array ||
+        !offs || offs->type != JsonValue::Type::Array || offs->a.size() != 2) {
+      fail(file, "malformed entry for " + kv.first);
+    }
+
+    Entry e;
+    e.shard = shard_idx;
+    e.dtype = parse_dtype(file, dtype->s);
+    int64_t numel = 1;
+    for (const auto& d : shape->a) {
+      e.sizes.push_back(as_offset(file, d));
+      numel *= e.sizes.back();
+    }
+    e.begin = data_start + as_offset(file, offs->a[0]);
+    e.end = data_start + as_offset(file, offs->a[1]);
+    if (e.end < e.begin || e.end > (int64_t)shard->size) fail(file, "data_offsets out of range for " + kv.first);
+    if (numel * (int64_t)c10::elementSize(e.dtype) != e.end - e.begin) {
+      fail(file, "byte size does not match shape for " + kv.first);
+    }
+    if (!entries_.emplace(kv.first, std::move(e)).second) fail(file, "duplicate key " + kv.first);
+  }
+  shards_.push_back(std::move(shard));
+}
+
+bool SafetensorsWeightLoader::exists(const std::string& key) const {
+  return entries_.find(key) != entries_.end();
+}
+
+torch::Tensor SafetensorsWeightLoader::get(const std::string& key) const {
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    throw std::runtime_error("WeightLoader: missing key: " + key);
+  }
+  const Entry& e = it->second;
+  std::shared_ptr<Shard> shard = shards_[e.shard];
+  const uint8_t* data = shard->base + e.begin;
+
+  // Start reading this tensor's pages ahead of the copy that follows.
+  const int64_t page = (int64_t)::sysconf(_SC_PAGESIZE);
+  const int64_t lo = e.begin / page * page;
+  if (e.end > lo) {
+    (void)::madvise(const_cast<uint8_t*>(shard->base) + lo, (size_t)(e.end - lo), MADV_WILLNEED);
+  }
+  bytes_read_ += e.end - e.begin;
+
+  return torch::from_blob(const_cast<uint8_t*>(data),
+                          e.sizes,
+                          [shard](void*) {},
+                          torch::TensorOptions().dtype(e.dtype));
+}
+
+std::string SafetensorsWeightLoader::metadata(const std::string& key) const {
+  auto it = metadata_.find(key);
+  return it == metadata_.end() ? std::string() : it->second;
+}
+
+std::vector<std::string> SafetensorsWeightLoader::list_keys() const {
+  std::vector<std::string> ks;
+  ks.reserve(entries_.size());
+  for (const auto& kv : entries_) ks.push_back(kv.first);
+  return ks;
+}
+
+} // namespace qwen
@@ -0,0 +1,126 @@
+#include "loader/stage_shard.h"
+
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace qwen {
+
+namespace {
+
+std::string safetensors_dtype(torch::Dtype t) {
+  switch (t) {
+    case torch::kFloat64: return "F64";
+    case torch::kFloat32: return "F32";
+    case torch::kFloat16: return "F16";
+    case torch::kBFloat16: return "BF16";
+    case torch::kInt64: return "I64";
+    case torch::kInt32: return "I32";
+    case torch::kInt8: return "I8";
+    case torch::kUInt8: return "U8";
+    case torch::kBool: return "BOOL";
+    default: break;
+  }
+  throw std::runtime_error(std::string("write_stage_shard: unsupported dtype ") + c10::toString(t));
+}
+
+int64_t align_up(int64_t n) {
+  return (n + kStageShardAlign - 1) / kStageShardAlign * kStageShardAlign;
+}
+
+bool parse_i32(const std::string& s, int32_t* out) {
+  if (s.empty()) return false;
+  try {
+    size_t pos = 0;
+    const long v = std::stol(s, &pos);
+    if (pos != s.size()) return false;
+    *out = (int32_t)v;
+    return true;
+  } catch (const std::exception&) {
+    return false;
+  }
+}
+
+} // namespace
+
+std::string stage_shard_file_name(int32_t stage_id, int32_t stage_count) {
+  return "stage-" + std::to_string(stage_id) + "-of-" + std::to_string(stage_count) + ".safetensors";
+}
+
+bool is_stage_shard_param(const std::string& name) {
+  return name.rfind("vision.", 0) != 0 && name.rfind("projector.", 0) != 0;
+}
+
+bool read_stage_shard_info(const WeightLoader& wl, StageShardInfo* info) {
+  if (wl.metadata("format") != kStageShardFormat) return false;
+  StageShardInfo r;
+  if (!parse_i32(wl.metadata("stage_id"), &r.stage_id) ||
+      !parse_i32(wl.metadata("stage_count"), &r.stage_count) ||
+      !parse_i32(wl.metadata("layer_start"), &r.layer_start) ||
+      !parse_i32(wl.metadata("layer_end"), &r.layer_end)) {
+    throw std::runtime_error("stage shard: malformed stage metadata");
+  }
+  r.moe_stacked = wl.metadata("moe_stacked") == "1";
+  r.qk_norm = wl.metadata("qk_norm") == "1";
+  if (info) *info = r;
+  return true;
+}
+
+int64_t write_stage_shard(const std::string& path, ModelStage& stage, const ModelConfig& cfg) {
+  bool qk_norm = false;
+  for (auto& blk : stage->blocks()) qk_norm = qk_norm || blk->attn()->qk_norm_enabled();
+
+  struct Item {
+    std::string name;
+    torch::Tensor t;
+    int64_t begin = 0;
+  };
+  std::vector<Item> items;
+  int64_t data_size = 0;
+  for (const auto& kv : stage->named_parameters()) {
+    if (!is_stage_shard_param(kv.key())) continue;
+    Item it;
+    it.name = kv.key();
+    it.t = kv.value().detach().to(torch::kCPU).contiguous();
+    it.begin = align_up(data_size);
+    data_size = it.begin + (int64_t)it.t.nbytes();
+    items.push_back(std::move(it));
+  }
+
+  std::string header = "{\"__metadata__\":{";
+  header += "\"format\":\"" + std::string(kStageShardFormat) + "\"";
+  header += ",\"stage_id\":\"" + std::to_string(cfg.stage_id) + "\"";
+  header += ",\"stage_count\":\"" + std::to_string(cfg.stage_count) + "\"";
+  header += ",\"layer_start\":\"" + std::to_string(cfg.layer_start) + "\"";
+  header += ",\"layer_end\":\"" + std::to_string(cfg.layer_end) + "\"";
+  header += std::string(",\"moe_stacked\":\"") + (cfg.moe_stacked_experts ? "1" : "0") + "\"";
+  header += std::string(",\"qk_norm\":\"") + (qk_norm ? "1" : "0") + "\"}";
+  for (const auto& it : items) {
+    header += ",\"" + it.name + "\":{\"dtype\":\"" + safetensors_dtype(it.t.scalar_type()) + "\",\"shape\":[";
+    for (int64_t d = 0; d < it.t.dim(); ++d) header += (d ? "," : "") + std::to_string(it.t.size(d));
+    header += "],\"data_offsets\":[" + std::to_string(it.begin) + "," +
+              std::to_string(it.begin + (int64_t)it.t.nbytes()) + "]}";
+  }
+  header += "}";
+  // Pad so the data section (after the 8-byte length) starts aligned.
+  while ((8 + (int64_t)header.size()) % kStageShardAlign != 0) header += ' ';
+
+  std::ofstream os(path, std::ios::binary | std::ios::trunc);
+  if (!os) throw std::runtime_error("write_stage_shard: cannot open " + path);
+  const uint64_t n = header.size();
+  for (int i = 0; i < 8; ++i) os.put((char)((n >> (8 * i)) & 0xff));
+  os.write(header.data(), (std::streamsize)header.size());
+
+  int64_t pos = 0;
+  const std::vector<char> zeros((size_t)kStageShardAlign, 0);
+  for (const auto& it : items) {
+    os.write(zeros.data(), (std::streamsize)(it.begin - pos));
+    os.write(static_cast<const char*>(it.t.data_ptr()), (std::streamsize)it.t.nbytes());
+    pos = it.begin + (int64_t)it.t.nbytes();
+  }
+  os.flush();
+  if (!os) throw std::runtime_error("write_stage_shard: write failed for " + path);
+  return 8 + (int64_t)header.size() + pos;
+}
+
+} // namespace qwen
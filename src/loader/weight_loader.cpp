@@ -1,13 +1,38 @@
 #include "loader/weight_loader.h"
 
-// This translation unit is intentionally minimal.
-//
+#include "loader/lazy_pt_weight_loader.h"
+#include "loader/pt_weight_loader.h"
+#include "loader/safetensors_weight_loader.h"
+
 // The weight loader interfaces and the MapWeightLoader implementation are
-// header-only (see include/loader/weight_loader.h).
-//
-// Historical note:
-// An older draft implementation of PtWeightLoader lived in this file, but the
-// authoritative implementation is now in src/loader/pt_weight_loader.cpp.
-//
-// Keeping this file avoids build-system churn when the project uses a glob like
-// src/loader/*.cpp, while ensuring there are no duplicate symbols.
+// header-only (see include/loader/weight_loader.h); this file only holds the
+// open_weight_loader() factory.
+
+namespace qwen {
+
+std::unique_ptr<WeightLoader> open_weight_loader(const std::string& weights_path) {
+  if (SafetensorsWeightLoader::accepts(weights_path)) {
+    return std::make_unique<SafetensorsWeightLoader>(weights_path);
+  }
+
+  std::string lazy_err;
+  try {
+    return std::make_unique<LazyPtWeightLoader>(weights_path);
+  } catch (const std::exception& e) {
+    lazy_err = e.what();
+  }
+
+  PtWeightLoader pt(weights_path);
+  try {
+    pt.load();
+  } catch (const std::exception& e) {
+    throw std::runtime_error(std::string(e.what()) + " [lazy: " + lazy_err + "]");
+  }
+  auto wl = std::make_unique<MapWeightLoader>();
+  for (const auto& kv : pt.weights()) {
+    wl->insert(kv.first, kv.second);
+  }
+  return wl;
+}
+
+} // namespace qwen
@@ -2,41 +2,83 @@
 #include "model/attention.h"
 #include "core/tensor_utils.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 namespace qwen {
 namespace {
 
-// Build a causal keep-mask for the no-cache case: [1,1,T,T] where True means keep.
-static torch::Tensor make_causal_keep_mask(int64_t T, int device_index) {
-  auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(torch::kCUDA, device_index);
-  auto i = torch::arange(T, opts_i64).view({T, 1});
-  auto j = torch::arange(T, opts_i64).view({1, T});
-  auto keep = (j <= i); // [T,T] bool
-  auto opts_b = torch::TensorOptions().dtype(torch::kBool).device(torch::kCUDA, device_index);
-  return keep.to(opts_b).view({1, 1, T, T});
-}
-
-// Repeat kv heads to match q heads.
-// kv: [B, kv_heads, S, Hd] -> [B, q_heads, S, Hd]
+// Repeat kv heads to match q heads (reference path only).
+// kv: [B, kv_heads, S, Hd] -> [B, q_heads, S, Hd]; q head h reads kv head h / rep,
+// matching HF repeat_kv.
 static torch::Tensor repeat_kv_heads(const torch::Tensor& kv, int64_t q_heads) {
   if (kv.size(1) == q_heads) return kv;
   const int64_t kv_heads = kv.size(1);
   require(kv_heads > 0, "Attention: kv_heads must be > 0");
   require(q_heads % kv_heads == 0, "Attention: q_heads must be multiple of kv_heads");
   const int64_t rep = q_heads / kv_heads;
-  return kv.repeat({1, rep, 1, 1});
+  return kv.repeat_interleave(rep, /*dim=*/1);
 }
 
-static torch::Tensor to_keep_bool_mask(const torch::Tensor& m, int device_index) {
-  require(m.defined(), "Attention: mask is undefined");
-  require_cuda(m, "Attention: mask must be CUDA");
-  if (m.scalar_type() == torch::kBool) return m;
-  // If it's a float additive mask, we don't convert; caller should handle add.
-  // This function is only for bool keep-masks.
-  require(false, "Attention: expected bool keep-mask");
-  (void)device_index;
-  return torch::Tensor();
+// Apply attn_mask (bool keep-mask or additive float mask, broadcastable to
+// [B,H,T,S]) or, if absent, the causal mask for queries at pos..pos+T-1.
+static torch::Tensor mask_scores(torch::Tensor scores,
+                                 const c10::optional<torch::Tensor>& attn_mask,
+                                 int64_t T,
+                                 int64_t S,
+                                 int64_t pos) {
+  if (attn_mask.has_value() && attn_mask->defined()) {
+    auto m = *attn_mask;
+    if (m.device() != scores.device()) m = m.to(scores.device());
+    if (m.scalar_type() == torch::kBool) {
+      // keep=true; fill where keep=false
+      return scores.masked_fill(~m, -1e9);
+    }
+    return scores + m;
+  }
+  // Causal masking; if S > T (cache), allow attending to all keys <= pos + t
+  auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(scores.device());
+  auto qi = torch::arange(T, opts_i64).view({T, 1});
+  auto kj = torch::arange(S, opts_i64).view({1, S});
+  auto keep = (kj <= (qi + pos)); // [T,S]
+  return scores.masked_fill(~keep, -1e9);
+}
+
+// Apply the [t0, t0+tq) x [s0, s0+tk) tile of attn_mask to scores viewed as
+// [B, H, tq, tk], in place. Size-1 mask dims broadcast.
+static void mask_tile(torch::Tensor scores, const torch::Tensor& mask, int64_t t0, int64_t tq, int64_t s0, int64_t tk) {
+  auto mt = mask;
+  if (mt.size(-2) > 1) mt = mt.narrow(-2, t0, tq);
+  if (mt.size(-1) > 1) mt = mt.narrow(-1, s0, tk);
+  if (mt.scalar_type() == torch::kBool) {
+    scores.masked_fill_(~mt, -1e9);
+  } else {
+    scores.add_(mt.to(torch::kFloat32));
+  }
+}
+
+// Per-row causal keep-mask for continuous batching: row b, query t sees keys
+// [0, positions[b] + t]. Everything past a row's own length (including stale
+// entries of a reused cache row) is hidden. Returns [B, 1, T, S] bool.
+static torch::Tensor placement_mask(const RowPlacement& place, int64_t T, int64_t S, const torch::Device& device) {
+  const int64_t B = (int64_t)place.positions.size();
+  auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64);
+  auto start = torch::tensor(place.positions, opts_i64).to(device).view({B, 1, 1, 1});
+  auto qi = torch::arange(T, opts_i64.device(device)).view({1, 1, T, 1});
+  auto kj = torch::arange(S, opts_i64.device(device)).view({1, 1, 1, S});
+  return kj <= (start + qi);
+}
+
+// Absolute position of every new token, [B, T] (packed: [1, total]).
+static torch::Tensor placement_position_ids(const RowPlacement& place, int64_t B, int64_t T, const torch::Device& device) {
+  auto host = torch::empty({B, T}, torch::TensorOptions().dtype(torch::kInt64));
+  auto* p = host.data_ptr<int64_t>();
+  for (int64_t i = 0; i < place.num_segments(); ++i) {
+    const int64_t off = place.offset(i, T);
+    for (int64_t t = 0; t < place.length(i, T); ++t) p[off + t] = place.positions[(size_t)i] + t;
+  }
+  return host.to(device);
 }
 
 } // namespace
@@ -53,31 +95,284 @@ AttentionImpl::AttentionImpl(const ModelConfig& cfg, int32_t layer_index_in_stag
   const int64_t head_dim = cfg_.hidden_size / q_heads;
   const int64_t kv_dim = kv_heads * head_dim;
 
-  wq_ = register_module(
-      "wq",
-      torch::nn::Linear(torch::nn::LinearOptions(cfg_.hidden_size, cfg_.hidden_size).bias(false)));
-  wk_ = register_module(
-      "wk",
-      torch::nn::Linear(torch::nn::LinearOptions(cfg_.hidden_size, kv_dim).bias(false)));
-  wv_ = register_module(
-      "wv",
-      torch::nn::Linear(torch::nn::LinearOptions(cfg_.hidden_size, kv_dim).bias(false)));
-  wo_ = register_module(
-      "wo",
-      torch::nn::Linear(torch::nn::LinearOptions(cfg_.hidden_size, cfg_.hidden_size).bias(false)));
+  wq_ = register_module("wq", Linear(cfg_.hidden_size, cfg_.hidden_size));
+  wk_ = register_module("wk", Linear(cfg_.hidden_size, kv_dim));
+  wv_ = register_module("wv", Linear(cfg_.hidden_size, kv_dim));
+  wo_ = register_module("wo", Linear(cfg_.hidden_size, cfg_.hidden_size));
 
   q_norm_ = register_module("q_norm", RmsNorm(head_dim, cfg_.rms_norm_eps));
   k_norm_ = register_module("k_norm", RmsNorm(head_dim, cfg_.rms_norm_eps));
   use_qk_norm_ = cfg_.use_qk_norm;
+
+  set_impl(cfg_.attention_impl);
+  decode_fast_path_ = cfg_.attention_decode_fast_path;
+}
+
+void AttentionImpl::set_impl(const std::string& name) {
+  if (name == "reference") {
+    impl_ = Impl::kReference;
+  } else if (name == "gqa" || name.empty()) {
+    impl_ = Impl::kGrouped;
+  } else if (name == "tiled") {
+    impl_ = Impl::kTiled;
+  } else {
+    throw std::runtime_error("Attention: unknown attention_impl '" + name + "'");
+  }
+}
+
+// Reference: repeat K/V to q_heads and run one [B,H,T,S] matmul + softmax.
+torch::Tensor AttentionImpl::attend_reference(const torch::Tensor& q,
+                                              const torch::Tensor& k_all,
+                                              const torch::Tensor& v_all,
+                                              const c10::optional<torch::Tensor>& attn_mask,
+                                              int64_t pos) const {
+  const int64_t q_heads = q.size(1);
+  const int64_t T = q.size(2);
+  const int64_t head_dim = q.size(3);
+  auto k = repeat_kv_heads(k_all, q_heads);
+  auto v = repeat_kv_heads(v_all, q_heads);
+  const int64_t S = k.size(2);
+
+  const double scale = 1.0 / std::sqrt((double)head_dim);
+  auto scores = torch::matmul(q, k.transpose(-2, -1)) * scale; // [B,H,T,S]
+  scores = mask_scores(scores, attn_mask, T, S, pos);
+  auto probs = torch::softmax(scores, -1);
+  return torch::matmul(probs, v); // [B,H,T,Hd]
+}
+
+// Grouped: the rep query heads sharing a KV head are folded into the row
+// dimension, so K/V are read once at kv_heads width:
+//   q [B, Hkv, rep*T, Hd] x k^T [B, Hkv, Hd, S] -> [B, Hkv, rep*T, S]
+torch::Tensor AttentionImpl::attend_grouped(const torch::Tensor& q,
+                                            const torch::Tensor& k_all,
+                                            const torch::Tensor& v_all,
+                                            const c10::optional<torch::Tensor>& attn_mask,
+                                            int64_t pos) const {
+  const int64_t B = q.size(0);
+  const int64_t q_heads = q.size(1);
+  const int64_t T = q.size(2);
+  const int64_t head_dim = q.size(3);
+  const int64_t kv_heads = k_all.size(1);
+  const int64_t rep = q_heads / kv_heads;
+  const int64_t S = k_all.size(2);
+
+  auto qg = q.reshape({B, kv_heads, rep * T, head_dim});
+  const double scale = 1.0 / std::sqrt((double)head_dim);
+  auto scores = torch::matmul(qg, k_all.transpose(-2, -1)) * scale; // [B,Hkv,rep*T,S]
+
+  // Masks are expressed per q head; [B,Hkv,rep*T,S] and [B,H,T,S] share storage.
+  scores = mask_scores(scores.view({B, q_heads, T, S}), attn_mask, T, S, pos);
+  auto probs = torch::softmax(scores, -1).view({B, kv_heads, rep * T, S});
+  return torch::matmul(probs, v_all).view({B, q_heads, T, head_dim});
+}
+
+// Tiled: for each block of query positions, stream K/V in blocks and keep a
+// running row max m, normalizer l and unnormalized context acc (fp32):
+//   m' = max(m, rowmax(s)),  l' = l*e^(m-m') + rowsum(e^(s-m')),
+//   acc' = acc*e^(m-m') + e^(s-m') v
+// Causal masking is analytic: key blocks past the last query are skipped and
+// only blocks straddling the diagonal build a [tq, tk] mask. Peak scratch is
+// O(H * block_q * block_kv) regardless of T and S.
+torch::Tensor AttentionImpl::attend_tiled(const torch::Tensor& q,
+                                          const torch::Tensor& k_all,
+                                          const torch::Tensor& v_all,
+                                          const c10::optional<torch::Tensor>& attn_mask,
+                                          int64_t pos) const {
+  const int64_t S = k_all.size(2);
+  const int64_t block_kv = (cfg_.attention_block_kv > 0) ? cfg_.attention_block_kv : S;
+  auto tile = [&](int64_t s0, int64_t tk) {
+    return std::make_pair(k_all.narrow(2, s0, tk), v_all.narrow(2, s0, tk));
+  };
+  return attend_tiles(q, k_all.size(1), S, block_kv, tile, attn_mask, pos);
+}
+
+// Paged prefill: the tiled loop with each KV tile gathered from the block
+// table (whole blocks of about attention_block_kv keys), so a chunked prefill
+// reads only the blocks it attends to instead of copying [0, S) per layer.
+torch::Tensor AttentionImpl::attend_tiled_paged(const torch::Tensor& q,
+                                                const KVCache& cache,
+                                                int64_t S,
+                                                const c10::optional<torch::Tensor>& attn_mask,
+                                                int64_t pos) const {
+  const int64_t bs = cache.pool()->block_size();
+  const int64_t want = (cfg_.attention_block_kv > 0) ? cfg_.attention_block_kv : S;
+  const int64_t chunk = std::max<int64_t>(1, (want + bs - 1) / bs) * bs;
+  const int64_t B = q.size(0);
+  auto tile = [&](int64_t s0, int64_t tk) {
+    return std::make_pair(cache.keys_range(layer_index_in_stage_, B, s0, tk),
+                          cache.values_range(layer_index_in_stage_, B, s0, tk));
+  };
+  return attend_tiles(q, cache.kv_heads(), S, chunk, tile, attn_mask, pos);
+}
+
+torch::Tensor AttentionImpl::attend_tiles(const torch::Tensor& q,
+                                          int64_t kv_heads,
+                                          int64_t S,
+                                          int64_t block_kv,
+                                          const KVTileFn& tile,
+                                          const c10::optional<torch::Tensor>& attn_mask,
+                                          int64_t pos) const {
+  const int64_t B = q.size(0);
+  const int64_t q_heads = q.size(1);
+  const int64_t T = q.size(2);
+  const int64_t head_dim = q.size(3);
+  const int64_t rep = q_heads / kv_heads;
+  const int64_t block_q = (cfg_.attention_block_q > 0) ? cfg_.attention_block_q : T;
+  const double scale = 1.0 / std::sqrt((double)head_dim);
+
+  const bool has_mask = attn_mask.has_value() && attn_mask->defined();
+  torch::Tensor mask;
+  if (has_mask) {
+    mask = *attn_mask;
+    require(mask.dim() >= 2, "Attention: attn_mask must have at least [T, S] dims");
+    if (mask.device() != q.device()) mask = mask.to(q.device());
+  }
+
+  auto f32 = torch::TensorOptions().dtype(torch::kFloat32).device(q.device());
+  auto i64 = torch::TensorOptions().dtype(torch::kInt64).device(q.device());
+  auto q5 = q.view({B, kv_heads, rep, T, head_dim});
+  auto out = torch::empty({B, kv_heads, rep, T, head_dim}, q.options());
+
+  for (int64_t t0 = 0; t0 < T; t0 += block_q) {
+    const int64_t tq = std::min(block_q, T - t0);
+    const int64_t q_first = pos + t0;
+    const int64_t q_last = pos + t0 + tq - 1;
+    auto qt = q5.narrow(3, t0, tq).reshape({B, kv_heads, rep * tq, head_dim});
+
+    auto m_run = torch::full({B, kv_heads, rep * tq, 1}, -std::numeric_limits<float>::infinity(), f32);
+    auto l_run = torch::zeros({B, kv_heads, rep * tq, 1}, f32);
+    auto acc = torch::zeros({B, kv_heads, rep * tq, head_dim}, f32);
+
+    for (int64_t s0 = 0; s0 < S; s0 += block_kv) {
+      if (!has_mask && s0 > q_last) break; // every later key is in the future
+      const int64_t tk = std::min(block_kv, S - s0);
+      auto [kt, vt] = tile(s0, tk); // [B,Hkv,tk,Hd]
+
+      auto s = torch::matmul(qt, kt.transpose(-2, -1)).to(torch::kFloat32).mul_(scale); // [B,Hkv,rep*tq,tk]
+      if (has_mask) {
+        mask_tile(s.view({B, q_heads, tq, tk}), mask, t0, tq, s0, tk);
+      } else if (s0 + tk - 1 > q_first) {
+        // Tile straddles the diagonal; fully visible tiles need no mask.
+        auto qi = torch::arange(q_first, q_last + 1, i64).view({tq, 1});
+        auto kj = torch::arange(s0, s0 + tk, i64).view({1, tk});
+        s.view({B, q_heads, tq, tk}).masked_fill_(kj > qi, -std::numeric_limits<float>::infinity());
+      }
+
+      auto m_new = torch::maximum(m_run, std::get<0>(s.max(-1, /*keepdim=*/true)));
+      auto p = (s - m_new).exp_();
+      auto corr = (m_run - m_new).exp_();
+      l_run.mul_(corr).add_(p.sum(-1, /*keepdim=*/true));
+      acc.mul_(corr).add_(torch::matmul(p.to(vt.scalar_type()), vt).to(torch::kFloat32));
+      m_run = m_new;
+    }
+
+    out.narrow(3, t0, tq).copy_(acc.div_(l_run).view({B, kv_heads, rep, tq, head_dim}));
+  }
+  return out.view({B, q_heads, T, head_dim});
+}
+
+// Decode: one query position, so there is nothing to mask causally. The rep
+// query heads of each KV head form a [rep, Hd] block against [Hd, S]; for
+// MHA (rep == 1) that is a plain GEMV. k_all/v_all are consumed as views.
+torch::Tensor AttentionImpl::attend_decode(const torch::Tensor& q,
+                                           const torch::Tensor& k_all,
+                                           const torch::Tensor& v_all,
+                                           const c10::optional<torch::Tensor>& attn_mask) const {
+  const int64_t B = q.size(0);
+  const int64_t q_heads = q.size(1);
+  const int64_t head_dim = q.size(3);
+  const int64_t kv_heads = k_all.size(1);
+  const int64_t rep = q_heads / kv_heads;
+  const int64_t S = k_all.size(2);
+
+  auto qg = q.view({B, kv_heads, rep, head_dim});
+  const double scale = 1.0 / std::sqrt((double)head_dim);
+  auto scores = torch::matmul(qg, k_all.transpose(-2, -1)).mul_(scale); // [B,Hkv,rep,S]
+  if (attn_mask.has_value() && attn_mask->defined()) {
+    // Padding mask for ragged batches; same broadcasting rules as prefill.
+    scores = mask_scores(scores.view({B, q_heads, 1, S}), attn_mask, 1, S, 0).view({B, kv_heads, rep, S});
+  }
+  auto probs = torch::softmax(scores, -1);
+  return torch::matmul(probs, v_all).view({B, q_heads, 1, head_dim});
+}
+
+// Paged decode: walk the block table in chunks of about attention_block_kv
+// keys (whole blocks) with the online softmax of attend_tiled. Each chunk is
+// gathered into its own scratch, so the history is read once per step and
+// never materialized as a contiguous [B, Hkv, S, Hd] copy.
+torch::Tensor AttentionImpl::attend_decode_paged(const torch::Tensor& q,
+                                                 const KVCache& cache,
+                                                 int64_t S,
+                                                 const c10::optional<torch::Tensor>& attn_mask) const {
+  const int64_t B = q.size(0);
+  const int64_t q_heads = q.size(1);
+  const int64_t head_dim = q.size(3);
+  const int64_t kv_heads = cache.kv_heads();
+  const int64_t rep = q_heads / kv_heads;
+  const int64_t bs = cache.pool()->block_size();
+  const int64_t want = (cfg_.attention_block_kv > 0) ? cfg_.attention_block_kv : S;
+  const int64_t chunk = std::max<int64_t>(1, (want + bs - 1) / bs) * bs;
+  const double scale = 1.0 / std::sqrt((double)head_dim);
+
+  const bool has_mask = attn_mask.has_value() && attn_mask->defined();
+  torch::Tensor mask;
+  if (has_mask) {
+    mask = *attn_mask;
+    require(mask.dim() >= 2, "Attention: attn_mask must have at least [T, S] dims");
+    if (mask.device() != q.device()) mask = mask.to(q.device());
+  }
+
+  auto f32 = torch::TensorOptions().dtype(torch::kFloat32).device(q.device());
+  auto qg = q.view({B, kv_heads, rep, head_dim});
+  auto m_run = torch::full({B, kv_heads, rep, 1}, -std::numeric_limits<float>::infinity(), f32);
+  auto l_run = torch::zeros({B, kv_heads, rep, 1}, f32);
+  auto acc = torch::zeros({B, kv_heads, rep, head_dim}, f32);
+
+  for (int64_t s0 = 0; s0 < S; s0 += chunk) {
+    const int64_t tk = std::min(chunk, S - s0);
+    auto kt = cache.keys_range(layer_index_in_stage_, B, s0, tk);   // [B,Hkv,tk,Hd]
+    auto vt = cache.values_range(layer_index_in_stage_, B, s0, tk);
+
+    auto s = torch::matmul(qg, kt.transpose(-2, -1)).to(torch::kFloat32).mul_(scale); // [B,Hkv,rep,tk]
+    if (has_mask) mask_tile(s.view({B, q_heads, 1, tk}), mask, 0, 1, s0, tk);
+
+    auto m_new = torch::maximum(m_run, std::get<0>(s.max(-1, /*keepdim=*/true)));
+    auto p = (s - m_new).exp_();
+    auto corr = (m_run - m_new).exp_();
+    l_run.mul_(corr).add_(p.sum(-1, /*keepdim=*/true));
+    acc.mul_(corr).add_(torch::matmul(p.to(vt.scalar_type()), vt).to(torch::kFloat32));
+    m_run = m_new;
+  }
+  return acc.div_(l_run).to(q.scalar_type()).view({B, q_heads, 1, head_dim});
+}
+
+torch::Tensor AttentionImpl::attend(const torch::Tensor& q,
+                                    const torch::Tensor& k_all,
+                                    const torch::Tensor& v_all,
+                                    const c10::optional<torch::Tensor>& attn_mask,
+                                    int64_t pos,
+                                    bool decode) const {
+  if (decode && decode_fast_path_ && impl_ != Impl::kReference) {
+    return attend_decode(q, k_all, v_all, attn_mask);
+  }
+  switch (impl_) {
+    case Impl::kReference:
+      return attend_reference(q, k_all, v_all, attn_mask, pos);
+    case Impl::kTiled:
+      return attend_tiled(q, k_all, v_all, attn_mask, pos);
+    case Impl::kGrouped:
+    default:
+      return attend_grouped(q, k_all, v_all, attn_mask, pos);
+  }
 }
 
 torch::Tensor AttentionImpl::forward(const torch::Tensor& x,
                                      const c10::optional<torch::Tensor>& attn_mask,
                                      KVCache* cache,
                                      int64_t pos,
-                                     const c10::optional<RopeTables>& rope) {
+                                     const c10::optional<RopeTables>& rope,
+                                     const RowPlacement* place) {
   require(x.defined(), "Attention: x is undefined");
-  require_cuda(x, "Attention: x");
   require(x.dim() == 3, "Attention: expected x shape [B, T, D]");
 
   const int64_t B = x.size(0);
@@ -89,6 +384,7 @@ torch::Tensor AttentionImpl::forward(const torch::Tensor& x,
   const int64_t kv_heads = (cfg_.num_key_value_heads > 0) ? cfg_.num_key_value_heads : q_heads;
   require(q_heads > 0 && kv_heads > 0, "Attention: heads must be > 0");
   require(kv_heads <= q_heads, "Attention: kv_heads must be <= q_heads");
+  require(q_heads % kv_heads == 0, "Attention: q_heads must be multiple of kv_heads");
   require(D % q_heads == 0, "Attention: hidden_size must be divisible by num_attention_heads");
   const int64_t head_dim = D / q_heads;
 
@@ -107,77 +403,100 @@ torch::Tensor AttentionImpl::forward(const torch::Tensor& x,
     k = k_norm_->forward(k);
   }
 
-  // Apply RoPE to q and k if provided.
+  const bool has_cache = cache && cache->is_initialized();
+  if (place) {
+    require(!(attn_mask.has_value() && attn_mask->defined()), "Attention: row placement and attn_mask are exclusive");
+    require((int64_t)place->positions.size() == place->num_segments(), "Attention: row placement is incomplete");
+    if (place->packed()) {
+      require(B == 1, "Attention: packed sequences must be a single [1, total] row");
+      require((int64_t)place->cu_seqlens.size() == place->num_segments() + 1 && place->cu_seqlens.back() == T,
+              "Attention: cu_seqlens must end at the packed length");
+    } else {
+      require(place->num_segments() == B, "Attention: row placement must cover every batch row");
+    }
+    bool fresh = true;
+    for (int64_t p : place->positions) fresh = fresh && (p == 0);
+    require(has_cache || (place->packed() && fresh),
+            "Attention: row placement requires a KV cache unless every packed sequence starts at 0");
+  }
+
+  // RoPE rotates each head independently, so K is rotated at kv_heads width.
   if (rope.has_value() && rope->cos.defined() && rope->sin.defined() && rope->rope_dim > 0) {
-    // RoPE helper expects q and k to have same head count; apply on a temporary repeated k if needed.
-    if (k.size(1) != q_heads) {
-      auto k_rep = repeat_kv_heads(k, q_heads);
-      apply_rope_inplace(q, k_rep, *rope, pos);
-      k = k_rep.index({torch::indexing::Slice(),
-                       torch::indexing::Slice(0, kv_heads),
-                       torch::indexing::Slice(),
-                       torch::indexing::Slice()}).contiguous();
+    if (place) {
+      apply_rope_inplace(q, k, *rope, placement_position_ids(*place, B, T, q.device()));
     } else {
       apply_rope_inplace(q, k, *rope, pos);
     }
   }
 
+  const bool decode = (T == 1) && decode_fast_path_ && impl_ != Impl::kReference;
+
   torch::Tensor k_all;
   torch::Tensor v_all;
+  c10::optional<torch::Tensor> mask = attn_mask;
 
-  // Cache path: store as [B, kv_heads, S, Hd]
-  if (cache && cache->is_initialized()) {
+  if (place && place->packed()) {
+    // Packed varlen: projections above ran on real tokens only; attention runs
+    // per segment against that sequence's own keys, so nothing attends across
+    // sequence boundaries and no [N, T_max] padding is ever built.
+    if (has_cache) cache->append_rows(layer_index_in_stage_, k, v, *place);
+    std::vector<torch::Tensor> parts;
+    parts.reserve((size_t)place->num_segments());
+    for (int64_t i = 0; i < place->num_segments(); ++i) {
+      const int64_t off = place->offset(i, T);
+      const int64_t len = place->length(i, T);
+      if (len == 0) continue;
+      const int64_t seg_pos = place->positions[(size_t)i];
+      auto qs = q.narrow(2, off, len);
+      torch::Tensor ks;
+      torch::Tensor vs;
+      if (has_cache) {
+        ks = cache->keys_rows(layer_index_in_stage_, {place->rows[(size_t)i]}, seg_pos + len);
+        vs = cache->values_rows(layer_index_in_stage_, {place->rows[(size_t)i]}, seg_pos + len);
+      } else {
+        ks = k.narrow(2, off, len);
+        vs = v.narrow(2, off, len);
+      }
+      parts.push_back(attend(qs, ks, vs, c10::nullopt, seg_pos, len == 1));
+    }
+    auto ctx = torch::cat(parts, 2);
+    auto y = ctx.transpose(1, 2).contiguous().view({B, T, D});
+    return wo_->forward(y);
+  }
+
+  if (place) {
+    // Continuous batching: rows live in arbitrary cache rows at their own
+    // positions; the causal structure is carried by a per-row mask.
+    cache->append_rows(layer_index_in_stage_, k, v, *place);
+    const int64_t S = place->max_end(T);
+    k_all = cache->keys_rows(layer_index_in_stage_, place->rows, S);
+    v_all = cache->values_rows(layer_index_in_stage_, place->rows, S);
+    mask = placement_mask(*place, T, S, q.device());
+  } else if (cache && cache->is_initialized()) {
+    // Cache path: store as [B, kv_heads, S, Hd]
     require(pos >= 0, "Attention: pos must be >= 0");
     cache->append(layer_index_in_stage_, k, v, pos);
 
+    // Dense caches slice; decode takes the slices as views. Paged caches are
+    // walked block by block in KV tiles (only "reference" gathers [0, S)).
     const int64_t S = pos + T;
-    auto& lk = cache->layer(layer_index_in_stage_);
-    k_all = lk.k.index({torch::indexing::Slice(0, B),
-                        torch::indexing::Slice(),
-                        torch::indexing::Slice(0, S),
-                        torch::indexing::Slice()}).contiguous();
-    v_all = lk.v.index({torch::indexing::Slice(0, B),
-                        torch::indexing::Slice(),
-                        torch::indexing::Slice(0, S),
-                        torch::indexing::Slice()}).contiguous();
+    if (cache->is_paged() && (decode || impl_ != Impl::kReference)) {
+      auto ctx = decode ? attend_decode_paged(q, *cache, S, mask) : attend_tiled_paged(q, *cache, S, mask, pos);
+      return wo_->forward(ctx.transpose(1, 2).contiguous().view({B, T, D}));
+    }
+    if (decode) {
+      k_all = cache->keys_view(layer_index_in_stage_, B, S);
+      v_all = cache->values_view(layer_index_in_stage_, B, S);
+    } else {
+      k_all = cache->keys(layer_index_in_stage_, B, S);
+      v_all = cache->values(layer_index_in_stage_, B, S);
+    }
   } else {
     k_all = k;
     v_all = v;
   }
 
-  // Expand kv heads to q heads for attention compute.
-  k_all = repeat_kv_heads(k_all, q_heads);
-  v_all = repeat_kv_heads(v_all, q_heads);
-
-  const int64_t S = k_all.size(2);
-
-  // Scores: [B,H,T,S]
-  const double scale = 1.0 / std::sqrt((double)head_dim);
-  auto attn_scores = torch::matmul(q, k_all.transpose(-2, -1)) * scale;
-
-  // Masking: bool keep-mask or additive float mask.
-  if (attn_mask.has_value() && attn_mask->defined()) {
-    auto m = *attn_mask;
-    require_cuda(m, "Attention: attn_mask");
-    if (m.scalar_type() == torch::kBool) {
-      // keep=true; fill where keep=false
-      attn_scores = attn_scores.masked_fill(~m, -1e9);
-    } else {
-      attn_scores = attn_scores + m;
-    }
-  } else {
-    // Causal masking; if S > T (cache), allow attending to all keys <= pos + t
-    auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(torch::kCUDA, x.get_device());
-    auto qi = torch::arange(T, opts_i64).view({T, 1});
-    auto kj = torch::arange(S, opts_i64).view({1, S});
-    auto keep = (kj <= (qi + pos)); // [T,S]
-    auto opts_b = torch::TensorOptions().dtype(torch::kBool).device(torch::kCUDA, x.get_device());
-    auto mask = keep.to(opts_b).view({1, 1, T, S});
-    attn_scores = attn_scores.masked_fill(~mask, -1e9);
-  }
-
-  auto attn_probs = torch::softmax(attn_scores, -1);
-  auto ctx = torch::matmul(attn_probs, v_all); // [B,H,T,Hd]
+  torch::Tensor ctx = attend(q, k_all, v_all, mask, pos, decode); // [B,H,T,Hd]
 
   // Back to [B,T,D]
   auto y = ctx.transpose(1, 2).contiguous().view({B, T, D});
@@ -1,22 +1,29 @@
 #include "model/embedding.h"
 
 #include "core/tensor_utils.h"
+#include "model/param_init.h"
 
 namespace qwen {
 
 EmbeddingImpl::EmbeddingImpl(const qwen::ModelConfig& cfg) : cfg_(cfg) {
   qwen::require(cfg_.vocab_size > 0, "Embedding: vocab_size must be > 0");
   qwen::require(cfg_.hidden_size > 0, "Embedding: hidden_size must be > 0");
-  embedding_ = register_module(
-      "embedding", torch::nn::Embedding(torch::nn::EmbeddingOptions(cfg_.vocab_size, cfg_.hidden_size)));
+  // Held by an "embedding" submodule so the parameter path stays
+  // "embedding.embedding.weight", as with the torch::nn::Embedding it replaces.
+  auto table = register_module("embedding", std::make_shared<torch::nn::Module>());
+  weight_ = table->register_parameter("weight", qwen::empty_param({cfg_.vocab_size, cfg_.hidden_size}));
+  if (qwen::param_init().random) {
+    // Same draw as torch::nn::Embedding's default init.
+    torch::nn::init::normal_(weight_);
+  }
 }
 
 torch::Tensor EmbeddingImpl::forward(const torch::Tensor& input_ids) {
   qwen::require(input_ids.defined(), "Embedding: input_ids is undefined");
-  qwen::require_cuda(input_ids, "Embedding: input_ids must be CUDA tensor");
+  qwen::require_same_device(input_ids, weight_, "Embedding: input_ids");
   qwen::require(input_ids.scalar_type() == torch::kInt64, "Embedding: input_ids must be int64");
 
-  return embedding_->forward(input_ids);
+  return torch::embedding(weight_, input_ids);
 }
 
 }  // namespace qwen
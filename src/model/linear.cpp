@@ -0,0 +1,27 @@
+#include "model/linear.h"
+
+#include <cmath>
+
+#include "core/tensor_utils.h"
+#include "model/param_init.h"
+
+namespace qwen {
+
+LinearImpl::LinearImpl(int64_t in_features, int64_t out_features, bool bias) {
+  require(in_features > 0 && out_features > 0, "Linear: features must be > 0");
+  weight = register_parameter("weight", empty_param({out_features, in_features}));
+  if (bias) {
+    this->bias = register_parameter("bias", empty_param({out_features}));
+  }
+
+  if (param_init().random) {
+    // Same draws as torch::nn::LinearImpl::reset_parameters().
+    torch::nn::init::kaiming_uniform_(weight, std::sqrt(5.0));
+    if (this->bias.defined()) {
+      const double bound = 1.0 / std::sqrt((double)in_features);
+      torch::nn::init::uniform_(this->bias, -bound, bound);
+    }
+  }
+}
+
+} // namespace qwen
@@ -1,11 +1,15 @@
 #include "model/model_stage.h"
 
 #include "core/tensor_utils.h"
+#include "model/param_init.h"
+
+#include <algorithm>
 
 namespace qwen {
 
 ModelStageImpl::ModelStageImpl(const ModelConfig& cfg) : cfg_(cfg) {
-  if (cfg_.vision_hidden_size > 0) {
+  // Images enter the pipeline on the first stage only.
+  if (cfg_.vision_hidden_size > 0 && is_first_stage()) {
     vision_ = register_module("vision", VisionEncoder(cfg_));
     projector_ = register_module("projector", Projector(cfg_));
   }
@@ -16,9 +20,7 @@ ModelStageImpl::ModelStageImpl(const ModelConfig& cfg) : cfg_(cfg) {
 
   if (cfg_.vocab_size > 0 && is_last_stage()) {
     final_norm_ = register_module("final_norm", RmsNorm(cfg_.hidden_size, cfg_.rms_norm_eps));
-    lm_head_ = register_module(
-        "lm_head",
-        torch::nn::Linear(torch::nn::LinearOptions(cfg_.hidden_size, cfg_.vocab_size).bias(false)));
+    lm_head_ = register_module("lm_head", Linear(cfg_.hidden_size, cfg_.vocab_size));
   }
 
   const int32_t full_count = (cfg_.num_hidden_layers > 0) ? cfg_.num_hidden_layers : 0;
@@ -36,9 +38,38 @@ ModelStageImpl::ModelStageImpl(const ModelConfig& cfg) : cfg_(cfg) {
   }
 }
 
-StageOutput ModelStageImpl::forward(const StageInput& in) {
-  StageOutput out;
+void ModelStageImpl::init_cache(KVCache& cache, const torch::Tensor& like) {
+  if (cache.is_initialized()) return;
+  const int32_t n_blocks = static_cast<int32_t>(blocks_.size());
+  require(n_blocks > 0, "ModelStage: no blocks, nothing to cache");
+  require(like.defined() && like.dim() == 3, "ModelStage: init_cache expects a [B,T,D] tensor");
+
+  const int32_t kv_heads = (cfg_.num_key_value_heads > 0) ? cfg_.num_key_value_heads : cfg_.num_attention_heads;
+  const int32_t head_dim = cfg_.hidden_size / cfg_.num_attention_heads;
+  const int32_t max_batch = cfg_.max_batch > 0 ? cfg_.max_batch : (int32_t)like.size(0);
+  const int32_t max_seq = cfg_.max_seq_len > 0 ? cfg_.max_seq_len : (int32_t)like.size(1);
+
+  if (cfg_.kv_block_size <= 0) {
+    cache.init(n_blocks, max_batch, max_seq, kv_heads, head_dim, like.scalar_type(), like.get_device());
+    return;
+  }
+
+  // One pool per stage, shared by the stage cache and every request cache.
+  // Rebuilt if the stage moved to another dtype/device; caches still attached
+  // to the old pool keep it alive.
+  if (!kv_pool_ || kv_pool_->dtype() != like.scalar_type() || kv_pool_->device_index() != like.get_device()) {
+    kv_pool_ = std::make_shared<KVBlockPool>(n_blocks,
+                                             cfg_.kv_block_size,
+                                             kv_heads,
+                                             head_dim,
+                                             like.scalar_type(),
+                                             like.get_device(),
+                                             cfg_.kv_max_blocks);
+  }
+  cache.init_paged(kv_pool_, max_batch, max_seq);
+}
 
+torch::Tensor ModelStageImpl::embed_inputs(const StageInput& in) {
   torch::Tensor h = in.hidden_in;
   if (in.input_ids.defined()) {
     require((bool)embedding_, "ModelStage: embedding not initialized");
@@ -67,29 +98,37 @@ StageOutput ModelStageImpl::forward(const StageInput& in) {
   }
 
   require(h.defined(), "ModelStage: hidden_in is undefined");
-  require_cuda(h, "ModelStage: hidden_in must be CUDA");
   require(h.dim() == 3, "ModelStage: expected hidden_in [B,T,D]");
+  return h;
+}
+
+StageOutput ModelStageImpl::run_blocks(torch::Tensor h,
+                                       const c10::optional<torch::Tensor>& attn_mask,
+                                       KVCache* cache_in,
+                                       int64_t pos,
+                                       const RowPlacement* place,
+                                       const BlockKVCallback* on_block_kv) {
+  StageOutput out;
 
   KVCache* kv = nullptr;
   c10::optional<RopeTables> rope = c10::nullopt;
 
   const int32_t n_blocks = static_cast<int32_t>(blocks_.size());
   if (n_blocks > 0) {
-    const int32_t kv_heads = (cfg_.num_key_value_heads > 0) ? cfg_.num_key_value_heads : cfg_.num_attention_heads;
-    const int32_t head_dim = cfg_.hidden_size / cfg_.num_attention_heads;
-    if (!cache_.is_initialized()) {
-      cache_.init(n_blocks,
-                  cfg_.max_batch > 0 ? cfg_.max_batch : (int32_t)h.size(0),
-                  cfg_.max_seq_len > 0 ? cfg_.max_seq_len : (int32_t)h.size(1),
-                  kv_heads,
-                  head_dim,
-                  h.scalar_type(),
-                  h.get_device());
+    KVCache& cache = (cache_in != nullptr) ? *cache_in : cache_;
+    init_cache(cache, h);
+    kv = &cache;
+
+    // A row written from position 0 starts a new sequence in that slot.
+    if (place) {
+      for (size_t i = 0; i < place->rows.size(); ++i) {
+        if (place->positions[i] == 0) cache.clear_row((int32_t)place->rows[i]);
+      }
     }
-    kv = &cache_;
 
     if (cfg_.rope_dim > 0) {
-      const int64_t rope_len = (cfg_.max_seq_len > 0) ? cfg_.max_seq_len : h.size(1);
+      const int64_t end = place ? place->max_end(h.size(1)) : pos + h.size(1);
+      const int64_t rope_len = (cfg_.max_seq_len > 0) ? cfg_.max_seq_len : end;
       const bool need_rebuild =
           !rope_.has_value() ||
           !rope_->cos.defined() ||
@@ -103,8 +142,10 @@ StageOutput ModelStageImpl::forward(const StageInput& in) {
     }
   }
 
-  for (auto& blk : blocks_) {
-    h = blk->forward(h, in.attn_mask, kv, in.pos, rope);
+  const int64_t T = h.size(1);
+  for (int32_t i = 0; i < n_blocks; ++i) {
+    h = blocks_[(size_t)i]->forward(h, attn_mask, kv, pos, rope, place);
+    if (on_block_kv && *on_block_kv) (*on_block_kv)(i, *kv, pos, T);
   }
 
   out.hidden_out = h;
@@ -119,4 +160,93 @@ StageOutput ModelStageImpl::forward(const StageInput& in) {
   return out;
 }
 
+static std::vector<int64_t> to_host_i64(const torch::Tensor& t) {
+  auto c = t.to(torch::kCPU, torch::kInt64).contiguous();
+  return std::vector<int64_t>(c.data_ptr<int64_t>(), c.data_ptr<int64_t>() + c.numel());
+}
+
+// Per-sequence rows/positions (and packed offsets) for a continuous or packed
+// batch; h is the embedded input.
+static RowPlacement placement_for(const StageInput& in, const torch::Tensor& h) {
+  RowPlacement place;
+  int64_t n = h.size(0);
+  if (in.cu_seqlens.defined()) {
+    require(h.size(0) == 1, "ModelStage: packed input must be [1, total]");
+    place.cu_seqlens = to_host_i64(in.cu_seqlens);
+    n = (int64_t)place.cu_seqlens.size() - 1;
+    require(n >= 1 && place.cu_seqlens.front() == 0 && place.cu_seqlens.back() == h.size(1),
+            "ModelStage: cu_seqlens must run from 0 to the packed length");
+  }
+  if (in.positions.defined()) {
+    require(in.positions.numel() == n, "ModelStage: positions must have one entry per sequence");
+    place.positions = to_host_i64(in.positions);
+  } else {
+    place.positions.assign((size_t)n, 0);
+  }
+  if (in.slots.defined()) {
+    require(in.slots.numel() == n, "ModelStage: slots must have one entry per sequence");
+    place.rows = to_host_i64(in.slots);
+  } else {
+    for (int64_t i = 0; i < n; ++i) place.rows.push_back(i);
+  }
+  return place;
+}
+
+void ModelStageImpl::forward_chunks(const StageInput& in, const ChunkCallback& on_chunk) {
+  torch::Tensor h = embed_inputs(in);
+  const int64_t T = h.size(1);
+  const int64_t chunk = cfg_.prefill_chunk_size;
+
+  if (in.positions.defined() || in.cu_seqlens.defined()) {
+    const RowPlacement place = placement_for(in, h);
+    on_chunk(run_blocks(h, in.attn_mask, in.cache, in.pos, blocks_.empty() ? nullptr : &place),
+             in.pos, /*last_chunk=*/true);
+    return;
+  }
+
+  // Chunking needs the KV cache to carry context between chunks, and an
+  // explicit [.., T, S] mask cannot be split by position here.
+  const bool has_mask = in.attn_mask.has_value() && in.attn_mask->defined();
+  if (chunk <= 0 || T <= chunk || blocks_.empty() || has_mask) {
+    on_chunk(run_blocks(h, in.attn_mask, in.cache, in.pos, nullptr, &in.on_block_kv), in.pos, /*last_chunk=*/true);
+    return;
+  }
+
+  // Size the cache for the whole prompt, not the first chunk.
+  init_cache((in.cache != nullptr) ? *in.cache : cache_, h);
+
+  for (int64_t c0 = 0; c0 < T; c0 += chunk) {
+    const int64_t len = std::min(chunk, T - c0);
+    StageOutput out = run_blocks(h.narrow(1, c0, len), c10::nullopt, in.cache, in.pos + c0, nullptr, &in.on_block_kv);
+    on_chunk(out, in.pos + c0, /*last_chunk=*/c0 + len >= T);
+  }
+}
+
+StageOutput ModelStageImpl::forward(const StageInput& in) {
+  std::vector<StageOutput> chunks;
+  forward_chunks(in, [&](const StageOutput& out, int64_t, bool) { chunks.push_back(out); });
+  if (chunks.size() == 1) return chunks.front();
+
+  StageOutput out;
+  std::vector<torch::Tensor> hidden;
+  std::vector<torch::Tensor> logits;
+  for (const auto& c : chunks) {
+    hidden.push_back(c.hidden_out);
+    if (c.logits.defined()) logits.push_back(c.logits);
+  }
+  out.hidden_out = torch::cat(hidden, 1);
+  if (!logits.empty()) out.logits = torch::cat(logits, 1);
+  return out;
+}
+
+ModelStage make_stage_for_load(const ModelConfig& cfg, const torch::Device& device, bool with_vision) {
+  ParamInitGuard init({device, /*random=*/false});
+  ModelConfig stage_cfg = cfg;
+  if (!with_vision) stage_cfg.vision_hidden_size = 0;
+  ModelStage stage(stage_cfg);
+  // The vision placeholder is built from torch::nn modules on the CPU.
+  if (with_vision) stage->to(device);
+  return stage;
+}
+
 } // namespace qwen
@@ -1,7 +1,10 @@
 // src/model/moe.cpp
 #include "model/moe.h"
 
+#include <cmath>
+
 #include "core/tensor_utils.h"
+#include "model/param_init.h"
 
 namespace qwen {
 
@@ -29,11 +32,24 @@ MoeImpl::MoeImpl(const ModelConfig& cfg, int32_t layer_index_in_stage)
     require(cfg_.num_experts > 0, "Moe: cfg.num_experts must be set when use_moe=true");
     require(cfg_.top_k > 0, "Moe: cfg.top_k must be set when use_moe=true");
 
-    router_ = register_module(
-        "router",
-        torch::nn::Linear(torch::nn::LinearOptions(cfg_.hidden_size, cfg_.num_experts).bias(false)));
+    router_ = register_module("router", Linear(cfg_.hidden_size, cfg_.num_experts));
 
     const int64_t h = expert_hidden_dim();
+
+    if (cfg_.moe_stacked_experts) {
+      // Same init bounds as the per-expert nn::Linear weights (1/sqrt(fan_in)).
+      const double gu_bound = 1.0 / std::sqrt((double)model_dim());
+      const double dn_bound = 1.0 / std::sqrt((double)h);
+      gate_up_proj_ = register_parameter("gate_up_proj", empty_param({cfg_.num_experts, 2 * h, model_dim()}));
+      down_proj_ = register_parameter("down_proj", empty_param({cfg_.num_experts, model_dim(), h}));
+      if (param_init().random) {
+        torch::NoGradGuard ng;
+        gate_up_proj_.uniform_(-gu_bound, gu_bound);
+        down_proj_.uniform_(-dn_bound, dn_bound);
+      }
+      return;
+    }
+
     experts_mods_.reserve((size_t)cfg_.num_experts);
     experts_raw_.reserve((size_t)cfg_.num_experts);
 
@@ -54,11 +70,130 @@ MoeImpl::MoeImpl(const ModelConfig& cfg, int32_t layer_index_in_stage)
   }
 }
 
-MoeOutput MoeImpl::forward(const torch::Tensor& x) {
+void MoeImpl::check_input(const torch::Tensor& x) const {
   require(x.defined(), "Moe: x is undefined");
-  require_cuda(x, "Moe: x must be CUDA");
   require(x.dim() == 3, "Moe: expected x shape [B, T, D]");
   require(x.size(2) == cfg_.hidden_size, "Moe: hidden_size mismatch");
+}
+
+torch::Tensor MoeImpl::run_expert(int32_t e, const torch::Tensor& x) {
+  if (!stacked_experts()) {
+    return experts_mods_[(size_t)e]->forward(x);
+  }
+  auto gu = torch::linear(x, gate_up_proj_.select(0, e)); // [..., 2I]
+  auto parts = gu.chunk(2, -1);
+  auto hidden = torch::silu(parts[0]) * parts[1];         // [..., I]
+  return torch::linear(hidden, down_proj_.select(0, e));  // [..., D]
+}
+
+torch::Tensor MoeImpl::dispatch_grouped(const torch::Tensor& x_flat,
+                                        const torch::Tensor& expert_ids,
+                                        const torch::Tensor& gates) {
+  // Flatten the N*K (token, expert) assignments, sort them by expert id, then
+  // run each active expert exactly once on the rows routed to it and
+  // scatter-add the gated result back.
+  const int64_t K = expert_ids.size(-1);
+  const int32_t E = cfg_.num_experts;
+
+  auto flat_expert = expert_ids.reshape({-1}); // [N*K]
+  auto flat_gate = gates.reshape({-1});        // [N*K]
+
+  auto sorted = torch::sort(flat_expert, /*stable=*/true, /*dim=*/0, /*descending=*/false);
+  auto order = std::get<1>(sorted);                                   // assignment ids grouped by expert
+  auto token_rows = order.div(K, /*rounding_mode=*/"floor");          // [N*K] row in x_flat
+  auto gate_sorted = flat_gate.index_select(0, order).unsqueeze(-1);  // [N*K,1]
+
+  // Per-expert group sizes: the only host sync on this path.
+  auto counts = torch::bincount(flat_expert, /*weights=*/{}, /*minlength=*/E).to(torch::kCPU);
+  auto counts_acc = counts.accessor<int64_t, 1>();
+
+  auto y = torch::zeros_like(x_flat);
+  int64_t start = 0;
+  for (int32_t e = 0; e < E; ++e) {
+    const int64_t n = counts_acc[e];
+    if (n == 0) continue;
+
+    auto rows = token_rows.narrow(0, start, n);
+    auto xe = x_flat.index_select(0, rows); // [n,D]
+    auto ye = run_expert(e, xe) * gate_sorted.narrow(0, start, n);
+    y.index_add_(0, rows, ye);
+    start += n;
+  }
+  return y;
+}
+
+torch::Tensor MoeImpl::dispatch_batched(const torch::Tensor& x_flat,
+                                        const torch::Tensor& expert_ids,
+                                        const torch::Tensor& gates) {
+  // Sort the N*K assignments by expert as in dispatch_grouped, then place
+  // expert e's rows at [e, 0..n_e) of a zero-padded [E, max_n, D] buffer and
+  // run every expert in one bmm against the stacked weights.
+  const int64_t K = expert_ids.size(-1);
+  const int64_t E = cfg_.num_experts;
+  const int64_t D = x_flat.size(1);
+
+  auto flat_expert = expert_ids.reshape({-1}); // [N*K]
+  auto flat_gate = gates.reshape({-1});        // [N*K]
+
+  auto sorted = torch::sort(flat_expert, /*stable=*/true, /*dim=*/0, /*descending=*/false);
+  auto sorted_expert = std::get<0>(sorted);
+  auto order = std::get<1>(sorted);
+  auto token_rows = order.div(K, /*rounding_mode=*/"floor");
+  auto gate_sorted = flat_gate.index_select(0, order).unsqueeze(-1);
+
+  // Padded slot of each sorted assignment: e * max_n + rank within expert e.
+  auto counts = torch::bincount(flat_expert, /*weights=*/{}, /*minlength=*/E);
+  const int64_t max_n = counts.max().item<int64_t>(); // the only host sync on this path
+  auto first = counts.cumsum(0) - counts;             // first sorted index of each expert
+  auto rank = torch::arange(flat_expert.size(0), flat_expert.options()) - first.index_select(0, sorted_expert);
+  auto slots = sorted_expert * max_n + rank;
+
+  auto xp = torch::zeros({E * max_n, D}, x_flat.options());
+  xp.index_copy_(0, slots, x_flat.index_select(0, token_rows));
+
+  auto gu = torch::bmm(xp.view({E, max_n, D}), gate_up_proj_.transpose(1, 2)); // [E, max_n, 2I]
+  auto parts = gu.chunk(2, -1);
+  auto hidden = torch::silu(parts[0]) * parts[1];                              // [E, max_n, I]
+  auto yp = torch::bmm(hidden, down_proj_.transpose(1, 2)).view({E * max_n, D});
+
+  auto y = torch::zeros_like(x_flat);
+  y.index_add_(0, token_rows, yp.index_select(0, slots) * gate_sorted);
+  return y;
+}
+
+MoeOutput MoeImpl::forward(const torch::Tensor& x) {
+  check_input(x);
+
+  MoeOutput out;
+
+  if (!use_moe_) {
+    out.y = experts_mods_[0]->forward(x);
+    out.router_logits = torch::Tensor();
+    return out;
+  }
+
+  // Router logits: [B,T,E]
+  auto logits = router_->forward(x);
+  out.router_logits = logits;
+
+  auto topk = torch::topk(logits, cfg_.top_k, /*dim=*/-1, /*largest=*/true, /*sorted=*/false);
+  auto topk_vals = std::get<0>(topk); // [B,T,K]
+  auto topk_idx  = std::get<1>(topk); // [B,T,K] int64
+  auto gates = torch::softmax(topk_vals, -1); // [B,T,K]
+
+  auto x_flat = x.reshape({-1, x.size(2)}); // [N,D]
+  // Prefill on stacked weights runs all experts in one bmm; decode touches
+  // few experts, so the per-expert loop does less work there.
+  if (stacked_experts() && x.size(1) > 1) {
+    out.y = dispatch_batched(x_flat, topk_idx, gates).view_as(x);
+  } else {
+    out.y = dispatch_grouped(x_flat, topk_idx, gates).view_as(x);
+  }
+  return out;
+}
+
+MoeOutput MoeImpl::forward_reference(const torch::Tensor& x) {
+  check_input(x);
 
   MoeOutput out;
 
@@ -81,12 +216,11 @@ MoeOutput MoeImpl::forward(const torch::Tensor& x) {
   auto gates = torch::softmax(topk_vals, -1); // [B,T,K]
 
   // Correctness-first dispatch: compute each expert output once, then mask+accumulate.
-  // This is not optimized and will be replaced by a fused routing path later.
   const int32_t E = cfg_.num_experts;
   std::vector<torch::Tensor> ex_outs;
   ex_outs.reserve((size_t)E);
   for (int32_t e = 0; e < E; ++e) {
-    ex_outs.push_back(experts_mods_[(size_t)e]->forward(x)); // [B,T,D]
+    ex_outs.push_back(run_expert(e, x)); // [B,T,D]
   }
 
   auto y = torch::zeros_like(x);
@@ -0,0 +1,26 @@
+#include "model/param_init.h"
+
+namespace qwen {
+namespace {
+
+thread_local ParamInit g_param_init;
+
+} // namespace
+
+const ParamInit& param_init() {
+  return g_param_init;
+}
+
+ParamInitGuard::ParamInitGuard(ParamInit init) : prev_(g_param_init) {
+  g_param_init = init;
+}
+
+ParamInitGuard::~ParamInitGuard() {
+  g_param_init = prev_;
+}
+
+torch::Tensor empty_param(at::IntArrayRef sizes) {
+  return torch::empty(sizes, torch::TensorOptions().dtype(torch::kFloat32).device(g_param_init.device));
+}
+
+} // namespace qwen
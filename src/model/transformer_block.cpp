@@ -18,13 +18,13 @@ torch::Tensor TransformerBlockImpl::forward(const torch::Tensor& x,
                                             const c10::optional<torch::Tensor>& attn_mask,
                                             KVCache* cache,
                                             int64_t pos,
-                                            const c10::optional<RopeTables>& rope) {
+                                            const c10::optional<RopeTables>& rope,
+                                            const RowPlacement* place) {
   require(x.defined(), "TransformerBlock: x is undefined");
-  require_cuda(x, "TransformerBlock: x");
   require(x.dim() == 3, "TransformerBlock: expected [B,T,D]");
 
   auto h = ln1_->forward(x);
-  auto a = attn_->forward(h, attn_mask, cache, pos, rope);
+  auto a = attn_->forward(h, attn_mask, cache, pos, rope, place);
   auto x1 = x + a;
 
   auto h2 = ln2_->forward(x1);
@@ -0,0 +1,294 @@
+#include "runtime/async_transport.h"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <utility>
+
+#ifdef USE_CUDA
+#include <ATen/cuda/CUDAContext.h>
+#include <ATen/cuda/CUDAEvent.h>
+#endif
+
+namespace qwen {
+
+// ---------------------------------------------------------------------------
+// StagingPool
+// ---------------------------------------------------------------------------
+
+struct StagingPool::State {
+  bool pinned = false;
+  int64_t max_free = 8;
+
+  std::mutex mu;
+  std::multimap<int64_t, torch::Tensor> free;   // capacity (bytes) -> uint8 block
+  int64_t allocations = 0;
+
+  void give_back(torch::Tensor block) {
+    std::lock_guard<std::mutex> lock(mu);
+    if ((int64_t)free.size() < max_free) free.emplace(block.numel(), std::move(block));
+  }
+};
+
+StagingPool::StagingPool(bool pinned, int64_t max_free) : state_(std::make_shared<State>()) {
+  state_->pinned = pinned && torch::cuda::is_available();
+  state_->max_free = std::max<int64_t>(0, max_free);
+}
+
+bool StagingPool::pinned() const {
+  return state_->pinned;
+}
+
+int64_t StagingPool::allocations() const {
+  std::lock_guard<std::mutex> lock(state_->mu);
+  return state_->allocations;
+}
+
+torch::Tensor StagingPool::empty(at::IntArrayRef sizes, c10::ScalarType dtype) {
+  int64_t numel = 1;
+  for (int64_t s : sizes) numel *= s;
+  const int64_t nbytes = numel * (int64_t)c10::elementSize(dtype);
+  if (nbytes == 0) return torch::empty(sizes, torch::TensorOptions().dtype(dtype));
+
+  torch::Tensor block;
+  {
+    std::lock_guard<std::mutex> lock(state_->mu);
+    auto it = state_->free.lower_bound(nbytes);
+    if (it != state_->free.end()) {
+      block = std::move(it->second);
+      state_->free.erase(it);
+    } else {
+      ++state_->allocations;
+    }
+  }
+  if (!block.defined()) {
+    // Power-of-two capacities let slightly different packet sizes (prefill
+    // chunks, growing batches) share blocks.
+    int64_t cap = 4096;
+    while (cap < nbytes) cap *= 2;
+    block = torch::empty({cap}, torch::TensorOptions().dtype(torch::kUInt8).pinned_memory(state_->pinned));
+  }
+
+  std::shared_ptr<State> state = state_;
+  return torch::from_blob(
+      block.data_ptr(),
+      sizes,
+      [state, block](void*) { state->give_back(block); },
+      torch::TensorOptions().dtype(dtype));
+}
+
+// ---------------------------------------------------------------------------
+// AsyncSender
+// ---------------------------------------------------------------------------
+
+struct AsyncSender::Item {
+  ActivationPacket packet;
+  KVPacket kv;
+  bool is_kv = false;
+#ifdef USE_CUDA
+  // Recorded after the device-to-host copies of this packet.
+  std::shared_ptr<at::cuda::CUDAEvent> ready;
+  int device = -1;
+#endif
+};
+
+AsyncSender::AsyncSender(SendFn send_fn, int64_t depth, std::shared_ptr<StagingPool> pool, KVSendFn send_kv_fn)
+    : send_fn_(std::move(send_fn)),
+      send_kv_fn_(std::move(send_kv_fn)),
+      depth_(std::max<int64_t>(1, depth)),
+      pool_(pool ? std::move(pool) : std::make_shared<StagingPool>(true)) {
+  thread_ = std::thread([this]() { loop(); });
+}
+
+AsyncSender::~AsyncSender() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+torch::Tensor AsyncSender::stage(const torch::Tensor& t, Item* item) {
+  if (!t.defined() || !t.is_cuda()) return t;
+  torch::Tensor src = t.contiguous();
+  torch::Tensor host = pool_->empty(src.sizes(), src.scalar_type());
+#ifdef USE_CUDA
+  host.copy_(src, /*non_blocking=*/pool_->pinned());
+  item->device = src.get_device();
+#else
+  (void)item;
+  host.copy_(src);
+#endif
+  return host;
+}
+
+void AsyncSender::send(const ActivationPacket& p) {
+  auto item = std::make_unique<Item>();
+  item->packet = p;
+  ActivationPacket& q = item->packet;
+  q.hidden = stage(p.hidden, item.get());
+  if (p.attn_mask.has_value()) q.attn_mask = stage(*p.attn_mask, item.get());
+  if (p.positions.has_value()) q.positions = stage(*p.positions, item.get());
+  if (p.slots.has_value()) q.slots = stage(*p.slots, item.get());
+  if (p.cu_seqlens.has_value()) q.cu_seqlens = stage(*p.cu_seqlens, item.get());
+  if (p.hidden_scale.has_value()) q.hidden_scale = stage(*p.hidden_scale, item.get());
+  enqueue(std::move(item));
+}
+
+void AsyncSender::send_kv(const KVPacket& p) {
+  if (!send_kv_fn_) throw std::runtime_error("AsyncSender: no KV send function");
+  auto item = std::make_unique<Item>();
+  item->is_kv = true;
+  item->kv = p;
+  if (p.k.has_value()) item->kv.k = stage(*p.k, item.get());
+  if (p.v.has_value()) item->kv.v = stage(*p.v, item.get());
+  enqueue(std::move(item));
+}
+
+void AsyncSender::enqueue(std::unique_ptr<Item> item) {
+#ifdef USE_CUDA
+  if (item->device >= 0) {
+    item->ready = std::make_shared<at::cuda::CUDAEvent>();
+    item->ready->record(at::cuda::getCurrentCUDAStream((c10::DeviceIndex)item->device));
+  }
+#endif
+
+  std::unique_lock<std::mutex> lock(mu_);
+  cv_.wait(lock, [&]() { return error_ || (int64_t)queue_.size() < depth_; });
+  if (error_) std::rethrow_exception(error_);
+  queue_.push_back(std::move(item));
+  lock.unlock();
+  cv_.notify_all();
+}
+
+void AsyncSender::flush() {
+  std::unique_lock<std::mutex> lock(mu_);
+  cv_.wait(lock, [&]() { return error_ || queue_.empty(); });
+  if (error_) std::rethrow_exception(error_);
+}
+
+int64_t AsyncSender::sent() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return sent_;
+}
+
+void AsyncSender::loop() {
+  for (;;) {
+    Item* item = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [&]() { return stop_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      item = queue_.front().get();
+    }
+
+    std::exception_ptr err;
+    try {
+#ifdef USE_CUDA
+      if (item->ready) item->ready->synchronize();
+#endif
+      if (item->is_kv) {
+        send_kv_fn_(item->kv);
+      } else {
+        send_fn_(item->packet);
+      }
+    } catch (...) {
+      err = std::current_exception();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      queue_.pop_front();
+      if (err) {
+        error_ = err;
+        queue_.clear();
+      } else {
+        ++sent_;
+      }
+    }
+    cv_.notify_all();
+    if (err) return;
+  }
+}
+
+// ---------------------------------------------------------------------------
+// AsyncReceiver
+// ---------------------------------------------------------------------------
+
+AsyncReceiver::AsyncReceiver(RecvFn recv_fn,
+                             std::function<void()> cancel,
+                             LastFn is_last,
+                             int64_t depth,
+                             std::shared_ptr<StagingPool> pool)
+    : recv_fn_(std::move(recv_fn)),
+      cancel_(std::move(cancel)),
+      is_last_(std::move(is_last)),
+      depth_(std::max<int64_t>(1, depth)),
+      pool_(pool ? std::move(pool) : std::make_shared<StagingPool>(true)) {
+  thread_ = std::thread([this]() { loop(); });
+}
+
+AsyncReceiver::~AsyncReceiver() {
+  bool running = false;
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+    running = !done_;
+  }
+  cv_.notify_all();
+  if (running && cancel_) cancel_();
+  if (thread_.joinable()) thread_.join();
+}
+
+ActivationPacket AsyncReceiver::pop() {
+  std::unique_lock<std::mutex> lock(mu_);
+  cv_.wait(lock, [&]() { return !queue_.empty() || done_; });
+  if (queue_.empty()) {
+    if (error_) std::rethrow_exception(error_);
+    throw std::runtime_error("AsyncReceiver: no more packets");
+  }
+  ActivationPacket p = std::move(queue_.front());
+  queue_.pop_front();
+  lock.unlock();
+  cv_.notify_all();
+  return p;
+}
+
+void AsyncReceiver::loop() {
+  const TensorAllocator alloc = [this](at::IntArrayRef sizes, c10::ScalarType dtype) {
+    return pool_->empty(sizes, dtype);
+  };
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(mu_);
+      cv_.wait(lock, [&]() { return stop_ || (int64_t)queue_.size() < depth_; });
+      if (stop_) break;
+    }
+
+    ActivationPacket p;
+    try {
+      p = recv_fn_(alloc);
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(mu_);
+      error_ = std::current_exception();
+      break;
+    }
+
+    const bool last = p.kind == PacketKind::kShutdown || (is_last_ && is_last_(p));
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      queue_.push_back(std::move(p));
+    }
+    cv_.notify_all();
+    if (last) break;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    done_ = true;
+  }
+  cv_.notify_all();
+}
+
+} // namespace qwen
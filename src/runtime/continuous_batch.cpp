@@ -0,0 +1,147 @@
+#include "runtime/continuous_batch.h"
+
+#include "core/tensor_utils.h"
+
+namespace qwen {
+
+torch::Tensor pack_sequences(const std::vector<torch::Tensor>& seqs, torch::Tensor* cu_seqlens) {
+  require(!seqs.empty(), "pack_sequences: no sequences");
+  require(cu_seqlens != nullptr, "pack_sequences: cu_seqlens is null");
+  std::vector<int64_t> cu = {0};
+  for (const auto& s : seqs) {
+    require(s.defined() && s.dim() == 2 && s.size(0) == 1, "pack_sequences: sequences must be [1, T]");
+    cu.push_back(cu.back() + s.size(1));
+  }
+  *cu_seqlens = torch::tensor(cu, torch::TensorOptions().dtype(torch::kInt64));
+  return seqs.size() == 1 ? seqs.front() : torch::cat(seqs, 1);
+}
+
+torch::Tensor packed_last_indices(const torch::Tensor& cu_seqlens) {
+  require(cu_seqlens.defined() && cu_seqlens.dim() == 1 && cu_seqlens.numel() >= 2,
+          "packed_last_indices: cu_seqlens must be [N+1]");
+  return cu_seqlens.narrow(0, 1, cu_seqlens.numel() - 1).to(torch::kInt64) - 1;
+}
+
+ContinuousBatchScheduler::ContinuousBatchScheduler(int64_t num_slots, bool static_batching)
+    : static_batching_(static_batching) {
+  require(num_slots > 0, "ContinuousBatchScheduler: num_slots must be > 0");
+  slots_.resize((size_t)num_slots);
+}
+
+void ContinuousBatchScheduler::submit(SequenceRequest r) {
+  require(r.prompt.defined() && r.prompt.dim() == 2 && r.prompt.size(0) == 1 && r.prompt.size(1) > 0,
+          "ContinuousBatchScheduler: prompt must be [1, T] with T > 0");
+  require(r.max_new_tokens > 0, "ContinuousBatchScheduler: max_new_tokens must be > 0");
+  r.prompt = r.prompt.to(torch::kCPU, torch::kInt64);
+  queue_.push_back(std::move(r));
+}
+
+int64_t ContinuousBatchScheduler::running() const {
+  int64_t n = 0;
+  for (const auto& s : slots_) n += s.active ? 1 : 0;
+  return n;
+}
+
+bool ContinuousBatchScheduler::next(ScheduledBatch* out) {
+  require(out != nullptr, "ContinuousBatchScheduler: out is null");
+  auto i64 = torch::TensorOptions().dtype(torch::kInt64);
+
+  // Static batching admits a whole batch only once the previous one drained.
+  if (!static_batching_ || running() == 0) admitting_ = true;
+
+  // Every queued request that fits a free slot is prefilled in one packed
+  // forward.
+  if (admitting_ && !queue_.empty()) {
+    std::vector<torch::Tensor> prompts;
+    std::vector<int64_t> admitted;
+    for (int64_t s = 0; s < num_slots() && !queue_.empty(); ++s) {
+      Slot& slot = slots_[(size_t)s];
+      if (slot.active) continue;
+      SequenceRequest r = std::move(queue_.front());
+      queue_.pop_front();
+      slot = Slot();
+      slot.active = true;
+      slot.id = r.id;
+      slot.max_new_tokens = r.max_new_tokens;
+      slot.admitted_iteration = iterations_;
+      prompts.push_back(r.prompt);
+      admitted.push_back(s);
+    }
+    if (!admitted.empty()) {
+      out->prefill = true;
+      out->input_ids = pack_sequences(prompts, &out->cu_seqlens);
+      out->positions = torch::zeros({(int64_t)admitted.size()}, i64);
+      out->slots = torch::tensor(admitted, i64);
+      ++iterations_;
+      return true;
+    }
+  }
+  if (static_batching_) admitting_ = false;
+
+  std::vector<int64_t> ids;
+  std::vector<int64_t> positions;
+  std::vector<int64_t> rows;
+  for (int64_t s = 0; s < num_slots(); ++s) {
+    const Slot& slot = slots_[(size_t)s];
+    if (!slot.active) continue;
+    ids.push_back(slot.tokens.back());
+    positions.push_back(slot.length);
+    rows.push_back(s);
+  }
+  if (rows.empty()) {
+    require(queue_.empty(), "ContinuousBatchScheduler: requests queued but no slot could be admitted");
+    return false;
+  }
+
+  const int64_t B = (int64_t)rows.size();
+  out->prefill = false;
+  out->input_ids = torch::tensor(ids, i64).view({B, 1});
+  out->positions = torch::tensor(positions, i64);
+  out->slots = torch::tensor(rows, i64);
+  out->cu_seqlens = torch::Tensor();
+  ++iterations_;
+  ++decode_iterations_;
+  decode_rows_ += B;
+  return true;
+}
+
+void ContinuousBatchScheduler::complete(const ScheduledBatch& batch, const torch::Tensor& tokens) {
+  const int64_t B = batch.slots.numel();
+  auto tok = tokens.to(torch::kCPU, torch::kInt64).reshape({-1}).contiguous();
+  require(tok.numel() == B, "ContinuousBatchScheduler: expected one token per batch row");
+  auto slots = batch.slots.contiguous();
+  torch::Tensor cu;
+  if (batch.prefill) {
+    cu = batch.cu_seqlens.to(torch::kCPU, torch::kInt64).contiguous();
+    require(cu.numel() == B + 1, "ContinuousBatchScheduler: prefill batch needs cu_seqlens [B+1]");
+  }
+
+  for (int64_t i = 0; i < B; ++i) {
+    const int64_t s = slots.data_ptr<int64_t>()[i];
+    Slot& slot = slots_[(size_t)s];
+    require(slot.active, "ContinuousBatchScheduler: token for an inactive slot");
+    slot.length += batch.prefill ? cu.data_ptr<int64_t>()[i + 1] - cu.data_ptr<int64_t>()[i] : 1;
+    slot.tokens.push_back(tok.data_ptr<int64_t>()[i]);
+    if ((int64_t)slot.tokens.size() >= slot.max_new_tokens) finish(s);
+  }
+}
+
+void ContinuousBatchScheduler::finish(int64_t s) {
+  Slot& slot = slots_[(size_t)s];
+  FinishedSequence f;
+  f.id = slot.id;
+  f.tokens = torch::tensor(slot.tokens, torch::TensorOptions().dtype(torch::kInt64)).view({1, -1});
+  f.slot = s;
+  f.admitted_iteration = slot.admitted_iteration;
+  f.finished_iteration = iterations_;
+  finished_.push_back(std::move(f));
+  slot = Slot();
+}
+
+std::vector<FinishedSequence> ContinuousBatchScheduler::take_finished() {
+  std::vector<FinishedSequence> out;
+  out.swap(finished_);
+  return out;
+}
+
+} // namespace qwen
@@ -0,0 +1,93 @@
+#include "runtime/hidden_codec.h"
+
+#include "core/tensor_utils.h"
+
+namespace qwen {
+
+bool parse_hidden_codec(const std::string& s, HiddenCodec* codec) {
+  if (s == "none") {
+    *codec = HiddenCodec::kNone;
+  } else if (s == "int8") {
+    *codec = HiddenCodec::kInt8;
+  } else if (s == "fp8") {
+    *codec = HiddenCodec::kFp8;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* hidden_codec_name(HiddenCodec codec) {
+  switch (codec) {
+    case HiddenCodec::kNone:
+      return "none";
+    case HiddenCodec::kInt8:
+      return "int8";
+    case HiddenCodec::kFp8:
+      return "fp8";
+  }
+  return "?";
+}
+
+// Largest code magnitude: int8 stays symmetric, e4m3 tops out at 448.
+static double codec_qmax(HiddenCodec codec) {
+  return codec == HiddenCodec::kInt8 ? 127.0 : 448.0;
+}
+
+std::pair<torch::Tensor, torch::Tensor> quantize_rows(const torch::Tensor& x, HiddenCodec codec) {
+  require(codec == HiddenCodec::kInt8 || codec == HiddenCodec::kFp8, "quantize_rows: not a quantizing codec");
+  require(x.defined() && x.dim() >= 1, "quantize_rows: expected [..., D]");
+  require(c10::isFloatingType(x.scalar_type()), "quantize_rows: expected a floating-point tensor");
+
+  const double qmax = codec_qmax(codec);
+  auto xf = x.to(torch::kFloat32);
+  // All-zero rows get a tiny scale instead of dividing by zero.
+  auto scale = xf.abs().amax(-1).div(qmax).clamp_min(1e-12);
+  auto y = xf.div(scale.unsqueeze(-1)).clamp(-qmax, qmax);
+  torch::Tensor codes = codec == HiddenCodec::kInt8 ? y.round().to(torch::kInt8) : y.to(torch::kFloat8_e4m3fn);
+  return {codes, scale};
+}
+
+torch::Tensor dequantize_rows(const torch::Tensor& codes, const torch::Tensor& scale, c10::ScalarType dtype) {
+  require(codes.defined() && scale.defined(), "dequantize_rows: codes/scale undefined");
+  require(scale.sizes() == codes.sizes().slice(0, codes.dim() - 1), "dequantize_rows: scale shape mismatch");
+  return codes.to(torch::kFloat32).mul(scale.to(torch::kFloat32).unsqueeze(-1)).to(dtype);
+}
+
+void quantize_hidden(ActivationPacket* p, HiddenCodec codec) {
+  require(p, "quantize_hidden: packet is null");
+  if (codec == HiddenCodec::kNone || p->codec != HiddenCodec::kNone) return;
+  if (!p->hidden.defined() || p->hidden.numel() == 0 || !c10::isFloatingType(p->hidden.scalar_type())) return;
+
+  auto q = quantize_rows(p->hidden, codec);
+  p->hidden_dtype = p->hidden.scalar_type();
+  p->hidden = q.first;
+  p->hidden_scale = q.second;
+  p->codec = codec;
+}
+
+torch::Tensor hidden_on(const ActivationPacket& p, const torch::Device& device) {
+  if (p.codec == HiddenCodec::kNone) return p.hidden.to(device);
+  require(p.hidden_scale.has_value() && p.hidden_scale->defined(), "hidden_on: quantized hidden without scales");
+  require(c10::isFloatingType(p.hidden_dtype), "hidden_on: quantized hidden without a floating-point dtype");
+  // Codes cross to the device first; the wide tensor only exists there.
+  return dequantize_rows(p.hidden.to(device), p.hidden_scale->to(device), p.hidden_dtype);
+}
+
+CodecError error_between(const torch::Tensor& a, const torch::Tensor& b) {
+  require(a.defined() && b.defined() && a.sizes() == b.sizes(), "error_between: shape mismatch");
+  CodecError e;
+  if (a.numel() == 0) return e;
+  auto d = (a.to(torch::kFloat32) - b.to(a.device(), torch::kFloat32)).abs();
+  e.max_abs = d.max().item<double>();
+  e.mean_abs = d.mean().item<double>();
+  return e;
+}
+
+CodecError codec_error(const torch::Tensor& x, HiddenCodec codec) {
+  if (codec == HiddenCodec::kNone) return CodecError{};
+  auto q = quantize_rows(x, codec);
+  return error_between(dequantize_rows(q.first, q.second, torch::kFloat32), x);
+}
+
+} // namespace qwen
@@ -0,0 +1,184 @@
+#include "runtime/inproc_transport.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+namespace qwen {
+
+struct InProcItem {
+  bool is_kv = false;
+  ActivationPacket act;
+  KVPacket kv;
+};
+
+struct InProcChannel {
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<InProcItem> to[2];  // packets waiting for side i
+  size_t capacity = 0;
+  bool closed = false;
+};
+
+static torch::Tensor copy_of(const torch::Tensor& t) {
+  return t.defined() ? t.clone() : t;
+}
+
+static c10::optional<torch::Tensor> copy_of(const c10::optional<torch::Tensor>& t) {
+  if (!t.has_value()) return t;
+  return copy_of(*t);
+}
+
+// ---------------------------------------------------------------------------
+// InProcTransport
+// ---------------------------------------------------------------------------
+
+InProcTransport::InProcTransport(std::shared_ptr<InProcChannel> ch, int side) : ch_(std::move(ch)), side_(side) {}
+
+InProcTransport::~InProcTransport() {
+  shutdown();
+}
+
+void InProcTransport::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(ch_->mu);
+    ch_->closed = true;
+  }
+  ch_->cv.notify_all();
+}
+
+static void push_item(InProcChannel& ch, int to, InProcItem item, const char* what) {
+  std::unique_lock<std::mutex> lock(ch.mu);
+  ch.cv.wait(lock, [&]() { return ch.closed || ch.capacity == 0 || ch.to[to].size() < ch.capacity; });
+  if (ch.closed) throw std::runtime_error(std::string(what) + ": connection closed");
+  ch.to[to].push_back(std::move(item));
+  lock.unlock();
+  ch.cv.notify_all();
+}
+
+static InProcItem pop_item(InProcChannel& ch, int side, bool want_kv, const char* what) {
+  std::unique_lock<std::mutex> lock(ch.mu);
+  ch.cv.wait(lock, [&]() { return ch.closed || !ch.to[side].empty(); });
+  if (ch.to[side].empty()) throw std::runtime_error(std::string(what) + ": connection closed by peer");
+  if (ch.to[side].front().is_kv != want_kv) {
+    throw std::runtime_error(std::string(what) + (want_kv ? ": next packet is an activation" : ": next packet is KV"));
+  }
+  InProcItem item = std::move(ch.to[side].front());
+  ch.to[side].pop_front();
+  lock.unlock();
+  ch.cv.notify_all();
+  return item;
+}
+
+void InProcTransport::send_activation(const ActivationPacket& p) {
+  InProcItem item;
+  item.act = p;
+  item.act.hidden = copy_of(p.hidden);
+  item.act.attn_mask = copy_of(p.attn_mask);
+  item.act.positions = copy_of(p.positions);
+  item.act.slots = copy_of(p.slots);
+  item.act.cu_seqlens = copy_of(p.cu_seqlens);
+  item.act.hidden_scale = copy_of(p.hidden_scale);
+  push_item(*ch_, 1 - side_, std::move(item), "inproc send_activation");
+}
+
+ActivationPacket InProcTransport::recv_activation(const TensorAllocator& alloc) {
+  (void)alloc;  // nothing is read into host memory
+  return std::move(pop_item(*ch_, side_, false, "recv_activation").act);
+}
+
+void InProcTransport::send_kv(const KVPacket& p) {
+  InProcItem item;
+  item.is_kv = true;
+  item.kv = p;
+  item.kv.k = copy_of(p.k);
+  item.kv.v = copy_of(p.v);
+  push_item(*ch_, 1 - side_, std::move(item), "inproc send_kv");
+}
+
+KVPacket InProcTransport::recv_kv() {
+  return std::move(pop_item(*ch_, side_, true, "recv_kv").kv);
+}
+
+std::pair<std::unique_ptr<InProcTransport>, std::unique_ptr<InProcTransport>> make_inproc_pair(
+    const InProcOptions& opts) {
+  auto ch = std::make_shared<InProcChannel>();
+  ch->capacity = opts.capacity > 0 ? (size_t)opts.capacity : 0;
+  return {std::make_unique<InProcTransport>(ch, 0), std::make_unique<InProcTransport>(ch, 1)};
+}
+
+// ---------------------------------------------------------------------------
+// Listener table
+// ---------------------------------------------------------------------------
+
+struct InProcAcceptQueue {
+  std::mutex mu;
+  std::condition_variable cv;
+  std::deque<std::unique_ptr<InProcTransport>> pending;
+};
+
+struct InProcRegistry {
+  std::mutex mu;
+  std::condition_variable cv;
+  std::unordered_map<int, std::shared_ptr<InProcAcceptQueue>> ports;
+  int next_port = 1 << 16;  // port 0: above the TCP range
+};
+
+static InProcRegistry& registry() {
+  static InProcRegistry r;
+  return r;
+}
+
+InProcListener::InProcListener(int port) : q_(std::make_shared<InProcAcceptQueue>()) {
+  InProcRegistry& r = registry();
+  {
+    std::lock_guard<std::mutex> lock(r.mu);
+    if (port == 0) {
+      while (r.ports.count(r.next_port)) ++r.next_port;
+      port = r.next_port++;
+    }
+    if (r.ports.count(port)) throw std::runtime_error("inproc listen: port " + std::to_string(port) + " in use");
+    r.ports[port] = q_;
+    port_ = port;
+  }
+  r.cv.notify_all();
+}
+
+InProcListener::~InProcListener() {
+  InProcRegistry& r = registry();
+  std::lock_guard<std::mutex> lock(r.mu);
+  r.ports.erase(port_);
+}
+
+std::unique_ptr<InProcTransport> InProcListener::accept_one() {
+  std::unique_lock<std::mutex> lock(q_->mu);
+  q_->cv.wait(lock, [&]() { return !q_->pending.empty(); });
+  std::unique_ptr<InProcTransport> conn = std::move(q_->pending.front());
+  q_->pending.pop_front();
+  return conn;
+}
+
+std::unique_ptr<InProcTransport> inproc_connect(int port, const InProcOptions& opts) {
+  InProcRegistry& r = registry();
+  std::shared_ptr<InProcAcceptQueue> q;
+  {
+    std::unique_lock<std::mutex> lock(r.mu);
+    const bool found = r.cv.wait_for(lock, std::chrono::milliseconds(opts.connect_timeout_ms),
+                                     [&]() { return r.ports.count(port) > 0; });
+    if (!found) throw std::runtime_error("inproc connect: no listener on port " + std::to_string(port));
+    q = r.ports[port];
+  }
+  auto ends = make_inproc_pair(opts);
+  {
+    std::lock_guard<std::mutex> lock(q->mu);
+    q->pending.push_back(std::move(ends.second));
+  }
+  q->cv.notify_all();
+  return std::move(ends.first);
+}
+
+} // namespace qwen
@@ -5,58 +5,93 @@
 namespace qwen {
 
 PackedKV pack_kv_cache(const KVCache& cache) {
+  if (!cache.is_initialized()) return PackedKV{};
+  // Dense caches ship the whole buffer (wire format unchanged); paged caches
+  // ship only the positions written so far.
+  const int64_t S = cache.is_paged() ? cache.length() : cache.max_seq_len();
+  return pack_kv_range(cache, 0, S);
+}
+
+PackedKV pack_kv_range(const KVCache& cache, int64_t start, int64_t len, bool pinned) {
   PackedKV out;
-  if (!cache.is_initialized()) return out;
+  out.start = start;
+  if (!cache.is_initialized() || len <= 0) return out;
+  require(start >= 0 && start + len <= cache.max_seq_len(), "pack_kv_range: range exceeds max_seq_len");
 
   const int32_t L = cache.num_layers();
-  std::vector<torch::Tensor> ks;
-  std::vector<torch::Tensor> vs;
-  ks.reserve((size_t)L);
-  vs.reserve((size_t)L);
+  const int64_t B = cache.max_batch();
+
+  // One [2, L, B, H, len, D] host buffer; each layer's slice is copied into
+  // place, so there is no per-layer temporary and no stack.
+  auto buf = torch::empty({2, (int64_t)L, B, (int64_t)cache.kv_heads(), len, (int64_t)cache.head_dim()},
+                          torch::TensorOptions()
+                              .dtype(cache.dtype())
+                              .pinned_memory(pinned && torch::cuda::is_available()));
+  out.k = buf.select(0, 0);
+  out.v = buf.select(0, 1);
 
   for (int32_t i = 0; i < L; ++i) {
-    auto k = cache.layer(i).k;
-    auto v = cache.layer(i).v;
-    require(k.defined() && v.defined(), "pack_kv_cache: k/v undefined");
-    if (k.is_cuda()) k = k.to(torch::kCPU);
-    if (v.is_cuda()) v = v.to(torch::kCPU);
-    if (!k.is_contiguous()) k = k.contiguous();
-    if (!v.is_contiguous()) v = v.contiguous();
-    ks.push_back(k);
-    vs.push_back(v);
+    // Dense ranges are strided windows of the cache buffer; paged caches
+    // gather only the blocks covering [start, start + len).
+    auto k = cache.keys_range(i, B, start, len);
+    auto v = cache.values_range(i, B, start, len);
+    require(k.defined() && v.defined(), "pack_kv_range: k/v undefined");
+    out.k.select(0, i).copy_(k);
+    out.v.select(0, i).copy_(v);
   }
-
-  out.k = torch::stack(ks, 0);
-  out.v = torch::stack(vs, 0);
   return out;
 }
 
-void restore_kv_cache(KVCache* cache, const torch::Tensor& k, const torch::Tensor& v) {
+void restore_kv_cache(KVCache* cache, const torch::Tensor& k, const torch::Tensor& v, int64_t start) {
   require(cache, "restore_kv_cache: cache is null");
   require(cache->is_initialized(), "restore_kv_cache: cache not initialized");
   require(k.defined() && v.defined(), "restore_kv_cache: k/v undefined");
   require(k.dim() == 5 && v.dim() == 5, "restore_kv_cache: expected [L,B,H,S,D]");
   require(k.sizes() == v.sizes(), "restore_kv_cache: k/v shape mismatch");
+  require(start >= 0, "restore_kv_cache: start must be >= 0");
 
   const int32_t L = cache->num_layers();
   require(k.size(0) == L, "restore_kv_cache: layer count mismatch");
+  if (k.size(3) == 0) return;
 
+  // Writes positions [start, start + S) of rows [0, B); works for dense and
+  // paged caches. One host-to-device copy per tensor, then per-layer appends
+  // from device memory.
+  const torch::Device device = device_for_index(cache->device_index());
+  auto k_dev = k.to(device, cache->dtype());
+  auto v_dev = v.to(device, cache->dtype());
   for (int32_t i = 0; i < L; ++i) {
-    auto k_i = k.index({i});
-    auto v_i = v.index({i});
-    if (k_i.is_cuda()) k_i = k_i.to(torch::kCPU);
-    if (v_i.is_cuda()) v_i = v_i.to(torch::kCPU);
-
-    auto& lk = cache->layer(i);
-    auto k_dst = lk.k;
-    auto v_dst = lk.v;
-    if (k_dst.is_cuda()) {
-      k_i = k_i.to(k_dst.device());
-      v_i = v_i.to(v_dst.device());
-    }
-    k_dst.copy_(k_i);
-    v_dst.copy_(v_i);
+    cache->append(i, k_dev.select(0, i), v_dev.select(0, i), start);
   }
 }
 
+PackedKV pack_kv_layer(const KVCache& cache, int32_t layer, int64_t start, int64_t len) {
+  PackedKV out;
+  out.start = start;
+  if (!cache.is_initialized() || len <= 0) return out;
+  require(layer >= 0 && layer < cache.num_layers(), "pack_kv_layer: layer out of range");
+  require(start >= 0 && start + len <= cache.max_seq_len(), "pack_kv_layer: range exceeds max_seq_len");
+
+  const int64_t B = cache.max_batch();
+  // contiguous() detaches the window from the cache buffer; on CUDA it is a
+  // device copy ordered on the current stream.
+  out.k = cache.keys_range(layer, B, start, len).contiguous().unsqueeze(0);
+  out.v = cache.values_range(layer, B, start, len).contiguous().unsqueeze(0);
+  return out;
+}
+
+void restore_kv_layer(KVCache* cache, int32_t layer, const torch::Tensor& k, const torch::Tensor& v, int64_t start) {
+  require(cache, "restore_kv_layer: cache is null");
+  require(cache->is_initialized(), "restore_kv_layer: cache not initialized");
+  require(k.defined() && v.defined(), "restore_kv_layer: k/v undefined");
+  require(k.dim() == 5 && k.size(0) == 1, "restore_kv_layer: expected [1,B,H,S,D]");
+  require(k.sizes() == v.sizes(), "restore_kv_layer: k/v shape mismatch");
+  require(layer >= 0 && layer < cache->num_layers(), "restore_kv_layer: layer out of range");
+  require(start >= 0, "restore_kv_layer: start must be >= 0");
+  if (k.size(3) == 0) return;
+
+  const torch::Device device = device_for_index(cache->device_index());
+  cache->append(layer, k.select(0, 0).to(device, cache->dtype()), v.select(0, 0).to(device, cache->dtype()), start);
+}
+
 } // namespace qwen
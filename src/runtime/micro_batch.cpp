@@ -0,0 +1,84 @@
+#include "runtime/micro_batch.h"
+
+#include "core/tensor_utils.h"
+
+#include <cstdio>
+
+namespace qwen {
+
+static std::vector<torch::Tensor> split_rows(const torch::Tensor& t, int64_t m) {
+  std::vector<torch::Tensor> out;
+  if (!t.defined()) {
+    out.resize((size_t)m);
+    return out;
+  }
+  return t.tensor_split(m, 0);
+}
+
+std::vector<StageInput> split_micro_batches(const StageInput& in, int64_t m) {
+  require(m >= 1, "split_micro_batches: m must be >= 1");
+  if (m == 1) return {in};
+
+  const torch::Tensor& lead = in.input_ids.defined() ? in.input_ids : in.hidden_in;
+  require(lead.defined(), "split_micro_batches: input_ids or hidden_in required");
+  const int64_t B = lead.size(0);
+  require(B >= m, "split_micro_batches: batch " + std::to_string(B) + " is smaller than " +
+                      std::to_string(m) + " micro-batches");
+
+  auto ids = split_rows(in.input_ids, m);
+  auto images = split_rows(in.images, m);
+  auto hidden = split_rows(in.hidden_in, m);
+  std::vector<torch::Tensor> masks;
+  if (in.attn_mask.has_value() && in.attn_mask->defined()) {
+    require(in.attn_mask->size(0) == B, "split_micro_batches: attn_mask must have a batch dim");
+    masks = split_rows(*in.attn_mask, m);
+  }
+
+  std::vector<StageInput> out((size_t)m);
+  for (int64_t i = 0; i < m; ++i) {
+    StageInput& mb = out[(size_t)i];
+    mb.input_ids = ids[(size_t)i];
+    mb.images = images[(size_t)i];
+    mb.hidden_in = hidden[(size_t)i];
+    mb.pos = in.pos;
+    if (!masks.empty()) mb.attn_mask = masks[(size_t)i];
+  }
+  return out;
+}
+
+void StageUtilization::begin_wall() {
+  if (started_) return;
+  started_ = true;
+  wall_begin_ = Clock::now();
+  wall_end_ = wall_begin_;
+}
+
+void StageUtilization::add_busy(const Clock::time_point& t0) {
+  const auto t1 = Clock::now();
+  if (!started_) {
+    started_ = true;
+    wall_begin_ = t0;
+  }
+  wall_end_ = t1;
+  busy_ms_ += std::chrono::duration<double, std::milli>(t1 - t0).count();
+  ++items_;
+}
+
+double StageUtilization::wall_ms() const {
+  if (!started_) return 0.0;
+  return std::chrono::duration<double, std::milli>(wall_end_ - wall_begin_).count();
+}
+
+double StageUtilization::utilization() const {
+  const double wall = wall_ms();
+  return wall > 0.0 ? busy_ms_ / wall : 0.0;
+}
+
+std::string StageUtilization::summary() const {
+  char buf[160];
+  std::snprintf(buf, sizeof(buf), "busy_ms=%.2f wall_ms=%.2f utilization=%.1f%% items=%lld",
+                busy_ms_, wall_ms(), 100.0 * utilization(), (long long)items_);
+  return buf;
+}
+
+} // namespace qwen
@@ -1,46 +1,162 @@
 #include "runtime/pipeline_stage.h"
 
+#include "core/tensor_utils.h"
+#include "runtime/hidden_codec.h"
+
+#include <stdexcept>
+
 namespace qwen {
 
 PipelineStage::PipelineStage(const ModelConfig& cfg)
     : cfg_(cfg),
       stage_(cfg_) {}
 
+PipelineStage::PipelineStage(ModelStage stage)
+    : cfg_(stage->cfg()),
+      stage_(std::move(stage)) {}
+
 StageOutput PipelineStage::run_local(const StageInput& in) {
   return stage_->forward(in);
 }
 
-StageOutput PipelineStage::run_from_activation(const ActivationPacket& p, int device_index) {
-  (void)device_index;
+torch::Device PipelineStage::stage_device() {
+  for (const auto& p : stage_->parameters()) {
+    return p.device();
+  }
+  return torch::Device(torch::kCPU);
+}
 
-  StageInput in;
+StageInput PipelineStage::input_from_activation(const ActivationPacket& p) {
+  require(p.kind == PacketKind::kActivation, "PipelineStage: not an activation packet");
+  require(p.hidden.defined(), "PipelineStage: activation packet has no hidden tensor");
 
-  // Only set fields we know exist from your compile errors / prior context.
+  const torch::Device device = stage_device();
+  StageInput in;
   in.pos = p.pos;
-  in.hidden_in = p.hidden;
-  in.attn_mask = p.attn_mask;
+  if (p.codec == HiddenCodec::kNone && !c10::isFloatingType(p.hidden.scalar_type())) {
+    in.input_ids = p.hidden.to(device);
+  } else {
+    in.hidden_in = hidden_on(p, device);
+  }
+  if (p.attn_mask.has_value() && p.attn_mask->defined()) {
+    in.attn_mask = p.attn_mask->to(device);
+  }
+  if (p.positions.has_value() && p.positions->defined()) in.positions = *p.positions;
+  if (p.slots.has_value() && p.slots->defined()) in.slots = *p.slots;
+  if (p.cu_seqlens.has_value() && p.cu_seqlens->defined()) in.cu_seqlens = *p.cu_seqlens;
+  in.cache = &request_cache(p.request_id);
+  return in;
+}
 
-  return run_local(in);
+StageOutput PipelineStage::run_from_activation(const ActivationPacket& p, int device_index) {
+  (void)device_index;
+  return run_local(input_from_activation(p));
+}
+
+void PipelineStage::run_chunks_from_activation(const ActivationPacket& p,
+                                               const ModelStageImpl::ChunkCallback& on_chunk) {
+  stage_->forward_chunks(input_from_activation(p), on_chunk);
 }
 
 ActivationPacket PipelineStage::to_activation(const StageOutput& out,
                                               int32_t stage_from,
                                               int32_t stage_to,
                                               int64_t step,
-                                              int64_t pos) {
-  (void)step;
-
+                                              int64_t pos,
+                                              int64_t request_id) {
   ActivationPacket p;
-  p.version = 1;
   p.stage_from = stage_from;
   p.stage_to = stage_to;
+  p.step = step;
   p.pos = pos;
+  p.request_id = request_id;
 
   p.hidden = out.hidden_out;
 
-  // Do NOT set p.attn_mask / p.logits here: those fields don't exist in your ActivationPacket.
-
   return p;
 }
 
+int64_t PipelineStage::serve(const ServeLinks& links, int32_t stage_idx, int32_t num_stages) {
+  require(links.upstream && links.connect_downstream, "PipelineStage::serve: upstream and downstream required");
+  const bool is_last = (stage_idx == num_stages - 1);
+  const int32_t stage_to = is_last ? -1 : stage_idx + 1;
+  auto event = [&](const std::string& msg) {
+    if (links.on_event) links.on_event(msg);
+  };
+
+  std::unique_ptr<Transport> downstream;
+  auto send_down = [&](ActivationPacket p) {
+    p.stage_from = stage_idx;
+    p.stage_to = stage_to;
+    quantize_hidden(&p, links.codec);
+    if (!downstream) downstream = links.connect_downstream();
+    downstream->send_activation(p);
+  };
+
+  int64_t served = 0;
+  bool running = true;
+  while (running) {
+    std::unique_ptr<Transport> upstream = links.upstream->accept();
+    event("upstream connected");
+
+    while (running) {
+      ActivationPacket p;
+      try {
+        p = upstream->recv_activation();
+      } catch (const std::exception& e) {
+        event(std::string("upstream closed (") + e.what() + ")");
+        break;
+      }
+
+      switch (p.kind) {
+        case PacketKind::kActivation: {
+          // Prefill chunks are forwarded as they finish; the client only sees
+          // the token predicted by the final chunk of a step.
+          const bool more_upstream = (p.flags & kFlagMoreChunks) != 0;
+          run_chunks_from_activation(p, [&](const StageOutput& out, int64_t pos, bool last_chunk) {
+            ActivationPacket next = to_activation(out, stage_idx, stage_to, p.step, pos, p.request_id);
+            if (more_upstream || !last_chunk) {
+              if (is_last) return;
+              next.flags = kFlagMoreChunks;
+            } else if (is_last) {
+              next.hidden = out.logits.select(1, out.logits.size(1) - 1).argmax(-1, /*keepdim=*/true);
+            }
+            send_down(next);
+          });
+          ++served;
+          break;
+        }
+        case PacketKind::kReset:
+          reset_request(p.request_id);
+          if (!is_last) send_down(p);
+          break;
+        case PacketKind::kRelease:
+          release_request(p.request_id);
+          if (!is_last) send_down(p);
+          break;
+        case PacketKind::kShutdown:
+          if (!is_last) send_down(p);
+          running = false;
+          break;
+        default:
+          throw std::runtime_error("serve: unknown packet kind " + std::to_string((int32_t)p.kind));
+      }
+    }
+  }
+  return served;
+}
+
+KVCache& PipelineStage::request_cache(int64_t request_id) {
+  return caches_[request_id];
+}
+
+void PipelineStage::reset_request(int64_t request_id) {
+  auto it = caches_.find(request_id);
+  if (it != caches_.end()) it->second.clear_all();
+}
+
+void PipelineStage::release_request(int64_t request_id) {
+  caches_.erase(request_id);
+}
+
 } // namespace qwen
@@ -0,0 +1,436 @@
+#include "runtime/shm_transport.h"
+
+#include <torch/torch.h>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace qwen {
+
+static void throw_sys(const std::string& msg) {
+  throw std::runtime_error(msg + ": " + std::string(std::strerror(errno)));
+}
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "shm rings need lock-free 64-bit atomics");
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex words must be plain 32-bit");
+
+constexpr uint64_t kShmMagic = 0x71776e2d73686d31ull;  // "qwn-shm1"
+constexpr uint64_t kAlign = 64;
+constexpr uint64_t kWrapMarker = ~0ull;
+// Record prefix: uint64 record_bytes, uint64 frame head bytes.
+constexpr uint64_t kRecordPrefix = 16;
+constexpr int kSpinIters = 64;
+constexpr int kWaitSliceMs = 100;
+
+enum : uint32_t { kStateInit = 0, kStateListening = 1, kStateConnected = 2 };
+
+static uint64_t align_up(uint64_t n) {
+  return (n + kAlign - 1) & ~(kAlign - 1);
+}
+
+static void futex_wait(std::atomic<uint32_t>* word, uint32_t expected, int timeout_ms) {
+  struct timespec ts;
+  ts.tv_sec = timeout_ms / 1000;
+  ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000L;
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT, expected, &ts, nullptr, 0);
+}
+
+static void futex_wake(std::atomic<uint32_t>* word) {
+  ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+// One direction. head/tail count bytes ever written/released; the data
+// offset of a cursor is cursor % capacity.
+struct alignas(64) ShmRingCtl {
+  std::atomic<uint64_t> head;
+  std::atomic<uint64_t> tail;
+  std::atomic<uint32_t> data_seq;   // bumped after every publish
+  std::atomic<uint32_t> space_seq;  // bumped after every release
+  std::atomic<uint32_t> data_waiters;
+  std::atomic<uint32_t> space_waiters;
+};
+
+// Segment layout: this header, then ring 0 (client -> server) and ring 1
+// (server -> client) data at page-aligned offsets.
+struct ShmHeader {
+  std::atomic<uint64_t> magic;
+  uint64_t ring_bytes;
+  uint64_t data_offset;
+  std::atomic<uint32_t> state;       // futex word for the handshake
+  std::atomic<uint32_t> closed;      // set by either side on close/shutdown
+  std::atomic<uint32_t> generation;  // bumped per accepted connection
+  std::atomic<int32_t> pid[2];       // server, client
+  ShmRingCtl ring[2];
+};
+
+// A mapping of the segment, shared by the connection and the views it
+// handed out.
+struct ShmSegment {
+  void* base = MAP_FAILED;
+  size_t bytes = 0;
+
+  ~ShmSegment() {
+    if (base != MAP_FAILED) ::munmap(base, bytes);
+  }
+
+  ShmHeader* hdr() const { return static_cast<ShmHeader*>(base); }
+  uint8_t* data(int ring) const {
+    return static_cast<uint8_t*>(base) + hdr()->data_offset + (size_t)ring * hdr()->ring_bytes;
+  }
+  uint64_t capacity() const { return hdr()->ring_bytes; }
+
+  void wake_all() {
+    ShmHeader* h = hdr();
+    futex_wake(&h->state);
+    for (auto& r : h->ring) {
+      futex_wake(&r.data_seq);
+      futex_wake(&r.space_seq);
+    }
+  }
+
+  // Blocks until ready() holds. Throws once the connection is closed (and
+  // nothing is ready) or the peer process is gone.
+  template <class Ready>
+  void wait(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiters, int peer, Ready ready, const char* what) {
+    for (int i = 0; i < kSpinIters; ++i) {
+      if (ready()) return;
+      std::this_thread::yield();
+    }
+    for (;;) {
+      const uint32_t s = seq.load();
+      if (ready()) return;
+      if (hdr()->closed.load()) throw std::runtime_error(std::string(what) + ": connection closed by peer");
+      const int32_t pid = hdr()->pid[peer].load();
+      if (pid > 0 && ::kill(pid, 0) != 0 && errno == ESRCH) {
+        throw std::runtime_error(std::string(what) + ": peer process exited");
+      }
+      waiters.fetch_add(1);
+      futex_wait(&seq, s, kWaitSliceMs);
+      waiters.fetch_sub(1);
+    }
+  }
+};
+
+// Receive-side bookkeeping: records are released in any order (views die
+// whenever), the ring tail only moves over a released prefix.
+struct ShmReleaseQueue {
+  std::shared_ptr<ShmSegment> seg;
+  int ring = 0;
+  uint32_t generation = 0;
+  std::mutex mu;
+  std::deque<std::pair<uint64_t, bool>> records;  // end cursor, released
+
+  // Returns the index of a new outstanding record ending at `end`.
+  uint64_t add(uint64_t end) {
+    std::lock_guard<std::mutex> lock(mu);
+    records.emplace_back(end, false);
+    return first_ + records.size() - 1;
+  }
+
+  void release(uint64_t index) {
+    uint64_t tail = 0;
+    {
+      std::lock_guard<std::mutex> lock(mu);
+      records[(size_t)(index - first_)].second = true;
+      while (!records.empty() && records.front().second) {
+        tail = records.front().first;
+        records.pop_front();
+        ++first_;
+      }
+    }
+    // A later connection reset the rings; this record is no longer in them.
+    ShmHeader* h = seg->hdr();
+    if (tail == 0 || h->generation.load() != generation) return;
+    ShmRingCtl& r = h->ring[ring];
+    r.tail.store(tail, std::memory_order_release);
+    r.space_seq.fetch_add(1);
+    if (r.space_waiters.load() > 0) futex_wake(&r.space_seq);
+  }
+
+private:
+  uint64_t first_ = 0;
+};
+
+// Keeps one received record in the ring until every view into it is gone.
+struct ShmLease {
+  std::shared_ptr<ShmReleaseQueue> q;
+  uint64_t index = 0;
+  ~ShmLease() { q->release(index); }
+};
+
+std::string shm_segment_name(int port) {
+  return "/qwen_pp_" + std::to_string(port);
+}
+
+static std::shared_ptr<ShmSegment> map_segment(int fd, size_t bytes) {
+  auto seg = std::make_shared<ShmSegment>();
+  seg->base = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (seg->base == MAP_FAILED) throw_sys("mmap");
+  seg->bytes = bytes;
+  return seg;
+}
+
+// ---------------------------------------------------------------------------
+// ShmConn
+// ---------------------------------------------------------------------------
+
+ShmConn::ShmConn(std::shared_ptr<ShmSegment> seg, bool server_side) : seg_(std::move(seg)) {
+  tx_ = server_side ? 1 : 0;
+  rx_ = 1 - tx_;
+  releases_ = std::make_shared<ShmReleaseQueue>();
+  releases_->seg = seg_;
+  releases_->ring = rx_;
+  releases_->generation = seg_->hdr()->generation.load();
+}
+
+ShmConn::~ShmConn() {
+  shutdown();
+}
+
+void ShmConn::shutdown() {
+  seg_->hdr()->closed.store(1);
+  seg_->wake_all();
+}
+
+void ShmConn::send_frame(const EncodedFrame& f) {
+  ShmHeader* h = seg_->hdr();
+  ShmRingCtl& r = h->ring[tx_];
+  const uint64_t cap = seg_->capacity();
+
+  const uint64_t head_bytes = align_up(kRecordPrefix + f.head.size());
+  uint64_t rec = head_bytes;
+  for (const auto& t : f.payloads) rec += align_up((uint64_t)t.nbytes());
+  if (rec > cap) {
+    throw std::runtime_error("shm send: packet of " + std::to_string(rec) + " bytes exceeds the " +
+                             std::to_string(cap) + "-byte ring");
+  }
+
+  // Records never straddle the end of the ring: skip to the start instead.
+  uint64_t w = r.head.load(std::memory_order_relaxed);
+  const uint64_t off = w % cap;
+  const uint64_t skip = (cap - off < rec) ? cap - off : 0;
+  seg_->wait(r.space_seq, r.space_waiters, peer(), [&]() {
+    return w + skip + rec - r.tail.load(std::memory_order_acquire) <= cap;
+  }, "shm send");
+  if (h->closed.load()) throw std::runtime_error("shm send: connection closed");
+
+  uint8_t* data = seg_->data(tx_);
+  if (skip) {
+    const uint64_t marker = kWrapMarker;
+    std::memcpy(data + off, &marker, sizeof(marker));
+    w += skip;
+  }
+  uint8_t* dst = data + (w % cap);
+  const uint64_t head_len = f.head.size();
+  std::memcpy(dst, &rec, sizeof(rec));
+  std::memcpy(dst + 8, &head_len, sizeof(head_len));
+  std::memcpy(dst + kRecordPrefix, f.head.data(), f.head.size());
+
+  // The only copy of each payload: host or device memory straight into the
+  // ring.
+  uint64_t p = head_bytes;
+  for (const auto& t : f.payloads) {
+    if (t.nbytes() > 0) {
+      auto view = torch::from_blob(dst + p, t.sizes(), torch::TensorOptions().dtype(t.scalar_type()));
+      view.copy_(t);
+    }
+    p += align_up((uint64_t)t.nbytes());
+  }
+
+  r.head.store(w + rec, std::memory_order_release);
+  r.data_seq.fetch_add(1);
+  if (r.data_waiters.load() > 0) futex_wake(&r.data_seq);
+}
+
+uint64_t ShmConn::next_record(const char* what) {
+  ShmRingCtl& r = seg_->hdr()->ring[rx_];
+  const uint64_t cap = seg_->capacity();
+  for (;;) {
+    seg_->wait(r.data_seq, r.data_waiters, peer(), [&]() {
+      return r.head.load(std::memory_order_acquire) != rd_;
+    }, what);
+    const uint64_t off = rd_ % cap;
+    uint64_t len = 0;
+    std::memcpy(&len, seg_->data(rx_) + off, sizeof(len));
+    if (len != kWrapMarker) return off;
+    // Padding up to the end of the ring: released at once.
+    rd_ += cap - off;
+    releases_->release(releases_->add(rd_));
+  }
+}
+
+template <class Packet, class Decode>
+Packet ShmConn::recv_frame(const char* what, Decode decode) {
+  const uint64_t off = next_record(what);
+  uint8_t* rec = seg_->data(rx_) + off;
+  uint64_t rec_bytes = 0;
+  uint64_t head_len = 0;
+  std::memcpy(&rec_bytes, rec, sizeof(rec_bytes));
+  std::memcpy(&head_len, rec + 8, sizeof(head_len));
+  if (head_len < kFramePrefixBytes || rec_bytes > seg_->capacity()) {
+    throw std::runtime_error(std::string(what) + ": corrupt shm record");
+  }
+  const uint8_t* head = rec + kRecordPrefix;
+  const uint32_t header_len = parse_frame_prefix(head, what);
+  if (kFramePrefixBytes + header_len != head_len) throw std::runtime_error(std::string(what) + ": corrupt shm record");
+
+  rd_ += rec_bytes;
+  auto lease = std::make_shared<ShmLease>();
+  lease->q = releases_;
+  lease->index = releases_->add(rd_);
+
+  // Payloads sit at 64-byte aligned offsets after the head, in slot order.
+  uint64_t p = align_up(kRecordPrefix + head_len);
+  const TensorAllocator view = [&](at::IntArrayRef sizes, c10::ScalarType dtype) {
+    int64_t numel = 1;
+    for (int64_t s : sizes) numel *= s;
+    const uint64_t nbytes = (uint64_t)numel * (uint64_t)c10::elementSize(dtype);
+    if (p + nbytes > rec_bytes) throw std::runtime_error(std::string(what) + ": payload overruns shm record");
+    torch::Tensor t = torch::from_blob(rec + p, sizes, [lease](void*) {}, torch::TensorOptions().dtype(dtype));
+    p += align_up(nbytes);
+    return t;
+  };
+  std::vector<torch::Tensor> payloads;
+  return decode(head + kFramePrefixBytes, header_len, view, &payloads);
+}
+
+void ShmConn::send_activation(const ActivationPacket& p) {
+  send_frame(encode_activation(p));
+}
+
+ActivationPacket ShmConn::recv_activation(const TensorAllocator& alloc) {
+  (void)alloc;  // payloads are returned in place
+  return recv_frame<ActivationPacket>("recv_activation", decode_activation);
+}
+
+void ShmConn::send_kv(const KVPacket& p) {
+  send_frame(encode_kv(p));
+}
+
+KVPacket ShmConn::recv_kv() {
+  return recv_frame<KVPacket>("recv_kv", decode_kv);
+}
+
+// ---------------------------------------------------------------------------
+// ShmServer / ShmClient
+// ---------------------------------------------------------------------------
+
+ShmServer::ShmServer(const std::string& name, const ShmOptions& opts) : name_(name) {
+  const uint64_t ring = align_up((uint64_t)std::max<int64_t>(opts.ring_bytes, 4096));
+  const uint64_t page = (uint64_t)::sysconf(_SC_PAGESIZE);
+  const uint64_t data_offset = (sizeof(ShmHeader) + page - 1) / page * page;
+  const size_t bytes = (size_t)(data_offset + 2 * ring);
+
+  // A segment left behind by a crashed run would hand clients stale state.
+  ::shm_unlink(name_.c_str());
+  int fd = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) throw_sys("shm_open(" + name_ + ")");
+  if (::ftruncate(fd, (off_t)bytes) != 0) {
+    ::close(fd);
+    ::shm_unlink(name_.c_str());
+    throw_sys("ftruncate(" + name_ + ")");
+  }
+  try {
+    seg_ = map_segment(fd, bytes);
+  } catch (...) {
+    ::close(fd);
+    ::shm_unlink(name_.c_str());
+    throw;
+  }
+  ::close(fd);
+
+  ShmHeader* h = new (seg_->base) ShmHeader();
+  h->ring_bytes = ring;
+  h->data_offset = data_offset;
+  h->state.store(kStateInit);
+  h->magic.store(kShmMagic, std::memory_order_release);
+}
+
+ShmServer::~ShmServer() {
+  ::shm_unlink(name_.c_str());
+}
+
+std::unique_ptr<ShmConn> ShmServer::accept_one() {
+  ShmHeader* h = seg_->hdr();
+  for (auto& r : h->ring) {
+    r.head.store(0);
+    r.tail.store(0);
+  }
+  h->pid[0].store((int32_t)::getpid());
+  h->pid[1].store(0);
+  h->closed.store(0);
+  h->generation.fetch_add(1);
+  h->state.store(kStateListening);
+  futex_wake(&h->state);
+
+  for (;;) {
+    const uint32_t s = h->state.load();
+    if (s == kStateConnected) break;
+    futex_wait(&h->state, s, kWaitSliceMs);
+  }
+  return std::make_unique<ShmConn>(seg_, /*server_side=*/true);
+}
+
+static std::shared_ptr<ShmSegment> connect_segment(const std::string& name, const ShmOptions& opts) {
+  const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(opts.connect_timeout_ms);
+  auto timed_out = [&]() { return std::chrono::steady_clock::now() > deadline; };
+
+  // The server may not have created (or sized) the segment yet.
+  std::shared_ptr<ShmSegment> seg;
+  while (!seg) {
+    int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd >= 0) {
+      struct stat st;
+      if (::fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(ShmHeader)) {
+        seg = map_segment(fd, (size_t)st.st_size);
+      }
+      ::close(fd);
+    } else if (errno != ENOENT) {
+      throw_sys("shm_open(" + name + ")");
+    }
+    if (seg && seg->hdr()->magic.load(std::memory_order_acquire) != kShmMagic) seg.reset();
+    if (!seg) {
+      if (timed_out()) throw std::runtime_error("shm connect: no server on " + name);
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  }
+
+  ShmHeader* h = seg->hdr();
+  if (seg->bytes < h->data_offset + 2 * h->ring_bytes) throw std::runtime_error("shm connect: truncated segment " + name);
+  for (;;) {
+    uint32_t s = h->state.load();
+    if (s == kStateListening) {
+      h->pid[1].store((int32_t)::getpid());
+      if (h->state.compare_exchange_strong(s, kStateConnected)) break;
+      continue;
+    }
+    if (timed_out()) throw std::runtime_error("shm connect: server on " + name + " is not accepting");
+    futex_wait(&h->state, s, kWaitSliceMs);
+  }
+  futex_wake(&h->state);
+  return seg;
+}
+
+ShmClient::ShmClient(const std::string& name, const ShmOptions& opts)
+    : ShmConn(connect_segment(name, opts), /*server_side=*/false) {}
+
+} // namespace qwen
@@ -4,9 +4,16 @@
 
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <cstdint>
 #include <cstring>
 #include <stdexcept>
@@ -36,8 +43,9 @@ static void read_all(int fd, void* data, size_t n) {
   uint8_t* p = static_cast<uint8_t*>(data);
   while (n) {
     ssize_t r = ::recv(fd, p, n, MSG_WAITALL);
-    if (r <= 0) {
-      if (r < 0 && errno == EINTR) continue;
+    if (r == 0) throw std::runtime_error("recv: connection closed by peer");
+    if (r < 0) {
+      if (errno == EINTR) continue;
       throw_sys("recv");
     }
     p += (size_t)r;
@@ -45,105 +53,170 @@ static void read_all(int fd, void* data, size_t n) {
   }
 }
 
-static uint64_t hton_u64(uint64_t x) {
-  uint32_t hi = htonl((uint32_t)(x >> 32));
-  uint32_t lo = htonl((uint32_t)(x & 0xffffffffu));
-  return ((uint64_t)lo << 32) | hi;
-}
-
-static uint64_t ntoh_u64(uint64_t x) {
-  uint32_t lo = ntohl((uint32_t)(x >> 32));
-  uint32_t hi = ntohl((uint32_t)(x & 0xffffffffu));
-  return ((uint64_t)hi << 32) | lo;
+// Sends every byte described by iov[0..n), resuming after partial writes.
+static void sendmsg_all(int fd, struct iovec* iov, size_t n) {
+  while (n > 0) {
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = std::min<size_t>(n, IOV_MAX);
+    ssize_t w = ::sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (w < 0) {
+      if (errno == EINTR) continue;
+      throw_sys("sendmsg");
+    }
+    size_t left = (size_t)w;
+    while (n > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --n;
+    }
+    if (n > 0) {
+      iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
 }
 
-static int32_t scalar_type_to_i32(c10::ScalarType t) {
-  return (int32_t)t;
+// Receives into iov[0..n) until every buffer is full.
+static void recvmsg_all(int fd, struct iovec* iov, size_t n) {
+  while (n > 0 && iov->iov_len == 0) { ++iov; --n; }
+  while (n > 0) {
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = std::min<size_t>(n, IOV_MAX);
+    ssize_t r = ::recvmsg(fd, &msg, MSG_WAITALL);
+    if (r == 0) throw std::runtime_error("recv: connection closed by peer");
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      throw_sys("recv");
+    }
+    size_t left = (size_t)r;
+    while (n > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --n;
+    }
+    if (n > 0) {
+      iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
 }
 
-static c10::ScalarType i32_to_scalar_type(int32_t v) {
-  return (c10::ScalarType)v;
-}
+// Sends one frame with a single sendmsg() (prefix, header and payloads);
+// CUDA payloads are copied to the host first.
+static void write_frame(int fd, EncodedFrame f, bool vectored) {
+  for (auto& t : f.payloads) {
+    if (t.is_cuda()) t = t.to(torch::kCPU);
+  }
 
-static void send_tensor(int fd, const torch::Tensor& t) {
-  if (!t.defined()) {
-    uint8_t defined = 0;
-    write_all(fd, &defined, 1);
+  if (!vectored) {
+    // One send() per field and per payload: the pre-framing syscall
+    // pattern, same bytes on the wire.
+    f.fields.push_back(f.head.size());
+    for (size_t i = 0; i + 1 < f.fields.size(); ++i) {
+      write_all(fd, f.head.data() + f.fields[i], f.fields[i + 1] - f.fields[i]);
+    }
+    for (const auto& t : f.payloads) write_all(fd, t.data_ptr(), (size_t)t.nbytes());
     return;
   }
 
-  uint8_t defined = 1;
-  write_all(fd, &defined, 1);
-
-  torch::Tensor cpu = t;
-  if (cpu.is_cuda()) cpu = cpu.to(torch::kCPU);
-  if (!cpu.is_contiguous()) cpu = cpu.contiguous();
-
-  const int32_t dtype_i = scalar_type_to_i32(cpu.scalar_type());
-  const int32_t ndim = (int32_t)cpu.dim();
+  std::vector<struct iovec> iov;
+  iov.reserve(1 + f.payloads.size());
+  iov.push_back({f.head.data(), f.head.size()});
+  for (const auto& t : f.payloads) {
+    if (t.nbytes() > 0) iov.push_back({t.data_ptr(), (size_t)t.nbytes()});
+  }
+  sendmsg_all(fd, iov.data(), iov.size());
+}
 
-  int32_t dtype_net = htonl((uint32_t)dtype_i);
-  int32_t ndim_net  = htonl((uint32_t)ndim);
+// Reads the prefix and the whole header up front so fields are decoded from
+// memory; read_payloads() then fills every payload with one recvmsg().
+static std::vector<uint8_t> read_header(int fd, const char* what) {
+  uint8_t prefix[kFramePrefixBytes];
+  read_all(fd, prefix, sizeof(prefix));
+  std::vector<uint8_t> header(parse_frame_prefix(prefix, what));
+  if (!header.empty()) read_all(fd, header.data(), header.size());
+  return header;
+}
 
-  write_all(fd, &dtype_net, sizeof(dtype_net));
-  write_all(fd, &ndim_net, sizeof(ndim_net));
+static void read_payloads(int fd, const std::vector<torch::Tensor>& payloads) {
+  std::vector<struct iovec> iov;
+  iov.reserve(payloads.size());
+  for (const auto& t : payloads) {
+    if (t.nbytes() > 0) iov.push_back({t.data_ptr(), (size_t)t.nbytes()});
+  }
+  recvmsg_all(fd, iov.data(), iov.size());
+}
 
-  std::vector<int64_t> sizes;
-  sizes.reserve((size_t)ndim);
-  for (int i = 0; i < ndim; ++i) sizes.push_back(cpu.size(i));
+static void write_activation(int fd, const ActivationPacket& p, bool vectored) {
+  write_frame(fd, encode_activation(p), vectored);
+}
 
-  for (int i = 0; i < ndim; ++i) {
-    uint64_t s = hton_u64((uint64_t)sizes[(size_t)i]);
-    write_all(fd, &s, sizeof(s));
-  }
+static ActivationPacket read_activation(int fd, const TensorAllocator& alloc) {
+  const auto header = read_header(fd, "recv_activation");
+  std::vector<torch::Tensor> payloads;
+  ActivationPacket p = decode_activation(header.data(), header.size(), alloc, &payloads);
+  read_payloads(fd, payloads);
+  return p;
+}
 
-  uint64_t nbytes = (uint64_t)cpu.nbytes();
-  uint64_t nbytes_net = hton_u64(nbytes);
-  write_all(fd, &nbytes_net, sizeof(nbytes_net));
+static void write_kv(int fd, const KVPacket& p, bool vectored) {
+  write_frame(fd, encode_kv(p), vectored);
+}
 
-  write_all(fd, cpu.data_ptr(), (size_t)nbytes);
+static KVPacket read_kv(int fd) {
+  const auto header = read_header(fd, "recv_kv");
+  std::vector<torch::Tensor> payloads;
+  KVPacket p = decode_kv(header.data(), header.size(), nullptr, &payloads);
+  read_payloads(fd, payloads);
+  return p;
 }
 
-static torch::Tensor recv_tensor(int fd) {
-  uint8_t defined = 0;
-  read_all(fd, &defined, 1);
-  if (!defined) return torch::Tensor();
+static void apply_socket_options(int fd, const TcpOptions& opts) {
+  int one = opts.nodelay ? 1 : 0;
+  if (::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0) {
+    throw_sys("setsockopt(TCP_NODELAY)");
+  }
+}
 
-  int32_t dtype_net = 0, ndim_net = 0;
-  read_all(fd, &dtype_net, sizeof(dtype_net));
-  read_all(fd, &ndim_net, sizeof(ndim_net));
+// ---------------------------------------------------------------------------
+// SocketTransport
+// ---------------------------------------------------------------------------
 
-  int32_t dtype_i = (int32_t)ntohl((uint32_t)dtype_net);
-  int32_t ndim    = (int32_t)ntohl((uint32_t)ndim_net);
+SocketTransport::SocketTransport(int fd, const TcpOptions& opts) : fd_(fd), opts_(opts) {}
 
-  if (ndim < 0 || ndim > 16) {
-    throw std::runtime_error("recv_tensor: invalid ndim");
-  }
+SocketTransport::~SocketTransport() {
+  if (fd_ >= 0) ::close(fd_);
+}
 
-  std::vector<int64_t> sizes((size_t)ndim);
-  for (int i = 0; i < ndim; ++i) {
-    uint64_t s_net = 0;
-    read_all(fd, &s_net, sizeof(s_net));
-    sizes[(size_t)i] = (int64_t)ntoh_u64(s_net);
-  }
+void SocketTransport::send_activation(const ActivationPacket& p) {
+  write_activation(fd_, p, opts_.vectored);
+}
 
-  uint64_t nbytes_net = 0;
-  read_all(fd, &nbytes_net, sizeof(nbytes_net));
-  uint64_t nbytes = ntoh_u64(nbytes_net);
+ActivationPacket SocketTransport::recv_activation(const TensorAllocator& alloc) {
+  return read_activation(fd_, alloc);
+}
 
-  auto dtype = i32_to_scalar_type(dtype_i);
-  auto opts = torch::TensorOptions().dtype(dtype).device(torch::kCPU);
+void SocketTransport::send_kv(const KVPacket& p) {
+  write_kv(fd_, p, opts_.vectored);
+}
 
-  torch::Tensor cpu = torch::empty(sizes, opts);
-  if ((uint64_t)cpu.nbytes() != nbytes) {
-    throw std::runtime_error("recv_tensor: nbytes mismatch");
-  }
+KVPacket SocketTransport::recv_kv() {
+  return read_kv(fd_);
+}
 
-  read_all(fd, cpu.data_ptr(), (size_t)nbytes);
-  return cpu;
+void SocketTransport::shutdown() {
+  if (fd_ >= 0) ::shutdown(fd_, SHUT_RDWR);
 }
 
-TcpClient::TcpClient(const std::string& host, int port) {
+// ---------------------------------------------------------------------------
+// TCP
+// ---------------------------------------------------------------------------
+
+TcpClient::TcpClient(const std::string& host, int port, const TcpOptions& opts) : SocketTransport(-1, opts) {
   struct addrinfo hints;
   std::memset(&hints, 0, sizeof(hints));
   hints.ai_family = AF_INET;
@@ -166,102 +239,11 @@ TcpClient::TcpClient(const std::string& host, int port) {
     freeaddrinfo(res);
     throw_sys("connect");
   }
-
   freeaddrinfo(res);
+  apply_socket_options(fd_, opts_);
 }
 
-TcpClient::~TcpClient() {
-  if (fd_ >= 0) ::close(fd_);
-}
-
-void TcpClient::send_activation(const ActivationPacket& p) {
-  int32_t version = htonl((uint32_t)p.version);
-  int32_t stage_from = htonl((uint32_t)p.stage_from);
-  int32_t stage_to = htonl((uint32_t)p.stage_to);
-
-  uint64_t step_net = hton_u64((uint64_t)p.step);
-  uint64_t pos_net  = hton_u64((uint64_t)p.pos);
-
-  write_all(fd_, &version, sizeof(version));
-  write_all(fd_, &stage_from, sizeof(stage_from));
-  write_all(fd_, &stage_to, sizeof(stage_to));
-  write_all(fd_, &step_net, sizeof(step_net));
-  write_all(fd_, &pos_net, sizeof(pos_net));
-
-  send_tensor(fd_, p.hidden);
-  send_tensor(fd_, p.attn_mask.value_or(torch::Tensor()));
-}
-
-ActivationPacket TcpClient::recv_activation() {
-  ActivationPacket p;
-
-  int32_t version=0, stage_from=0, stage_to=0;
-  uint64_t step_net=0, pos_net=0;
-
-  read_all(fd_, &version, sizeof(version));
-  read_all(fd_, &stage_from, sizeof(stage_from));
-  read_all(fd_, &stage_to, sizeof(stage_to));
-  read_all(fd_, &step_net, sizeof(step_net));
-  read_all(fd_, &pos_net, sizeof(pos_net));
-
-  p.version = (int32_t)ntohl((uint32_t)version);
-  p.stage_from = (int32_t)ntohl((uint32_t)stage_from);
-  p.stage_to   = (int32_t)ntohl((uint32_t)stage_to);
-  p.step = (int64_t)ntoh_u64(step_net);
-  p.pos  = (int64_t)ntoh_u64(pos_net);
-
-  p.hidden = recv_tensor(fd_);
-  auto m = recv_tensor(fd_);
-  if (m.defined()) p.attn_mask = m;
-
-  return p;
-}
-
-void TcpClient::send_kv(const KVPacket& p) {
-  int32_t version = htonl((uint32_t)p.version);
-  int32_t stage_from = htonl((uint32_t)p.stage_from);
-  int32_t stage_to = htonl((uint32_t)p.stage_to);
-
-  uint64_t step_net = hton_u64((uint64_t)p.step);
-  uint64_t pos_net  = hton_u64((uint64_t)p.pos);
-
-  write_all(fd_, &version, sizeof(version));
-  write_all(fd_, &stage_from, sizeof(stage_from));
-  write_all(fd_, &stage_to, sizeof(stage_to));
-  write_all(fd_, &step_net, sizeof(step_net));
-  write_all(fd_, &pos_net, sizeof(pos_net));
-
-  send_tensor(fd_, p.k.value_or(torch::Tensor()));
-  send_tensor(fd_, p.v.value_or(torch::Tensor()));
-}
-
-KVPacket TcpClient::recv_kv() {
-  KVPacket p;
-
-  int32_t version=0, stage_from=0, stage_to=0;
-  uint64_t step_net=0, pos_net=0;
-
-  read_all(fd_, &version, sizeof(version));
-  read_all(fd_, &stage_from, sizeof(stage_from));
-  read_all(fd_, &stage_to, sizeof(stage_to));
-  read_all(fd_, &step_net, sizeof(step_net));
-  read_all(fd_, &pos_net, sizeof(pos_net));
-
-  p.version = (int32_t)ntohl((uint32_t)version);
-  p.stage_from = (int32_t)ntohl((uint32_t)stage_from);
-  p.stage_to   = (int32_t)ntohl((uint32_t)stage_to);
-  p.step = (int64_t)ntoh_u64(step_net);
-  p.pos  = (int64_t)ntoh_u64(pos_net);
-
-  auto k = recv_tensor(fd_);
-  auto v = recv_tensor(fd_);
-  if (k.defined()) p.k = k;
-  if (v.defined()) p.v = v;
-
-  return p;
-}
-
-TcpServer::TcpServer(int port) {
+TcpServer::TcpServer(int port, const TcpOptions& opts) : opts_(opts) {
   fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
   if (fd_ < 0) throw_sys("socket");
 
@@ -294,101 +276,71 @@ TcpServer::~TcpServer() {
 int TcpServer::accept_one() {
   int cfd = ::accept(fd_, nullptr, nullptr);
   if (cfd < 0) throw_sys("accept");
+  try {
+    apply_socket_options(cfd, opts_);
+  } catch (...) {
+    ::close(cfd);
+    throw;
+  }
   return cfd;
 }
 
-TcpConn::TcpConn(int fd) : fd_(fd) {}
-TcpConn::~TcpConn() { if (fd_ >= 0) ::close(fd_); }
+TcpConn::TcpConn(int fd, const TcpOptions& opts) : SocketTransport(fd, opts) {}
 
-void TcpConn::send_activation(const ActivationPacket& p) {
-  send_activation_raw(p);
+void TcpConn::send_activation_raw(const ActivationPacket& p) {
+  send_activation(p);
 }
 
-ActivationPacket TcpConn::recv_activation() {
-  ActivationPacket p;
-
-  int32_t version=0, stage_from=0, stage_to=0;
-  uint64_t step_net=0, pos_net=0;
-
-  read_all(fd_, &version, sizeof(version));
-  read_all(fd_, &stage_from, sizeof(stage_from));
-  read_all(fd_, &stage_to, sizeof(stage_to));
-  read_all(fd_, &step_net, sizeof(step_net));
-  read_all(fd_, &pos_net, sizeof(pos_net));
+// ---------------------------------------------------------------------------
+// Unix domain
+// ---------------------------------------------------------------------------
 
-  p.version = (int32_t)ntohl((uint32_t)version);
-  p.stage_from = (int32_t)ntohl((uint32_t)stage_from);
-  p.stage_to   = (int32_t)ntohl((uint32_t)stage_to);
-  p.step = (int64_t)ntoh_u64(step_net);
-  p.pos  = (int64_t)ntoh_u64(pos_net);
-
-  p.hidden = recv_tensor(fd_);
-  auto m = recv_tensor(fd_);
-  if (m.defined()) p.attn_mask = m;
-
-  return p;
+std::string unix_socket_path(int port) {
+  return "/tmp/qwen_pp_" + std::to_string(port) + ".sock";
 }
 
-void TcpConn::send_activation_raw(const ActivationPacket& p) {
-  int32_t version = htonl((uint32_t)p.version);
-  int32_t stage_from = htonl((uint32_t)p.stage_from);
-  int32_t stage_to = htonl((uint32_t)p.stage_to);
-
-  uint64_t step_net = hton_u64((uint64_t)p.step);
-  uint64_t pos_net  = hton_u64((uint64_t)p.pos);
-
-  write_all(fd_, &version, sizeof(version));
-  write_all(fd_, &stage_from, sizeof(stage_from));
-  write_all(fd_, &stage_to, sizeof(stage_to));
-  write_all(fd_, &step_net, sizeof(step_net));
-  write_all(fd_, &pos_net, sizeof(pos_net));
-
-  send_tensor(fd_, p.hidden);
-  send_tensor(fd_, p.attn_mask.value_or(torch::Tensor()));
+static sockaddr_un unix_address(const std::string& path) {
+  sockaddr_un addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) throw std::runtime_error("unix socket path too long: " + path);
+  std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  return addr;
 }
 
-void TcpConn::send_kv(const KVPacket& p) {
-  int32_t version = htonl((uint32_t)p.version);
-  int32_t stage_from = htonl((uint32_t)p.stage_from);
-  int32_t stage_to = htonl((uint32_t)p.stage_to);
-
-  uint64_t step_net = hton_u64((uint64_t)p.step);
-  uint64_t pos_net  = hton_u64((uint64_t)p.pos);
-
-  write_all(fd_, &version, sizeof(version));
-  write_all(fd_, &stage_from, sizeof(stage_from));
-  write_all(fd_, &stage_to, sizeof(stage_to));
-  write_all(fd_, &step_net, sizeof(step_net));
-  write_all(fd_, &pos_net, sizeof(pos_net));
-
-  send_tensor(fd_, p.k.value_or(torch::Tensor()));
-  send_tensor(fd_, p.v.value_or(torch::Tensor()));
+UnixServer::UnixServer(const std::string& path) : path_(path) {
+  const sockaddr_un addr = unix_address(path_);
+  fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ < 0) throw_sys("socket");
+  // A socket file left behind by an earlier run makes bind() fail.
+  ::unlink(path_.c_str());
+  if (::bind(fd_, (const sockaddr*)&addr, sizeof(addr)) < 0) {
+    ::close(fd_);
+    throw_sys("bind(" + path_ + ")");
+  }
+  if (::listen(fd_, 16) < 0) {
+    ::close(fd_);
+    ::unlink(path_.c_str());
+    throw_sys("listen");
+  }
 }
 
-KVPacket TcpConn::recv_kv() {
-  KVPacket p;
-
-  int32_t version=0, stage_from=0, stage_to=0;
-  uint64_t step_net=0, pos_net=0;
-
-  read_all(fd_, &version, sizeof(version));
-  read_all(fd_, &stage_from, sizeof(stage_from));
-  read_all(fd_, &stage_to, sizeof(stage_to));
-  read_all(fd_, &step_net, sizeof(step_net));
-  read_all(fd_, &pos_net, sizeof(pos_net));
-
-  p.version = (int32_t)ntohl((uint32_t)version);
-  p.stage_from = (int32_t)ntohl((uint32_t)stage_from);
-  p.stage_to   = (int32_t)ntohl((uint32_t)stage_to);
-  p.step = (int64_t)ntoh_u64(step_net);
-  p.pos  = (int64_t)ntoh_u64(pos_net);
+UnixServer::~UnixServer() {
+  if (fd_ >= 0) ::close(fd_);
+  ::unlink(path_.c_str());
+}
 
-  auto k = recv_tensor(fd_);
-  auto v = recv_tensor(fd_);
-  if (k.defined()) p.k = k;
-  if (v.defined()) p.v = v;
+int UnixServer::accept_one() {
+  int cfd = ::accept(fd_, nullptr, nullptr);
+  if (cfd < 0) throw_sys("accept");
+  return cfd;
+}
 
-  return p;
+UnixClient::UnixClient(const std::string& path, const TcpOptions& opts) : SocketTransport(-1, opts) {
+  const sockaddr_un addr = unix_address(path);
+  fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd_ < 0) throw_sys("socket");
+  if (::connect(fd_, (const sockaddr*)&addr, sizeof(addr)) < 0) throw_sys("connect(" + path + ")");
 }
 
 } // namespace qwen
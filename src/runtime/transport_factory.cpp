@@ -0,0 +1,100 @@
+#include "runtime/transport_factory.h"
+
+namespace qwen {
+
+bool parse_transport_kind(const std::string& s, TransportKind* kind) {
+  if (s == "tcp") {
+    *kind = TransportKind::kTcp;
+  } else if (s == "shm") {
+    *kind = TransportKind::kShm;
+  } else if (s == "unix") {
+    *kind = TransportKind::kUnix;
+  } else if (s == "inproc") {
+    *kind = TransportKind::kInProc;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* transport_kind_name(TransportKind kind) {
+  switch (kind) {
+    case TransportKind::kTcp: return "tcp";
+    case TransportKind::kShm: return "shm";
+    case TransportKind::kUnix: return "unix";
+    case TransportKind::kInProc: return "inproc";
+  }
+  return "?";
+}
+
+namespace {
+
+class TcpListener : public TransportListener {
+public:
+  TcpListener(int port, const TcpOptions& opts) : server_(port, opts), opts_(opts) {}
+  std::unique_ptr<Transport> accept() override { return std::make_unique<TcpConn>(server_.accept_one(), opts_); }
+  int port() const override { return server_.port(); }
+
+private:
+  TcpServer server_;
+  TcpOptions opts_;
+};
+
+class ShmListener : public TransportListener {
+public:
+  ShmListener(int port, const ShmOptions& opts) : server_(shm_segment_name(port), opts), port_(port) {}
+  std::unique_ptr<Transport> accept() override { return server_.accept_one(); }
+  int port() const override { return port_; }
+
+private:
+  ShmServer server_;
+  int port_;
+};
+
+class UnixListener : public TransportListener {
+public:
+  UnixListener(int port, const TcpOptions& opts) : server_(unix_socket_path(port)), opts_(opts), port_(port) {}
+  std::unique_ptr<Transport> accept() override {
+    return std::make_unique<SocketTransport>(server_.accept_one(), opts_);
+  }
+  int port() const override { return port_; }
+
+private:
+  UnixServer server_;
+  TcpOptions opts_;
+  int port_;
+};
+
+class InProcTransportListener : public TransportListener {
+public:
+  explicit InProcTransportListener(int port) : listener_(port) {}
+  std::unique_ptr<Transport> accept() override { return listener_.accept_one(); }
+  int port() const override { return listener_.port(); }
+
+private:
+  InProcListener listener_;
+};
+
+} // namespace
+
+std::unique_ptr<TransportListener> make_listener(const TransportOptions& opts, int port) {
+  switch (opts.kind) {
+    case TransportKind::kShm: return std::make_unique<ShmListener>(port, opts.shm);
+    case TransportKind::kUnix: return std::make_unique<UnixListener>(port, opts.tcp);
+    case TransportKind::kInProc: return std::make_unique<InProcTransportListener>(port);
+    case TransportKind::kTcp: break;
+  }
+  return std::make_unique<TcpListener>(port, opts.tcp);
+}
+
+std::unique_ptr<Transport> make_connection(const TransportOptions& opts, const std::string& host, int port) {
+  switch (opts.kind) {
+    case TransportKind::kShm: return std::make_unique<ShmClient>(shm_segment_name(port), opts.shm);
+    case TransportKind::kUnix: return std::make_unique<UnixClient>(unix_socket_path(port), opts.tcp);
+    case TransportKind::kInProc: return inproc_connect(port, opts.inproc);
+    case TransportKind::kTcp: break;
+  }
+  return std::make_unique<TcpClient>(host, port, opts.tcp);
+}
+
+} // namespace qwen
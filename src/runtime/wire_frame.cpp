@@ -0,0 +1,275 @@
+#include "runtime/wire_frame.h"
+
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace qwen {
+
+static uint64_t hton_u64(uint64_t x) {
+  uint32_t hi = htonl((uint32_t)(x >> 32));
+  uint32_t lo = htonl((uint32_t)(x & 0xffffffffu));
+  return ((uint64_t)lo << 32) | hi;
+}
+
+static uint64_t ntoh_u64(uint64_t x) {
+  uint32_t lo = ntohl((uint32_t)(x >> 32));
+  uint32_t hi = ntohl((uint32_t)(x & 0xffffffffu));
+  return ((uint64_t)hi << 32) | lo;
+}
+
+static int32_t scalar_type_to_i32(c10::ScalarType t) {
+  return (int32_t)t;
+}
+
+static c10::ScalarType i32_to_scalar_type(int32_t v) {
+  return (c10::ScalarType)v;
+}
+
+size_t EncodedFrame::payload_bytes() const {
+  size_t n = 0;
+  for (const auto& t : payloads) n += (size_t)t.nbytes();
+  return n;
+}
+
+// Builds prefix and header in memory; header_len is patched in finish().
+class FrameWriter {
+public:
+  explicit FrameWriter(int32_t version) {
+    put_i32(version);
+    put_u32(0);
+  }
+
+  void put_u8(uint8_t v) {
+    mark();
+    f_.head.push_back(v);
+  }
+
+  void put_i32(int32_t v) { put_u32((uint32_t)v); }
+
+  void put_u32(uint32_t v) {
+    mark();
+    const uint32_t net = htonl(v);
+    append(&net, sizeof(net));
+  }
+
+  void put_u64(uint64_t v) {
+    mark();
+    const uint64_t net = hton_u64(v);
+    append(&net, sizeof(net));
+  }
+
+  // Metadata goes into the header, the tensor itself (contiguous, on its
+  // device) into the payload list.
+  void put_tensor(const torch::Tensor& t) {
+    if (!t.defined()) {
+      put_u8(0);
+      return;
+    }
+    torch::Tensor c = t.is_contiguous() ? t : t.contiguous();
+    put_u8(1);
+    put_i32(scalar_type_to_i32(c.scalar_type()));
+    put_i32((int32_t)c.dim());
+    for (int64_t i = 0; i < c.dim(); ++i) put_u64((uint64_t)c.size(i));
+    put_u64((uint64_t)c.nbytes());
+    f_.payloads.push_back(std::move(c));
+  }
+
+  EncodedFrame finish() {
+    const uint32_t len_net = htonl((uint32_t)(f_.head.size() - kFramePrefixBytes));
+    std::memcpy(f_.head.data() + 4, &len_net, sizeof(len_net));
+    return std::move(f_);
+  }
+
+private:
+  void mark() { f_.fields.push_back(f_.head.size()); }
+
+  void append(const void* p, size_t n) {
+    const uint8_t* b = static_cast<const uint8_t*>(p);
+    f_.head.insert(f_.head.end(), b, b + n);
+  }
+
+  EncodedFrame f_;
+};
+
+// Parses header fields from memory.
+class FrameReader {
+public:
+  FrameReader(const uint8_t* buf, size_t len, const char* what, const TensorAllocator& alloc,
+              std::vector<torch::Tensor>* payloads)
+      : buf_(buf), len_(len), what_(what), alloc_(alloc), payloads_(payloads) {}
+
+  uint8_t u8() {
+    need(1);
+    return buf_[off_++];
+  }
+
+  int32_t i32() { return (int32_t)u32(); }
+
+  uint32_t u32() {
+    uint32_t net = 0;
+    need(sizeof(net));
+    std::memcpy(&net, buf_ + off_, sizeof(net));
+    off_ += sizeof(net);
+    return ntohl(net);
+  }
+
+  uint64_t u64() {
+    uint64_t net = 0;
+    need(sizeof(net));
+    std::memcpy(&net, buf_ + off_, sizeof(net));
+    off_ += sizeof(net);
+    return ntoh_u64(net);
+  }
+
+  // Allocates the tensor described by the next metadata record.
+  torch::Tensor tensor() {
+    if (!u8()) return torch::Tensor();
+    const int32_t dtype_i = i32();
+    const int32_t ndim = i32();
+    if (ndim < 0 || ndim > 16) fail("invalid ndim");
+    std::vector<int64_t> sizes((size_t)ndim);
+    for (int32_t i = 0; i < ndim; ++i) sizes[(size_t)i] = (int64_t)u64();
+    const uint64_t nbytes = u64();
+
+    const c10::ScalarType dtype = i32_to_scalar_type(dtype_i);
+    torch::Tensor cpu = alloc_ ? alloc_(sizes, dtype)
+                               : torch::empty(sizes, torch::TensorOptions().dtype(dtype).device(torch::kCPU));
+    if ((uint64_t)cpu.nbytes() != nbytes || !cpu.is_contiguous()) fail("nbytes mismatch");
+    payloads_->push_back(cpu);
+    return cpu;
+  }
+
+  void done() {
+    if (off_ != len_) fail("trailing header bytes");
+  }
+
+private:
+  void need(size_t n) {
+    if (off_ + n > len_) fail("truncated header");
+  }
+
+  [[noreturn]] void fail(const char* msg) {
+    throw std::runtime_error(std::string(what_) + ": " + msg);
+  }
+
+  const uint8_t* buf_;
+  size_t len_;
+  const char* what_;
+  const TensorAllocator& alloc_;
+  std::vector<torch::Tensor>* payloads_;
+  size_t off_ = 0;
+};
+
+EncodedFrame encode_activation(const ActivationPacket& p) {
+  FrameWriter w(p.version);
+  w.put_i32(p.stage_from);
+  w.put_i32(p.stage_to);
+  w.put_i32((int32_t)p.kind);
+  w.put_i32(p.flags);
+  w.put_i32((int32_t)p.codec);
+  w.put_i32(scalar_type_to_i32(p.hidden_dtype));
+  w.put_u64((uint64_t)p.step);
+  w.put_u64((uint64_t)p.pos);
+  w.put_u64((uint64_t)p.request_id);
+
+  w.put_tensor(p.hidden);
+  w.put_tensor(p.attn_mask.value_or(torch::Tensor()));
+  w.put_tensor(p.positions.value_or(torch::Tensor()));
+  w.put_tensor(p.slots.value_or(torch::Tensor()));
+  w.put_tensor(p.cu_seqlens.value_or(torch::Tensor()));
+  w.put_tensor(p.hidden_scale.value_or(torch::Tensor()));
+  return w.finish();
+}
+
+EncodedFrame encode_kv(const KVPacket& p) {
+  FrameWriter w(p.version);
+  w.put_i32(p.stage_from);
+  w.put_i32(p.stage_to);
+  w.put_u64((uint64_t)p.step);
+  w.put_u64((uint64_t)p.pos);
+  w.put_u64((uint64_t)p.request_id);
+  w.put_u64((uint64_t)p.kv_start);
+  w.put_i32(p.layer);
+  w.put_i32(p.layer_count);
+
+  w.put_tensor(p.k.value_or(torch::Tensor()));
+  w.put_tensor(p.v.value_or(torch::Tensor()));
+  return w.finish();
+}
+
+uint32_t parse_frame_prefix(const uint8_t* prefix, const char* what) {
+  uint32_t net[2];
+  std::memcpy(net, prefix, sizeof(net));
+  const int32_t version = (int32_t)ntohl(net[0]);
+  if (version != kWireVersion) {
+    throw std::runtime_error(std::string(what) + ": unsupported wire version " + std::to_string(version) +
+                             " (expected " + std::to_string(kWireVersion) + ")");
+  }
+  const uint32_t len = ntohl(net[1]);
+  if (len > kMaxHeaderBytes) throw std::runtime_error(std::string(what) + ": header too large");
+  return len;
+}
+
+ActivationPacket decode_activation(const uint8_t* header,
+                                   size_t len,
+                                   const TensorAllocator& alloc,
+                                   std::vector<torch::Tensor>* payloads) {
+  FrameReader r(header, len, "recv_activation", alloc, payloads);
+  ActivationPacket p;
+  p.stage_from = r.i32();
+  p.stage_to = r.i32();
+  p.kind = (PacketKind)r.i32();
+  p.flags = r.i32();
+  const int32_t codec = r.i32();
+  if (codec < (int32_t)HiddenCodec::kNone || codec > (int32_t)HiddenCodec::kFp8) {
+    throw std::runtime_error("recv_activation: unknown hidden codec " + std::to_string(codec));
+  }
+  p.codec = (HiddenCodec)codec;
+  p.hidden_dtype = i32_to_scalar_type(r.i32());
+  p.step = (int64_t)r.u64();
+  p.pos = (int64_t)r.u64();
+  p.request_id = (int64_t)r.u64();
+
+  p.hidden = r.tensor();
+  auto m = r.tensor();
+  auto positions = r.tensor();
+  auto slots = r.tensor();
+  auto cu = r.tensor();
+  auto scale = r.tensor();
+  r.done();
+
+  if (m.defined()) p.attn_mask = m;
+  if (positions.defined()) p.positions = positions;
+  if (slots.defined()) p.slots = slots;
+  if (cu.defined()) p.cu_seqlens = cu;
+  if (scale.defined()) p.hidden_scale = scale;
+  return p;
+}
+
+KVPacket decode_kv(const uint8_t* header,
+                   size_t len,
+                   const TensorAllocator& alloc,
+                   std::vector<torch::Tensor>* payloads) {
+  FrameReader r(header, len, "recv_kv", alloc, payloads);
+  KVPacket p;
+  p.stage_from = r.i32();
+  p.stage_to = r.i32();
+  p.step = (int64_t)r.u64();
+  p.pos = (int64_t)r.u64();
+  p.request_id = (int64_t)r.u64();
+  p.kv_start = (int64_t)r.u64();
+  p.layer = r.i32();
+  p.layer_count = r.i32();
+
+  auto k = r.tensor();
+  auto v = r.tensor();
+  r.done();
+  if (k.defined()) p.k = k;
+  if (v.defined()) p.v = v;
+  return p;
+}
+
+} // namespace qwen
@@ -45,7 +45,6 @@ ProjectorImpl::ProjectorImpl(const ModelConfig& cfg) : cfg_(cfg) {
 
 torch::Tensor ProjectorImpl::forward(const torch::Tensor& vision_emb) {
   require(vision_emb.defined(), "Projector: vision_emb is undefined");
-  require_cuda(vision_emb, "Projector: vision_emb must be CUDA");
   require(vision_emb.dim() == 3, "Projector: expected [B, V, Dv]");
   require(vision_emb.size(2) == in_dim_, "Projector: unexpected Dv (vision hidden size mismatch)");
 
@@ -46,7 +46,6 @@ VisionEncoderImpl::VisionEncoderImpl(const ModelConfig& cfg) : cfg_(cfg) {
 
 torch::Tensor VisionEncoderImpl::forward(const torch::Tensor& images) {
   require(images.defined(), "VisionEncoder: input is undefined");
-  require_cuda(images, "VisionEncoder: input must be CUDA");
   require(images.dim() == 4, "VisionEncoder: expected [B, 3, H, W]");
 
   auto x = images;
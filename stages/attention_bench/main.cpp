@@ -0,0 +1,191 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "core/config.h"
+#include "core/kv_cache.h"
+#include "core/rope.h"
+#include "core/tensor_utils.h"
+#include "model/attention.h"
+
+// Decode microbenchmark for one attention layer: fills a KV cache with
+// --context positions, then times single-token steps for each --impls entry.
+// "decode" is gqa with the T == 1 fast path; every other entry runs its
+// generic path so the two can be compared. --kv-block-size times the same
+// entries against a paged cache, where "decode" walks the block table in
+// block_kv chunks and the other entries gather it.
+
+static const char* arg_str(int argc, char** argv, const char* key, const char* def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return argv[i + 1];
+  }
+  return def;
+}
+
+static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return std::stoll(argv[i + 1]);
+  }
+  return def;
+}
+
+// "cpu" or a negative index selects the CPU backend.
+static int64_t arg_device(int argc, char** argv, const char* key, int64_t def) {
+  const std::string s = arg_str(argc, argv, key, "");
+  if (s.empty()) return def;
+  if (s == "cpu") return -1;
+  return std::stoll(s);
+}
+
+static bool has_flag(int argc, char** argv, const char* flag) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == flag) return true;
+  }
+  return false;
+}
+
+static void usage() {
+  std::fprintf(stderr,
+               "attention_bench usage:\n"
+               "  [--impls <a,b,...>]           (default reference,gqa,tiled,decode)\n"
+               "  [--q-heads <H>]               (default 64)\n"
+               "  [--kv-heads <Hkv>]            (default 4)\n"
+               "  [--head-dim <Hd>]             (default 128)\n"
+               "  [--batch <B>]                 (default 1)\n"
+               "  [--context <S>]               (cached positions before decode, default 4096)\n"
+               "  [--prefill <T>]               (tokens per step; default 1 = decode)\n"
+               "  [--iters <N>]                 (timed steps, default 50)\n"
+               "  [--warmup <N>]                (default 5)\n"
+               "  [--kv-block-size <bs>]        (paged cache with bs-token blocks, default 0 = dense)\n"
+               "  [--block-q <n>] [--block-kv <n>] (tile sizes for tiled, default 128/512)\n"
+               "  [--dtype <fp32|bf16|fp16>]    (default bf16 on CUDA, fp32 on CPU)\n"
+               "  [--device <cuda_device_index|cpu>]\n");
+}
+
+static std::vector<std::string> split_csv(const std::string& s) {
+  std::vector<std::string> out;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) out.push_back(item);
+  }
+  return out;
+}
+
+static void sync(const torch::Device& device) {
+  if (device.is_cuda()) torch::cuda::synchronize(device.index());
+}
+
+int main(int argc, char** argv) {
+  if (has_flag(argc, argv, "--help")) {
+    usage();
+    return 0;
+  }
+
+  const std::vector<std::string> impls = split_csv(arg_str(argc, argv, "--impls", "reference,gqa,tiled,decode"));
+  const int64_t q_heads = arg_i64(argc, argv, "--q-heads", 64);
+  const int64_t kv_heads = arg_i64(argc, argv, "--kv-heads", 4);
+  const int64_t head_dim = arg_i64(argc, argv, "--head-dim", 128);
+  const int64_t B = arg_i64(argc, argv, "--batch", 1);
+  const int64_t context = arg_i64(argc, argv, "--context", 4096);
+  const int64_t T = arg_i64(argc, argv, "--prefill", 1);
+  const int64_t iters = arg_i64(argc, argv, "--iters", 50);
+  const int64_t warmup = arg_i64(argc, argv, "--warmup", 5);
+  const int64_t block_size = arg_i64(argc, argv, "--kv-block-size", 0);
+  const int64_t device_index = arg_device(argc, argv, "--device", torch::cuda::is_available() ? 0 : -1);
+  if (impls.empty() || q_heads <= 0 || kv_heads <= 0 || head_dim <= 0 || T <= 0 || iters <= 0) {
+    usage();
+    return 2;
+  }
+  if (device_index >= 0 && !torch::cuda::is_available()) {
+    std::fprintf(stderr, "error: CUDA is not available\n");
+    return 3;
+  }
+
+  const torch::Device device = qwen::device_for_index((int)device_index);
+  const std::string dtype_s = arg_str(argc, argv, "--dtype", device.is_cpu() ? "fp32" : "bf16");
+  c10::ScalarType dtype = torch::kFloat32;
+  if (dtype_s == "bf16") dtype = torch::kBFloat16;
+  if (dtype_s == "fp16") dtype = torch::kFloat16;
+
+  qwen::ModelConfig cfg;
+  cfg.hidden_size = (int32_t)(q_heads * head_dim);
+  cfg.num_attention_heads = (int32_t)q_heads;
+  cfg.num_key_value_heads = (int32_t)kv_heads;
+  cfg.rope_dim = (int32_t)head_dim;
+  cfg.max_batch = (int32_t)B;
+  cfg.max_seq_len = (int32_t)(context + T * (warmup + iters));
+  cfg.use_qk_norm = true;
+  cfg.attention_block_q = (int32_t)arg_i64(argc, argv, "--block-q", cfg.attention_block_q);
+  cfg.attention_block_kv = (int32_t)arg_i64(argc, argv, "--block-kv", cfg.attention_block_kv);
+
+  torch::NoGradGuard no_grad;
+  qwen::Attention attn(cfg, 0);
+  attn->to(device, dtype);
+  attn->eval();
+
+  const qwen::RopeTables rope =
+      qwen::precompute_cos_sin(cfg.max_seq_len, cfg.rope_dim, cfg.rope_theta, dtype, (int)device_index);
+
+  std::fprintf(stderr,
+               "[attention_bench] device=%s dtype=%s B=%lld H=%lld Hkv=%lld Hd=%lld context=%lld T=%lld kv_block_size=%lld\n",
+               device.str().c_str(),
+               dtype_s.c_str(),
+               (long long)B,
+               (long long)q_heads,
+               (long long)kv_heads,
+               (long long)head_dim,
+               (long long)context,
+               (long long)T,
+               (long long)block_size);
+
+  auto opts = torch::TensorOptions().dtype(dtype).device(device);
+  for (const auto& impl : impls) {
+    const bool fast = (impl == "decode");
+    attn->set_impl(fast ? "gqa" : impl);
+    attn->set_decode_fast_path(fast);
+
+    qwen::KVCache cache;
+    if (block_size > 0) {
+      auto pool = std::make_shared<qwen::KVBlockPool>(
+          1, (int32_t)block_size, (int32_t)kv_heads, (int32_t)head_dim, dtype, (int)device_index);
+      cache.init_paged(pool, cfg.max_batch, cfg.max_seq_len);
+    } else {
+      cache.init(1, cfg.max_batch, cfg.max_seq_len, (int32_t)kv_heads, (int32_t)head_dim, dtype, (int)device_index);
+    }
+    if (context > 0) {
+      cache.append(0,
+                   torch::randn({B, kv_heads, context, head_dim}, opts),
+                   torch::randn({B, kv_heads, context, head_dim}, opts),
+                   0);
+    }
+
+    int64_t pos = context;
+    auto x = torch::randn({B, T, cfg.hidden_size}, opts);
+    for (int64_t i = 0; i < warmup; ++i, pos += T) {
+      (void)attn->forward(x, c10::nullopt, &cache, pos, rope);
+    }
+    sync(device);
+
+    const auto t0 = std::chrono::steady_clock::now();
+    for (int64_t i = 0; i < iters; ++i, pos += T) {
+      (void)attn->forward(x, c10::nullopt, &cache, pos, rope);
+    }
+    sync(device);
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+
+    std::fprintf(stderr,
+                 "[attention_bench] impl=%s ms_per_step=%.4f tok_per_s=%.1f\n",
+                 impl.c_str(),
+                 ms / (double)iters,
+                 (double)(iters * T * B) * 1000.0 / ms);
+  }
+  return 0;
+}
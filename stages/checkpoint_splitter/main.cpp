@@ -0,0 +1,156 @@
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "core/config.h"
+#include "core/hf_config.h"
+#include "core/sharding.h"
+#include "loader/model_loader.h"
+#include "loader/stage_shard.h"
+#include "loader/weight_loader.h"
+#include "model/model_stage.h"
+
+// Cuts a full checkpoint into one self-contained stage shard per pipeline
+// stage (see loader/stage_shard.h), so each stage starts by mmapping only
+// its own file instead of filtering and converting the whole checkpoint.
+
+static const char* arg_str(int argc, char** argv, const char* key, const char* def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return argv[i + 1];
+  }
+  return def;
+}
+
+static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return std::stoll(argv[i + 1]);
+  }
+  return def;
+}
+
+static bool has_flag(int argc, char** argv, const char* flag) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == flag) return true;
+  }
+  return false;
+}
+
+static void usage() {
+  std::fprintf(stderr,
+               "checkpoint_splitter usage:\n"
+               "  --hf-config <path>\n"
+               "  --weights <weights.pt | *.safetensors | index.json | dir>\n"
+               "  --out-dir <dir>\n"
+               "  --num-stages <N>               (even layer split)\n"
+               "  [--ranges <b0:e0,b1:e1,...>]   (manual layer ranges instead of --num-stages)\n"
+               "  [--moe-stacked]                (write stacked expert weights; stages must run with\n"
+               "                                  the same flag)\n"
+               "  [--load-threads <N>]           (weight loading workers, default 4)\n");
+}
+
+// "0:12,12:24" -> {{0,12},{12,24}}
+static bool parse_ranges(const std::string& s, std::vector<std::pair<int32_t, int32_t>>* out) {
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    const size_t colon = item.find(':');
+    if (colon == std::string::npos) return false;
+    try {
+      out->emplace_back((int32_t)std::stoi(item.substr(0, colon)), (int32_t)std::stoi(item.substr(colon + 1)));
+    } catch (const std::exception&) {
+      return false;
+    }
+  }
+  return !out->empty();
+}
+
+int main(int argc, char** argv) {
+  const std::string hf_path = arg_str(argc, argv, "--hf-config", "");
+  const std::string weights_path = arg_str(argc, argv, "--weights", "");
+  const std::string out_dir = arg_str(argc, argv, "--out-dir", "");
+  const int64_t num_stages = arg_i64(argc, argv, "--num-stages", -1);
+  const std::string ranges_s = arg_str(argc, argv, "--ranges", "");
+  const int64_t load_threads = arg_i64(argc, argv, "--load-threads", 4);
+  if (hf_path.empty() || weights_path.empty() || out_dir.empty() || (num_stages <= 0 && ranges_s.empty())) {
+    usage();
+    return 2;
+  }
+
+  qwen::ModelConfig base_cfg = qwen::load_hf_config_json(hf_path);
+  qwen::ShardingPlan plan;
+  if (!ranges_s.empty()) {
+    std::vector<std::pair<int32_t, int32_t>> ranges;
+    if (!parse_ranges(ranges_s, &ranges)) {
+      std::fprintf(stderr, "error: --ranges must look like 0:12,12:24\n");
+      return 3;
+    }
+    plan = qwen::make_plan_manual(base_cfg, ranges, std::vector<int32_t>{});
+  } else {
+    plan = qwen::make_plan_even_layers(base_cfg, (int32_t)num_stages, std::vector<int32_t>{});
+  }
+
+  std::filesystem::create_directories(out_dir);
+  std::unique_ptr<qwen::WeightLoader> wl = qwen::open_weight_loader(weights_path);
+  torch::NoGradGuard no_grad;
+
+  std::ostringstream index;
+  index << "{\n  \"format\": \"" << qwen::kStageShardFormat << "\",\n";
+  index << "  \"stage_count\": " << plan.stages.size() << ",\n";
+  index << "  \"moe_stacked\": " << (has_flag(argc, argv, "--moe-stacked") ? "true" : "false") << ",\n";
+  index << "  \"stages\": [\n";
+
+  for (size_t i = 0; i < plan.stages.size(); ++i) {
+    const qwen::ShardSpec& spec = plan.stages[i];
+    qwen::ModelConfig cfg = qwen::config_for_stage(base_cfg, spec);
+    cfg.device_index = -1;
+    cfg.moe_stacked_experts = has_flag(argc, argv, "--moe-stacked");
+
+    // Build and load on the CPU, one stage at a time, so peak memory is one
+    // stage's weights.
+    qwen::ModelStage stage = qwen::make_stage_for_load(cfg, torch::Device(torch::kCPU));
+    qwen::LoadReport rep;
+    qwen::LoadOptions opts;
+    opts.strict = true;
+    opts.load_vision = false;
+    opts.num_threads = (int32_t)load_threads;
+    qwen::load_stage_weights(stage, *wl, cfg, &rep, opts);
+    if (rep.missing > 0 || rep.mismatched > 0) {
+      std::fprintf(stderr,
+                   "error: stage %zu: missing=%lld mismatched=%lld\n",
+                   i,
+                   (long long)rep.missing,
+                   (long long)rep.mismatched);
+      return 5;
+    }
+
+    const std::string file = qwen::stage_shard_file_name(spec.stage_id, spec.stage_count);
+    const int64_t bytes = qwen::write_stage_shard((std::filesystem::path(out_dir) / file).string(), stage, cfg);
+    std::fprintf(stderr,
+                 "[checkpoint_splitter] stage %d layers [%d, %d): %lld tensors, %.1f MB -> %s\n",
+                 spec.stage_id,
+                 spec.layer_start,
+                 spec.layer_end,
+                 (long long)rep.loaded,
+                 (double)bytes / 1e6,
+                 file.c_str());
+
+    index << "    {\"stage_id\": " << spec.stage_id << ", \"layer_start\": " << spec.layer_start
+          << ", \"layer_end\": " << spec.layer_end << ", \"file\": \"" << file << "\", \"bytes\": " << bytes << "}"
+          << (i + 1 < plan.stages.size() ? "," : "") << "\n";
+  }
+  index << "  ]\n}\n";
+
+  const std::string index_path = (std::filesystem::path(out_dir) / "stage_shards.json").string();
+  std::ofstream os(index_path);
+  os << index.str();
+  std::fprintf(stderr, "[checkpoint_splitter] wrote %zu stage shards, index -> %s\n", plan.stages.size(), index_path.c_str());
+  return 0;
+}
@@ -1,6 +1,8 @@
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -9,9 +11,11 @@
 #include "core/config.h"
 #include "core/hf_config.h"
 #include "core/sharding.h"
+#include "core/tensor_utils.h"
 #include "loader/model_loader.h"
-#include "loader/pt_weight_loader.h"
+#include "loader/weight_loader.h"
 #include "model/model_stage.h"
+#include "runtime/hidden_codec.h"
 #include "runtime/transport.h"
 
 static const char* arg_str(int argc, char** argv, const char* key, const char* def) {
@@ -28,11 +32,19 @@ static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
   return def;
 }
 
+// "cpu" or a negative index selects the CPU backend.
+static int64_t arg_device(int argc, char** argv, const char* key, int64_t def) {
+  const std::string s = arg_str(argc, argv, key, "");
+  if (s.empty()) return def;
+  if (s == "cpu") return -1;
+  return std::stoll(s);
+}
+
 static void usage() {
   std::fprintf(stderr,
                "distributed_parity_stage usage:\n"
                "  --hf-config <path>\n"
-               "  --weights <weights.pt>\n"
+               "  --weights <weights.pt | *.safetensors | index.json | dir>\n"
                "  --num-stages <N>\n"
                "  --stage-idx <i>\n"
                "  [--listen <port>]              (required for non-first stages)\n"
@@ -41,9 +53,15 @@ static void usage() {
                "  [--out <output.pt>]            (required for last stage)\n"
                "  [--input-ids <input_ids.pt>]   (first stage only)\n"
                "  [--images <images.pt>]         (first stage only)\n"
-               "  [--device <cuda_device_index>]\n"
+               "  [--device <cuda_device_index|cpu>]\n"
+               "  [--wire-codec <none|int8|fp8>] (quantize the hidden states this stage sends and log the\n"
+               "                                  error the hop adds; default none)\n"
+               "  [--reference <ref.pt>]         (last stage: parity_runner --out of the same input; logs\n"
+               "                                  the max/mean error of this output against it)\n"
+               "  [--report <report.json>]       (last stage, with --reference: write that comparison)\n"
                "  [--layer-begin <L>]\n"
-               "  [--layer-end <R>]\n");
+               "  [--layer-end <R>]\n"
+               "  [--load-threads <N>]           (weight loading workers, default 4)\n");
 }
 
 int main(int argc, char** argv) {
@@ -56,13 +74,21 @@ int main(int argc, char** argv) {
     return 2;
   }
 
-  const int64_t device_index = arg_i64(argc, argv, "--device", 0);
+  const int64_t device_index = arg_device(argc, argv, "--device", 0);
   const int64_t listen_port = arg_i64(argc, argv, "--listen", -1);
   const std::string next_host = arg_str(argc, argv, "--next-host", "");
   const int64_t next_port = arg_i64(argc, argv, "--next-port", -1);
   const std::string out_path = arg_str(argc, argv, "--out", "");
   const int64_t layer_begin_override = arg_i64(argc, argv, "--layer-begin", -1);
   const int64_t layer_end_override = arg_i64(argc, argv, "--layer-end", -1);
+  const int64_t load_threads = arg_i64(argc, argv, "--load-threads", 4);
+  const std::string reference_path = arg_str(argc, argv, "--reference", "");
+  const std::string report_path = arg_str(argc, argv, "--report", "");
+  qwen::HiddenCodec wire_codec = qwen::HiddenCodec::kNone;
+  if (!qwen::parse_hidden_codec(arg_str(argc, argv, "--wire-codec", "none"), &wire_codec)) {
+    std::fprintf(stderr, "error: --wire-codec must be none, int8 or fp8\n");
+    return 3;
+  }
 
   const bool is_first = (stage_idx == 0);
   const bool is_last = (stage_idx == num_stages - 1);
@@ -79,8 +105,12 @@ int main(int argc, char** argv) {
     std::fprintf(stderr, "error: --out required for last stage\n");
     return 3;
   }
+  if (!report_path.empty() && reference_path.empty()) {
+    std::fprintf(stderr, "error: --report requires --reference\n");
+    return 3;
+  }
 
-  if (!torch::cuda::is_available()) {
+  if (device_index >= 0 && !torch::cuda::is_available()) {
     std::fprintf(stderr, "error: CUDA is not available\n");
     return 4;
   }
@@ -92,24 +122,30 @@ int main(int argc, char** argv) {
   if (layer_end_override >= 0) spec.layer_end = (int32_t)layer_end_override;
   qwen::ModelConfig cfg = qwen::config_for_stage(base_cfg, spec);
 
-  qwen::PtWeightLoader pt(weights_path);
-  pt.load();
-  qwen::MapWeightLoader wl;
-  for (const auto& kv : pt.weights()) {
-    wl.insert(kv.first, kv.second);
-  }
+  // Packed checkpoints are read lazily: only this stage's tensors are loaded.
+  std::unique_ptr<qwen::WeightLoader> wl = qwen::open_weight_loader(weights_path);
 
-  qwen::ModelStage stage(cfg);
-  stage->to(torch::Device(torch::kCUDA, (int)device_index));
+  const bool with_vision = !std::string(arg_str(argc, argv, "--images", "")).empty();
+  qwen::ModelStage stage = qwen::make_stage_for_load(cfg, qwen::device_for_index((int)device_index), with_vision);
   stage->eval();
 
   qwen::LoadReport rep;
   qwen::LoadOptions opts;
   opts.strict = true;
   opts.load_vision = false;
-  qwen::load_stage_weights(stage, wl, cfg, &rep, opts);
+  opts.num_threads = (int32_t)load_threads;
+  qwen::load_stage_weights(stage, *wl, cfg, &rep, opts);
+  std::fprintf(stderr,
+               "[distributed_parity_stage] loaded %lld tensors, %.1f MB in %.2f s (%.2f GB/s, %d threads)\n",
+               (long long)rep.loaded,
+               (double)rep.bytes / 1e6,
+               rep.seconds,
+               rep.gb_per_s(),
+               (int)opts.num_threads);
 
   qwen::StageInput in;
+  // Codec of the hop into this stage; the reference comparison reports it.
+  qwen::HiddenCodec recv_codec = qwen::HiddenCodec::kNone;
 
   if (is_first) {
     const std::string input_ids_path = arg_str(argc, argv, "--input-ids", "");
@@ -117,22 +153,23 @@ int main(int argc, char** argv) {
     if (!input_ids_path.empty()) {
       torch::Tensor input_ids;
       torch::load(input_ids, input_ids_path);
-      in.input_ids = input_ids.to(torch::kCUDA, (int)device_index);
+      in.input_ids = input_ids.to(qwen::device_for_index((int)device_index));
     } else if (cfg.vocab_size > 0) {
-      auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(torch::Device(torch::kCUDA, (int)device_index));
+      auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(qwen::device_for_index((int)device_index));
       in.input_ids = torch::randint(0, cfg.vocab_size, {1, 8}, opts_i64);
     }
     if (!images_path.empty()) {
       torch::Tensor images;
       torch::load(images, images_path);
-      in.images = images.to(torch::kCUDA, (int)device_index);
+      in.images = images.to(qwen::device_for_index((int)device_index));
     }
     in.pos = 0;
   } else {
     qwen::TcpServer server((int)listen_port);
     qwen::TcpConn conn(server.accept_one());
     qwen::ActivationPacket p = conn.recv_activation();
-    in.hidden_in = p.hidden.to(torch::kCUDA, (int)device_index);
+    recv_codec = p.codec;
+    in.hidden_in = qwen::hidden_on(p, qwen::device_for_index((int)device_index));
     if (p.attn_mask.has_value() && p.attn_mask->defined()) {
       in.attn_mask = p.attn_mask->to(torch::kCUDA, (int)device_index);
     }
@@ -145,6 +182,37 @@ int main(int argc, char** argv) {
     torch::Tensor to_save = out.logits.defined() ? out.logits : out.hidden_out;
     torch::save(to_save, out_path);
     std::fprintf(stderr, "[distributed_parity_stage] saved output -> %s\n", out_path.c_str());
+
+    if (!reference_path.empty()) {
+      torch::Tensor ref;
+      torch::load(ref, reference_path);
+      if (ref.sizes() != to_save.sizes()) {
+        std::fprintf(stderr, "error: --reference shape does not match this output\n");
+        return 5;
+      }
+      const qwen::CodecError err = qwen::error_between(to_save, ref);
+      // Greedy agreement is what decoding sees; only meaningful for logits.
+      double top1 = -1.0;
+      if (out.logits.defined()) {
+        top1 = to_save.argmax(-1).eq(ref.to(to_save.device()).argmax(-1)).to(torch::kFloat32).mean().item<double>();
+      }
+      std::fprintf(stderr,
+                   "[distributed_parity_stage] vs reference (last hop codec %s): max_abs=%.6g mean_abs=%.6g "
+                   "top1_match=%.4f\n",
+                   qwen::hidden_codec_name(recv_codec),
+                   err.max_abs,
+                   err.mean_abs,
+                   top1);
+      if (!report_path.empty()) {
+        std::ofstream os(report_path);
+        os << "{\n";
+        os << "  \"wire_codec\": \"" << qwen::hidden_codec_name(recv_codec) << "\",\n";
+        os << "  \"max_abs\": " << err.max_abs << ",\n";
+        os << "  \"mean_abs\": " << err.mean_abs << ",\n";
+        os << "  \"top1_match\": " << top1 << "\n";
+        os << "}\n";
+      }
+    }
     return 0;
   }
 
@@ -155,6 +223,23 @@ int main(int argc, char** argv) {
   p.pos = in.pos;
   p.hidden = out.hidden_out;
   if (out.hidden_out.defined()) {
+    if (wire_codec != qwen::HiddenCodec::kNone) {
+      const qwen::CodecError err = qwen::codec_error(out.hidden_out, wire_codec);
+      const int64_t raw_bytes = (int64_t)out.hidden_out.nbytes();
+      qwen::quantize_hidden(&p, wire_codec);
+      const int64_t wire_bytes =
+          (int64_t)(p.hidden.nbytes() + (p.hidden_scale.has_value() ? p.hidden_scale->nbytes() : 0));
+      std::fprintf(stderr,
+                   "[distributed_parity_stage] hop %lld->%lld codec %s: max_abs=%.6g mean_abs=%.6g "
+                   "bytes %lld -> %lld\n",
+                   (long long)stage_idx,
+                   (long long)(stage_idx + 1),
+                   qwen::hidden_codec_name(wire_codec),
+                   err.max_abs,
+                   err.mean_abs,
+                   (long long)raw_bytes,
+                   (long long)wire_bytes);
+    }
     qwen::TcpClient client(next_host, (int)next_port);
     client.send_activation(p);
   } else {
@@ -1,6 +1,9 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -9,11 +12,17 @@
 #include "core/config.h"
 #include "core/hf_config.h"
 #include "core/sharding.h"
+#include "core/tensor_utils.h"
 #include "loader/model_loader.h"
-#include "loader/pt_weight_loader.h"
+#include "loader/weight_loader.h"
 #include "model/model_stage.h"
+#include "runtime/async_transport.h"
+#include "runtime/continuous_batch.h"
+#include "runtime/hidden_codec.h"
 #include "runtime/kv_wire.h"
-#include "runtime/transport.h"
+#include "runtime/micro_batch.h"
+#include "runtime/pipeline_stage.h"
+#include "runtime/transport_factory.h"
 
 static const char* arg_str(int argc, char** argv, const char* key, const char* def) {
   for (int i = 1; i + 1 < argc; ++i) {
@@ -29,6 +38,14 @@ static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
   return def;
 }
 
+// "cpu" or a negative index selects the CPU backend.
+static int64_t arg_device(int argc, char** argv, const char* key, int64_t def) {
+  const std::string s = arg_str(argc, argv, key, "");
+  if (s.empty()) return def;
+  if (s == "cpu") return -1;
+  return std::stoll(s);
+}
+
 static bool has_flag(int argc, char** argv, const char* flag) {
   for (int i = 1; i < argc; ++i) {
     if (std::string(argv[i]) == flag) return true;
@@ -40,7 +57,7 @@ static void usage() {
   std::fprintf(stderr,
                "distributed_pipeline_stage usage:\n"
                "  --hf-config <path>\n"
-               "  --weights <weights.pt>\n"
+               "  --weights <weights.pt | *.safetensors | index.json | dir>\n"
                "  --num-stages <N>\n"
                "  --stage-idx <i>\n"
                "  [--listen <port>]              (required for non-first stages)\n"
@@ -49,13 +66,506 @@ static void usage() {
                "  [--out <output.pt>]            (required for last stage)\n"
                "  [--input-ids <input_ids.pt>]   (first stage only)\n"
                "  [--images <images.pt>]         (first stage only)\n"
-               "  [--device <cuda_device_index>]\n"
+               "  [--device <cuda_device_index|cpu>]\n"
+               "  [--transport <tcp|unix|shm>]   (unix/shm: stages on one host, over a Unix socket or a\n"
+               "                                  shared-memory ring per hop, named after the hop's port;\n"
+               "                                  --next-host is ignored; same choice on every stage)\n"
+               "  [--shm-ring-mb <N>]            (with --transport shm: ring size per direction, default 64;\n"
+               "                                  one packet must fit)\n"
+               "  [--wire-codec <none|int8|fp8>] (quantize the hidden states this stage sends, one scale per\n"
+               "                                  token; receivers follow the packet header; default none)\n"
                "  [--send-kv]\n"
+               "  [--kv-delta]                   (with --send-kv: ship only the written positions\n"
+               "                                  [0, length) instead of the whole max_seq_len buffer)\n"
                "  [--recv-kv]\n"
+               "  [--kv-stream]                  (with --send-kv/--recv-kv: one KV packet per layer, sent as\n"
+               "                                  soon as the layer's block has run and restored on arrival;\n"
+               "                                  set on both ends)\n"
                "  [--kv-out <path>]\n"
                "  [--kv-restore]\n"
+               "  [--moe-stacked]                (stacked expert weights, no per-expert modules)\n"
+               "  [--kv-block-size <N>]          (paged KV cache with N-token blocks; default 0 = dense)\n"
+               "  [--generate <N>]               (greedy-decode N tokens; stage 0 --listen receives\n"
+               "                                  tokens from the last stage, whose --next-host/--next-port\n"
+               "                                  point back at stage 0)\n"
+               "  [--serve]                      (long-running server; every stage needs --listen and\n"
+               "                                  --next-host/--next-port, the last stage replies to the client)\n"
+               "  [--prefill-chunk <N>]          (run and forward the prompt in N-token chunks so the next\n"
+               "                                  stage starts before this one finishes the prompt)\n"
+               "  [--micro-batches <M>]          (split the batch into M micro-batches that flow through the\n"
+               "                                  stages back to back, each with its own KV cache; same M on\n"
+               "                                  every stage)\n"
+               "  [--sync-io]                    (with --generate: send and receive on the compute thread\n"
+               "                                  instead of the async I/O threads)\n"
+               "  [--continuous]                (continuous batching with --generate N: stage 0 schedules\n"
+               "                                  --requests R synthetic prompts of up to --prompt-len P tokens\n"
+               "                                  into --slots S KV slots; ring wiring as --generate)\n"
+               "  [--static-batching]            (with --continuous: admit only when every slot is free)\n"
                "  [--layer-begin <L>]\n"
-               "  [--layer-end <R>]\n");
+               "  [--layer-end <R>]\n"
+               "  [--load-threads <N>]           (weight loading workers, default 4)\n");
+}
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(const Clock::time_point& t0) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+static qwen::StageInput load_first_stage_input(int argc, char** argv,
+                                               const qwen::ModelConfig& cfg,
+                                               const torch::Device& device) {
+  qwen::StageInput in;
+  const std::string input_ids_path = arg_str(argc, argv, "--input-ids", "");
+  const std::string images_path = arg_str(argc, argv, "--images", "");
+  if (!input_ids_path.empty()) {
+    torch::Tensor input_ids;
+    torch::load(input_ids, input_ids_path);
+    in.input_ids = input_ids.to(device);
+  } else if (cfg.vocab_size > 0) {
+    auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(device);
+    in.input_ids = torch::randint(0, cfg.vocab_size, {1, 8}, opts_i64);
+  }
+  if (!images_path.empty()) {
+    torch::Tensor images;
+    torch::load(images, images_path);
+    in.images = images.to(device);
+  }
+  in.pos = 0;
+  return in;
+}
+
+// Greedy next token from the last position: [B, T, V] -> [B, 1] int64.
+static torch::Tensor next_token(const torch::Tensor& logits) {
+  return logits.select(1, logits.size(1) - 1).argmax(-1, /*keepdim=*/true);
+}
+
+// Greedy next token of every sequence in a packed batch: [1, total, V] with
+// cu_seqlens [N+1] -> [N, 1] int64, taken at each sequence's last token.
+static torch::Tensor next_token_packed(const torch::Tensor& logits, const torch::Tensor& cu_seqlens) {
+  auto last = qwen::packed_last_indices(cu_seqlens).to(logits.device());
+  return logits.index_select(1, last).argmax(-1).view({-1, 1});
+}
+
+struct GenerateContext {
+  int64_t stage_idx = 0;
+  int64_t num_stages = 1;
+  int64_t steps = 0;
+  int64_t listen_port = -1;
+  std::string next_host;
+  int64_t next_port = -1;
+  std::string out_path;
+  int64_t micro_batches = 1;
+  bool async_io = true;
+  qwen::TransportOptions transport;
+  qwen::HiddenCodec codec = qwen::HiddenCodec::kNone;
+};
+
+// step_ms[0] is the prefill step; the rest are single-token decode steps.
+static void report_generate(const char* what, const std::vector<double>& step_ms, int64_t batch) {
+  if (step_ms.empty()) return;
+  double decode_ms = 0.0;
+  for (size_t i = 1; i < step_ms.size(); ++i) decode_ms += step_ms[i];
+  const int64_t decode_steps = (int64_t)step_ms.size() - 1;
+  const double per_token = decode_steps > 0 ? decode_ms / (double)decode_steps : 0.0;
+  const double tok_s = decode_ms > 0.0 ? (double)(decode_steps * batch) * 1000.0 / decode_ms : 0.0;
+  std::fprintf(stderr,
+               "[distributed_pipeline_stage] %s: steps=%lld batch=%lld prefill_ms=%.2f "
+               "decode_ms_per_token=%.2f decode_tok_per_s=%.2f\n",
+               what,
+               (long long)step_ms.size(),
+               (long long)batch,
+               step_ms[0],
+               per_token,
+               tok_s);
+}
+
+// Autoregressive loop over a ring of stages: 0 -> 1 -> ... -> last -> 0.
+// Every stage runs ctx.steps forwards per micro-batch; each micro-batch keeps
+// its own KV cache across steps and pos advances by the number of tokens each
+// step appended.
+//
+// With M micro-batches stage 0 launches all M prefills back to back, then
+// starts micro-batch m's next step as soon as its token returns, so up to M
+// micro-batches are in flight around the ring and downstream stages work on
+// one while stage 0 works on the next. The ring is FIFO, so tokens come back
+// in launch order. M = 1 is the unpipelined loop.
+static int run_generate(qwen::ModelStage& stage,
+                        const qwen::ModelConfig& cfg,
+                        const GenerateContext& ctx,
+                        qwen::StageInput first_in,
+                        const torch::Device& device) {
+  const bool is_first = (ctx.stage_idx == 0);
+  const bool is_last = (ctx.stage_idx == ctx.num_stages - 1);
+  const int64_t M = ctx.micro_batches;
+
+  // Stage 0 binds its return port before anything is sent so the last stage can
+  // always connect back; every other stage accepts its upstream peer once. On
+  // stage 0, upstream is that return connection from the last stage.
+  std::unique_ptr<qwen::TransportListener> server;
+  std::unique_ptr<qwen::Transport> upstream;
+  std::unique_ptr<qwen::Transport> downstream;
+  if (!(is_first && is_last)) {
+    server = qwen::make_listener(ctx.transport, (int)ctx.listen_port);
+    if (!is_first) upstream = server->accept();
+  }
+
+  // Connect lazily: on the last stage the peer is stage 0, which is only
+  // guaranteed to be listening once it has sent its first activation.
+  auto send_downstream = [&](const qwen::ActivationPacket& p) {
+    if (!downstream) downstream = qwen::make_connection(ctx.transport, ctx.next_host, (int)ctx.next_port);
+    downstream->send_activation(p);
+  };
+
+  // With async I/O packets leave through a send thread and arrive through a
+  // receive thread, both staged in pooled pinned buffers, so the next
+  // forward overlaps the previous transfer. Declared after the connections
+  // they use so they are torn down first.
+  auto staging = std::make_shared<qwen::StagingPool>(device.is_cuda());
+  std::unique_ptr<qwen::AsyncSender> sender;
+  std::unique_ptr<qwen::AsyncReceiver> receiver;
+  auto start_receiver = [&](int64_t last_step) {
+    receiver = std::make_unique<qwen::AsyncReceiver>(
+        [&](const qwen::TensorAllocator& alloc) { return upstream->recv_activation(alloc); },
+        [&]() { upstream->shutdown(); },
+        [M, last_step](const qwen::ActivationPacket& p) {
+          return p.step == last_step && p.request_id == M - 1 && (p.flags & qwen::kFlagMoreChunks) == 0;
+        },
+        2,
+        staging);
+  };
+  if (ctx.async_io && !(is_first && is_last)) {
+    sender = std::make_unique<qwen::AsyncSender>(send_downstream, 2, staging);
+    // Stage 0 accepts its return connection on the first token.
+    if (!is_first) start_receiver(ctx.steps - 1);
+  }
+
+  std::vector<qwen::KVCache> caches((size_t)M);
+  std::vector<qwen::StageInput> inputs;
+  if (is_first) inputs = qwen::split_micro_batches(first_in, M);
+  std::vector<int64_t> pos((size_t)M, 0);
+  std::vector<int64_t> rows((size_t)M, 0);
+  std::vector<std::vector<torch::Tensor>> generated((size_t)M);
+  std::vector<torch::Tensor> local_tok((size_t)M);
+
+  // step_ms[s]: on stage 0 the span from launching step s of the first
+  // micro-batch to receiving the token of its last (full round trip); on other
+  // stages the compute time of step s summed over micro-batches.
+  std::vector<double> step_ms((size_t)ctx.steps, 0.0);
+  std::vector<Clock::time_point> step_begin((size_t)ctx.steps);
+  qwen::StageUtilization util;
+
+  // Runs one micro-batch's step (or one prefill chunk of it) and forwards each
+  // chunk downstream. Returns the number of positions appended.
+  auto forward_and_send = [&](qwen::StageInput& in, int64_t m, int64_t step, bool more_upstream) {
+    const auto t0 = Clock::now();
+    int64_t appended = 0;
+    in.cache = &caches[(size_t)m];
+    stage->forward_chunks(in, [&](const qwen::StageOutput& out, int64_t chunk_pos, bool last_chunk) {
+      const bool more = more_upstream || !last_chunk;
+      rows[(size_t)m] = out.hidden_out.size(0);
+      appended += out.hidden_out.size(1);
+      torch::Tensor tok;
+      if (is_last) {
+        // Only the final chunk's last position predicts the next token.
+        if (more) return;
+        tok = next_token(out.logits);
+        generated[(size_t)m].push_back(tok.to(torch::kCPU));
+      }
+
+      if (is_first && is_last) {
+        local_tok[(size_t)m] = tok;
+        return;
+      }
+      qwen::ActivationPacket p;
+      p.stage_from = (int32_t)ctx.stage_idx;
+      p.stage_to = is_last ? 0 : (int32_t)(ctx.stage_idx + 1);
+      p.step = step;
+      p.pos = chunk_pos;
+      p.request_id = m;
+      p.flags = more ? qwen::kFlagMoreChunks : 0;
+      p.hidden = is_last ? tok : out.hidden_out;
+      qwen::quantize_hidden(&p, ctx.codec);
+      if (sender) {
+        sender->send(p);
+      } else {
+        send_downstream(p);
+      }
+    });
+    util.add_busy(t0);
+    if (!is_first) step_ms[(size_t)step] += ms_since(t0);
+    return appended;
+  };
+
+  if (is_first) {
+    // Token of (step, m) from the last stage, or from the local forward when
+    // this is the only stage.
+    auto take_token = [&](int64_t step, int64_t m) {
+      torch::Tensor tok = local_tok[(size_t)m];
+      if (!is_last) {
+        if (!upstream) {
+          upstream = server->accept();
+          if (ctx.async_io) start_receiver(ctx.steps - 1);
+        }
+        qwen::ActivationPacket ret = receiver ? receiver->pop() : upstream->recv_activation();
+        qwen::require(ret.request_id == m && ret.step == step, "generate: token arrived out of order");
+        tok = ret.hidden;
+      }
+      if (m == M - 1) step_ms[(size_t)step] = ms_since(step_begin[(size_t)step]);
+      return tok;
+    };
+
+    util.begin_wall();
+    for (int64_t step = 0; step < ctx.steps; ++step) {
+      for (int64_t m = 0; m < M; ++m) {
+        qwen::StageInput& in = inputs[(size_t)m];
+        if (step > 0) {
+          torch::Tensor tok = take_token(step - 1, m);
+          in = qwen::StageInput();
+          in.input_ids = tok.to(device);
+        }
+        if (m == 0) step_begin[(size_t)step] = Clock::now();
+        in.pos = pos[(size_t)m];
+        pos[(size_t)m] += forward_and_send(in, m, step, false);
+        if (step == 0 && cfg.max_seq_len > 0) {
+          qwen::require(pos[(size_t)m] + ctx.steps - 1 <= cfg.max_seq_len,
+                        "generate: prompt + generated tokens exceed max_seq_len");
+        }
+      }
+    }
+    for (int64_t m = 0; m < M; ++m) (void)take_token(ctx.steps - 1, m);
+  } else {
+    // Packets arrive in launch order: for each step, each micro-batch, all of
+    // its prefill chunks.
+    for (int64_t step = 0; step < ctx.steps; ++step) {
+      for (int64_t m = 0; m < M; ++m) {
+        bool more_upstream = false;
+        do {
+          qwen::ActivationPacket p = receiver ? receiver->pop() : upstream->recv_activation();
+          util.begin_wall();
+          qwen::require(p.request_id == m && p.step == step, "generate: activation arrived out of order");
+          qwen::StageInput in;
+          in.hidden_in = qwen::hidden_on(p, device);
+          if (p.attn_mask.has_value() && p.attn_mask->defined()) {
+            in.attn_mask = p.attn_mask->to(device);
+          }
+          in.pos = p.pos;
+          more_upstream = (p.flags & qwen::kFlagMoreChunks) != 0;
+          forward_and_send(in, m, step, more_upstream);
+        } while (more_upstream);
+      }
+    }
+  }
+
+  if (sender) sender->flush();
+
+  int64_t batch = 0;
+  for (int64_t r : rows) batch += r;
+  if (is_first) {
+    report_generate("generate", step_ms, batch);
+  } else {
+    report_generate("stage compute", step_ms, batch);
+  }
+  std::fprintf(stderr, "[distributed_pipeline_stage] stage %lld utilization: micro_batches=%lld %s\n",
+               (long long)ctx.stage_idx, (long long)M, util.summary().c_str());
+
+  if (is_last && !ctx.out_path.empty()) {
+    std::vector<torch::Tensor> per_mb;
+    for (const auto& toks : generated) per_mb.push_back(torch::cat(toks, 1));
+    torch::save(torch::cat(per_mb, 0), ctx.out_path);
+    std::fprintf(stderr, "[distributed_pipeline_stage] saved %lld generated tokens -> %s\n",
+                 (long long)ctx.steps, ctx.out_path.c_str());
+  }
+  return 0;
+}
+
+struct ContinuousOptions {
+  int64_t requests = 8;
+  int64_t prompt_len = 16;
+  int64_t slots = 4;
+  bool static_batching = false;
+};
+
+// Continuous batching over the same ring as --generate. Stage 0 owns the
+// scheduler: every iteration is either the prefill of one newly admitted
+// request (into a free KV slot) or one decode step over every running
+// sequence at its own position. Positions and slots travel with the packet,
+// so downstream stages only run what they are sent against a single
+// slot-indexed cache. A shutdown packet ends the run.
+static int run_continuous(qwen::ModelStage& stage,
+                          const qwen::ModelConfig& cfg,
+                          const GenerateContext& ctx,
+                          const ContinuousOptions& opts,
+                          const torch::Device& device) {
+  const bool is_first = (ctx.stage_idx == 0);
+  const bool is_last = (ctx.stage_idx == ctx.num_stages - 1);
+
+  std::unique_ptr<qwen::TransportListener> server;
+  std::unique_ptr<qwen::Transport> upstream;
+  std::unique_ptr<qwen::Transport> downstream;
+  if (!(is_first && is_last)) {
+    server = qwen::make_listener(ctx.transport, (int)ctx.listen_port);
+    if (!is_first) upstream = server->accept();
+  }
+  auto send_down = [&](const qwen::ActivationPacket& p) {
+    if (!downstream) downstream = qwen::make_connection(ctx.transport, ctx.next_host, (int)ctx.next_port);
+    downstream->send_activation(p);
+  };
+
+  qwen::KVCache cache;
+  qwen::StageUtilization util;
+
+  if (!is_first) {
+    while (true) {
+      qwen::ActivationPacket p = upstream->recv_activation();
+      if (p.kind == qwen::PacketKind::kShutdown) {
+        if (!is_last) send_down(p);
+        break;
+      }
+      util.begin_wall();
+      const auto t0 = Clock::now();
+      qwen::StageInput in;
+      in.hidden_in = qwen::hidden_on(p, device);
+      if (p.positions.has_value()) in.positions = *p.positions;
+      if (p.slots.has_value()) in.slots = *p.slots;
+      if (p.cu_seqlens.has_value()) in.cu_seqlens = *p.cu_seqlens;
+      in.cache = &cache;
+      qwen::StageOutput out = stage->forward(in);
+
+      qwen::ActivationPacket next;
+      next.stage_from = (int32_t)ctx.stage_idx;
+      next.stage_to = is_last ? 0 : (int32_t)(ctx.stage_idx + 1);
+      next.step = p.step;
+      if (!is_last) {
+        next.hidden = out.hidden_out;
+      } else if (p.cu_seqlens.has_value()) {
+        next.hidden = next_token_packed(out.logits, *p.cu_seqlens);
+      } else {
+        next.hidden = next_token(out.logits);
+      }
+      next.positions = p.positions;
+      next.slots = p.slots;
+      next.cu_seqlens = p.cu_seqlens;
+      qwen::quantize_hidden(&next, ctx.codec);
+      send_down(next);
+      util.add_busy(t0);
+    }
+    std::fprintf(stderr, "[distributed_pipeline_stage] stage %lld utilization: %s\n",
+                 (long long)ctx.stage_idx, util.summary().c_str());
+    return 0;
+  }
+
+  // Synthetic workload: prompts of varying length (prompt_len/2 .. prompt_len).
+  qwen::ContinuousBatchScheduler sched(opts.slots, opts.static_batching);
+  auto i64 = torch::TensorOptions().dtype(torch::kInt64);
+  const int64_t min_len = std::max<int64_t>(1, opts.prompt_len / 2);
+  for (int64_t r = 0; r < opts.requests; ++r) {
+    qwen::SequenceRequest req;
+    req.id = r;
+    const int64_t len = min_len + (r * 7) % (opts.prompt_len - min_len + 1);
+    req.prompt = torch::randint(0, cfg.vocab_size, {1, len}, i64);
+    req.max_new_tokens = ctx.steps;
+    sched.submit(std::move(req));
+  }
+
+  std::vector<qwen::FinishedSequence> done;
+  double decode_ms = 0.0;
+  const auto t_run = Clock::now();
+  qwen::ScheduledBatch batch;
+  while (sched.next(&batch)) {
+    const auto t0 = Clock::now();
+    qwen::StageInput in;
+    in.input_ids = batch.input_ids.to(device);
+    in.positions = batch.positions;
+    in.slots = batch.slots;
+    in.cu_seqlens = batch.cu_seqlens;
+    in.cache = &cache;
+    qwen::StageOutput out = stage->forward(in);
+    util.add_busy(t0);
+
+    torch::Tensor tok;
+    if (is_last) {
+      tok = batch.prefill ? next_token_packed(out.logits, batch.cu_seqlens) : next_token(out.logits);
+    } else {
+      qwen::ActivationPacket p;
+      p.stage_from = 0;
+      p.stage_to = 1;
+      p.step = sched.iterations();
+      p.hidden = out.hidden_out;
+      p.positions = batch.positions;
+      p.slots = batch.slots;
+      if (batch.prefill) p.cu_seqlens = batch.cu_seqlens;
+      qwen::quantize_hidden(&p, ctx.codec);
+      send_down(p);
+      if (!upstream) upstream = server->accept();
+      tok = upstream->recv_activation().hidden;
+    }
+    sched.complete(batch, tok);
+    if (!batch.prefill) decode_ms += ms_since(t0);
+    for (auto& f : sched.take_finished()) done.push_back(std::move(f));
+  }
+  const double wall_ms = ms_since(t_run);
+
+  if (!is_last) {
+    qwen::ActivationPacket bye;
+    bye.kind = qwen::PacketKind::kShutdown;
+    send_down(bye);
+  }
+
+  const int64_t tokens = (int64_t)done.size() * ctx.steps;
+  const double mean_batch =
+      sched.decode_iterations() > 0 ? (double)sched.decode_rows() / (double)sched.decode_iterations() : 0.0;
+  std::fprintf(stderr,
+               "[distributed_pipeline_stage] %s batching: requests=%lld slots=%lld tokens=%lld "
+               "iterations=%lld mean_decode_batch=%.2f wall_ms=%.2f tok_per_s=%.2f decode_tok_per_s=%.2f\n",
+               opts.static_batching ? "static" : "continuous",
+               (long long)done.size(),
+               (long long)opts.slots,
+               (long long)tokens,
+               (long long)sched.iterations(),
+               mean_batch,
+               wall_ms,
+               wall_ms > 0.0 ? (double)tokens * 1000.0 / wall_ms : 0.0,
+               decode_ms > 0.0 ? (double)sched.decode_rows() * 1000.0 / decode_ms : 0.0);
+  std::fprintf(stderr, "[distributed_pipeline_stage] stage 0 utilization: %s\n", util.summary().c_str());
+
+  if (!ctx.out_path.empty()) {
+    std::sort(done.begin(), done.end(),
+              [](const qwen::FinishedSequence& a, const qwen::FinishedSequence& b) { return a.id < b.id; });
+    std::vector<torch::Tensor> rows;
+    for (const auto& f : done) rows.push_back(f.tokens);
+    torch::save(torch::cat(rows, 0), ctx.out_path);
+    std::fprintf(stderr, "[distributed_pipeline_stage] saved generated tokens -> %s\n", ctx.out_path.c_str());
+  }
+  return 0;
+}
+
+// Long-running server: weights stay loaded, connections persist, and every
+// packet carries a request id that selects its own KV cache. Stage 0's
+// upstream is the client; the last stage replies to --next-host/--next-port
+// with the greedy next token of each activation. Control packets are applied
+// locally and forwarded down the chain. If the upstream peer disconnects the
+// stage waits for a new one; only a shutdown packet ends the loop.
+static int run_serve(qwen::ModelStage& stage, const GenerateContext& ctx) {
+  qwen::PipelineStage ps(stage);
+  auto server = qwen::make_listener(ctx.transport, (int)ctx.listen_port);
+  std::fprintf(stderr, "[distributed_pipeline_stage] serve: listening on :%d (%s)\n", server->port(),
+               qwen::transport_kind_name(ctx.transport.kind));
+
+  qwen::ServeLinks links;
+  links.upstream = server.get();
+  links.connect_downstream = [&]() { return qwen::make_connection(ctx.transport, ctx.next_host, (int)ctx.next_port); };
+  links.on_event = [](const std::string& msg) {
+    std::fprintf(stderr, "[distributed_pipeline_stage] serve: %s\n", msg.c_str());
+  };
+  links.codec = ctx.codec;
+  const int64_t served = ps.serve(links, (int32_t)ctx.stage_idx, (int32_t)ctx.num_stages);
+
+  std::fprintf(stderr,
+               "[distributed_pipeline_stage] serve: shutdown after %lld activations (%zu requests still cached)\n",
+               (long long)served,
+               ps.active_requests());
+  return 0;
 }
 
 int main(int argc, char** argv) {
@@ -68,7 +578,7 @@ int main(int argc, char** argv) {
     return 2;
   }
 
-  const int64_t device_index = arg_i64(argc, argv, "--device", 0);
+  const int64_t device_index = arg_device(argc, argv, "--device", 0);
   const int64_t listen_port = arg_i64(argc, argv, "--listen", -1);
   const std::string next_host = arg_str(argc, argv, "--next-host", "");
   const int64_t next_port = arg_i64(argc, argv, "--next-port", -1);
@@ -76,9 +586,35 @@ int main(int argc, char** argv) {
   const std::string kv_out_path = arg_str(argc, argv, "--kv-out", "");
   const int64_t layer_begin_override = arg_i64(argc, argv, "--layer-begin", -1);
   const int64_t layer_end_override = arg_i64(argc, argv, "--layer-end", -1);
+  const int64_t load_threads = arg_i64(argc, argv, "--load-threads", 4);
   const bool send_kv = has_flag(argc, argv, "--send-kv");
+  const bool kv_delta = has_flag(argc, argv, "--kv-delta");
+  const bool kv_stream = has_flag(argc, argv, "--kv-stream");
   const bool recv_kv = has_flag(argc, argv, "--recv-kv");
   const bool kv_restore = has_flag(argc, argv, "--kv-restore");
+  const int64_t generate_n = arg_i64(argc, argv, "--generate", 0);
+  const bool serve = has_flag(argc, argv, "--serve");
+  const int64_t prefill_chunk = arg_i64(argc, argv, "--prefill-chunk", 0);
+  const int64_t kv_block_size = arg_i64(argc, argv, "--kv-block-size", 0);
+  const int64_t micro_batches = arg_i64(argc, argv, "--micro-batches", 1);
+  const bool continuous = has_flag(argc, argv, "--continuous");
+  ContinuousOptions cont;
+  cont.requests = arg_i64(argc, argv, "--requests", cont.requests);
+  cont.prompt_len = arg_i64(argc, argv, "--prompt-len", cont.prompt_len);
+  cont.slots = arg_i64(argc, argv, "--slots", cont.slots);
+  cont.static_batching = has_flag(argc, argv, "--static-batching");
+  qwen::TransportOptions transport;
+  if (!qwen::parse_transport_kind(arg_str(argc, argv, "--transport", "tcp"), &transport.kind) ||
+      transport.kind == qwen::TransportKind::kInProc) {
+    std::fprintf(stderr, "error: --transport must be tcp, unix or shm (inproc: see pipeline_bench)\n");
+    return 3;
+  }
+  transport.shm.ring_bytes = arg_i64(argc, argv, "--shm-ring-mb", transport.shm.ring_bytes >> 20) << 20;
+  qwen::HiddenCodec wire_codec = qwen::HiddenCodec::kNone;
+  if (!qwen::parse_hidden_codec(arg_str(argc, argv, "--wire-codec", "none"), &wire_codec)) {
+    std::fprintf(stderr, "error: --wire-codec must be none, int8 or fp8\n");
+    return 3;
+  }
 
   const bool is_first = (stage_idx == 0);
   const bool is_last = (stage_idx == num_stages - 1);
@@ -91,12 +627,65 @@ int main(int argc, char** argv) {
     std::fprintf(stderr, "error: --next-host/--next-port required for non-last stages\n");
     return 3;
   }
-  if (is_last && out_path.empty()) {
+  if (is_last && out_path.empty() && !serve) {
     std::fprintf(stderr, "error: --out required for last stage\n");
     return 3;
   }
+  if (serve) {
+    if (listen_port < 0 || next_host.empty() || next_port < 0) {
+      std::fprintf(stderr, "error: --serve requires --listen and --next-host/--next-port on every stage\n");
+      return 3;
+    }
+    if (generate_n > 0 || send_kv || recv_kv) {
+      std::fprintf(stderr, "error: --serve cannot be combined with --generate/--send-kv/--recv-kv\n");
+      return 3;
+    }
+  }
+  if (generate_n > 0 && num_stages > 1) {
+    if (is_first && listen_port < 0) {
+      std::fprintf(stderr, "error: --generate requires --listen on stage 0 (return connection)\n");
+      return 3;
+    }
+    if (is_last && (next_host.empty() || next_port < 0)) {
+      std::fprintf(stderr, "error: --generate requires --next-host/--next-port on the last stage (stage 0)\n");
+      return 3;
+    }
+  }
+  if (generate_n > 0 && (send_kv || recv_kv)) {
+    std::fprintf(stderr, "error: --send-kv/--recv-kv are not supported with --generate\n");
+    return 3;
+  }
+
+  if (kv_stream && !send_kv && !recv_kv) {
+    std::fprintf(stderr, "error: --kv-stream requires --send-kv or --recv-kv\n");
+    return 3;
+  }
 
-  if (!torch::cuda::is_available()) {
+  if (prefill_chunk > 0 && (send_kv || recv_kv)) {
+    std::fprintf(stderr, "error: --prefill-chunk is not supported with --send-kv/--recv-kv\n");
+    return 3;
+  }
+
+  if (continuous) {
+    if (generate_n <= 0 || serve || micro_batches > 1 || send_kv || recv_kv) {
+      std::fprintf(stderr, "error: --continuous requires --generate and excludes --serve/--micro-batches/--send-kv/--recv-kv\n");
+      return 3;
+    }
+    if (cont.requests <= 0 || cont.prompt_len <= 0 || cont.slots <= 0) {
+      std::fprintf(stderr, "error: --requests/--prompt-len/--slots must be > 0\n");
+      return 3;
+    }
+  }
+  if (micro_batches < 1) {
+    std::fprintf(stderr, "error: --micro-batches must be >= 1\n");
+    return 3;
+  }
+  if (micro_batches > 1 && (send_kv || recv_kv || serve)) {
+    std::fprintf(stderr, "error: --micro-batches is not supported with --send-kv/--recv-kv/--serve\n");
+    return 3;
+  }
+
+  if (device_index >= 0 && !torch::cuda::is_available()) {
     std::fprintf(stderr, "error: CUDA is not available\n");
     return 4;
   }
@@ -107,101 +696,255 @@ int main(int argc, char** argv) {
   if (layer_begin_override >= 0) spec.layer_start = (int32_t)layer_begin_override;
   if (layer_end_override >= 0) spec.layer_end = (int32_t)layer_end_override;
   qwen::ModelConfig cfg = qwen::config_for_stage(base_cfg, spec);
-
-  qwen::PtWeightLoader pt(weights_path);
-  pt.load();
-  qwen::MapWeightLoader wl;
-  for (const auto& kv : pt.weights()) {
-    wl.insert(kv.first, kv.second);
+  cfg.moe_stacked_experts = has_flag(argc, argv, "--moe-stacked");
+  if (prefill_chunk > 0) cfg.prefill_chunk_size = (int32_t)prefill_chunk;
+  if (kv_block_size > 0) cfg.kv_block_size = (int32_t)kv_block_size;
+  if (continuous) {
+    // One cache row per slot, long enough for the longest prompt plus output.
+    cfg.max_batch = (int32_t)cont.slots;
+    cfg.max_seq_len = std::max<int32_t>(cfg.max_seq_len, (int32_t)(cont.prompt_len + generate_n));
   }
 
-  qwen::ModelStage stage(cfg);
-  stage->to(torch::Device(torch::kCUDA, (int)device_index));
+  // Packed checkpoints are read lazily: only this stage's tensors are loaded.
+  std::unique_ptr<qwen::WeightLoader> wl = qwen::open_weight_loader(weights_path);
+
+  const torch::Device device = qwen::device_for_index((int)device_index);
+  torch::NoGradGuard no_grad;
+
+  const bool with_vision = !std::string(arg_str(argc, argv, "--images", "")).empty();
+  qwen::ModelStage stage = qwen::make_stage_for_load(cfg, device, with_vision);
   stage->eval();
 
   qwen::LoadReport rep;
   qwen::LoadOptions opts;
   opts.strict = true;
   opts.load_vision = false;
-  qwen::load_stage_weights(stage, wl, cfg, &rep, opts);
+  opts.num_threads = (int32_t)load_threads;
+  qwen::load_stage_weights(stage, *wl, cfg, &rep, opts);
+  std::fprintf(stderr,
+               "[distributed_pipeline_stage] loaded %lld tensors, %.1f MB in %.2f s (%.2f GB/s, %d threads)\n",
+               (long long)rep.loaded,
+               (double)rep.bytes / 1e6,
+               rep.seconds,
+               rep.gb_per_s(),
+               (int)opts.num_threads);
 
-  qwen::StageInput in;
-  qwen::TcpConn* conn_in = nullptr;
-  std::unique_ptr<qwen::TcpConn> conn_holder;
+  if (generate_n > 0 || serve) {
+    GenerateContext ctx;
+    ctx.stage_idx = stage_idx;
+    ctx.num_stages = num_stages;
+    ctx.steps = generate_n;
+    ctx.listen_port = listen_port;
+    ctx.next_host = next_host;
+    ctx.next_port = next_port;
+    ctx.out_path = out_path;
+    ctx.micro_batches = micro_batches;
+    ctx.async_io = !has_flag(argc, argv, "--sync-io");
+    ctx.transport = transport;
+    ctx.codec = wire_codec;
+    if (serve) return run_serve(stage, ctx);
+    if (continuous) return run_continuous(stage, cfg, ctx, cont, device);
 
-  if (is_first) {
-    const std::string input_ids_path = arg_str(argc, argv, "--input-ids", "");
-    const std::string images_path = arg_str(argc, argv, "--images", "");
-    if (!input_ids_path.empty()) {
-      torch::Tensor input_ids;
-      torch::load(input_ids, input_ids_path);
-      in.input_ids = input_ids.to(torch::kCUDA, (int)device_index);
-    } else if (cfg.vocab_size > 0) {
-      auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(torch::Device(torch::kCUDA, (int)device_index));
-      in.input_ids = torch::randint(0, cfg.vocab_size, {1, 8}, opts_i64);
+    qwen::StageInput first_in;
+    if (is_first) first_in = load_first_stage_input(argc, argv, cfg, device);
+    return run_generate(stage, cfg, ctx, std::move(first_in), device);
+  }
+
+  // Single pass. Micro-batch m flows through the stages as its own packets
+  // (request_id m) with its own KV cache, so stage i+1 runs micro-batch m while
+  // stage i runs m+1. Prefill chunks of a micro-batch go downstream as soon as
+  // they are computed; the last stage stitches chunks and micro-batches back
+  // together before saving.
+  std::vector<qwen::KVCache> caches((size_t)micro_batches);
+  std::vector<std::vector<torch::Tensor>> outputs((size_t)micro_batches);
+  qwen::StageUtilization util;
+  std::unique_ptr<qwen::Transport> client;
+  // --kv-stream: every layer's KV and then the activation go out through one
+  // send thread, in order, on the downstream connection.
+  std::unique_ptr<qwen::AsyncSender> kv_streamer;
+  const bool stream_kv_out = send_kv && kv_stream && !is_last;
+
+  auto run_micro_batch = [&](qwen::StageInput& in, int64_t m, bool more_upstream) {
+    const auto t0 = Clock::now();
+    in.cache = &caches[(size_t)m];
+    if (stream_kv_out) {
+      if (!kv_streamer) {
+        client = qwen::make_connection(transport, next_host, (int)next_port);
+        kv_streamer = std::make_unique<qwen::AsyncSender>(
+            [&](const qwen::ActivationPacket& p) { client->send_activation(p); },
+            (int64_t)stage->blocks().size() + 1,
+            nullptr,
+            [&](const qwen::KVPacket& p) { client->send_kv(p); });
+      }
+      // Queued right after block i appends; blocks i+1.. keep running while
+      // the send thread copies it out and writes it.
+      in.on_block_kv = [&](int32_t block, const qwen::KVCache& cache, int64_t pos, int64_t T) {
+        auto packed = qwen::pack_kv_layer(cache, block, pos, T);
+        qwen::KVPacket kv;
+        kv.stage_from = (int32_t)stage_idx;
+        kv.stage_to = (int32_t)(stage_idx + 1);
+        kv.step = 0;
+        kv.pos = pos;
+        kv.request_id = m;
+        kv.kv_start = packed.start;
+        kv.layer = block;
+        kv.layer_count = cache.num_layers();
+        kv.k = packed.k;
+        kv.v = packed.v;
+        kv_streamer->send_kv(kv);
+      };
     }
-    if (!images_path.empty()) {
-      torch::Tensor images;
-      torch::load(images, images_path);
-      in.images = images.to(torch::kCUDA, (int)device_index);
+    stage->forward_chunks(in, [&](const qwen::StageOutput& out, int64_t pos, bool last_chunk) {
+      if (is_last) {
+        outputs[(size_t)m].push_back(out.logits.defined() ? out.logits : out.hidden_out);
+        return;
+      }
+      qwen::ActivationPacket p;
+      p.stage_from = (int32_t)stage_idx;
+      p.stage_to = (int32_t)(stage_idx + 1);
+      p.step = 0;
+      p.pos = pos;
+      p.request_id = m;
+      p.flags = (more_upstream || !last_chunk) ? qwen::kFlagMoreChunks : 0;
+      p.hidden = out.hidden_out;
+      qwen::quantize_hidden(&p, wire_codec);
+      if (kv_streamer) {
+        kv_streamer->send(p);
+        return;
+      }
+      if (!client) client = qwen::make_connection(transport, next_host, (int)next_port);
+      client->send_activation(p);
+    });
+    util.add_busy(t0);
+  };
+
+  int64_t last_pos = 0;
+  if (is_first) {
+    auto inputs = qwen::split_micro_batches(load_first_stage_input(argc, argv, cfg, device), micro_batches);
+    util.begin_wall();
+    for (int64_t m = 0; m < micro_batches; ++m) {
+      last_pos = inputs[(size_t)m].pos;
+      run_micro_batch(inputs[(size_t)m], m, false);
     }
-    in.pos = 0;
   } else {
-    qwen::TcpServer server((int)listen_port);
-    conn_holder = std::make_unique<qwen::TcpConn>(server.accept_one());
-    conn_in = conn_holder.get();
-    qwen::ActivationPacket p = conn_in->recv_activation();
-    in.hidden_in = p.hidden.to(torch::kCUDA, (int)device_index);
-    if (p.attn_mask.has_value() && p.attn_mask->defined()) {
-      in.attn_mask = p.attn_mask->to(torch::kCUDA, (int)device_index);
-    }
-    in.pos = p.pos;
+    auto server = qwen::make_listener(transport, (int)listen_port);
+    std::unique_ptr<qwen::Transport> conn_in = server->accept();
+    bool first_packet = true;
 
-    if (recv_kv) {
-      qwen::KVPacket kv = conn_in->recv_kv();
-      if (kv.k.has_value() && kv.v.has_value()) {
-        if (!kv_out_path.empty()) {
-          std::vector<torch::Tensor> tensors;
-          tensors.push_back(kv.k.value());
-          tensors.push_back(kv.v.value());
-          torch::save(tensors, kv_out_path);
-          std::fprintf(stderr, "[distributed_pipeline_stage] saved kv -> %s\n", kv_out_path.c_str());
-        }
+    // --kv-stream: the upstream stage sends its layers before the activation;
+    // each is restored as it arrives.
+    auto recv_kv_stream = [&]() {
+      std::vector<torch::Tensor> ks;
+      std::vector<torch::Tensor> vs;
+      int32_t received = 0;
+      int32_t count = 0;
+      do {
+        qwen::KVPacket kv = conn_in->recv_kv();
+        qwen::require(kv.layer == received && kv.layer_count > 0, "kv stream: layer out of order");
+        qwen::require(kv.k.has_value() && kv.v.has_value(), "kv stream: layer without tensors");
+        count = kv.layer_count;
+        ++received;
+        const torch::Tensor& k = kv.k.value();
         if (kv_restore) {
-          qwen::restore_kv_cache(&stage->cache(), kv.k.value(), kv.v.value());
+          if (!caches[0].is_initialized()) {
+            // The activation is still in flight; size the cache as it would
+            // for [B, kv_start + S, D] hidden states of the KV's dtype.
+            auto like = torch::empty({1}, torch::TensorOptions().dtype(k.scalar_type()).device(device))
+                            .expand({k.size(1), kv.kv_start + k.size(3), (int64_t)cfg.hidden_size});
+            stage->init_cache(caches[0], like);
+          }
+          qwen::restore_kv_layer(&caches[0], kv.layer, k, kv.v.value(), kv.kv_start);
+        }
+        if (!kv_out_path.empty()) {
+          // Copies: shared-memory payloads are views that must not pin the ring.
+          ks.push_back(k.clone());
+          vs.push_back(kv.v.value().clone());
         }
+      } while (received < count);
+      std::fprintf(stderr, "[distributed_pipeline_stage] received kv stream: %d layers\n", (int)count);
+      if (!kv_out_path.empty()) {
+        std::vector<torch::Tensor> tensors;
+        tensors.push_back(torch::cat(ks, 0));
+        tensors.push_back(torch::cat(vs, 0));
+        torch::save(tensors, kv_out_path);
+        std::fprintf(stderr, "[distributed_pipeline_stage] saved kv -> %s\n", kv_out_path.c_str());
       }
+    };
+
+    for (int64_t m = 0; m < micro_batches; ++m) {
+      bool more_upstream = false;
+      do {
+        if (recv_kv && kv_stream && first_packet) recv_kv_stream();
+        qwen::ActivationPacket p = conn_in->recv_activation();
+        util.begin_wall();
+        qwen::require(p.request_id == m, "activation arrived out of micro-batch order");
+        qwen::StageInput in;
+        in.hidden_in = qwen::hidden_on(p, device);
+        if (p.attn_mask.has_value() && p.attn_mask->defined()) {
+          in.attn_mask = p.attn_mask->to(device);
+        }
+        in.pos = p.pos;
+        last_pos = p.pos;
+        more_upstream = (p.flags & qwen::kFlagMoreChunks) != 0;
+
+        if (recv_kv && !kv_stream && first_packet) {
+          qwen::KVPacket kv = conn_in->recv_kv();
+          if (kv.k.has_value() && kv.v.has_value()) {
+            if (!kv_out_path.empty()) {
+              std::vector<torch::Tensor> tensors;
+              tensors.push_back(kv.k.value());
+              tensors.push_back(kv.v.value());
+              torch::save(tensors, kv_out_path);
+              std::fprintf(stderr, "[distributed_pipeline_stage] saved kv -> %s\n", kv_out_path.c_str());
+            }
+            if (kv_restore) {
+              stage->init_cache(caches[0], in.hidden_in);
+              qwen::restore_kv_cache(&caches[0], kv.k.value(), kv.v.value(), kv.kv_start);
+            }
+          }
+        }
+        first_packet = false;
+
+        run_micro_batch(in, m, more_upstream);
+      } while (more_upstream);
     }
   }
 
-  qwen::StageOutput out = stage->forward(in);
+  if (micro_batches > 1) {
+    std::fprintf(stderr, "[distributed_pipeline_stage] stage %lld utilization: micro_batches=%lld %s\n",
+                 (long long)stage_idx, (long long)micro_batches, util.summary().c_str());
+  }
 
   if (is_last) {
-    torch::Tensor to_save = out.logits.defined() ? out.logits : out.hidden_out;
+    std::vector<torch::Tensor> per_mb;
+    for (const auto& chunks : outputs) {
+      per_mb.push_back(chunks.size() == 1 ? chunks.front() : torch::cat(chunks, 1));
+    }
+    torch::Tensor to_save = per_mb.size() == 1 ? per_mb.front() : torch::cat(per_mb, 0);
     torch::save(to_save, out_path);
     std::fprintf(stderr, "[distributed_pipeline_stage] saved output -> %s\n", out_path.c_str());
     return 0;
   }
 
-  qwen::TcpClient client(next_host, (int)next_port);
-  qwen::ActivationPacket p;
-  p.stage_from = (int32_t)stage_idx;
-  p.stage_to = (int32_t)(stage_idx + 1);
-  p.step = 0;
-  p.pos = in.pos;
-  p.hidden = out.hidden_out;
-  client.send_activation(p);
-
-  if (send_kv) {
+  if (kv_streamer) {
+    kv_streamer->flush();
+    std::fprintf(stderr, "[distributed_pipeline_stage] streamed kv: %lld packets\n", (long long)kv_streamer->sent());
+  } else if (send_kv) {
     qwen::KVPacket kv;
     kv.stage_from = (int32_t)stage_idx;
     kv.stage_to = (int32_t)(stage_idx + 1);
     kv.step = 0;
-    kv.pos = in.pos;
-    auto packed = qwen::pack_kv_cache(stage->cache());
+    kv.pos = last_pos;
+    auto packed = kv_delta ? qwen::pack_kv_range(caches[0], 0, caches[0].length())
+                           : qwen::pack_kv_cache(caches[0]);
+    kv.kv_start = packed.start;
     if (packed.k.defined()) kv.k = packed.k;
     if (packed.v.defined()) kv.v = packed.v;
-    client.send_kv(kv);
+    client->send_kv(kv);
+    std::fprintf(stderr, "[distributed_pipeline_stage] sent kv positions [%lld, %lld) bytes=%lld\n",
+                 (long long)packed.start,
+                 (long long)(packed.start + (packed.k.defined() ? packed.k.size(3) : 0)),
+                 (long long)(packed.k.defined() ? packed.k.nbytes() + packed.v.nbytes() : 0));
   }
 
   return 0;
@@ -2,6 +2,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -10,8 +11,9 @@
 #include "core/config.h"
 #include "core/hf_config.h"
 #include "core/sharding.h"
+#include "core/tensor_utils.h"
 #include "loader/model_loader.h"
-#include "loader/pt_weight_loader.h"
+#include "loader/weight_loader.h"
 #include "model/model_stage.h"
 
 static const char* arg_str(int argc, char** argv, const char* key, const char* def) {
@@ -28,20 +30,37 @@ static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
   return def;
 }
 
+// "cpu" or a negative index selects the CPU backend.
+static int64_t arg_device(int argc, char** argv, const char* key, int64_t def) {
+  const std::string s = arg_str(argc, argv, key, "");
+  if (s.empty()) return def;
+  if (s == "cpu") return -1;
+  return std::stoll(s);
+}
+
+static bool has_flag(int argc, char** argv, const char* flag) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == flag) return true;
+  }
+  return false;
+}
+
 static void usage() {
   std::fprintf(stderr,
                "parity_runner usage:\n"
                "  --hf-config <path>\n"
-               "  --weights <weights.pt>\n"
+               "  --weights <weights.pt | *.safetensors | index.json | dir>\n"
                "  --out <output.pt>\n"
                "  [--report <report.json>]\n"
                "  [--input-ids <input_ids.pt>]\n"
                "  [--images <images.pt>]\n"
-               "  [--device <cuda_device_index>]\n"
+               "  [--device <cuda_device_index|cpu>]\n"
                "  [--num-stages <N>]\n"
                "  [--stage-idx <i>]\n"
                "  [--layer-begin <L>]\n"
-               "  [--layer-end <R>]\n");
+               "  [--layer-end <R>]\n"
+               "  [--moe-stacked]\n"
+               "  [--load-threads <N>]           (weight loading workers, default 4)\n");
 }
 
 int main(int argc, char** argv) {
@@ -57,13 +76,14 @@ int main(int argc, char** argv) {
   const std::string input_ids_path = arg_str(argc, argv, "--input-ids", "");
   const std::string images_path = arg_str(argc, argv, "--images", "");
 
-  const int64_t device_index = arg_i64(argc, argv, "--device", 0);
+  const int64_t device_index = arg_device(argc, argv, "--device", 0);
   const int64_t num_stages = arg_i64(argc, argv, "--num-stages", 1);
   const int64_t stage_idx = arg_i64(argc, argv, "--stage-idx", 0);
   const int64_t layer_begin_override = arg_i64(argc, argv, "--layer-begin", -1);
   const int64_t layer_end_override = arg_i64(argc, argv, "--layer-end", -1);
+  const int64_t load_threads = arg_i64(argc, argv, "--load-threads", 4);
 
-  if (!torch::cuda::is_available()) {
+  if (device_index >= 0 && !torch::cuda::is_available()) {
     std::fprintf(stderr, "error: CUDA is not available\n");
     return 3;
   }
@@ -74,37 +94,40 @@ int main(int argc, char** argv) {
   if (layer_begin_override >= 0) spec.layer_start = (int32_t)layer_begin_override;
   if (layer_end_override >= 0) spec.layer_end = (int32_t)layer_end_override;
   qwen::ModelConfig cfg = qwen::config_for_stage(base_cfg, spec);
+  cfg.moe_stacked_experts = has_flag(argc, argv, "--moe-stacked");
 
-  qwen::PtWeightLoader pt(weights_path);
-  pt.load();
-  qwen::MapWeightLoader wl;
-  for (const auto& kv : pt.weights()) {
-    wl.insert(kv.first, kv.second);
-  }
+  // Packed checkpoints are read lazily: only this stage's tensors are loaded.
+  std::unique_ptr<qwen::WeightLoader> wl = qwen::open_weight_loader(weights_path);
 
-  qwen::ModelStage stage(cfg);
-  stage->to(torch::Device(torch::kCUDA, (int)device_index));
+  qwen::ModelStage stage =
+      qwen::make_stage_for_load(cfg, qwen::device_for_index((int)device_index), /*with_vision=*/!images_path.empty());
   stage->eval();
 
   qwen::LoadReport rep;
   qwen::LoadOptions opts;
   opts.strict = true;
   opts.load_vision = false;
-  qwen::load_stage_weights(stage, wl, cfg, &rep, opts);
+  opts.num_threads = (int32_t)load_threads;
+  qwen::load_stage_weights(stage, *wl, cfg, &rep, opts);
 
   std::fprintf(stderr,
-               "[parity_runner] loaded=%lld missing=%lld mismatched=%lld\n",
+               "[parity_runner] loaded=%lld missing=%lld mismatched=%lld bytes=%lld load_s=%.2f gb_per_s=%.2f\n",
                (long long)rep.loaded,
                (long long)rep.missing,
-               (long long)rep.mismatched);
+               (long long)rep.mismatched,
+               (long long)rep.bytes,
+               rep.seconds,
+               rep.gb_per_s());
 
   if (!report_path.empty()) {
-    auto extra = qwen::diff_unused_keys(wl, rep.used_keys);
+    auto extra = qwen::diff_unused_keys(*wl, rep.used_keys);
     std::ofstream os(report_path);
     os << "{\n";
     os << "  \"loaded\": " << rep.loaded << ",\n";
     os << "  \"missing\": " << rep.missing << ",\n";
     os << "  \"mismatched\": " << rep.mismatched << ",\n";
+    os << "  \"load_bytes\": " << rep.bytes << ",\n";
+    os << "  \"load_seconds\": " << rep.seconds << ",\n";
     os << "  \"extra\": " << extra.size() << "\n";
     os << "}\n";
   }
@@ -113,16 +136,16 @@ int main(int argc, char** argv) {
   if (!input_ids_path.empty()) {
     torch::Tensor input_ids;
     torch::load(input_ids, input_ids_path);
-    in.input_ids = input_ids.to(torch::kCUDA, (int)device_index);
+    in.input_ids = input_ids.to(qwen::device_for_index((int)device_index));
   } else if (cfg.vocab_size > 0) {
-    auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(torch::Device(torch::kCUDA, (int)device_index));
+    auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(qwen::device_for_index((int)device_index));
     in.input_ids = torch::randint(0, cfg.vocab_size, {1, 8}, opts_i64);
   }
 
   if (!images_path.empty()) {
     torch::Tensor images;
     torch::load(images, images_path);
-    in.images = images.to(torch::kCUDA, (int)device_index);
+    in.images = images.to(qwen::device_for_index((int)device_index));
   }
 
   in.pos = 0;
@@ -0,0 +1,244 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "core/config.h"
+#include "core/hf_config.h"
+#include "core/sharding.h"
+#include "core/tensor_utils.h"
+#include "loader/model_loader.h"
+#include "loader/weight_loader.h"
+#include "model/model_stage.h"
+#include "runtime/hidden_codec.h"
+#include "runtime/pipeline_stage.h"
+#include "runtime/transport_factory.h"
+
+// Runs a whole --serve pipeline inside one process: every stage is a
+// PipelineStage::serve loop on its own thread, and the main thread is the
+// client (as pipeline_client). With --transport inproc packets move between
+// threads through queues, so the numbers are stage compute plus scheduling
+// with no socket or serialization cost; tcp/unix/shm run the same pipeline
+// over loopback for comparison.
+
+static const char* arg_str(int argc, char** argv, const char* key, const char* def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return argv[i + 1];
+  }
+  return def;
+}
+
+static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return std::stoll(argv[i + 1]);
+  }
+  return def;
+}
+
+// "cpu" or a negative index selects the CPU backend.
+static int64_t arg_device(int argc, char** argv, const char* key, int64_t def) {
+  const std::string s = arg_str(argc, argv, key, "");
+  if (s.empty()) return def;
+  if (s == "cpu") return -1;
+  return std::stoll(s);
+}
+
+static void usage() {
+  std::fprintf(stderr,
+               "pipeline_bench usage:\n"
+               "  --hf-config <path>\n"
+               "  [--weights <weights.pt | *.safetensors | index.json | dir>]  (default: random init)\n"
+               "  [--num-stages <N>]            (default 2)\n"
+               "  [--transport <inproc|tcp|unix|shm>]  (default inproc)\n"
+               "  [--port-base <P>]             (stage i listens on P+i, the client on P+N; default 7600)\n"
+               "  [--wire-codec <none|int8|fp8>]  (hidden states between stages; default none)\n"
+               "  [--requests <R>]              (concurrent requests, default 4)\n"
+               "  [--generate <N>]              (tokens per request, default 16)\n"
+               "  [--prompt-len <T>]            (random prompt length, default 32)\n"
+               "  [--device <cuda_device_index|cpu>]  (every stage; default 0, cpu without CUDA)\n"
+               "  [--load-threads <N>]          (weight loading workers, default 4)\n");
+}
+
+using Clock = std::chrono::steady_clock;
+
+static double ms_since(const Clock::time_point& t0) {
+  return std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+}
+
+struct RequestState {
+  int64_t pos = 0;
+  int64_t steps_done = 0;
+  Clock::time_point started;
+};
+
+int main(int argc, char** argv) {
+  const std::string hf_path = arg_str(argc, argv, "--hf-config", "");
+  const std::string weights_path = arg_str(argc, argv, "--weights", "");
+  const int64_t num_stages = arg_i64(argc, argv, "--num-stages", 2);
+  const int64_t port_base = arg_i64(argc, argv, "--port-base", 7600);
+  const int64_t num_requests = arg_i64(argc, argv, "--requests", 4);
+  const int64_t steps = arg_i64(argc, argv, "--generate", 16);
+  const int64_t prompt_len = arg_i64(argc, argv, "--prompt-len", 32);
+  const int64_t device_index = arg_device(argc, argv, "--device", torch::cuda::is_available() ? 0 : -1);
+  const int64_t load_threads = arg_i64(argc, argv, "--load-threads", 4);
+  if (hf_path.empty() || num_stages <= 0 || num_requests <= 0 || steps <= 0 || prompt_len <= 0) {
+    usage();
+    return 2;
+  }
+
+  qwen::TransportOptions transport;
+  transport.kind = qwen::TransportKind::kInProc;
+  if (!qwen::parse_transport_kind(arg_str(argc, argv, "--transport", "inproc"), &transport.kind)) {
+    usage();
+    return 2;
+  }
+  // The client submits every prompt before it reads a reply.
+  transport.inproc.capacity = 0;
+  qwen::HiddenCodec codec = qwen::HiddenCodec::kNone;
+  if (!qwen::parse_hidden_codec(arg_str(argc, argv, "--wire-codec", "none"), &codec)) {
+    usage();
+    return 2;
+  }
+
+  if (device_index >= 0 && !torch::cuda::is_available()) {
+    std::fprintf(stderr, "error: CUDA is not available\n");
+    return 4;
+  }
+  const torch::Device device = qwen::device_for_index((int)device_index);
+  torch::NoGradGuard no_grad;
+
+  qwen::ModelConfig base_cfg = qwen::load_hf_config_json(hf_path);
+  qwen::ShardingPlan plan = qwen::make_plan_even_layers(base_cfg, (int32_t)num_stages, std::vector<int>{});
+  std::unique_ptr<qwen::WeightLoader> wl;
+  if (!weights_path.empty()) wl = qwen::open_weight_loader(weights_path);
+
+  std::vector<std::unique_ptr<qwen::PipelineStage>> stages;
+  for (int64_t i = 0; i < num_stages; ++i) {
+    const qwen::ModelConfig cfg = qwen::config_for_stage(base_cfg, plan.stages.at((size_t)i));
+    qwen::ModelStage stage(nullptr);
+    if (wl) {
+      stage = qwen::make_stage_for_load(cfg, device);
+      qwen::LoadReport rep;
+      qwen::LoadOptions opts;
+      opts.strict = true;
+      opts.load_vision = false;
+      opts.num_threads = (int32_t)load_threads;
+      qwen::load_stage_weights(stage, *wl, cfg, &rep, opts);
+    } else {
+      stage = qwen::ModelStage(cfg);
+      stage->to(device);
+    }
+    stage->eval();
+    stages.push_back(std::make_unique<qwen::PipelineStage>(stage));
+  }
+  std::fprintf(stderr, "[pipeline_bench] %lld stages on %s (%s weights), transport=%s wire_codec=%s\n",
+               (long long)num_stages,
+               device.str().c_str(),
+               wl ? "loaded" : "random",
+               qwen::transport_kind_name(transport.kind),
+               qwen::hidden_codec_name(codec));
+
+  // Every listener exists before any stage or the client connects.
+  std::vector<std::unique_ptr<qwen::TransportListener>> listeners;
+  for (int64_t i = 0; i < num_stages; ++i) listeners.push_back(qwen::make_listener(transport, (int)(port_base + i)));
+  auto reply_server = qwen::make_listener(transport, (int)(port_base + num_stages));
+
+  std::mutex mu;
+  std::string err;
+  std::vector<std::thread> threads;
+  for (int64_t i = 0; i < num_stages; ++i) {
+    threads.emplace_back([&, i]() {
+      torch::NoGradGuard ng;
+      try {
+        qwen::ServeLinks links;
+        links.upstream = listeners[(size_t)i].get();
+        links.codec = codec;
+        links.connect_downstream = [&, i]() {
+          return qwen::make_connection(transport, "127.0.0.1", (int)(port_base + i + 1));
+        };
+        (void)stages[(size_t)i]->serve(links, (int32_t)i, (int32_t)num_stages);
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mu);
+        err = "stage " + std::to_string(i) + ": " + e.what();
+      }
+    });
+  }
+
+  std::unique_ptr<qwen::Transport> stage0 = qwen::make_connection(transport, "127.0.0.1", (int)port_base);
+  auto prompt = torch::randint(0, base_cfg.vocab_size, {1, prompt_len}, torch::TensorOptions().dtype(torch::kInt64));
+
+  std::unordered_map<int64_t, RequestState> states;
+  const auto t_start = Clock::now();
+  for (int64_t r = 0; r < num_requests; ++r) {
+    const int64_t request_id = r + 1;
+    qwen::ActivationPacket p;
+    p.request_id = request_id;
+    p.hidden = prompt;
+    RequestState& st = states[request_id];
+    st.started = Clock::now();
+    st.pos = prompt_len;
+    stage0->send_activation(p);
+  }
+
+  std::unique_ptr<qwen::Transport> replies = reply_server->accept();
+  int64_t remaining = num_requests;
+  int64_t total_tokens = 0;
+  double latency_ms_sum = 0.0;
+  double first_token_ms_sum = 0.0;
+  while (remaining > 0) {
+    qwen::ActivationPacket rp = replies->recv_activation();
+    RequestState& st = states.at(rp.request_id);
+    if (st.steps_done == 0) first_token_ms_sum += ms_since(st.started);
+    st.steps_done++;
+    total_tokens += rp.hidden.size(0);
+
+    if (st.steps_done < steps) {
+      qwen::ActivationPacket p;
+      p.request_id = rp.request_id;
+      p.step = st.steps_done;
+      p.pos = st.pos;
+      p.hidden = rp.hidden;
+      st.pos += rp.hidden.size(1);
+      stage0->send_activation(p);
+      continue;
+    }
+    latency_ms_sum += ms_since(st.started);
+
+    qwen::ActivationPacket release;
+    release.kind = qwen::PacketKind::kRelease;
+    release.request_id = rp.request_id;
+    stage0->send_activation(release);
+    --remaining;
+  }
+  const double wall_ms = ms_since(t_start);
+
+  qwen::ActivationPacket stop;
+  stop.kind = qwen::PacketKind::kShutdown;
+  stage0->send_activation(stop);
+  for (auto& t : threads) t.join();
+  if (!err.empty()) {
+    std::fprintf(stderr, "error: %s\n", err.c_str());
+    return 1;
+  }
+
+  std::fprintf(stderr,
+               "[pipeline_bench] transport=%s stages=%lld requests=%lld tokens=%lld wall_ms=%.2f tok_per_s=%.2f "
+               "mean_first_token_ms=%.2f mean_request_ms=%.2f\n",
+               qwen::transport_kind_name(transport.kind),
+               (long long)num_stages,
+               (long long)num_requests,
+               (long long)total_tokens,
+               wall_ms,
+               wall_ms > 0.0 ? (double)total_tokens * 1000.0 / wall_ms : 0.0,
+               first_token_ms_sum / (double)num_requests,
+               latency_ms_sum / (double)num_requests);
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <torch/torch.h>
+
+#include "runtime/activation_packet.h"
+#include "runtime/transport_factory.h"
+
+// Drives a pipeline started with `distributed_pipeline_stage --serve`:
+// submits R concurrent requests (prompt + N greedy decode steps each) to
+// stage 0 and collects the tokens the last stage replies with.
+
+static const char* arg_str(int argc, char** argv, const char* key, const char* def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return argv[i + 1];
+  }
+  return def;
+}
+
+static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return std::stoll(argv[i + 1]);
+  }
+  return def;
+}
+
+static bool has_flag(int argc, char** argv, const char* flag) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == flag) return true;
+  }
+  return false;
+}
+
+static void usage() {
+  std::fprintf(stderr,
+               "pipeline_client usage:\n"
+               "  --host <stage0_host>\n"
+               "  --port <stage0_port>\n"
+               "  --reply-port <port>           (the last stage's --next-port)\n"
+               "  [--requests <R>]              (concurrent requests, default 1)\n"
+               "  [--generate <N>]              (tokens per request, default 8)\n"
+               "  [--input-ids <input_ids.pt>]  (prompt for every request; default random)\n"
+               "  [--prompt-len <T>]            (random prompt length, default 8)\n"
+               "  [--vocab <V>]                 (random prompt vocab, default 32)\n"
+               "  [--out <tokens.pt>]           (saves [R, B, N] generated ids)\n"
+               "  [--shutdown]                  (stop the pipeline when done)\n"
+               "  [--transport <tcp|unix|shm>]  (must match the stages' --transport)\n");
+}
+
+using Clock = std::chrono::steady_clock;
+
+struct RequestState {
+  int64_t pos = 0;
+  int64_t steps_done = 0;
+  Clock::time_point started;
+  std::vector<torch::Tensor> tokens;
+};
+
+int main(int argc, char** argv) {
+  const std::string host = arg_str(argc, argv, "--host", "");
+  const int64_t port = arg_i64(argc, argv, "--port", -1);
+  const int64_t reply_port = arg_i64(argc, argv, "--reply-port", -1);
+  if (host.empty() || port < 0 || reply_port < 0) {
+    usage();
+    return 2;
+  }
+
+  const int64_t num_requests = arg_i64(argc, argv, "--requests", 1);
+  const int64_t steps = arg_i64(argc, argv, "--generate", 8);
+  const int64_t prompt_len = arg_i64(argc, argv, "--prompt-len", 8);
+  const int64_t vocab = arg_i64(argc, argv, "--vocab", 32);
+  const std::string input_ids_path = arg_str(argc, argv, "--input-ids", "");
+  const std::string out_path = arg_str(argc, argv, "--out", "");
+  const bool shutdown = has_flag(argc, argv, "--shutdown");
+  qwen::TransportOptions transport;
+  if (!qwen::parse_transport_kind(arg_str(argc, argv, "--transport", "tcp"), &transport.kind) ||
+      transport.kind == qwen::TransportKind::kInProc) {
+    usage();
+    return 2;
+  }
+  if (num_requests <= 0 || steps <= 0) {
+    usage();
+    return 2;
+  }
+
+  torch::Tensor prompt;
+  if (!input_ids_path.empty()) {
+    torch::load(prompt, input_ids_path);
+    prompt = prompt.to(torch::kCPU, torch::kInt64);
+  } else {
+    prompt = torch::randint(0, vocab, {1, prompt_len}, torch::TensorOptions().dtype(torch::kInt64));
+  }
+
+  // Bind the reply port before any request goes out: the last stage connects
+  // back as soon as it has its first reply.
+  auto reply_server = qwen::make_listener(transport, (int)reply_port);
+  std::unique_ptr<qwen::Transport> stage0 = qwen::make_connection(transport, host, (int)port);
+
+  std::unordered_map<int64_t, RequestState> states;
+  const auto t_start = Clock::now();
+  for (int64_t r = 0; r < num_requests; ++r) {
+    const int64_t request_id = r + 1;
+    qwen::ActivationPacket p;
+    p.stage_to = 0;
+    p.request_id = request_id;
+    p.step = 0;
+    p.pos = 0;
+    p.hidden = prompt;
+    RequestState& st = states[request_id];
+    st.started = Clock::now();
+    st.pos = prompt.size(1);
+    stage0->send_activation(p);
+  }
+
+  std::unique_ptr<qwen::Transport> replies = reply_server->accept();
+  int64_t remaining = num_requests;
+  int64_t total_tokens = 0;
+  double latency_ms_sum = 0.0;
+
+  while (remaining > 0) {
+    qwen::ActivationPacket rp = replies->recv_activation();
+    auto it = states.find(rp.request_id);
+    if (it == states.end()) {
+      std::fprintf(stderr, "error: reply for unknown request %lld\n", (long long)rp.request_id);
+      return 1;
+    }
+    RequestState& st = it->second;
+    // Kept for the whole run: copy out of a shared-memory ring.
+    st.tokens.push_back(rp.hidden.clone());
+    st.steps_done++;
+    total_tokens += rp.hidden.size(0);
+
+    if (st.steps_done < steps) {
+      qwen::ActivationPacket p;
+      p.stage_to = 0;
+      p.request_id = rp.request_id;
+      p.step = st.steps_done;
+      p.pos = st.pos;
+      p.hidden = rp.hidden;
+      st.pos += rp.hidden.size(1);
+      stage0->send_activation(p);
+      continue;
+    }
+
+    const double ms = std::chrono::duration<double, std::milli>(Clock::now() - st.started).count();
+    latency_ms_sum += ms;
+    std::fprintf(stderr, "[pipeline_client] request %lld done: %lld tokens in %.2f ms\n",
+                 (long long)rp.request_id, (long long)st.steps_done, ms);
+
+    qwen::ActivationPacket release;
+    release.kind = qwen::PacketKind::kRelease;
+    release.request_id = rp.request_id;
+    stage0->send_activation(release);
+    --remaining;
+  }
+
+  const double wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - t_start).count();
+  std::fprintf(stderr,
+               "[pipeline_client] requests=%lld tokens=%lld wall_ms=%.2f tok_per_s=%.2f mean_request_ms=%.2f\n",
+               (long long)num_requests,
+               (long long)total_tokens,
+               wall_ms,
+               wall_ms > 0.0 ? (double)total_tokens * 1000.0 / wall_ms : 0.0,
+               latency_ms_sum / (double)num_requests);
+
+  if (!out_path.empty()) {
+    std::vector<torch::Tensor> per_request;
+    for (int64_t r = 0; r < num_requests; ++r) {
+      per_request.push_back(torch::cat(states[r + 1].tokens, 1));
+    }
+    torch::save(torch::stack(per_request, 0), out_path);
+    std::fprintf(stderr, "[pipeline_client] saved tokens -> %s\n", out_path.c_str());
+  }
+
+  if (shutdown) {
+    qwen::ActivationPacket stop;
+    stop.kind = qwen::PacketKind::kShutdown;
+    stage0->send_activation(stop);
+  }
+  return 0;
+}
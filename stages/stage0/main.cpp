@@ -9,6 +9,7 @@
 #include "core/config.h"
 #include "core/hf_config.h"
 #include "core/sharding.h"
+#include "core/tensor_utils.h"
 #include "model/model_stage.h"
 
 static bool has_flag(int argc, char** argv, const char* flag) {
@@ -32,11 +33,19 @@ static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
   return def;
 }
 
+// "cpu" or a negative index selects the CPU backend.
+static int64_t arg_device(int argc, char** argv, const char* key, int64_t def) {
+  const std::string s = arg_str(argc, argv, key, "");
+  if (s.empty()) return def;
+  if (s == "cpu") return -1;
+  return std::stoll(s);
+}
+
 static void usage() {
   std::fprintf(stderr,
                "stage0 usage:\n"
                "  --hf-config <path>\n"
-               "  [--device <cuda_device_index>]\n"
+               "  [--device <cuda_device_index|cpu>]\n"
                "  [--num-stages <N>]\n"
                "  [--stage-idx <i>]\n"
                "  [--layer-begin <L>]\n"
@@ -56,13 +65,13 @@ int main(int argc, char** argv) {
     return 2;
   }
 
-  const int64_t device_index = arg_i64(argc, argv, "--device", 0);
+  const int64_t device_index = arg_device(argc, argv, "--device", 0);
   const int64_t num_stages = arg_i64(argc, argv, "--num-stages", 1);
   const int64_t stage_idx = arg_i64(argc, argv, "--stage-idx", 0);
   const int64_t layer_begin_override = arg_i64(argc, argv, "--layer-begin", -1);
   const int64_t layer_end_override = arg_i64(argc, argv, "--layer-end", -1);
 
-  if (!torch::cuda::is_available()) {
+  if (device_index >= 0 && !torch::cuda::is_available()) {
     std::fprintf(stderr, "error: CUDA is not available\n");
     return 3;
   }
@@ -85,12 +94,12 @@ int main(int argc, char** argv) {
                spec.layer_end);
 
   qwen::ModelStage stage(cfg);
-  stage->to(torch::Device(torch::kCUDA, (int)device_index));
+  stage->to(qwen::device_for_index((int)device_index));
   stage->eval();
 
   const int64_t B = 1;
   const int64_t T = 8;
-  auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(torch::Device(torch::kCUDA, (int)device_index));
+  auto opts_i64 = torch::TensorOptions().dtype(torch::kInt64).device(qwen::device_for_index((int)device_index));
   auto input_ids = torch::randint(0, cfg.vocab_size, {B, T}, opts_i64);
 
   qwen::StageInput in;
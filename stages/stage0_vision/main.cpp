@@ -7,7 +7,11 @@
 
 static int arg_int(int argc, char** argv, const char* key, int defv) {
   for (int i = 1; i + 1 < argc; ++i) {
-    if (std::string(argv[i]) == key) return std::atoi(argv[i + 1]);
+    if (std::string(argv[i]) == key) {
+      // "cpu" selects the CPU backend (device_index < 0).
+      if (std::string(argv[i + 1]) == "cpu") return -1;
+      return std::atoi(argv[i + 1]);
+    }
   }
   return defv;
 }
@@ -23,7 +27,9 @@ int main(int argc, char** argv) {
 
   qwen::VisionEncoder ve(cfg);
 
-  auto images = torch::zeros({1, 3, 224, 224}, torch::dtype(torch::kFloat16).device(torch::kCUDA));
+  const torch::Device device = qwen::device_for_index(cfg.device_index);
+  ve->to(device);
+  auto images = torch::zeros({1, 3, 224, 224}, torch::dtype(torch::kFloat32).device(device));
   auto out = ve->forward(images);
 
   qwen::require(out.defined(), "stage0_vision: output undefined");
@@ -35,7 +35,7 @@ static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
 static void usage(const char* argv0) {
   std::fprintf(
       stderr,
-      "Usage: %s --hf-config <path> [--device <cuda:0>] [--num-stages N] [--stage-idx I] "
+      "Usage: %s --hf-config <path> [--device <cuda:0|cpu>] [--num-stages N] [--stage-idx I] "
       "[--layer-begin L] [--layer-end R]\n",
       argv0);
 }
@@ -94,7 +94,7 @@ int main(int argc, char** argv) {
   // Dummy hidden input for non-embedding stages.
   torch::Tensor hidden = torch::randn(
       {1, 1, cfg.hidden_size},
-      torch::TensorOptions().dtype(torch::kFloat16).device(device));
+      torch::TensorOptions().dtype(device.is_cpu() ? torch::kFloat32 : torch::kFloat16).device(device));
 
   qwen::StageInput in;
   in.hidden_in = hidden;
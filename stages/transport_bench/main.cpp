@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include <torch/torch.h>
+
+#include "runtime/activation_packet.h"
+#include "runtime/transport_factory.h"
+
+// Small-packet round-trip latency between two threads. An echo thread sends
+// every activation straight back; the client times send + recv of a
+// decode-sized packet ([B, 1, D] hidden plus positions) for each --modes
+// entry:
+//   legacy    one send() per field, Nagle on (the pre-framing transport)
+//   nodelay   one send() per field, TCP_NODELAY
+//   framed    one sendmsg() per packet, TCP_NODELAY (the default)
+//   unix      framed, over a Unix-domain socket
+//   shm       shared-memory rings, zero-copy receive
+//   inproc    in-process queues (no encoding, no syscalls)
+
+static const char* arg_str(int argc, char** argv, const char* key, const char* def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return argv[i + 1];
+  }
+  return def;
+}
+
+static int64_t arg_i64(int argc, char** argv, const char* key, int64_t def) {
+  for (int i = 1; i + 1 < argc; ++i) {
+    if (std::string(argv[i]) == key) return std::stoll(argv[i + 1]);
+  }
+  return def;
+}
+
+static bool has_flag(int argc, char** argv, const char* flag) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::string(argv[i]) == flag) return true;
+  }
+  return false;
+}
+
+static void usage() {
+  std::fprintf(stderr,
+               "transport_bench usage:\n"
+               "  [--modes <a,b,...>]           (legacy,nodelay,framed,unix,shm,inproc;\n"
+               "                                 default legacy,nodelay,framed)\n"
+               "  [--hidden <D>]                (default 4096)\n"
+               "  [--batch <B>]                 (default 1)\n"
+               "  [--dtype <fp32|bf16|fp16>]    (default bf16)\n"
+               "  [--iters <N>]                 (timed round trips, default 2000)\n"
+               "  [--warmup <N>]                (default 100)\n");
+}
+
+static std::vector<std::string> split_csv(const std::string& s) {
+  std::vector<std::string> out;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) out.push_back(item);
+  }
+  return out;
+}
+
+static bool options_for(const std::string& mode, qwen::TransportOptions* opts) {
+  if (mode == "legacy") {
+    opts->tcp.vectored = false;
+    opts->tcp.nodelay = false;
+  } else if (mode == "nodelay") {
+    opts->tcp.vectored = false;
+    opts->tcp.nodelay = true;
+  } else if (mode == "framed") {
+    opts->tcp.vectored = true;
+    opts->tcp.nodelay = true;
+  } else if (mode == "unix") {
+    opts->kind = qwen::TransportKind::kUnix;
+  } else if (mode == "shm") {
+    opts->kind = qwen::TransportKind::kShm;
+  } else if (mode == "inproc") {
+    opts->kind = qwen::TransportKind::kInProc;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  if (has_flag(argc, argv, "--help")) {
+    usage();
+    return 0;
+  }
+
+  const std::vector<std::string> modes = split_csv(arg_str(argc, argv, "--modes", "legacy,nodelay,framed"));
+  const int64_t D = arg_i64(argc, argv, "--hidden", 4096);
+  const int64_t B = arg_i64(argc, argv, "--batch", 1);
+  const int64_t iters = arg_i64(argc, argv, "--iters", 2000);
+  const int64_t warmup = arg_i64(argc, argv, "--warmup", 100);
+  const std::string dtype_s = arg_str(argc, argv, "--dtype", "bf16");
+  if (modes.empty() || D <= 0 || B <= 0 || iters <= 0 || warmup < 0) {
+    usage();
+    return 2;
+  }
+  c10::ScalarType dtype = torch::kFloat32;
+  if (dtype_s == "bf16") dtype = torch::kBFloat16;
+  if (dtype_s == "fp16") dtype = torch::kFloat16;
+
+  qwen::ActivationPacket pkt;
+  pkt.hidden = torch::randn({B, 1, D}).to(dtype);
+  pkt.positions = torch::arange(0, B, torch::TensorOptions().dtype(torch::kInt64));
+
+  std::fprintf(stderr,
+               "[transport_bench] loopback B=%lld D=%lld dtype=%s payload_bytes=%lld iters=%lld\n",
+               (long long)B,
+               (long long)D,
+               dtype_s.c_str(),
+               (long long)(pkt.hidden.nbytes() + pkt.positions->nbytes()),
+               (long long)iters);
+
+  for (const auto& mode : modes) {
+    qwen::TransportOptions opts;
+    if (!options_for(mode, &opts)) {
+      std::fprintf(stderr, "error: unknown mode '%s'\n", mode.c_str());
+      return 2;
+    }
+
+    // TCP and in-process pick a free port; a segment or socket file is named
+    // after the pid.
+    const bool named = opts.kind == qwen::TransportKind::kShm || opts.kind == qwen::TransportKind::kUnix;
+    const int port = named ? (int)::getpid() : 0;
+    auto server = qwen::make_listener(opts, port);
+    std::string err;
+    std::thread echo([&]() {
+      try {
+        std::unique_ptr<qwen::Transport> conn = server->accept();
+        for (;;) {
+          qwen::ActivationPacket p = conn->recv_activation();
+          conn->send_activation(p);
+          if (p.kind == qwen::PacketKind::kShutdown) break;
+        }
+      } catch (const std::exception& e) {
+        err = e.what();
+      }
+    });
+
+    std::vector<double> us;
+    us.reserve((size_t)iters);
+    {
+      std::unique_ptr<qwen::Transport> client = qwen::make_connection(opts, "127.0.0.1", server->port());
+      for (int64_t i = 0; i < warmup + iters; ++i) {
+        pkt.step = i;
+        const auto t0 = std::chrono::steady_clock::now();
+        client->send_activation(pkt);
+        (void)client->recv_activation();
+        const double dt = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        if (i >= warmup) us.push_back(dt);
+      }
+      qwen::ActivationPacket stop;
+      stop.kind = qwen::PacketKind::kShutdown;
+      client->send_activation(stop);
+      (void)client->recv_activation();
+    }
+    echo.join();
+    if (!err.empty()) {
+      std::fprintf(stderr, "error: echo thread: %s\n", err.c_str());
+      return 1;
+    }
+
+    double sum = 0.0;
+    for (double v : us) sum += v;
+    std::sort(us.begin(), us.end());
+    auto pct = [&](double p) { return us[std::min(us.size() - 1, (size_t)(p * (double)us.size()))]; };
+    std::fprintf(stderr,
+                 "[transport_bench] mode=%s rtt_us mean=%.1f p50=%.1f p99=%.1f max=%.1f\n",
+                 mode.c_str(),
+                 sum / (double)us.size(),
+                 pct(0.50),
+                 pct(0.99),
+                 us.back());
+  }
+  return 0;
+}
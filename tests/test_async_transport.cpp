@@ -0,0 +1,130 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "runtime/async_transport.h"
+#include "runtime/transport.h"
+
+int main() {
+  // Staging buffers are reused once their tensors are dropped.
+  {
+    qwen::StagingPool pool(false);
+    {
+      auto a = pool.empty({4, 8}, torch::kFloat32);
+      auto b = pool.empty({4, 8}, torch::kFloat32);
+      CHECK_TRUE(a.data_ptr() != b.data_ptr());
+      a.fill_(1.0f);
+      CHECK_EQ(a.sum().item<double>(), 32.0);
+    }
+    CHECK_EQ(pool.allocations(), 2);
+    for (int i = 0; i < 10; ++i) {
+      auto c = pool.empty({2, 16}, torch::kBFloat16);
+      CHECK_EQ(c.numel(), 32);
+    }
+    CHECK_EQ(pool.allocations(), 2);
+  }
+
+  std::unique_ptr<qwen::TcpServer> server;
+  try {
+    server = std::make_unique<qwen::TcpServer>(0);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "SKIP: %s\n", e.what());
+    return 0;
+  }
+
+  // 16 packets through a send thread and a receive thread arrive intact and
+  // in order; the receiver stops on the last one.
+  const int64_t n = 16;
+  auto pool = std::make_shared<qwen::StagingPool>(torch::cuda::is_available());
+  const torch::Device device = torch::cuda::is_available() ? torch::Device(torch::kCUDA, 0) : torch::Device(torch::kCPU);
+
+  std::unique_ptr<qwen::TcpClient> client = std::make_unique<qwen::TcpClient>("127.0.0.1", server->port());
+  qwen::TcpConn conn(server->accept_one());
+  qwen::AsyncReceiver rx(
+      [&](const qwen::TensorAllocator& alloc) { return conn.recv_activation(alloc); },
+      [&]() { conn.shutdown(); },
+      [n](const qwen::ActivationPacket& p) { return p.step == n - 1; },
+      2,
+      pool);
+  {
+    qwen::AsyncSender tx([&](const qwen::ActivationPacket& p) { client->send_activation(p); }, 2, pool);
+    for (int64_t i = 0; i < n; ++i) {
+      qwen::ActivationPacket p;
+      p.step = i;
+      p.hidden = torch::full({1, 3, 8}, (float)i, torch::TensorOptions().device(device));
+      p.positions = torch::tensor({i}, torch::TensorOptions().dtype(torch::kInt64));
+      tx.send(p);
+    }
+    tx.flush();
+    CHECK_EQ(tx.sent(), n);
+  }
+
+  for (int64_t i = 0; i < n; ++i) {
+    qwen::ActivationPacket p = rx.pop();
+    CHECK_EQ(p.step, i);
+    CHECK_TRUE(p.hidden.device().is_cpu());
+    CHECK_TRUE(torch::equal(p.hidden, torch::full({1, 3, 8}, (float)i)));
+    CHECK_EQ(p.positions->item<int64_t>(), i);
+  }
+  // Packets in flight bound the buffers allocated, not the packet count.
+  CHECK_TRUE(pool->allocations() < 2 * n);
+
+  bool threw = false;
+  try {
+    (void)rx.pop();
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  CHECK_TRUE(threw);
+
+  // KV and activation packets leave one send thread in queue order.
+  {
+    qwen::AsyncSender tx([&](const qwen::ActivationPacket& p) { client->send_activation(p); },
+                         4,
+                         pool,
+                         [&](const qwen::KVPacket& p) { client->send_kv(p); });
+    for (int32_t l = 0; l < 2; ++l) {
+      qwen::KVPacket kv;
+      kv.layer = l;
+      kv.layer_count = 2;
+      kv.k = torch::full({1, 1, 2, 3, 4}, (float)l, torch::TensorOptions().device(device));
+      kv.v = torch::full({1, 1, 2, 3, 4}, (float)(l + 10), torch::TensorOptions().device(device));
+      tx.send_kv(kv);
+    }
+    qwen::ActivationPacket p;
+    p.step = 99;
+    p.hidden = torch::zeros({1, 1, 8});
+    tx.send(p);
+    tx.flush();
+    CHECK_EQ(tx.sent(), 3);
+  }
+  for (int32_t l = 0; l < 2; ++l) {
+    qwen::KVPacket kv = conn.recv_kv();
+    CHECK_EQ(kv.layer, l);
+    CHECK_EQ(kv.layer_count, 2);
+    CHECK_TRUE(torch::equal(kv.k.value(), torch::full({1, 1, 2, 3, 4}, (float)l)));
+    CHECK_TRUE(torch::equal(kv.v.value(), torch::full({1, 1, 2, 3, 4}, (float)(l + 10))));
+  }
+  CHECK_EQ(conn.recv_activation().step, 99);
+
+  // A send error surfaces on the next call.
+  client->shutdown();
+  threw = false;
+  try {
+    qwen::AsyncSender tx([&](const qwen::ActivationPacket& p) { client->send_activation(p); });
+    qwen::ActivationPacket p;
+    p.hidden = torch::zeros({1, 1, 4});
+    for (int i = 0; i < 8; ++i) tx.send(p);
+    tx.flush();
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  CHECK_TRUE(threw);
+
+  return 0;
+}
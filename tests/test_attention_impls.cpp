@@ -0,0 +1,155 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <memory>
+#include <string>
+
+#include "core/config.h"
+#include "core/kv_cache.h"
+#include "core/rope.h"
+#include "model/attention.h"
+#include "test_util.h"
+
+// Every attention_impl must match the reference path on the same weights:
+// prefill without cache, prefill + decode through a paged cache (multi-token
+// steps walk it in KV tiles), and explicit masks.
+
+static qwen::ModelConfig tiny_attention_config() {
+  qwen::ModelConfig cfg;
+  cfg.hidden_size = 32;
+  cfg.num_attention_heads = 8;
+  cfg.num_key_value_heads = 2;
+  cfg.rope_dim = 4;
+  cfg.max_seq_len = 64;
+  cfg.use_qk_norm = true;
+  // Small tiles so "tiled" crosses several query/key blocks and the diagonal.
+  cfg.attention_block_q = 4;
+  cfg.attention_block_kv = 3;
+  return cfg;
+}
+
+static int check_impl(const std::string& impl, const torch::Device& device) {
+  const qwen::ModelConfig cfg = tiny_attention_config();
+  const int dev = device.is_cpu() ? -1 : (int)device.index();
+  torch::NoGradGuard ng;
+
+  qwen::Attention ref(cfg, 0);
+  qwen::Attention cand(cfg, 0);
+  ref->set_impl("reference");
+  cand->set_impl(impl);
+  {
+    auto src = ref->named_parameters();
+    auto dst = cand->named_parameters();
+    for (const auto& p : src) dst[p.key()].copy_(p.value());
+  }
+  ref->to(device);
+  cand->to(device);
+
+  const auto rope = qwen::precompute_cos_sin(cfg.max_seq_len, cfg.rope_dim, cfg.rope_theta, torch::kFloat32, dev);
+  auto opts = torch::TensorOptions().dtype(torch::kFloat32).device(device);
+
+  // No cache, causal.
+  auto x = torch::randn({2, 9, cfg.hidden_size}, opts);
+  CHECK_NEAR(qwen_test::max_diff(cand->forward(x, c10::nullopt, nullptr, 0, rope),
+                      ref->forward(x, c10::nullopt, nullptr, 0, rope)),
+             0.0, 1e-5);
+
+  // Additive mask broadcast over heads.
+  auto m = torch::zeros({2, 1, 9, 9}, opts);
+  m.index_put_({0, 0, torch::indexing::Slice(), 3}, -1e9);
+  CHECK_NEAR(qwen_test::max_diff(cand->forward(x, m, nullptr, 0, rope), ref->forward(x, m, nullptr, 0, rope)),
+             0.0, 1e-5);
+
+  // Cached prefill then decode steps.
+  auto pool = std::make_shared<qwen::KVBlockPool>(1, 4, cfg.num_key_value_heads, 4, torch::kFloat32, dev);
+  qwen::KVCache ref_cache;
+  qwen::KVCache cand_cache;
+  ref_cache.init_paged(pool, 2, cfg.max_seq_len);
+  cand_cache.init_paged(pool, 2, cfg.max_seq_len);
+  int64_t pos = 0;
+  for (int64_t T : {7, 1, 1, 3, 1, 11}) {
+    auto xs = torch::randn({2, T, cfg.hidden_size}, opts);
+    auto a = cand->forward(xs, c10::nullopt, &cand_cache, pos, rope);
+    auto b = ref->forward(xs, c10::nullopt, &ref_cache, pos, rope);
+    CHECK_NEAR(qwen_test::max_diff(a, b), 0.0, 1e-5);
+    pos += T;
+  }
+
+  // Masked multi-token step on the paged cache: causal keep-mask with a few
+  // keys of row 1 hidden.
+  {
+    auto keep = torch::ones({2, 1, 3, pos + 3}, opts.dtype(torch::kBool));
+    for (int64_t t = 0; t < 3; ++t) {
+      keep.index_put_({torch::indexing::Slice(), 0, t, torch::indexing::Slice(pos + t + 1, pos + 3)}, false);
+    }
+    keep.index_put_({1, 0, torch::indexing::Slice(), torch::indexing::Slice(2, 6)}, false);
+    auto xs = torch::randn({2, 3, cfg.hidden_size}, opts);
+    CHECK_NEAR(qwen_test::max_diff(cand->forward(xs, keep, &cand_cache, pos, rope),
+                                   ref->forward(xs, keep, &ref_cache, pos, rope)),
+               0.0, 1e-5);
+    pos += 3;
+  }
+
+  // Ragged decode: row 1 is three tokens shorter, expressed as a padding mask.
+  auto keep = torch::ones({2, 1, 1, pos + 1}, opts.dtype(torch::kBool));
+  keep.index_put_({1, 0, 0, torch::indexing::Slice(pos - 3, pos)}, false);
+  auto xs = torch::randn({2, 1, cfg.hidden_size}, opts);
+  CHECK_NEAR(qwen_test::max_diff(cand->forward(xs, keep, &cand_cache, pos, rope),
+                                 ref->forward(xs, keep, &ref_cache, pos, rope)),
+             0.0, 1e-5);
+  return 0;
+}
+
+// The T == 1 fast path against the generic path of the same implementation,
+// on a dense cache (K/V consumed as strided views) and on a paged cache (the
+// block table walked in chunks).
+static int check_decode_fast_path(const torch::Device& device) {
+  const qwen::ModelConfig cfg = tiny_attention_config();
+  const int dev = device.is_cpu() ? -1 : (int)device.index();
+  torch::NoGradGuard ng;
+
+  qwen::Attention attn(cfg, 0);
+  attn->to(device);
+  const auto rope = qwen::precompute_cos_sin(cfg.max_seq_len, cfg.rope_dim, cfg.rope_theta, torch::kFloat32, dev);
+  auto opts = torch::TensorOptions().dtype(torch::kFloat32).device(device);
+
+  qwen::KVCache fast_cache;
+  qwen::KVCache paged_cache;
+  qwen::KVCache slow_cache;
+  fast_cache.init(1, 2, cfg.max_seq_len, cfg.num_key_value_heads, 4, torch::kFloat32, dev);
+  paged_cache.init_paged(std::make_shared<qwen::KVBlockPool>(1, 4, cfg.num_key_value_heads, 4, torch::kFloat32, dev),
+                         2, cfg.max_seq_len);
+  slow_cache.init(1, 2, cfg.max_seq_len, cfg.num_key_value_heads, 4, torch::kFloat32, dev);
+
+  auto prompt = torch::randn({2, 5, cfg.hidden_size}, opts);
+  (void)attn->forward(prompt, c10::nullopt, &fast_cache, 0, rope);
+  (void)attn->forward(prompt, c10::nullopt, &paged_cache, 0, rope);
+  (void)attn->forward(prompt, c10::nullopt, &slow_cache, 0, rope);
+  for (int64_t pos = 5; pos < 14; ++pos) {
+    auto x = torch::randn({2, 1, cfg.hidden_size}, opts);
+    attn->set_decode_fast_path(true);
+    auto fast = attn->forward(x, c10::nullopt, &fast_cache, pos, rope);
+    auto paged = attn->forward(x, c10::nullopt, &paged_cache, pos, rope);
+    attn->set_decode_fast_path(false);
+    auto slow = attn->forward(x, c10::nullopt, &slow_cache, pos, rope);
+    CHECK_NEAR(qwen_test::max_diff(fast, slow), 0.0, 1e-5);
+    CHECK_NEAR(qwen_test::max_diff(paged, slow), 0.0, 1e-5);
+  }
+  return 0;
+}
+
+int main() {
+  torch::manual_seed(0);
+  for (const char* impl : {"gqa", "tiled"}) {
+    if (check_impl(impl, torch::Device(torch::kCPU)) != 0) return 1;
+    if (torch::cuda::is_available()) {
+      if (check_impl(impl, torch::Device(torch::kCUDA, 0)) != 0) return 1;
+    }
+  }
+  if (check_decode_fast_path(torch::Device(torch::kCPU)) != 0) return 1;
+  if (torch::cuda::is_available()) {
+    if (check_decode_fast_path(torch::Device(torch::kCUDA, 0)) != 0) return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,29 @@
+#include <torch/torch.h>
+
+#include "core/config.h"
+#include "model/embedding.h"
+
+int main() {
+  // CPU counterpart of test_embedding_cuda.
+  qwen::ModelConfig cfg;
+  cfg.vocab_size = 1000;
+  cfg.hidden_size = 64;
+  cfg.max_seq_len = 16;
+  cfg.device_index = -1;
+
+  qwen::Embedding emb(cfg);
+
+  torch::Tensor input_ids = torch::randint(
+      0, cfg.vocab_size, {2, 5}, torch::TensorOptions().dtype(torch::kInt64));
+
+  torch::Tensor out = emb->forward(input_ids);
+
+  if (out.sizes() != torch::IntArrayRef({2, 5, cfg.hidden_size})) {
+    throw std::runtime_error("unexpected embedding output shape");
+  }
+  if (!out.is_cpu()) {
+    throw std::runtime_error("embedding output should stay on CPU");
+  }
+
+  return 0;
+}
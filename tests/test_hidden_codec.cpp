@@ -0,0 +1,136 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <cstring>
+#include <vector>
+
+#include "runtime/hidden_codec.h"
+#include "runtime/inproc_transport.h"
+#include "runtime/wire_frame.h"
+
+// Encodes `p` and decodes it again as a socket receiver would.
+static qwen::ActivationPacket through_wire(const qwen::ActivationPacket& p) {
+  qwen::EncodedFrame f = qwen::encode_activation(p);
+  const uint32_t len = qwen::parse_frame_prefix(f.head.data(), "test");
+  std::vector<torch::Tensor> payloads;
+  qwen::ActivationPacket r = qwen::decode_activation(f.head.data() + qwen::kFramePrefixBytes, len, nullptr, &payloads);
+  for (size_t i = 0; i < payloads.size(); ++i) {
+    std::memcpy(payloads[i].data_ptr(), f.payloads[i].data_ptr(), (size_t)payloads[i].nbytes());
+  }
+  return r;
+}
+
+// Per-element error of one codec against its rounding bound: half a step of
+// the token's scale for int8; 3 mantissa bits (relative 2^-4) for e4m3, plus
+// half its subnormal spacing near zero.
+static int check_codec(const torch::Tensor& x, qwen::HiddenCodec codec) {
+  auto q = qwen::quantize_rows(x, codec);
+  CHECK_TRUE(q.first.scalar_type() == (codec == qwen::HiddenCodec::kInt8 ? torch::kInt8 : torch::kFloat8_e4m3fn));
+  CHECK_TRUE(q.second.scalar_type() == torch::kFloat32);
+  CHECK_TRUE(q.second.sizes() == x.sizes().slice(0, x.dim() - 1));
+
+  auto y = qwen::dequantize_rows(q.first, q.second, torch::kFloat32);
+  CHECK_TRUE(y.sizes() == x.sizes());
+  auto err = (y - x).abs();
+  auto s = q.second.unsqueeze(-1);
+  auto bound = codec == qwen::HiddenCodec::kInt8 ? s * 0.5 : x.abs() * 0.0625 + s * (1.0 / 1024.0);
+  CHECK_TRUE((err <= bound * 1.0001 + 1e-7).all().item<bool>());
+
+  // The largest element of every token maps onto the top code exactly.
+  auto amax = x.abs().amax(-1);
+  CHECK_NEAR((y.abs().amax(-1) - amax).abs().max().item<double>(), 0.0, 1e-5 * amax.max().item<double>());
+
+  const qwen::CodecError e = qwen::codec_error(x, codec);
+  CHECK_NEAR(e.max_abs, err.max().item<double>(), 1e-6);
+  CHECK_NEAR(e.mean_abs, err.mean().item<double>(), 1e-6);
+  return 0;
+}
+
+int main() {
+  torch::NoGradGuard no_grad;
+  torch::manual_seed(0);
+
+  qwen::HiddenCodec codec = qwen::HiddenCodec::kNone;
+  CHECK_TRUE(qwen::parse_hidden_codec("int8", &codec) && codec == qwen::HiddenCodec::kInt8);
+  CHECK_TRUE(qwen::parse_hidden_codec("fp8", &codec) && codec == qwen::HiddenCodec::kFp8);
+  CHECK_TRUE(qwen::parse_hidden_codec("none", &codec) && codec == qwen::HiddenCodec::kNone);
+  CHECK_TRUE(!qwen::parse_hidden_codec("int4", &codec));
+
+  // Tokens with very different magnitudes each get their own scale; one
+  // all-zero token must not divide by zero.
+  auto x = torch::randn({2, 5, 64});
+  x.select(1, 1).mul_(1000.0);
+  x.select(1, 2).mul_(1e-3);
+  x.select(1, 3).zero_();
+  for (qwen::HiddenCodec c : {qwen::HiddenCodec::kInt8, qwen::HiddenCodec::kFp8}) {
+    if (int rc = check_codec(x, c)) return rc;
+    auto q = qwen::quantize_rows(x, c);
+    CHECK_TRUE(qwen::dequantize_rows(q.first, q.second, torch::kFloat32).select(1, 3).eq(0).all().item<bool>());
+  }
+
+  // A bf16 packet is quantized on the sender; the header carries the codec,
+  // the original dtype and the scales, and the receiver restores bf16.
+  for (qwen::HiddenCodec c : {qwen::HiddenCodec::kInt8, qwen::HiddenCodec::kFp8}) {
+    qwen::ActivationPacket p;
+    p.step = 4;
+    p.pos = 9;
+    p.hidden = x.to(torch::kBFloat16);
+    const torch::Tensor original = p.hidden;
+    qwen::quantize_hidden(&p, c);
+    CHECK_TRUE(p.codec == c);
+    CHECK_TRUE(p.hidden_dtype == torch::kBFloat16);
+    CHECK_EQ(p.hidden.element_size(), 1);
+    CHECK_TRUE(p.hidden_scale.has_value());
+
+    // Quantizing twice is a no-op.
+    qwen::quantize_hidden(&p, qwen::HiddenCodec::kInt8);
+    CHECK_TRUE(p.codec == c);
+
+    qwen::ActivationPacket r = through_wire(p);
+    CHECK_TRUE(r.codec == c);
+    CHECK_TRUE(r.hidden_dtype == torch::kBFloat16);
+    CHECK_EQ(r.step, 4);
+    CHECK_EQ(r.pos, 9);
+    CHECK_TRUE(torch::equal(r.hidden.view(torch::kUInt8), p.hidden.view(torch::kUInt8)));
+    CHECK_TRUE(r.hidden_scale.has_value() && torch::equal(*r.hidden_scale, *p.hidden_scale));
+
+    auto h = qwen::hidden_on(r, torch::Device(torch::kCPU));
+    CHECK_TRUE(h.scalar_type() == torch::kBFloat16);
+    CHECK_TRUE(h.sizes() == original.sizes());
+    auto rel = (h.to(torch::kFloat32) - original.to(torch::kFloat32)).abs().amax(-1) /
+               original.to(torch::kFloat32).abs().amax(-1).clamp_min(1e-12);
+    CHECK_TRUE((rel < 0.08).all().item<bool>());
+  }
+
+  // Token ids and the default codec leave the packet untouched.
+  {
+    qwen::ActivationPacket p;
+    p.hidden = torch::tensor({{3, 1, 4}}, torch::TensorOptions().dtype(torch::kInt64));
+    qwen::quantize_hidden(&p, qwen::HiddenCodec::kInt8);
+    CHECK_TRUE(p.codec == qwen::HiddenCodec::kNone);
+    CHECK_TRUE(!p.hidden_scale.has_value());
+    qwen::ActivationPacket r = through_wire(p);
+    CHECK_TRUE(r.codec == qwen::HiddenCodec::kNone && !r.hidden_scale.has_value());
+    CHECK_TRUE(torch::equal(qwen::hidden_on(r, torch::Device(torch::kCPU)), p.hidden));
+
+    qwen::ActivationPacket f;
+    f.hidden = x;
+    qwen::quantize_hidden(&f, qwen::HiddenCodec::kNone);
+    CHECK_TRUE(f.codec == qwen::HiddenCodec::kNone);
+    CHECK_TRUE(torch::equal(through_wire(f).hidden, x));
+  }
+
+  // The in-process transport carries the scales along with the codes.
+  {
+    auto ends = qwen::make_inproc_pair();
+    qwen::ActivationPacket p;
+    p.hidden = x;
+    qwen::quantize_hidden(&p, qwen::HiddenCodec::kInt8);
+    ends.first->send_activation(p);
+    qwen::ActivationPacket r = ends.second->recv_activation();
+    CHECK_TRUE(r.codec == qwen::HiddenCodec::kInt8);
+    CHECK_TRUE(torch::equal(qwen::hidden_on(r, torch::Device(torch::kCPU)), qwen::hidden_on(p, torch::Device(torch::kCPU))));
+  }
+  return 0;
+}
@@ -0,0 +1,226 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/config.h"
+#include "core/kv_cache.h"
+#include "model/model_stage.h"
+#include "runtime/pipeline_stage.h"
+#include "runtime/transport_factory.h"
+#include "test_util.h"
+
+// Activation then KV through `tx` arrive intact on `rx`.
+static int round_trip(qwen::Transport& tx, qwen::Transport& rx) {
+  qwen::ActivationPacket a;
+  a.stage_from = 1;
+  a.stage_to = 2;
+  a.step = 3;
+  a.pos = 5;
+  a.request_id = 7;
+  a.flags = qwen::kFlagMoreChunks;
+  a.hidden = torch::arange(0, 12, torch::TensorOptions().dtype(torch::kFloat32)).view({1, 3, 4});
+  a.slots = torch::tensor({2}, torch::TensorOptions().dtype(torch::kInt64));
+  tx.send_activation(a);
+
+  qwen::KVPacket kv;
+  kv.kv_start = 4;
+  kv.layer = 1;
+  kv.layer_count = 2;
+  kv.k = torch::ones({1, 1, 2, 3, 4});
+  kv.v = torch::zeros({1, 1, 2, 3, 4});
+  tx.send_kv(kv);
+
+  qwen::ActivationPacket ra = rx.recv_activation();
+  CHECK_EQ(ra.stage_from, 1);
+  CHECK_EQ(ra.stage_to, 2);
+  CHECK_EQ(ra.step, 3);
+  CHECK_EQ(ra.pos, 5);
+  CHECK_EQ(ra.request_id, 7);
+  CHECK_EQ(ra.flags, qwen::kFlagMoreChunks);
+  CHECK_TRUE(torch::equal(ra.hidden, a.hidden));
+  CHECK_TRUE(ra.slots.has_value());
+  CHECK_EQ(ra.slots->item<int64_t>(), 2);
+  CHECK_TRUE(!ra.attn_mask.has_value());
+
+  qwen::KVPacket rk = rx.recv_kv();
+  CHECK_EQ(rk.kv_start, 4);
+  CHECK_EQ(rk.layer, 1);
+  CHECK_EQ(rk.layer_count, 2);
+  CHECK_TRUE(torch::equal(rk.k.value(), kv.k.value()));
+  CHECK_TRUE(torch::equal(rk.v.value(), kv.v.value()));
+  return 0;
+}
+
+// Greedy tokens of `steps` decode steps, running the stages back to back in
+// this thread.
+static std::vector<int64_t> local_tokens(std::vector<qwen::ModelStage>& stages, const torch::Tensor& prompt, int64_t steps) {
+  std::vector<qwen::KVCache> caches(stages.size());
+  std::vector<int64_t> out;
+  torch::Tensor ids = prompt;
+  int64_t pos = 0;
+  for (int64_t s = 0; s < steps; ++s) {
+    qwen::StageInput in;
+    in.input_ids = ids;
+    in.pos = pos;
+    in.cache = &caches[0];
+    qwen::StageOutput o = stages[0]->forward(in);
+    for (size_t i = 1; i < stages.size(); ++i) {
+      qwen::StageInput next;
+      next.hidden_in = o.hidden_out;
+      next.pos = pos;
+      next.cache = &caches[i];
+      o = stages[i]->forward(next);
+    }
+    pos += ids.size(1);
+    ids = o.logits.select(1, o.logits.size(1) - 1).argmax(-1, /*keepdim=*/true);
+    out.push_back(ids.item<int64_t>());
+  }
+  return out;
+}
+
+int main() {
+  torch::NoGradGuard no_grad;
+
+  // Connected pair: both packet kinds, in order, and a recv of the wrong kind
+  // throws.
+  {
+    auto ends = qwen::make_inproc_pair();
+    if (int rc = round_trip(*ends.first, *ends.second)) return rc;
+    if (int rc = round_trip(*ends.second, *ends.first)) return rc;
+
+    qwen::KVPacket kv;
+    ends.first->send_kv(kv);
+    bool threw = false;
+    try {
+      (void)ends.second->recv_activation();
+    } catch (const std::exception&) {
+      threw = true;
+    }
+    CHECK_TRUE(threw);
+  }
+
+  // Payloads are copied at send: the sender may reuse its buffer at once.
+  {
+    auto ends = qwen::make_inproc_pair();
+    qwen::ActivationPacket a;
+    a.hidden = torch::full({2, 2}, 1.0f);
+    ends.first->send_activation(a);
+    a.hidden.fill_(9.0f);
+    CHECK_NEAR(ends.second->recv_activation().hidden.sum().item<double>(), 4.0, 0.0);
+  }
+
+  // A destroyed peer fails the receive once its queue is drained.
+  {
+    auto ends = qwen::make_inproc_pair();
+    qwen::ActivationPacket a;
+    a.step = 1;
+    ends.first->send_activation(a);
+    ends.first.reset();
+    CHECK_EQ(ends.second->recv_activation().step, 1);
+    bool threw = false;
+    try {
+      (void)ends.second->recv_activation();
+    } catch (const std::exception&) {
+      threw = true;
+    }
+    CHECK_TRUE(threw);
+  }
+
+  // Listener/connection by port, for in-process and Unix-domain transports.
+  for (qwen::TransportKind kind : {qwen::TransportKind::kInProc, qwen::TransportKind::kUnix}) {
+    qwen::TransportOptions opts;
+    opts.kind = kind;
+    std::unique_ptr<qwen::TransportListener> listener;
+    try {
+      listener = qwen::make_listener(opts, kind == qwen::TransportKind::kUnix ? (int)::getpid() : 0);
+    } catch (const std::exception& e) {
+      std::fprintf(stderr, "SKIP %s: %s\n", qwen::transport_kind_name(kind), e.what());
+      continue;
+    }
+    std::unique_ptr<qwen::Transport> client = qwen::make_connection(opts, "127.0.0.1", listener->port());
+    std::unique_ptr<qwen::Transport> server = listener->accept();
+    if (int rc = round_trip(*client, *server)) return rc;
+    if (int rc = round_trip(*server, *client)) return rc;
+  }
+
+  // A two-stage serving pipeline on threads over in-process transports
+  // produces the same greedy tokens as running the stages back to back.
+  torch::manual_seed(0);
+  std::vector<qwen::ModelStage> models;
+  for (int32_t i = 0; i < 2; ++i) {
+    qwen::ModelConfig cfg = qwen_test::tiny_stage_config(/*max_batch=*/1, /*max_seq_len=*/32, i, 2);
+    cfg.use_qk_norm = true;
+    models.emplace_back(cfg);
+    models.back()->eval();
+  }
+  const int64_t steps = 6;
+  auto prompt = torch::randint(0, 32, {1, 5}, torch::TensorOptions().dtype(torch::kInt64));
+  const std::vector<int64_t> expected = local_tokens(models, prompt, steps);
+
+  qwen::TransportOptions opts;
+  opts.kind = qwen::TransportKind::kInProc;
+  std::vector<std::unique_ptr<qwen::TransportListener>> listeners;
+  for (int i = 0; i < 3; ++i) listeners.push_back(qwen::make_listener(opts, 0));
+
+  std::mutex mu;
+  std::string err;
+  std::vector<std::thread> threads;
+  for (int32_t i = 0; i < 2; ++i) {
+    threads.emplace_back([&, i]() {
+      torch::NoGradGuard ng;
+      try {
+        qwen::PipelineStage ps(models[(size_t)i]);
+        qwen::ServeLinks links;
+        links.upstream = listeners[(size_t)i].get();
+        links.connect_downstream = [&, i]() {
+          return qwen::make_connection(opts, "", listeners[(size_t)i + 1]->port());
+        };
+        (void)ps.serve(links, i, 2);
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mu);
+        err = e.what();
+      }
+    });
+  }
+
+  std::unique_ptr<qwen::Transport> stage0 = qwen::make_connection(opts, "", listeners[0]->port());
+  qwen::ActivationPacket p;
+  p.request_id = 1;
+  p.hidden = prompt;
+  stage0->send_activation(p);
+  std::unique_ptr<qwen::Transport> replies = listeners[2]->accept();
+  std::vector<int64_t> got;
+  int64_t pos = prompt.size(1);
+  for (int64_t s = 0; s < steps; ++s) {
+    qwen::ActivationPacket rp = replies->recv_activation();
+    CHECK_EQ(rp.request_id, 1);
+    CHECK_EQ(rp.step, s);
+    got.push_back(rp.hidden.item<int64_t>());
+    if (s + 1 == steps) break;
+    qwen::ActivationPacket next;
+    next.request_id = 1;
+    next.step = s + 1;
+    next.pos = pos;
+    next.hidden = rp.hidden;
+    pos += 1;
+    stage0->send_activation(next);
+  }
+  qwen::ActivationPacket stop;
+  stop.kind = qwen::PacketKind::kShutdown;
+  stage0->send_activation(stop);
+  for (auto& t : threads) t.join();
+  CHECK_TRUE(err.empty());
+
+  CHECK_EQ(got.size(), expected.size());
+  for (size_t i = 0; i < got.size(); ++i) CHECK_EQ(got[i], expected[i]);
+  return 0;
+}
@@ -0,0 +1,178 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <memory>
+
+#include "core/config.h"
+#include "core/kv_block_pool.h"
+#include "core/kv_cache.h"
+#include "model/model_stage.h"
+#include "runtime/kv_wire.h"
+#include "test_util.h"
+
+static int check_cache_vs_dense() {
+  const int32_t L = 2, B = 2, S_max = 32, H = 2, D = 4, bs = 4;
+  auto pool = std::make_shared<qwen::KVBlockPool>(L, bs, H, D, torch::kFloat32, /*device*/-1);
+
+  qwen::KVCache dense;
+  dense.init(L, B, S_max, H, D, torch::kFloat32, /*device*/-1);
+  qwen::KVCache paged;
+  paged.init_paged(pool, B, S_max);
+  CHECK_TRUE(paged.is_paged());
+  CHECK_EQ(pool->capacity(), 0);
+
+  // Prefill 5 tokens, then 4 single-token decode steps.
+  int64_t pos = 0;
+  for (int64_t T : {5, 1, 1, 1, 1}) {
+    for (int32_t l = 0; l < L; ++l) {
+      auto k = torch::randn({B, H, T, D});
+      auto v = torch::randn({B, H, T, D});
+      dense.append(l, k, v, pos);
+      paged.append(l, k, v, pos);
+    }
+    pos += T;
+    for (int32_t l = 0; l < L; ++l) {
+      CHECK_NEAR(qwen_test::max_diff(paged.keys(l, B, pos), dense.keys(l, B, pos)), 0.0, 0.0);
+      CHECK_NEAR(qwen_test::max_diff(paged.values(l, B, pos), dense.values(l, B, pos)), 0.0, 0.0);
+      // A range straddling a block boundary reads only its own blocks.
+      CHECK_NEAR(qwen_test::max_diff(paged.keys_range(l, B, 3, pos - 3), dense.keys_range(l, B, 3, pos - 3)), 0.0, 0.0);
+    }
+  }
+
+  // 9 tokens in blocks of 4 -> 3 blocks per row; nothing sized by S_max.
+  CHECK_EQ(paged.length(), 9);
+  CHECK_EQ(paged.num_blocks(), 2 * 3);
+  CHECK_EQ(pool->num_used(), 2 * 3);
+
+  paged.clear_all();
+  CHECK_EQ(paged.num_blocks(), 0);
+  CHECK_EQ(pool->num_used(), 0);
+  return 0;
+}
+
+static int check_fork_copy_on_write() {
+  const int32_t L = 2, S_max = 32, H = 2, D = 4, bs = 4;
+  auto pool = std::make_shared<qwen::KVBlockPool>(L, bs, H, D, torch::kFloat32, /*device*/-1);
+
+  qwen::KVCache base;
+  base.init_paged(pool, /*max_batch*/1, S_max);
+  for (int32_t l = 0; l < L; ++l) {
+    base.append(l, torch::randn({1, H, 6, D}), torch::randn({1, H, 6, D}), 0);
+  }
+  const auto base_k = base.keys(1, 1, 6).clone();
+  CHECK_EQ(pool->num_used(), 2);
+
+  {
+    qwen::KVCache child = base.fork();
+    CHECK_EQ(pool->num_used(), 2);
+    CHECK_EQ(pool->refcount(base.block_table(0)[0]), 2);
+    CHECK_NEAR(qwen_test::max_diff(child.keys(1, 1, 6), base_k), 0.0, 0.0);
+
+    // Writing position 6 touches the shared second block: only that one is copied.
+    for (int32_t l = 0; l < L; ++l) {
+      child.append(l, torch::ones({1, H, 1, D}), torch::ones({1, H, 1, D}), 6);
+    }
+    CHECK_EQ(pool->num_used(), 3);
+    CHECK_TRUE(child.block_table(0)[0] == base.block_table(0)[0]);
+    CHECK_TRUE(child.block_table(0)[1] != base.block_table(0)[1]);
+    CHECK_NEAR(qwen_test::max_diff(child.keys(1, 1, 6), base_k), 0.0, 0.0);
+    CHECK_NEAR(qwen_test::max_diff(base.keys(1, 1, 6), base_k), 0.0, 0.0);
+    CHECK_NEAR(child.keys(0, 1, 7).select(2, 6).sum().item<double>(), (double)(H * D), 1e-6);
+  }
+  // Child destroyed: its private block is freed, the shared one drops to refcount 1.
+  CHECK_EQ(pool->num_used(), 2);
+  CHECK_EQ(pool->refcount(base.block_table(0)[0]), 1);
+  return 0;
+}
+
+static int check_bounded_pool() {
+  auto pool = std::make_shared<qwen::KVBlockPool>(1, 4, 2, 4, torch::kFloat32, /*device*/-1, /*max_blocks*/3);
+  const int32_t a = pool->allocate();
+  CHECK_EQ(pool->capacity(), 3);
+  auto* storage = pool->k(0).data_ptr();
+  (void)pool->allocate();
+  (void)pool->allocate();
+  CHECK_TRUE(pool->k(0).data_ptr() == storage);
+  pool->release(a);
+  CHECK_EQ(pool->num_free(), 1);
+  return 0;
+}
+
+static int check_wire_roundtrip() {
+  auto pool = std::make_shared<qwen::KVBlockPool>(2, 4, 2, 4, torch::kFloat32, /*device*/-1);
+  qwen::KVCache src;
+  src.init_paged(pool, 1, 32);
+  for (int32_t l = 0; l < 2; ++l) {
+    src.append(l, torch::randn({1, 2, 7, 4}), torch::randn({1, 2, 7, 4}), 0);
+  }
+  auto packed = qwen::pack_kv_cache(src);
+  CHECK_EQ(packed.k.size(3), 7);
+  // A range reads only its own blocks.
+  auto tail = qwen::pack_kv_range(src, 5, 2);
+  CHECK_NEAR(qwen_test::max_diff(tail.k.select(0, 1), src.keys(1, 1, 7).narrow(2, 5, 2)), 0.0, 0.0);
+
+  qwen::KVCache dst;
+  dst.init_paged(pool, 1, 32);
+  qwen::restore_kv_cache(&dst, packed.k, packed.v);
+  CHECK_EQ(dst.length(), 7);
+  CHECK_NEAR(qwen_test::max_diff(dst.values(1, 1, 7), src.values(1, 1, 7)), 0.0, 0.0);
+  return 0;
+}
+
+static int check_stage_dense_vs_paged() {
+  qwen::ModelConfig cfg;
+  cfg.vocab_size = 32;
+  cfg.hidden_size = 16;
+  cfg.num_hidden_layers = 2;
+  cfg.num_attention_heads = 4;
+  cfg.num_key_value_heads = 2;
+  cfg.intermediate_size = 32;
+  cfg.rope_dim = 4;
+  cfg.max_seq_len = 64;
+  cfg.layer_start = 0;
+  cfg.layer_end = 2;
+  cfg.device_index = -1;
+  cfg.kv_block_size = 4;
+
+  qwen::ModelStage stage(cfg);
+  stage->eval();
+  torch::NoGradGuard ng;
+  auto ids = torch::randint(0, cfg.vocab_size, {1, 10}, torch::TensorOptions().dtype(torch::kInt64));
+
+  // Paged (stage-configured) prefill + decode.
+  qwen::KVCache paged;
+  qwen::StageInput in;
+  in.input_ids = ids.narrow(1, 0, 9);
+  in.cache = &paged;
+  (void)stage->forward(in);
+  in.input_ids = ids.narrow(1, 9, 1);
+  in.pos = 9;
+  auto paged_out = stage->forward(in);
+  CHECK_TRUE(paged.is_paged());
+  CHECK_EQ(stage->kv_pool()->num_used(), 3);
+
+  // Same steps against a dense cache.
+  qwen::KVCache dense;
+  dense.init(2, 1, cfg.max_seq_len, 2, 4, torch::kFloat32, -1);
+  in.input_ids = ids.narrow(1, 0, 9);
+  in.pos = 0;
+  in.cache = &dense;
+  (void)stage->forward(in);
+  in.input_ids = ids.narrow(1, 9, 1);
+  in.pos = 9;
+  auto dense_out = stage->forward(in);
+
+  CHECK_NEAR(qwen_test::max_diff(paged_out.logits, dense_out.logits), 0.0, 1e-5);
+  return 0;
+}
+
+int main() {
+  torch::manual_seed(0);
+  if (check_cache_vs_dense() != 0) return 1;
+  if (check_fork_copy_on_write() != 0) return 1;
+  if (check_bounded_pool() != 0) return 1;
+  if (check_wire_roundtrip() != 0) return 1;
+  if (check_stage_dense_vs_paged() != 0) return 1;
+  return 0;
+}
@@ -4,12 +4,64 @@
 
 #include "core/kv_cache.h"
 #include "runtime/kv_wire.h"
+#include "test_util.h"
+
+// A first sync of [0, length) followed by one-token deltas rebuilds the
+// cache exactly, and each delta carries one position, not max_seq_len.
+static int check_delta(int device, c10::ScalarType dtype) {
+  const torch::Device dev = device >= 0 ? torch::Device(torch::kCUDA, device) : torch::Device(torch::kCPU);
+  const auto opts = torch::TensorOptions().dtype(dtype).device(dev);
+  const int64_t L = 2, B = 1, H = 2, D = 4, S = 64;
+
+  qwen::KVCache src;
+  src.init(L, B, S, H, D, dtype, device);
+  qwen::KVCache dst;
+  dst.init(L, B, S, H, D, dtype, device);
+
+  const int64_t prompt = 5;
+  for (int32_t l = 0; l < L; ++l) {
+    src.append(l, torch::randn({B, H, prompt, D}, opts), torch::randn({B, H, prompt, D}, opts), 0);
+  }
+  auto first = qwen::pack_kv_range(src, 0, src.length());
+  CHECK_EQ(first.start, 0);
+  CHECK_EQ(first.k.size(3), prompt);
+  CHECK_TRUE(first.k.is_cpu() && first.k.is_contiguous() && first.v.is_contiguous());
+  qwen::restore_kv_cache(&dst, first.k, first.v, first.start);
+
+  const int64_t full_bytes = (int64_t)qwen::pack_kv_cache(src).k.nbytes();
+  for (int64_t pos = prompt; pos < prompt + 3; ++pos) {
+    for (int32_t l = 0; l < L; ++l) {
+      src.append(l, torch::randn({B, H, 1, D}, opts), torch::randn({B, H, 1, D}, opts), pos);
+    }
+    auto delta = qwen::pack_kv_range(src, pos, 1);
+    CHECK_EQ(delta.start, pos);
+    CHECK_EQ((int64_t)delta.k.nbytes() * S, full_bytes);
+    qwen::restore_kv_cache(&dst, delta.k, delta.v, delta.start);
+  }
+
+  CHECK_EQ(dst.length(), src.length());
+  for (int32_t l = 0; l < L; ++l) {
+    CHECK_NEAR(qwen_test::max_diff(dst.keys(l, B, src.length()), src.keys(l, B, src.length())), 0.0, 0.0);
+    CHECK_NEAR(qwen_test::max_diff(dst.values(l, B, src.length()), src.values(l, B, src.length())), 0.0, 0.0);
+  }
+
+  bool threw = false;
+  try {
+    (void)qwen::pack_kv_range(src, S - 1, 2);
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  CHECK_TRUE(threw);
+  return 0;
+}
 
 int main() {
-  SKIP_IF(!torch::cuda::is_available(), "CUDA not available");
+  // Runs on CUDA when available, otherwise on the CPU backend (device < 0).
+  const int device = torch::cuda::is_available() ? 0 : -1;
+  const auto dtype = (device >= 0) ? torch::kFloat16 : torch::kFloat32;
 
   qwen::KVCache cache;
-  cache.init(/*layers*/2, /*max_batch*/1, /*max_seq*/8, /*kv_heads*/2, /*head_dim*/4, torch::kFloat16, /*device*/0);
+  cache.init(/*layers*/2, /*max_batch*/1, /*max_seq*/8, /*kv_heads*/2, /*head_dim*/4, dtype, device);
 
   // Fill cache with non-zero values.
   for (int i = 0; i < cache.num_layers(); ++i) {
@@ -26,10 +78,12 @@ int main() {
 
   // Restore into a new cache and compare shapes.
   qwen::KVCache cache2;
-  cache2.init(/*layers*/2, /*max_batch*/1, /*max_seq*/8, /*kv_heads*/2, /*head_dim*/4, torch::kFloat16, /*device*/0);
+  cache2.init(/*layers*/2, /*max_batch*/1, /*max_seq*/8, /*kv_heads*/2, /*head_dim*/4, dtype, device);
   qwen::restore_kv_cache(&cache2, packed.k, packed.v);
   CHECK_TRUE(cache2.layer(0).k.sizes() == cache.layer(0).k.sizes());
   CHECK_TRUE(cache2.layer(1).v.sizes() == cache.layer(1).v.sizes());
+  CHECK_NEAR(qwen_test::max_diff(cache2.layer(1).v, cache.layer(1).v), 0.0, 0.0);
 
+  if (int rc = check_delta(device, dtype)) return rc;
   return 0;
 }
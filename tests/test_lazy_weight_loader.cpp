@@ -0,0 +1,71 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "loader/lazy_pt_weight_loader.h"
+#include "loader/weight_loader.h"
+
+// A packed state_dict (same zip layout as Python's torch.save of a dict) is
+// indexed without reading tensor data; get() reads only the requested record.
+int main() {
+  torch::manual_seed(0);
+  auto big = torch::randn({64, 32});
+  auto small = torch::arange(0, 6, torch::TensorOptions().dtype(torch::kInt64)).view({2, 3});
+  auto half = torch::randn({4, 8}).to(torch::kFloat16);
+
+  c10::Dict<std::string, at::Tensor> dict;
+  dict.insert("model.layers.0.mlp.down_proj.weight", big);
+  dict.insert("model.layers.1.input_layernorm.weight", small);
+  dict.insert("model.norm.weight", half);
+  dict.insert("model.layers.0.mlp.down_proj.weight_t", big.t());
+
+  const auto path = (std::filesystem::temp_directory_path() / "qwen_test_lazy_weight_loader.pt").string();
+  {
+    const std::vector<char> bytes = torch::pickle_save(c10::IValue(dict));
+    std::ofstream os(path, std::ios::binary);
+    os.write(bytes.data(), (std::streamsize)bytes.size());
+  }
+
+  qwen::LazyPtWeightLoader wl(path);
+  CHECK_EQ(wl.bytes_read(), 0);
+  CHECK_EQ(wl.list_keys().size(), 4);
+  CHECK_TRUE(wl.exists("model.norm.weight"));
+  CHECK_TRUE(!wl.exists("model.embed_tokens.weight"));
+
+  auto s = wl.get("model.layers.1.input_layernorm.weight");
+  CHECK_TRUE(s.scalar_type() == torch::kInt64);
+  CHECK_TRUE(torch::equal(s, small));
+  // Only the small record was read, not the 8 KB matrix.
+  CHECK_TRUE(wl.bytes_read() < big.numel() * (int64_t)sizeof(float));
+
+  auto h = wl.get("model.norm.weight");
+  CHECK_TRUE(h.scalar_type() == torch::kFloat16);
+  CHECK_TRUE(torch::equal(h, half));
+
+  CHECK_TRUE(torch::equal(wl.get("model.layers.0.mlp.down_proj.weight"), big));
+  auto t = wl.get("model.layers.0.mlp.down_proj.weight_t");
+  CHECK_EQ(t.size(0), 32);
+  CHECK_TRUE(torch::equal(t, big.t()));
+
+  bool threw = false;
+  try {
+    (void)wl.get("missing");
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  CHECK_TRUE(threw);
+
+  // The factory picks the lazy reader for packed archives.
+  std::unique_ptr<qwen::WeightLoader> opened = qwen::open_weight_loader(path);
+  CHECK_TRUE(dynamic_cast<qwen::LazyPtWeightLoader*>(opened.get()) != nullptr);
+  CHECK_TRUE(torch::equal(opened->get("model.norm.weight"), half));
+
+  std::filesystem::remove(path);
+  return 0;
+}
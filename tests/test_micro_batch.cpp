@@ -0,0 +1,95 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "core/config.h"
+#include "core/kv_cache.h"
+#include "model/model_stage.h"
+#include "runtime/micro_batch.h"
+#include "test_util.h"
+
+int main() {
+  torch::manual_seed(0);
+  torch::NoGradGuard ng;
+
+  // Rows are split as evenly as possible and every tensor follows.
+  const int64_t B = 5, T = 6;
+  auto ids = torch::randint(0, 32, {B, T}, torch::TensorOptions().dtype(torch::kInt64));
+  qwen::StageInput in;
+  in.input_ids = ids;
+  in.attn_mask = torch::ones({B, T}, torch::TensorOptions().dtype(torch::kBool));
+  auto mbs = qwen::split_micro_batches(in, 2);
+  CHECK_EQ((int64_t)mbs.size(), 2);
+  CHECK_EQ(mbs[0].input_ids.size(0), 3);
+  CHECK_EQ(mbs[1].input_ids.size(0), 2);
+  CHECK_EQ(mbs[1].attn_mask->size(0), 2);
+  CHECK_TRUE(!mbs[0].hidden_in.defined());
+  CHECK_TRUE(torch::equal(torch::cat({mbs[0].input_ids, mbs[1].input_ids}, 0), ids));
+
+  bool threw = false;
+  try {
+    (void)qwen::split_micro_batches(in, B + 1);
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  CHECK_TRUE(threw);
+
+  // Micro-batches with their own caches reproduce the full batch, including
+  // a decode step that reuses each micro-batch's cache.
+  const qwen::ModelConfig cfg = qwen_test::tiny_stage_config(/*max_batch=*/8, /*max_seq_len=*/16);
+  qwen::ModelStage stage(cfg);
+  stage->eval();
+
+  qwen::KVCache full_cache;
+  qwen::StageInput full_in;
+  full_in.input_ids = ids;
+  full_in.cache = &full_cache;
+  auto full = stage->forward(full_in).logits;
+  auto next = torch::randint(0, 32, {B, 1}, torch::TensorOptions().dtype(torch::kInt64));
+  qwen::StageInput full_step;
+  full_step.input_ids = next;
+  full_step.pos = T;
+  full_step.cache = &full_cache;
+  auto full_decode = stage->forward(full_step).logits;
+
+  qwen::StageInput plain;
+  plain.input_ids = ids;
+  auto parts = qwen::split_micro_batches(plain, 3);
+  auto next_parts = next.tensor_split(3, 0);
+  std::vector<qwen::KVCache> caches(parts.size());
+  std::vector<torch::Tensor> mb_logits;
+  std::vector<torch::Tensor> mb_decode;
+  for (size_t m = 0; m < parts.size(); ++m) {
+    parts[m].cache = &caches[m];
+    mb_logits.push_back(stage->forward(parts[m]).logits);
+  }
+  for (size_t m = 0; m < parts.size(); ++m) {
+    qwen::StageInput step;
+    step.input_ids = next_parts[m];
+    step.pos = T;
+    step.cache = &caches[m];
+    mb_decode.push_back(stage->forward(step).logits);
+  }
+  CHECK_NEAR((torch::cat(mb_logits, 0) - full).abs().max().item<double>(), 0.0, 1e-5);
+  CHECK_NEAR((torch::cat(mb_decode, 0) - full_decode).abs().max().item<double>(), 0.0, 1e-5);
+
+  // Utilization is busy time over the span from first to last unit of work.
+  qwen::StageUtilization util;
+  CHECK_NEAR(util.utilization(), 0.0, 0.0);
+  util.begin_wall();
+  for (int i = 0; i < 2; ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    const auto t0 = qwen::StageUtilization::Clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    util.add_busy(t0);
+  }
+  CHECK_EQ(util.items(), 2);
+  CHECK_TRUE(util.busy_ms() >= 10.0);
+  CHECK_TRUE(util.wall_ms() >= util.busy_ms());
+  CHECK_TRUE(util.utilization() > 0.0 && util.utilization() <= 1.0);
+  return 0;
+}
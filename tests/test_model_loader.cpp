@@ -3,10 +3,12 @@
 #include <torch/torch.h>
 
 #include "core/config.h"
+#include "core/kv_cache.h"
 #include "core/tensor_utils.h"
 #include "loader/model_loader.h"
 #include "loader/weight_loader.h"
 #include "model/model_stage.h"
+#include "model/param_init.h"
 
 static void fill_param(qwen::MapWeightLoader& wl, const std::string& key, const std::vector<int64_t>& shape) {
   auto t = torch::randn(shape, torch::TensorOptions().dtype(torch::kFloat32).device(torch::kCPU));
@@ -14,7 +16,7 @@ static void fill_param(qwen::MapWeightLoader& wl, const std::string& key, const
 }
 
 int main() {
-  SKIP_IF(!torch::cuda::is_available(), "CUDA not available");
+  const int device_index = torch::cuda::is_available() ? 0 : -1;
 
   qwen::ModelConfig cfg;
   cfg.vocab_size = 32;
@@ -34,6 +36,7 @@ int main() {
   cfg.stage_count = 1;
   cfg.layer_start = 0;
   cfg.layer_end = 2;
+  cfg.device_index = device_index;
 
   const int64_t head_dim = cfg.hidden_size / cfg.num_attention_heads;
   const int64_t kv_dim = cfg.num_key_value_heads * head_dim;
@@ -42,7 +45,7 @@ int main() {
   const int64_t I = cfg.moe_intermediate_size;
 
   qwen::ModelStage stage(cfg);
-  stage->to(torch::Device(torch::kCUDA, 0));
+  stage->to(qwen::device_for_index(device_index));
   stage->eval();
 
   qwen::MapWeightLoader wl;
@@ -91,5 +94,119 @@ int main() {
   CHECK_TRUE(qwen::load_stage_weights(stage, wl2, cfg, &rep2, opts2));
   CHECK_TRUE(rep2.missing > 0);
 
+  // Strict loads fail on a missing tensor instead of leaving it unloaded,
+  // and still report what was missing.
+  {
+    qwen::LoadReport rep_strict;
+    bool threw = false;
+    try {
+      qwen::load_stage_weights(stage, wl2, cfg, &rep_strict, opts);
+    } catch (const std::exception&) {
+      threw = true;
+    }
+    CHECK_TRUE(threw);
+    CHECK_EQ(rep_strict.missing, 1);
+  }
+
+  // Tied checkpoints carry no lm_head tensor; the head loads embed_tokens.
+  {
+    qwen::MapWeightLoader tied;
+    for (const auto& k : wl.list_keys()) {
+      if (k != "lm_head.weight") tied.insert(k, wl.get(k));
+    }
+    qwen::ModelConfig tcfg = cfg;
+    tcfg.tie_word_embeddings = true;
+    qwen::LoadReport trep;
+    CHECK_TRUE(qwen::load_stage_weights(stage, tied, tcfg, &trep, opts));
+    CHECK_EQ(trep.missing, 0);
+    CHECK_TRUE(torch::equal(stage->lm_head()->weight, stage->embedding()->weight()));
+  }
+
+  // A stage built for loading (no random init, allocated on the target
+  // device) ends up identical to a randomly initialized one after the load.
+  {
+    const torch::Device device = qwen::device_for_index(device_index);
+    qwen::ModelStage fast = qwen::make_stage_for_load(cfg, device);
+    fast->eval();
+    for (const auto& p : fast->parameters()) CHECK_TRUE(p.device() == device);
+    CHECK_TRUE(qwen::param_init().random);
+
+    qwen::LoadReport rep3;
+    CHECK_TRUE(qwen::load_stage_weights(fast, wl, cfg, &rep3, opts));
+    CHECK_EQ(rep3.loaded, rep.loaded);
+    qwen::LoadReport rep4;
+    CHECK_TRUE(qwen::load_stage_weights(stage, wl, cfg, &rep4, opts));
+
+    torch::NoGradGuard ng;
+    qwen::StageInput in;
+    in.input_ids = torch::randint(0, cfg.vocab_size, {1, 5}, torch::TensorOptions().dtype(torch::kInt64).device(device));
+    qwen::KVCache ca;
+    qwen::KVCache cb;
+    in.cache = &ca;
+    auto a = stage->forward(in).logits;
+    in.cache = &cb;
+    auto b = fast->forward(in).logits;
+    CHECK_NEAR((a - b).abs().max().item<double>(), 0.0, 0.0);
+  }
+
+  // A threaded load produces the same parameters and the same report.
+  {
+    const torch::Device device = qwen::device_for_index(device_index);
+    qwen::ModelStage par = qwen::make_stage_for_load(cfg, device);
+    par->eval();
+    qwen::LoadReport prep;
+    qwen::LoadOptions popts = opts;
+    popts.num_threads = 4;
+    CHECK_TRUE(qwen::load_stage_weights(par, wl, cfg, &prep, popts));
+    CHECK_EQ(prep.loaded, rep.loaded);
+    CHECK_EQ(prep.bytes, rep.bytes);
+    CHECK_TRUE(prep.bytes > 0);
+    CHECK_TRUE(prep.used_keys == rep.used_keys);
+    CHECK_TRUE(prep.seconds > 0.0);
+
+    auto ps = stage->named_parameters();
+    for (const auto& kv : par->named_parameters()) {
+      CHECK_TRUE(torch::equal(kv.value().cpu(), ps[kv.key()].cpu()));
+    }
+
+    // Strict failures still surface from worker threads.
+    qwen::ModelStage bad = qwen::make_stage_for_load(cfg, device);
+    bool threw = false;
+    try {
+      qwen::load_stage_weights(bad, wl2, cfg, nullptr, popts);
+    } catch (const std::exception&) {
+      threw = true;
+    }
+    CHECK_TRUE(threw);
+  }
+
+  // The default init path draws exactly what torch::nn::Linear draws.
+  {
+    torch::manual_seed(7);
+    qwen::Linear ours(6, 3);
+    torch::manual_seed(7);
+    torch::nn::Linear ref(torch::nn::LinearOptions(6, 3).bias(false));
+    CHECK_TRUE(torch::equal(ours->weight, ref->weight));
+  }
+
+  // Vision modules are only built where images enter the pipeline.
+  {
+    qwen::ModelConfig vcfg = cfg;
+    vcfg.device_index = -1;
+    vcfg.vision_hidden_size = 8;
+    vcfg.stage_count = 2;
+    vcfg.stage_id = 1;
+    qwen::ModelStage later(vcfg);
+    CHECK_TRUE(!(bool)later->vision());
+
+    // A stage built for loading leaves the (unloaded) vision placeholder out.
+    vcfg.stage_id = 0;
+    qwen::ModelStage first = qwen::make_stage_for_load(vcfg, torch::Device(torch::kCPU));
+    CHECK_TRUE(!(bool)first->vision() && !(bool)first->projector());
+  }
+
+  // Parameter paths are unchanged by the param_init() rewrite.
+  CHECK_TRUE(stage->named_parameters().contains("embedding.embedding.weight"));
+
   return 0;
 }
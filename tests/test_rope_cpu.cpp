@@ -0,0 +1,42 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <core/rope.h>
+
+int main() {
+  // CPU counterpart of test_rope_cuda: device_index < 0 builds the tables on CPU.
+  const int device_index = -1;
+  const int64_t head_dim = 8;
+  const int64_t seq_len = 4;
+
+  qwen::RopeTables tables =
+      qwen::precompute_cos_sin(/*max_seq_len=*/128,
+                               /*head_dim=*/head_dim,
+                               /*theta=*/10000.0f,
+                               /*dtype=*/torch::kFloat32,
+                               /*device_index=*/device_index);
+  CHECK_TRUE(tables.cos.is_cpu());
+  CHECK_TRUE(tables.sin.is_cpu());
+
+  auto opts = torch::TensorOptions().dtype(torch::kFloat32);
+  auto q = torch::randn({1, 2, seq_len, head_dim}, opts);
+  auto k = torch::randn({1, 2, seq_len, head_dim}, opts);
+  auto q0 = q.clone();
+
+  qwen::apply_rope_inplace(q, k, tables, /*pos_offset=*/0);
+
+  CHECK_TRUE(torch::isfinite(q).all().item<bool>());
+  CHECK_TRUE(torch::isfinite(k).all().item<bool>());
+  // Position 0 is the identity rotation; rotation preserves per-pair norms.
+  CHECK_NEAR((q.select(2, 0) - q0.select(2, 0)).abs().max().item<double>(), 0.0, 1e-6);
+  CHECK_NEAR((q.norm(2, -1) - q0.norm(2, -1)).abs().max().item<double>(), 0.0, 1e-4);
+
+  // bf16 tables are supported on CPU as well.
+  qwen::RopeTables tables_bf16 = qwen::precompute_cos_sin(16, head_dim, 10000.0f, torch::kBFloat16, device_index);
+  auto qb = torch::randn({1, 1, seq_len, head_dim}, opts.dtype(torch::kBFloat16));
+  auto kb = torch::randn({1, 1, seq_len, head_dim}, opts.dtype(torch::kBFloat16));
+  qwen::apply_rope_inplace(qb, kb, tables_bf16, /*pos_offset=*/2);
+  CHECK_TRUE(torch::isfinite(qb.to(torch::kFloat32)).all().item<bool>());
+  return 0;
+}
@@ -0,0 +1,126 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "core/json.h"
+#include "loader/safetensors_weight_loader.h"
+#include "loader/weight_loader.h"
+
+namespace fs = std::filesystem;
+
+struct NamedTensor {
+  std::string name;
+  std::string dtype;
+  torch::Tensor t;
+};
+
+// Writes the safetensors layout: u64 LE header length, JSON header (space
+// padded to 8 bytes), then the raw tensor bytes back to back.
+static void write_safetensors(const std::string& path, const std::vector<NamedTensor>& tensors) {
+  std::string header = "{\"__metadata__\":{\"format\":\"pt\"}";
+  std::string data;
+  for (const auto& nt : tensors) {
+    auto c = nt.t.contiguous();
+    const size_t begin = data.size();
+    data.append(static_cast<const char*>(c.data_ptr()), c.nbytes());
+    header += ",\"" + nt.name + "\":{\"dtype\":\"" + nt.dtype + "\",\"shape\":[";
+    for (int64_t d = 0; d < c.dim(); ++d) header += (d ? "," : "") + std::to_string(c.size(d));
+    header += "],\"data_offsets\":[" + std::to_string(begin) + "," + std::to_string(data.size()) + "]}";
+  }
+  header += "}";
+  while (header.size() % 8 != 0) header += ' ';
+
+  std::ofstream os(path, std::ios::binary);
+  uint64_t n = header.size();
+  for (int i = 0; i < 8; ++i) os.put((char)((n >> (8 * i)) & 0xff));
+  os << header << data;
+}
+
+int main() {
+  // The extracted JSON parser still handles what hf_config needs.
+  auto j = qwen::parse_json("{\"a\": [1, 2.5, \"x\"], \"b\": {\"c\": true}}");
+  CHECK_TRUE(j.type == qwen::JsonValue::Type::Object);
+  CHECK_EQ(qwen::json_get(j.o, "a")->a.size(), 3);
+  CHECK_NEAR(qwen::json_get(j.o, "a")->a[1].n, 2.5, 0.0);
+  CHECK_TRUE(qwen::json_get(j.o, "missing") == nullptr);
+
+  torch::manual_seed(0);
+  auto w0 = torch::randn({8, 4});
+  auto w1 = torch::randn({3, 5}).to(torch::kBFloat16);
+  auto ids = torch::arange(0, 7, torch::TensorOptions().dtype(torch::kInt64));
+
+  const fs::path dir = fs::temp_directory_path() / "qwen_test_safetensors";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+  write_safetensors((dir / "model-00001-of-00002.safetensors").string(),
+                    {{"model.layers.0.self_attn.q_proj.weight", "F32", w0}, {"model.ids", "I64", ids}});
+  write_safetensors((dir / "model-00002-of-00002.safetensors").string(),
+                    {{"model.layers.1.input_layernorm.weight", "BF16", w1}});
+  {
+    std::ofstream os(dir / "model.safetensors.index.json");
+    os << "{\"metadata\": {\"total_size\": 0}, \"weight_map\": {"
+       << "\"model.layers.0.self_attn.q_proj.weight\": \"model-00001-of-00002.safetensors\", "
+       << "\"model.ids\": \"model-00001-of-00002.safetensors\", "
+       << "\"model.layers.1.input_layernorm.weight\": \"model-00002-of-00002.safetensors\"}}";
+  }
+
+  // Directory -> index -> both shards.
+  qwen::SafetensorsWeightLoader wl(dir.string());
+  CHECK_EQ(wl.num_shards(), 2);
+  CHECK_EQ(wl.list_keys().size(), 3);
+  CHECK_EQ(wl.bytes_read(), 0);
+  CHECK_TRUE(wl.exists("model.ids"));
+  CHECK_TRUE(!wl.exists("model.norm.weight"));
+
+  auto b = wl.get("model.layers.1.input_layernorm.weight");
+  CHECK_TRUE(b.scalar_type() == torch::kBFloat16);
+  CHECK_TRUE(torch::equal(b, w1));
+  CHECK_EQ(wl.bytes_read(), w1.nbytes());
+
+  auto a = wl.get("model.layers.0.self_attn.q_proj.weight");
+  CHECK_TRUE(torch::equal(a, w0));
+  CHECK_TRUE(torch::equal(wl.get("model.ids"), ids));
+
+  // Zero copy: two gets of one key alias the same mapped bytes.
+  CHECK_TRUE(wl.get("model.ids").data_ptr() == wl.get("model.ids").data_ptr());
+
+  // A view outlives its loader.
+  torch::Tensor kept;
+  {
+    qwen::SafetensorsWeightLoader single((dir / "model-00002-of-00002.safetensors").string());
+    CHECK_EQ(single.num_shards(), 1);
+    kept = single.get("model.layers.1.input_layernorm.weight");
+  }
+  CHECK_TRUE(torch::equal(kept, w1));
+
+  std::unique_ptr<qwen::WeightLoader> opened = qwen::open_weight_loader((dir / "model.safetensors.index.json").string());
+  CHECK_TRUE(dynamic_cast<qwen::SafetensorsWeightLoader*>(opened.get()) != nullptr);
+  CHECK_TRUE(torch::equal(opened->get("model.ids"), ids));
+
+  // Truncated data is rejected at open time.
+  {
+    std::ofstream os(dir / "bad.safetensors", std::ios::binary);
+    const std::string h = "{\"x\":{\"dtype\":\"F32\",\"shape\":[4],\"data_offsets\":[0,16]}}";
+    uint64_t n = h.size();
+    for (int i = 0; i < 8; ++i) os.put((char)((n >> (8 * i)) & 0xff));
+    os << h << "1234";
+  }
+  bool threw = false;
+  try {
+    qwen::SafetensorsWeightLoader bad((dir / "bad.safetensors").string());
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  CHECK_TRUE(threw);
+
+  fs::remove_all(dir);
+  return 0;
+}
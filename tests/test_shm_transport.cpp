@@ -0,0 +1,183 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "runtime/shm_transport.h"
+
+// 8 KB of fp32 per packet; 32 of them wrap a 64 KB ring several times.
+static const int64_t kD = 2048;
+static const int64_t kPackets = 32;
+
+static torch::Tensor hidden_for(int64_t i) {
+  return torch::full({1, 1, kD}, (float)i);
+}
+
+static int check_packet(const qwen::ActivationPacket& p, int64_t i) {
+  CHECK_EQ(p.step, i);
+  CHECK_TRUE(p.hidden.device().is_cpu());
+  CHECK_TRUE(torch::equal(p.hidden, hidden_for(i)));
+  return 0;
+}
+
+int main() {
+  const std::string name = "/qwen_pp_test_" + std::to_string((long long)::getpid());
+  qwen::ShmOptions opts;
+  opts.ring_bytes = 64 << 10;
+  opts.connect_timeout_ms = 10000;
+
+  std::unique_ptr<qwen::ShmServer> server;
+  try {
+    server = std::make_unique<qwen::ShmServer>(name, opts);
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "SKIP: %s\n", e.what());
+    return 0;
+  }
+
+  std::mutex mu;
+  std::string err;
+  std::atomic<int64_t> sent{0};
+  std::unique_ptr<qwen::ShmClient> client;
+
+  std::thread t([&]() {
+    try {
+      client = std::make_unique<qwen::ShmClient>(name, opts);
+
+      qwen::ActivationPacket a;
+      a.stage_from = 1;
+      a.stage_to = 2;
+      a.step = 7;
+      a.pos = 13;
+      a.request_id = 42;
+      a.flags = qwen::kFlagMoreChunks;
+      a.hidden = torch::arange(0, 6, torch::TensorOptions().dtype(torch::kBFloat16)).view({1, 2, 3});
+      a.positions = torch::tensor({5, 9}, torch::TensorOptions().dtype(torch::kInt64));
+      client->send_activation(a);
+
+      qwen::KVPacket kv;
+      kv.stage_from = 1;
+      kv.stage_to = 2;
+      kv.pos = 13;
+      kv.kv_start = 4;
+      kv.layer = 3;
+      kv.layer_count = 8;
+      kv.k = torch::arange(0, 24, torch::TensorOptions().dtype(torch::kFloat32)).view({1, 1, 2, 3, 4});
+      kv.v = -kv.k.value();
+      client->send_kv(kv);
+
+      for (int64_t i = 0; i < kPackets; ++i) {
+        qwen::ActivationPacket p;
+        p.step = i;
+        p.hidden = hidden_for(i);
+        client->send_activation(p);
+        ++sent;
+      }
+    } catch (const std::exception& e) {
+      std::lock_guard<std::mutex> lock(mu);
+      err = e.what();
+    }
+  });
+
+  std::unique_ptr<qwen::ShmConn> conn = server->accept_one();
+
+  // Every field and tensor slot survives the ring.
+  qwen::ActivationPacket a = conn->recv_activation();
+  CHECK_EQ(a.stage_from, 1);
+  CHECK_EQ(a.stage_to, 2);
+  CHECK_EQ(a.step, 7);
+  CHECK_EQ(a.pos, 13);
+  CHECK_EQ(a.request_id, 42);
+  CHECK_EQ(a.flags, qwen::kFlagMoreChunks);
+  CHECK_TRUE(a.hidden.scalar_type() == torch::kBFloat16);
+  CHECK_TRUE(torch::equal(a.hidden, torch::arange(0, 6, torch::TensorOptions().dtype(torch::kBFloat16)).view({1, 2, 3})));
+  CHECK_TRUE(a.positions.has_value());
+  CHECK_EQ(a.positions->index({1}).item<int64_t>(), 9);
+  CHECK_TRUE(!a.attn_mask.has_value());
+  CHECK_TRUE(!a.slots.has_value());
+
+  qwen::KVPacket kv = conn->recv_kv();
+  CHECK_EQ(kv.kv_start, 4);
+  CHECK_EQ(kv.layer, 3);
+  CHECK_EQ(kv.layer_count, 8);
+  CHECK_TRUE(kv.k.has_value() && kv.v.has_value());
+  CHECK_TRUE(torch::equal(kv.k.value(), torch::arange(0, 24, torch::TensorOptions().dtype(torch::kFloat32)).view({1, 1, 2, 3, 4})));
+  CHECK_TRUE(torch::equal(kv.v.value(), -kv.k.value()));
+  a = qwen::ActivationPacket();
+  kv = qwen::KVPacket();
+
+  // Received payloads are views of the ring: while they are held the sender
+  // cannot reuse their space and stalls, and their contents stay intact.
+  std::vector<qwen::ActivationPacket> held;
+  for (int64_t i = 0; i < 3; ++i) held.push_back(conn->recv_activation());
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  CHECK_TRUE(sent.load() < kPackets);
+  for (int64_t i = 0; i < 3; ++i) {
+    if (check_packet(held[(size_t)i], i)) return 1;
+  }
+  held.clear();
+
+  // Dropping them lets the rest through, wrapping around the ring.
+  for (int64_t i = 3; i < kPackets; ++i) {
+    if (check_packet(conn->recv_activation(), i)) return 1;
+  }
+  t.join();
+  CHECK_TRUE(err.empty());
+  CHECK_EQ(sent.load(), kPackets);
+
+  // A packet larger than the ring is rejected instead of blocking forever.
+  bool threw = false;
+  try {
+    qwen::ActivationPacket big;
+    big.hidden = torch::zeros({1, 1, 32 * kD});
+    client->send_activation(big);
+  } catch (const std::exception&) {
+    threw = true;
+  }
+  CHECK_TRUE(threw);
+
+  // shutdown() unblocks a receive waiting on another thread.
+  std::atomic<bool> unblocked{false};
+  std::thread r([&]() {
+    try {
+      (void)conn->recv_activation();
+    } catch (const std::exception&) {
+      unblocked = true;
+    }
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  client->shutdown();
+  r.join();
+  CHECK_TRUE(unblocked.load());
+
+  // The server accepts a new client on the same segment.
+  conn.reset();
+  client.reset();
+  std::thread t2([&]() {
+    try {
+      qwen::ShmClient c(name, opts);
+      qwen::ActivationPacket p;
+      p.step = 99;
+      p.hidden = hidden_for(99);
+      c.send_activation(p);
+    } catch (const std::exception& e) {
+      std::lock_guard<std::mutex> lock(mu);
+      err = e.what();
+    }
+  });
+  conn = server->accept_one();
+  if (check_packet(conn->recv_activation(), 99)) return 1;
+  t2.join();
+  CHECK_TRUE(err.empty());
+
+  return 0;
+}
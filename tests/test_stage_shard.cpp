@@ -0,0 +1,159 @@
+#include "mini_test.h"
+
+#include <torch/torch.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "core/config.h"
+#include "core/kv_cache.h"
+#include "core/sharding.h"
+#include "core/tensor_utils.h"
+#include "loader/model_loader.h"
+#include "loader/safetensors_weight_loader.h"
+#include "loader/stage_shard.h"
+#include "loader/weight_loader.h"
+#include "model/model_stage.h"
+
+namespace fs = std::filesystem;
+
+static void fill_param(qwen::MapWeightLoader& wl, const std::string& key, const std::vector<int64_t>& shape) {
+  wl.insert(key, torch::randn(shape));
+}
+
+// Split a two-stage model into stage shards, then load each stage from its
+// shard alone: parameters match the HF-keyed load exactly.
+static int check_split(bool stacked) {
+  qwen::ModelConfig base;
+  base.vocab_size = 32;
+  base.hidden_size = 16;
+  base.num_hidden_layers = 4;
+  base.num_attention_heads = 4;
+  base.num_key_value_heads = 2;
+  base.intermediate_size = 32;
+  base.moe_intermediate_size = 32;
+  base.num_experts = 2;
+  base.top_k = 1;
+  base.use_moe = true;
+  base.moe_layer_freq = 1;
+  base.use_qk_norm = false;
+  base.device_index = -1;
+
+  const int64_t H = base.hidden_size;
+  const int64_t head_dim = H / base.num_attention_heads;
+  const int64_t kv_dim = base.num_key_value_heads * head_dim;
+  const int64_t E = base.num_experts;
+  const int64_t I = base.moe_intermediate_size;
+
+  torch::manual_seed(0);
+  qwen::MapWeightLoader wl;
+  const std::string lm = "model.language_model";
+  fill_param(wl, lm + ".embed_tokens.weight", {base.vocab_size, H});
+  fill_param(wl, lm + ".norm.weight", {H});
+  fill_param(wl, "lm_head.weight", {base.vocab_size, H});
+  for (int i = 0; i < base.num_hidden_layers; ++i) {
+    const std::string b = lm + ".layers." + std::to_string(i);
+    fill_param(wl, b + ".input_layernorm.weight", {H});
+    fill_param(wl, b + ".post_attention_layernorm.weight", {H});
+    fill_param(wl, b + ".self_attn.q_proj.weight", {H, H});
+    fill_param(wl, b + ".self_attn.k_proj.weight", {kv_dim, H});
+    fill_param(wl, b + ".self_attn.v_proj.weight", {kv_dim, H});
+    fill_param(wl, b + ".self_attn.o_proj.weight", {H, H});
+    // q/k norm present in the checkpoint but not in the config: the loader
+    // turns it on, and the shard has to carry that.
+    fill_param(wl, b + ".self_attn.q_norm.weight", {head_dim});
+    fill_param(wl, b + ".self_attn.k_norm.weight", {head_dim});
+    fill_param(wl, b + ".mlp.gate.weight", {E, H});
+    fill_param(wl, b + ".mlp.experts.gate_up_proj", {E, 2 * I, H});
+    fill_param(wl, b + ".mlp.experts.down_proj", {E, H, I});
+  }
+
+  const fs::path dir = fs::temp_directory_path() / "qwen_test_stage_shard";
+  fs::remove_all(dir);
+  fs::create_directories(dir);
+
+  qwen::ShardingPlan plan = qwen::make_plan_even_layers(base, 2, std::vector<int32_t>{});
+  for (const auto& spec : plan.stages) {
+    qwen::ModelConfig cfg = qwen::config_for_stage(base, spec);
+    cfg.device_index = -1;
+    cfg.moe_stacked_experts = stacked;
+
+    qwen::ModelStage ref = qwen::make_stage_for_load(cfg, torch::Device(torch::kCPU));
+    ref->eval();
+    qwen::LoadReport rep;
+    CHECK_TRUE(qwen::load_stage_weights(ref, wl, cfg, &rep));
+    CHECK_EQ(rep.missing, 0);
+
+    const std::string path = (dir / qwen::stage_shard_file_name(spec.stage_id, spec.stage_count)).string();
+    const int64_t bytes = qwen::write_stage_shard(path, ref, cfg);
+    CHECK_EQ(bytes, (int64_t)fs::file_size(path));
+
+    qwen::SafetensorsWeightLoader shard(path);
+    qwen::StageShardInfo info;
+    CHECK_TRUE(qwen::read_stage_shard_info(shard, &info));
+    CHECK_EQ(info.stage_id, spec.stage_id);
+    CHECK_EQ(info.layer_start, spec.layer_start);
+    CHECK_EQ(info.layer_end, spec.layer_end);
+    CHECK_TRUE(info.moe_stacked == stacked);
+    CHECK_TRUE(info.qk_norm);
+    CHECK_TRUE(!qwen::read_stage_shard_info(wl, nullptr));
+
+    // Every tensor sits on a 64-byte boundary of the mapping.
+    for (const auto& k : shard.list_keys()) {
+      CHECK_EQ((int64_t)((uintptr_t)shard.get(k).data_ptr() % qwen::kStageShardAlign), 0);
+    }
+
+    qwen::ModelStage fast = qwen::make_stage_for_load(cfg, torch::Device(torch::kCPU));
+    fast->eval();
+    qwen::LoadReport frep;
+    CHECK_TRUE(qwen::load_stage_weights(fast, shard, cfg, &frep));
+    CHECK_EQ(frep.missing, 0);
+    CHECK_EQ(frep.mismatched, 0);
+    CHECK_EQ((int64_t)frep.used_keys.size(), (int64_t)shard.list_keys().size());
+
+    auto want = ref->named_parameters();
+    for (const auto& kv : fast->named_parameters()) {
+      if (!qwen::is_stage_shard_param(kv.key())) continue;
+      CHECK_TRUE(torch::equal(kv.value(), want[kv.key()]));
+    }
+    for (auto& blk : fast->blocks()) CHECK_TRUE(blk->attn()->qk_norm_enabled());
+
+    // Same forward output as the HF-keyed load.
+    if (cfg.stage_id == 0) {
+      torch::NoGradGuard ng;
+      qwen::StageInput in;
+      in.input_ids = torch::randint(0, cfg.vocab_size, {1, 4}, torch::TensorOptions().dtype(torch::kInt64));
+      qwen::KVCache ca;
+      qwen::KVCache cb;
+      in.cache = &ca;
+      auto a = ref->forward(in).hidden_out;
+      in.cache = &cb;
+      auto b = fast->forward(in).hidden_out;
+      CHECK_TRUE(torch::equal(a, b));
+    }
+
+    // A shard cut for other layers is refused.
+    qwen::ModelConfig other = cfg;
+    other.layer_start = cfg.layer_start == 0 ? 2 : 0;
+    other.layer_end = other.layer_start + 2;
+    qwen::ModelStage wrong = qwen::make_stage_for_load(other, torch::Device(torch::kCPU));
+    bool threw = false;
+    try {
+      qwen::load_stage_weights(wrong, shard, other, nullptr);
+    } catch (const std::exception&) {
+      threw = true;
+    }
+    CHECK_TRUE(threw);
+  }
+
+  fs::remove_all(dir);
+  return 0;
+}
+
+int main() {
+  if (int rc = check_split(false)) return rc;
+  if (int rc = check_split(true)) return rc;
+  return 0;
+}
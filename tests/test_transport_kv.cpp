@@ -27,12 +27,14 @@ int main() {
   std::string err;
   qwen::ActivationPacket recv_act;
   qwen::KVPacket recv_kv;
+  qwen::ActivationPacket recv_ctrl;
 
   std::thread t([&]() {
     try {
       qwen::TcpConn conn(server->accept_one());
       recv_act = conn.recv_activation();
       recv_kv = conn.recv_kv();
+      recv_ctrl = conn.recv_activation();
     } catch (const std::exception& e) {
       std::lock_guard<std::mutex> lock(mu);
       err = e.what();
@@ -47,8 +49,12 @@ int main() {
   send_act.stage_to = 2;
   send_act.step = 7;
   send_act.pos = 13;
+  send_act.request_id = 42;
+  send_act.flags = qwen::kFlagMoreChunks;
   send_act.hidden = hidden;
   send_act.attn_mask = mask;
+  send_act.positions = torch::tensor({5, 9}, torch::TensorOptions().dtype(torch::kInt64));
+  send_act.cu_seqlens = torch::tensor({0, 1, 2}, torch::TensorOptions().dtype(torch::kInt64));
   client.send_activation(send_act);
 
   auto k = torch::arange(0, 2 * 1 * 2 * 3 * 4,
@@ -60,10 +66,17 @@ int main() {
   send_kv.stage_to = 2;
   send_kv.step = 7;
   send_kv.pos = 13;
+  send_kv.request_id = 42;
+  send_kv.kv_start = 5;
   send_kv.k = k;
   send_kv.v = v;
   client.send_kv(send_kv);
 
+  qwen::ActivationPacket send_ctrl;
+  send_ctrl.kind = qwen::PacketKind::kRelease;
+  send_ctrl.request_id = 42;
+  client.send_activation(send_ctrl);
+
   t.join();
 
   if (!err.empty()) {
@@ -72,7 +85,9 @@ int main() {
   }
 
   if (recv_act.stage_from != send_act.stage_from || recv_act.stage_to != send_act.stage_to ||
-      recv_act.step != send_act.step || recv_act.pos != send_act.pos) {
+      recv_act.step != send_act.step || recv_act.pos != send_act.pos ||
+      recv_act.request_id != send_act.request_id || recv_act.kind != send_act.kind ||
+      recv_act.flags != send_act.flags) {
     std::fprintf(stderr, "activation metadata mismatch\n");
     return 1;
   }
@@ -84,9 +99,16 @@ int main() {
     std::fprintf(stderr, "activation attn_mask mismatch\n");
     return 1;
   }
+  if (!recv_act.positions.has_value() || !torch::equal(recv_act.positions.value(), send_act.positions.value()) ||
+      recv_act.slots.has_value() || !recv_act.cu_seqlens.has_value() ||
+      !torch::equal(recv_act.cu_seqlens.value(), send_act.cu_seqlens.value())) {
+    std::fprintf(stderr, "activation positions/slots/cu_seqlens mismatch\n");
+    return 1;
+  }
 
   if (recv_kv.stage_from != send_kv.stage_from || recv_kv.stage_to != send_kv.stage_to ||
-      recv_kv.step != send_kv.step || recv_kv.pos != send_kv.pos) {
+      recv_kv.step != send_kv.step || recv_kv.pos != send_kv.pos ||
+      recv_kv.request_id != send_kv.request_id || recv_kv.kv_start != send_kv.kv_start) {
     std::fprintf(stderr, "kv metadata mismatch\n");
     return 1;
   }
@@ -99,5 +121,44 @@ int main() {
     return 1;
   }
 
+  if (recv_ctrl.kind != qwen::PacketKind::kRelease || recv_ctrl.request_id != 42 ||
+      recv_ctrl.flags != 0 || recv_ctrl.hidden.defined()) {
+    std::fprintf(stderr, "control packet mismatch\n");
+    return 1;
+  }
+
+  // Per-field sends (the pre-framing syscall pattern) put the same frame on
+  // the wire; an empty tensor has a header entry but no payload bytes.
+  {
+    qwen::TcpOptions legacy;
+    legacy.vectored = false;
+    legacy.nodelay = false;
+    qwen::ActivationPacket got;
+    std::thread t2([&]() {
+      try {
+        qwen::TcpConn conn(server->accept_one());
+        got = conn.recv_activation();
+      } catch (const std::exception& e) {
+        std::lock_guard<std::mutex> lock(mu);
+        err = e.what();
+      }
+    });
+    qwen::TcpClient slow("127.0.0.1", port, legacy);
+    qwen::ActivationPacket p = send_act;
+    p.slots = torch::empty({0}, torch::TensorOptions().dtype(torch::kInt64));
+    slow.send_activation(p);
+    t2.join();
+    if (!err.empty()) {
+      std::fprintf(stderr, "per-field transport error: %s\n", err.c_str());
+      return 1;
+    }
+    if (got.step != p.step || got.request_id != p.request_id || !torch::equal(got.hidden, hidden) ||
+        !got.slots.has_value() || got.slots->numel() != 0 ||
+        !torch::equal(got.cu_seqlens.value(), p.cu_seqlens.value())) {
+      std::fprintf(stderr, "per-field activation mismatch\n");
+      return 1;
+    }
+  }
+
   return 0;
 }
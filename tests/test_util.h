@@ -1,9 +1,13 @@
 #pragma once
 
+#include <torch/torch.h>
+
 #include <cstdio>
 #include <cstdlib>
 #include <string>
 
+#include "core/config.h"
+
 namespace qwen_test {
 
 inline void fail(const char* file, int line, const std::string& msg) {
@@ -36,4 +40,34 @@ inline bool cuda_available_or_skip() {
   return true;
 }
 
+// Largest absolute elementwise difference, compared in fp32.
+inline double max_diff(const torch::Tensor& a, const torch::Tensor& b) {
+  return (a.to(torch::kFloat32) - b.to(torch::kFloat32)).abs().max().item<double>();
+}
+
+// Two-layer dense CPU model small enough for every stage test. With
+// stage_count > 1 each stage runs an equal share of the layers. Tests add
+// MoE, qk-norm or a paged cache on top.
+inline qwen::ModelConfig tiny_stage_config(int32_t max_batch,
+                                           int32_t max_seq_len,
+                                           int32_t stage_id = 0,
+                                           int32_t stage_count = 1) {
+  qwen::ModelConfig cfg;
+  cfg.vocab_size = 32;
+  cfg.hidden_size = 16;
+  cfg.num_hidden_layers = 2;
+  cfg.num_attention_heads = 4;
+  cfg.num_key_value_heads = 2;
+  cfg.intermediate_size = 32;
+  cfg.rope_dim = 4;
+  cfg.max_batch = max_batch;
+  cfg.max_seq_len = max_seq_len;
+  cfg.stage_id = stage_id;
+  cfg.stage_count = stage_count;
+  cfg.layer_start = stage_id * cfg.num_hidden_layers / stage_count;
+  cfg.layer_end = (stage_id + 1) * cfg.num_hidden_layers / stage_count;
+  cfg.device_index = -1;
+  return cfg;
+}
+
 } // namespace qwen_test